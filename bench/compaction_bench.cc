@@ -0,0 +1,141 @@
+// Measures how fast merging reclaims disk space with different numbers of
+// merge threads.
+//
+// For every thread count a fresh database is filled with `keys` keys which
+// are then overwritten `rounds` times, leaving most log files almost entirely
+// dead. Hint files are generated up front, so only the merge itself is timed.
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "clipp.h"
+
+#include "mybitcask/mybitcask.h"
+
+namespace {
+
+std::uintmax_t DirSize(const ghc::filesystem::path& dir) {
+  std::uintmax_t size = 0;
+  for (auto const& entry : ghc::filesystem::directory_iterator(dir)) {
+    if (ghc::filesystem::is_regular_file(entry.path())) {
+      size += ghc::filesystem::file_size(entry.path());
+    }
+  }
+  return size;
+}
+
+std::string RandomValue(std::mt19937& engine, std::size_t len) {
+  std::uniform_int_distribution<int> dist('a', 'z');
+  std::string v(len, '\0');
+  for (auto& c : v) {
+    c = static_cast<char>(dist(engine));
+  }
+  return v;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string db_root = (ghc::filesystem::temp_directory_path() /
+                         "mybitcask_compaction_bench")
+                            .string();
+  std::size_t keys = 20000;
+  std::size_t rounds = 5;
+  std::size_t value_size = 512;
+  std::uint32_t dead_bytes_threshold = 1024 * 1024;
+  std::vector<std::string> threads_args;
+
+  auto cli = (clipp::option("--db") & clipp::value("path", db_root),
+              clipp::option("--keys") & clipp::value("n", keys),
+              clipp::option("--rounds") & clipp::value("n", rounds),
+              clipp::option("--value_size") & clipp::value("bytes", value_size),
+              clipp::option("--dead_bytes_threshold") &
+                  clipp::value("bytes", dead_bytes_threshold),
+              clipp::option("--threads") &
+                  clipp::values("n", threads_args));
+  if (!clipp::parse(argc, argv, cli)) {
+    std::cerr << clipp::make_man_page(cli, argv[0]);
+    return 1;
+  }
+  std::vector<std::size_t> thread_counts;
+  for (auto& t : threads_args) {
+    thread_counts.push_back(std::stoul(t));
+  }
+  if (thread_counts.empty()) {
+    thread_counts = {1, 2, 4, 8};
+  }
+
+  std::cout << std::left << std::setw(10) << "threads" << std::setw(14)
+            << "merge(s)" << std::setw(16) << "reclaimed(MB)" << "MB/s"
+            << std::endl;
+
+  for (auto threads : thread_counts) {
+    auto db_path = ghc::filesystem::path(db_root) / std::to_string(threads);
+    ghc::filesystem::remove_all(db_path);
+    ghc::filesystem::create_directories(db_path);
+
+    // Fill and overwrite, then generate hint files without merging.
+    {
+      mybitcask::Options options;
+      options.dead_bytes_threshold = dead_bytes_threshold;
+      options.merge_threshold = -1.0f;
+      auto db = mybitcask::Open(db_path, options);
+      if (!db.ok()) {
+        std::cerr << "open failed: " << db.status() << std::endl;
+        return 1;
+      }
+      std::mt19937 engine(42);
+      for (std::size_t r = 0; r < rounds; r++) {
+        for (std::size_t i = 0; i < keys; i++) {
+          auto status = (*db)->Insert("key" + std::to_string(i),
+                                      RandomValue(engine, value_size));
+          if (!status.ok()) {
+            std::cerr << "insert failed: " << status << std::endl;
+            return 1;
+          }
+        }
+      }
+      auto status = (*db)->Merge();
+      if (!status.ok()) {
+        std::cerr << "hint generation failed: " << status << std::endl;
+        return 1;
+      }
+    }
+
+    mybitcask::Options options;
+    options.dead_bytes_threshold = dead_bytes_threshold;
+    options.merge_threshold = 0.5f;
+    options.merge_threads = threads;
+    auto db = mybitcask::Open(db_path, options);
+    if (!db.ok()) {
+      std::cerr << "open failed: " << db.status() << std::endl;
+      return 1;
+    }
+    auto size_before = DirSize(db_path);
+    auto start = std::chrono::steady_clock::now();
+    auto status = (*db)->Merge();
+    auto elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    if (!status.ok()) {
+      std::cerr << "merge failed: " << status << std::endl;
+      return 1;
+    }
+    auto size_after = DirSize(db_path);
+    double reclaimed_mb =
+        size_before > size_after
+            ? static_cast<double>(size_before - size_after) / (1024 * 1024)
+            : 0.0;
+
+    std::cout << std::left << std::setw(10) << threads << std::setw(14)
+              << elapsed << std::setw(16) << reclaimed_mb
+              << reclaimed_mb / elapsed << std::endl;
+    db->reset();
+    ghc::filesystem::remove_all(db_path);
+  }
+  return 0;
+}
@@ -0,0 +1,549 @@
+// Measures the throughput and latency of standard workloads, in the style
+// of LevelDB's db_bench.
+//
+// The benchmarks named by --benchmarks run in order against the same
+// database. fillseq and fillrandom start from an empty database, the others
+// use the keys left by the previous benchmarks. Every benchmark reports
+// micros/op, ops/s, MB/s of keys and values and the p50/p99/p999 latency of
+// a single operation.
+//
+//   fillseq           insert --num keys in order
+//   fillrandom        insert --num keys in random order
+//   overwrite         overwrite --num random existing keys
+//   readrandom        read --reads random existing keys
+//   readseq           iterate over every key and read its value
+//   readmissing       read --reads keys which do not exist
+//   readwhilewriting  readrandom while one more thread overwrites keys
+//   deleterandom      delete --num random keys
+//   readwhilemerging  readrandom while one more thread overwrites keys and
+//                     compacts every log file in a loop
+//   readwhilewritingslow, readwhilemergingslow
+//                     readwhilewriting and readwhilemerging on a slow or
+//                     failing device: the fault described by the --fault_*
+//                     flags is injected while they run, by default 1% of
+//                     the syncs take 200 ms
+//
+// With --mem_env the database is kept in memory, which measures the CPU cost
+// of the engine alone. With --use_existing_db the database in --db is never
+// emptied, not even by fillseq and fillrandom.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "absl/strings/str_split.h"
+#include "clipp.h"
+
+#include "mybitcask/internal/fault_injection_env.h"
+#include "mybitcask/mybitcask.h"
+
+namespace {
+
+struct Config {
+  std::string db_path;
+  bool use_existing_db = false;
+  std::uint64_t num = 1000000;
+  std::uint64_t reads = 0;
+  std::size_t threads = 1;
+  std::size_t key_size = 16;
+  std::size_t value_size = 100;
+  // fixed, uniform or exponential, with a mean of value_size bytes
+  std::string value_size_dist = "fixed";
+  std::uint64_t seed = 301;
+  // Fault injected by the slow benchmarks into operation fault_op on
+  // fault_files files (log, hint or all)
+  std::string fault_op = "sync";
+  std::string fault_files = "all";
+  std::uint64_t fault_latency_micros = 200000;
+  // fixed, uniform or exponential
+  std::string fault_dist = "fixed";
+  double fault_probability = 0.01;
+};
+
+// Remove the log, hint and temporary files of the database in `db_path`
+// through `env`, leaving anything else in the directory alone.
+void RemoveDatabase(mybitcask::Env* env, const std::string& db_path) {
+  auto children = env->GetChildren(db_path);
+  if (!children.ok()) {
+    return;
+  }
+  for (const auto& child : *children) {
+    auto extension = ghc::filesystem::path(child).extension();
+    if (extension == ".log" || extension == ".hint" || extension == ".tmp") {
+      auto _ = env->RemoveFile(ghc::filesystem::path(db_path) / child);
+    }
+  }
+}
+
+// Key `i` zero padded to `key_size` bytes, longer if it has more digits
+std::string Key(std::uint64_t i, std::size_t key_size) {
+  auto digits = std::to_string(i);
+  if (digits.size() >= key_size) {
+    return digits;
+  }
+  return std::string(key_size - digits.size(), '0') + digits;
+}
+
+// Produces values from a buffer of random bytes, so generating them costs
+// next to nothing
+class ValueGenerator {
+ public:
+  ValueGenerator(const Config& config, std::uint64_t seed)
+      : engine_(seed),
+        value_size_(std::max<std::size_t>(1, config.value_size)),
+        dist_(config.value_size_dist),
+        pos_(0) {
+    std::uniform_int_distribution<int> byte(0, 255);
+    data_.resize(std::max<std::size_t>(1024 * 1024, value_size_ * 4));
+    for (auto& c : data_) {
+      c = static_cast<char>(byte(engine_));
+    }
+  }
+
+  std::string Next() {
+    auto len = NextLen();
+    if (pos_ + len > data_.size()) {
+      pos_ = 0;
+    }
+    std::string value(data_, pos_, len);
+    pos_ += len;
+    return value;
+  }
+
+ private:
+  std::size_t NextLen() {
+    if (dist_ == "uniform") {
+      return std::uniform_int_distribution<std::size_t>(
+          1, value_size_ * 2 - 1)(engine_);
+    }
+    if (dist_ == "exponential") {
+      auto len = static_cast<std::size_t>(
+          std::exponential_distribution<double>(1.0 / value_size_)(engine_));
+      return std::max<std::size_t>(1, std::min(len, data_.size() / 2));
+    }
+    return value_size_;
+  }
+
+  std::mt19937_64 engine_;
+  std::size_t value_size_;
+  std::string dist_;
+  std::string data_;
+  std::size_t pos_;
+};
+
+// Latencies and bytes of the operations of one thread
+struct ThreadStats {
+  std::vector<double> micros;
+  std::uint64_t bytes = 0;
+  std::uint64_t found = 0;
+  bool failed = false;
+};
+
+double Percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto i = static_cast<std::size_t>(p * static_cast<double>(sorted.size()));
+  return sorted[std::min(i, sorted.size() - 1)];
+}
+
+class Benchmark {
+ public:
+  // Faults are injected through `fault_env`, the Env of `options`
+  Benchmark(const Config& config, const mybitcask::Options& options,
+            mybitcask::FaultInjectionEnv* fault_env)
+      : config_(config), options_(options), fault_env_(fault_env), run_(0) {}
+
+  bool Run(const std::string& name) {
+    // Every benchmark draws other random keys
+    run_++;
+    if (name == "fillseq" || name == "fillrandom") {
+      if (!Reopen(true)) {
+        return false;
+      }
+      bool seq = name == "fillseq";
+      return Measure(name, config_.num, [&](std::uint64_t i,
+                                            ValueGenerator& values,
+                                            std::mt19937_64& engine,
+                                            ThreadStats* stats) {
+        return Write(seq ? i : RandomKey(engine), values, stats);
+      });
+    }
+    if (!Reopen(false)) {
+      return false;
+    }
+    auto reads = config_.reads > 0 ? config_.reads : config_.num;
+    if (name == "overwrite") {
+      return Measure(name, config_.num,
+                     [&](std::uint64_t, ValueGenerator& values,
+                         std::mt19937_64& engine, ThreadStats* stats) {
+                       return Write(RandomKey(engine), values, stats);
+                     });
+    }
+    if (name == "readrandom") {
+      return Measure(name, reads, RandomRead(false));
+    }
+    if (name == "readmissing") {
+      return Measure(name, reads, RandomRead(true));
+    }
+    if (name == "readseq") {
+      return ReadSeq();
+    }
+    if (name == "deleterandom") {
+      return Measure(name, config_.num,
+                     [&](std::uint64_t, ValueGenerator&,
+                         std::mt19937_64& engine, ThreadStats*) {
+                       return db_->Delete(Key(RandomKey(engine),
+                                              config_.key_size))
+                           .ok();
+                     });
+    }
+    if (name == "readwhilewriting" || name == "readwhilemerging") {
+      return ReadWhile(name, reads, name == "readwhilemerging");
+    }
+    if (name == "readwhilewritingslow" || name == "readwhilemergingslow") {
+      if (!InjectFault()) {
+        return false;
+      }
+      bool ok = ReadWhile(name, reads, name == "readwhilemergingslow");
+      fault_env_->ClearFaults();
+      return ok;
+    }
+    std::cerr << "unknown benchmark: " << name << std::endl;
+    return false;
+  }
+
+ private:
+  using Op = std::function<bool(std::uint64_t i, ValueGenerator& values,
+                                std::mt19937_64& engine, ThreadStats* stats)>;
+
+  bool Reopen(bool fresh) {
+    if (db_ != nullptr && !fresh) {
+      return true;
+    }
+    db_.reset();
+    if (fresh && !config_.use_existing_db) {
+      RemoveDatabase(options_.env, config_.db_path);
+    }
+    auto _ = options_.env->CreateDir(config_.db_path);
+    auto db = mybitcask::Open(config_.db_path, options_);
+    if (!db.ok()) {
+      std::cerr << "open failed: " << db.status() << std::endl;
+      return false;
+    }
+    db_ = std::move(db).value();
+    return true;
+  }
+
+  bool InjectFault() {
+    mybitcask::Fault fault;
+    fault.probability = config_.fault_probability;
+    fault.latency = absl::Microseconds(config_.fault_latency_micros);
+    if (config_.fault_dist == "uniform") {
+      fault.distribution = mybitcask::Fault::Distribution::kUniform;
+    } else if (config_.fault_dist == "exponential") {
+      fault.distribution = mybitcask::Fault::Distribution::kExponential;
+    }
+    for (std::uint32_t op = 0;
+         op < static_cast<std::uint32_t>(mybitcask::FileOp::kNumFileOps);
+         op++) {
+      auto file_op = static_cast<mybitcask::FileOp>(op);
+      if (config_.fault_op != mybitcask::FileOpName(file_op)) {
+        continue;
+      }
+      if (config_.fault_files == "log" || config_.fault_files == "all") {
+        fault_env_->SetFault(file_op, mybitcask::FaultFileType::kLogFile,
+                             fault);
+      }
+      if (config_.fault_files == "hint" || config_.fault_files == "all") {
+        fault_env_->SetFault(file_op, mybitcask::FaultFileType::kHintFile,
+                             fault);
+      }
+      std::cout << "injecting " << config_.fault_latency_micros << " us "
+                << config_.fault_dist << " into "
+                << config_.fault_probability * 100 << "% of "
+                << config_.fault_op << " on " << config_.fault_files
+                << " files" << std::endl;
+      return true;
+    }
+    std::cerr << "unknown fault op: " << config_.fault_op << std::endl;
+    return false;
+  }
+
+  std::uint64_t Seed(std::size_t thread) const {
+    return config_.seed + run_ * 1000 + thread;
+  }
+
+  std::uint64_t RandomKey(std::mt19937_64& engine) const {
+    return std::uniform_int_distribution<std::uint64_t>(
+        0, config_.num - 1)(engine);
+  }
+
+  bool Write(std::uint64_t k, ValueGenerator& values, ThreadStats* stats) {
+    auto key = Key(k, config_.key_size);
+    auto value = values.Next();
+    stats->bytes += key.size() + value.size();
+    return db_->Insert(key, value).ok();
+  }
+
+  Op RandomRead(bool missing) {
+    return [this, missing](std::uint64_t, ValueGenerator&,
+                           std::mt19937_64& engine, ThreadStats* stats) {
+      auto key = Key(RandomKey(engine), config_.key_size);
+      if (missing) {
+        key.push_back('.');
+      }
+      std::string value;
+      auto found = db_->Get(key, &value);
+      if (!found.ok()) {
+        return false;
+      }
+      if (*found) {
+        stats->found++;
+        stats->bytes += key.size() + value.size();
+      }
+      return true;
+    };
+  }
+
+  // Run `ops` operations split across the threads, operation `i` on thread
+  // i % threads
+  std::vector<ThreadStats> RunThreads(std::uint64_t ops, const Op& op) {
+    std::vector<ThreadStats> stats(config_.threads);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < config_.threads; t++) {
+      threads.emplace_back([&, t]() {
+        auto seed = Seed(t);
+        ValueGenerator values(config_, seed);
+        std::mt19937_64 engine(seed);
+        auto& thread_stats = stats[t];
+        thread_stats.micros.reserve(ops / config_.threads + 1);
+        for (auto i = t; i < ops; i += config_.threads) {
+          auto start = std::chrono::steady_clock::now();
+          bool ok = op(i, values, engine, &thread_stats);
+          thread_stats.micros.push_back(
+              std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - start)
+                  .count());
+          if (!ok) {
+            thread_stats.failed = true;
+            return;
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    return stats;
+  }
+
+  bool Measure(const std::string& name, std::uint64_t ops, const Op& op) {
+    auto start = std::chrono::steady_clock::now();
+    auto stats = RunThreads(ops, op);
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    return Report(name, stats, seconds);
+  }
+
+  bool ReadSeq() {
+    ThreadStats stats;
+    auto start = std::chrono::steady_clock::now();
+    auto it = db_->NewIterator(mybitcask::ReadOptions());
+    auto op_start = std::chrono::steady_clock::now();
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      stats.bytes += it->key().size() + it->value().size();
+      stats.found++;
+      auto now = std::chrono::steady_clock::now();
+      stats.micros.push_back(
+          std::chrono::duration<double, std::micro>(now - op_start).count());
+      op_start = now;
+    }
+    if (!it->status().ok()) {
+      std::cerr << "readseq failed: " << it->status() << std::endl;
+      return false;
+    }
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    return Report("readseq", {stats}, seconds);
+  }
+
+  // readrandom while a background thread overwrites keys, and also compacts
+  // all log files between batches of writes if `merging`
+  bool ReadWhile(const std::string& name, std::uint64_t reads,
+                 bool merging) {
+    std::atomic<bool> done(false);
+    std::atomic<bool> failed(false);
+    std::uint64_t writes = 0;
+    std::size_t compactions = 0;
+    std::thread writer([&]() {
+      auto seed = Seed(config_.threads);
+      ValueGenerator values(config_, seed);
+      std::mt19937_64 engine(seed);
+      ThreadStats stats;
+      while (!done.load()) {
+        for (int i = 0; i < 1000 && !done.load(); i++) {
+          if (!Write(RandomKey(engine), values, &stats)) {
+            failed.store(true);
+            return;
+          }
+          writes++;
+        }
+        if (merging && !done.load()) {
+          if (!db_->CompactAll(mybitcask::CompactOptions()).ok()) {
+            failed.store(true);
+            return;
+          }
+          compactions++;
+        }
+      }
+    });
+    auto start = std::chrono::steady_clock::now();
+    auto stats = RunThreads(reads, RandomRead(false));
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    done.store(true);
+    writer.join();
+    if (failed.load()) {
+      std::cerr << name << ": background writes failed" << std::endl;
+      return false;
+    }
+    std::cout << name << ": " << writes << " background writes";
+    if (merging) {
+      std::cout << ", " << compactions << " compactions";
+    }
+    std::cout << std::endl;
+    return Report(name, stats, seconds);
+  }
+
+  bool Report(const std::string& name, const std::vector<ThreadStats>& stats,
+              double seconds) {
+    std::vector<double> micros;
+    std::uint64_t bytes = 0;
+    std::uint64_t found = 0;
+    for (auto& thread_stats : stats) {
+      if (thread_stats.failed) {
+        std::cerr << name << " failed" << std::endl;
+        return false;
+      }
+      micros.insert(micros.end(), thread_stats.micros.begin(),
+                    thread_stats.micros.end());
+      bytes += thread_stats.bytes;
+      found += thread_stats.found;
+    }
+    std::sort(micros.begin(), micros.end());
+    auto ops = static_cast<double>(micros.size());
+    std::printf(
+        "%-18s: %10.3f micros/op %10.0f ops/s %8.1f MB/s; "
+        "p50 %.2f p99 %.2f p999 %.2f us",
+        name.c_str(), ops > 0 ? seconds * 1e6 / ops * config_.threads : 0,
+        seconds > 0 ? ops / seconds : 0,
+        seconds > 0 ? static_cast<double>(bytes) / (1024 * 1024) / seconds
+                    : 0,
+        Percentile(micros, 0.5), Percentile(micros, 0.99),
+        Percentile(micros, 0.999));
+    if (name.compare(0, 4, "read") == 0) {
+      std::printf(" (%llu of %.0f found)",
+                  static_cast<unsigned long long>(found), ops);
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+    return true;
+  }
+
+  Config config_;
+  mybitcask::Options options_;
+  mybitcask::FaultInjectionEnv* fault_env_;
+  std::unique_ptr<mybitcask::MyBitcask> db_;
+  std::uint64_t run_;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config config;
+  config.db_path =
+      (ghc::filesystem::temp_directory_path() / "mybitcask_bench").string();
+  std::string benchmarks =
+      "fillseq,fillrandom,overwrite,readrandom,readseq,readmissing,"
+      "readwhilewriting,readwhilemerging,deleterandom";
+  bool checksum = false;
+  bool mem_env = false;
+  std::uint32_t dead_bytes_threshold = 128 * 1024 * 1024;
+  float merge_threshold = 0.2f;
+
+  auto cli =
+      (clipp::option("--db") & clipp::value("path", config.db_path),
+       clipp::option("--benchmarks") & clipp::value("names", benchmarks),
+       clipp::option("--num") & clipp::value("n", config.num),
+       clipp::option("--reads") & clipp::value("n", config.reads),
+       clipp::option("--threads") & clipp::value("n", config.threads),
+       clipp::option("--key_size") & clipp::value("bytes", config.key_size),
+       clipp::option("--value_size") &
+           clipp::value("bytes", config.value_size),
+       clipp::option("--value_size_dist") &
+           clipp::value("fixed|uniform|exponential", config.value_size_dist),
+       clipp::option("--seed") & clipp::value("n", config.seed),
+       clipp::option("--checksum").set(checksum),
+       clipp::option("--dead_bytes_threshold") &
+           clipp::value("bytes", dead_bytes_threshold),
+       clipp::option("--merge_threshold") &
+           clipp::value("ratio", merge_threshold),
+       clipp::option("--use_existing_db").set(config.use_existing_db),
+       clipp::option("--mem_env").set(mem_env),
+       clipp::option("--fault_op") &
+           clipp::value("open|read|append|sync|...", config.fault_op),
+       clipp::option("--fault_files") &
+           clipp::value("log|hint|all", config.fault_files),
+       clipp::option("--fault_latency_micros") &
+           clipp::value("n", config.fault_latency_micros),
+       clipp::option("--fault_dist") &
+           clipp::value("fixed|uniform|exponential", config.fault_dist),
+       clipp::option("--fault_probability") &
+           clipp::value("ratio", config.fault_probability));
+  if (!clipp::parse(argc, argv, cli) || config.num == 0 ||
+      config.threads == 0) {
+    std::cerr << clipp::make_man_page(cli, argv[0]);
+    return 1;
+  }
+  mybitcask::Options options;
+  options.checksum = checksum;
+  options.dead_bytes_threshold = dead_bytes_threshold;
+  options.merge_threshold = merge_threshold;
+  std::unique_ptr<mybitcask::Env> env;
+  if (mem_env) {
+    env = mybitcask::NewMemEnv();
+  }
+  // Passes operations through until a slow benchmark injects a fault
+  mybitcask::FaultInjectionEnv fault_env(
+      mem_env ? env.get() : mybitcask::Env::Default(), config.seed);
+  options.env = &fault_env;
+  if (!config.use_existing_db) {
+    RemoveDatabase(options.env, config.db_path);
+  }
+
+  std::cout << "keys: " << config.num << " x " << config.key_size
+            << " bytes, values: " << config.value_size << " bytes "
+            << config.value_size_dist << ", threads: " << config.threads
+            << ", checksum: " << (checksum ? "on" : "off")
+            << ", dead_bytes_threshold: " << dead_bytes_threshold
+            << (mem_env ? ", in memory" : "") << std::endl;
+
+  Benchmark benchmark(config, options, &fault_env);
+  for (auto name : absl::StrSplit(benchmarks, ',', absl::SkipEmpty())) {
+    if (!benchmark.Run(std::string(name))) {
+      return 1;
+    }
+  }
+  return 0;
+}
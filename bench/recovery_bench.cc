@@ -0,0 +1,169 @@
+// Injects crashes into writers and measures how long recovery takes.
+//
+// Every round forks a writer which inserts keys as fast as it can and
+// acknowledges each completed insert through a pipe. The writer is killed
+// with SIGKILL after a random delay, usually in the middle of an append,
+// then the database is opened again: the time Open takes, the bytes of the
+// torn tail it dropped, and whether every acknowledged key survived are
+// reported.
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "clipp.h"
+
+#include "mybitcask/mybitcask.h"
+
+namespace {
+
+std::string Key(std::uint32_t i) { return "key" + std::to_string(i); }
+
+std::string RandomValue(std::mt19937& engine, std::size_t len) {
+  std::uniform_int_distribution<int> dist('a', 'z');
+  std::string v(len, '\0');
+  for (auto& c : v) {
+    c = static_cast<char>(dist(engine));
+  }
+  return v;
+}
+
+// Insert keys from `first` on until killed, writing the index of every
+// inserted key to `ack_fd`
+[[noreturn]] void RunWriter(const std::string& db_path,
+                            const mybitcask::Options& options,
+                            std::uint32_t first, std::size_t value_size,
+                            int ack_fd) {
+  auto db = mybitcask::Open(db_path, options);
+  if (!db.ok()) {
+    std::cerr << "writer open failed: " << db.status() << std::endl;
+    _exit(1);
+  }
+  std::mt19937 engine(first);
+  std::uniform_int_distribution<std::size_t> len(1, value_size * 2);
+  for (auto i = first;; i++) {
+    if (!(*db)->Insert(Key(i), RandomValue(engine, len(engine))).ok()) {
+      _exit(1);
+    }
+    if (::write(ack_fd, &i, sizeof(i)) != sizeof(i)) {
+      _exit(1);
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string db_path = (ghc::filesystem::temp_directory_path() /
+                         "mybitcask_recovery_bench")
+                            .string();
+  std::size_t rounds = 20;
+  std::size_t value_size = 4096;
+  std::uint32_t dead_bytes_threshold = 64 * 1024 * 1024;
+  std::size_t min_delay_ms = 50;
+  std::size_t max_delay_ms = 500;
+  bool block_format = false;
+
+  auto cli = (clipp::option("--db") & clipp::value("path", db_path),
+              clipp::option("--rounds") & clipp::value("n", rounds),
+              clipp::option("--value_size") & clipp::value("bytes", value_size),
+              clipp::option("--dead_bytes_threshold") &
+                  clipp::value("bytes", dead_bytes_threshold),
+              clipp::option("--min_delay_ms") &
+                  clipp::value("ms", min_delay_ms),
+              clipp::option("--max_delay_ms") &
+                  clipp::value("ms", max_delay_ms),
+              clipp::option("--block_format").set(block_format));
+  if (!clipp::parse(argc, argv, cli) || min_delay_ms > max_delay_ms) {
+    std::cerr << clipp::make_man_page(cli, argv[0]);
+    return 1;
+  }
+  ghc::filesystem::remove_all(db_path);
+  ghc::filesystem::create_directories(db_path);
+
+  mybitcask::Options options;
+  options.dead_bytes_threshold = dead_bytes_threshold;
+  options.block_format = block_format;
+
+  std::cout << std::left << std::setw(8) << "round" << std::setw(12)
+            << "keys" << std::setw(12) << "killed(ms)" << std::setw(14)
+            << "dropped(B)" << std::setw(12) << "open(ms)" << "lost"
+            << std::endl;
+
+  std::mt19937 engine(42);
+  std::uniform_int_distribution<std::size_t> delay(min_delay_ms, max_delay_ms);
+  std::uint32_t next_key = 0;
+  std::vector<double> open_ms;
+  std::size_t lost_total = 0;
+  for (std::size_t round = 0; round < rounds; round++) {
+    int fds[2];
+    if (::pipe(fds) != 0) {
+      std::cerr << "pipe failed" << std::endl;
+      return 1;
+    }
+    auto pid = ::fork();
+    if (pid < 0) {
+      std::cerr << "fork failed" << std::endl;
+      return 1;
+    }
+    if (pid == 0) {
+      ::close(fds[0]);
+      RunWriter(db_path, options, next_key, value_size, fds[1]);
+    }
+    ::close(fds[1]);
+    auto killed_after = delay(engine);
+    std::this_thread::sleep_for(std::chrono::milliseconds(killed_after));
+    ::kill(pid, SIGKILL);
+    ::waitpid(pid, nullptr, 0);
+
+    // Acknowledged keys, the writer may have died before the first one
+    std::uint32_t acked = 0;
+    std::uint32_t last = 0;
+    while (::read(fds[0], &last, sizeof(last)) == sizeof(last)) {
+      acked++;
+    }
+    ::close(fds[0]);
+
+    auto start = std::chrono::steady_clock::now();
+    auto db = mybitcask::Open(db_path, options);
+    auto elapsed = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    if (!db.ok()) {
+      std::cerr << "recovery failed: " << db.status() << std::endl;
+      return 1;
+    }
+    open_ms.push_back(elapsed);
+    std::size_t lost = 0;
+    for (std::uint32_t i = next_key; i < next_key + acked; i++) {
+      std::string value;
+      auto found = (*db)->Get(Key(i), &value);
+      if (!found.ok() || !*found) {
+        lost++;
+      }
+    }
+    lost_total += lost;
+    std::cout << std::left << std::setw(8) << round << std::setw(12) << acked
+              << std::setw(12) << killed_after << std::setw(14)
+              << (*db)->recovery_report().dropped_bytes << std::setw(12)
+              << elapsed << lost << std::endl;
+    next_key += acked + 1;
+  }
+
+  std::sort(open_ms.begin(), open_ms.end());
+  std::cout << "open(ms) p50 " << open_ms[open_ms.size() / 2] << " max "
+            << open_ms.back() << ", acknowledged keys lost " << lost_total
+            << std::endl;
+  ghc::filesystem::remove_all(db_path);
+  return lost_total == 0 ? 0 : 2;
+}
@@ -0,0 +1,17 @@
+# Uses an installed Google Benchmark if there is one
+find_package(benchmark CONFIG QUIET)
+
+if(NOT benchmark_FOUND)
+  include(FetchContent)
+  FetchContent_Declare(
+    benchmark
+    GIT_REPOSITORY https://github.com/google/benchmark.git
+    GIT_TAG v1.8.3
+  )
+
+  set(BENCHMARK_ENABLE_TESTING OFF CACHE BOOL "" FORCE)
+  set(BENCHMARK_ENABLE_GTEST_TESTS OFF CACHE BOOL "" FORCE)
+  FetchContent_MakeAvailable(benchmark)
+endif()
+
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(Benchmark DEFAULT_MSG)
@@ -0,0 +1,137 @@
+#ifndef MYBITCASK_INCLUDE_INTERNAL_COMPRESSION_H_
+#define MYBITCASK_INCLUDE_INTERNAL_COMPRESSION_H_
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mybitcask {
+namespace compression {
+
+// Compression types recorded in log entries. Types up to
+// kMaxCompressionType which are not built in are free for custom
+// compressors.
+const std::uint8_t kNoCompression = 0;
+const std::uint8_t kLzCompression = 1;
+// Compressed by the built-in LZ codec against the dictionary of the log file
+// holding the value
+const std::uint8_t kLzDictCompression = 2;
+const std::uint8_t kMaxCompressionType = 7;
+
+// Compressor compresses the values of log entries. Every value is compressed
+// on its own, so entries stay independently readable.
+//
+// Implementations must be safe for concurrent use by multiple threads.
+class Compressor {
+ public:
+  virtual ~Compressor() = default;
+
+  // Compression type recorded in the entries compressed by this compressor,
+  // between 1 and kMaxCompressionType
+  virtual std::uint8_t type() const = 0;
+
+  // Compress `input` and append the result to `output`.
+  virtual void Compress(absl::Span<const std::uint8_t> input,
+                        std::vector<std::uint8_t>* output) const = 0;
+
+  // Return the length of the value compressed into `compressed`, or a
+  // non-ok status if `compressed` is malformed.
+  virtual absl::StatusOr<std::uint64_t> UncompressedLength(
+      absl::Span<const std::uint8_t> compressed) const = 0;
+
+  // Decompress `compressed` into `dst`, which is exactly
+  // UncompressedLength(compressed) bytes long. Returns a non-ok status if
+  // `compressed` is malformed.
+  virtual absl::Status Uncompress(absl::Span<const std::uint8_t> compressed,
+                                  absl::Span<std::uint8_t> dst) const = 0;
+};
+
+// Return the built-in compressor of type kLzCompression, a byte oriented
+// LZ77 codec which favors speed over compression ratio.
+std::shared_ptr<const Compressor> LzCompressor();
+
+// Dictionaries are at most kMaxDictionaryLen bytes long, the farthest an LZ
+// match can reach back.
+const std::size_t kMaxDictionaryLen = 32 * 1024;
+// Only values of at most kMaxDictionaryValueLen bytes are compressed against
+// a dictionary. Longer values have enough redundancy on their own.
+const std::size_t kMaxDictionaryValueLen = 32 * 1024;
+
+// Dictionary holds content shared by many small values, which values are
+// compressed against by the built-in LZ codec. A value compressed against a
+// dictionary can only be decompressed with the same dictionary.
+//
+// Safe for concurrent use by multiple threads.
+class Dictionary {
+ public:
+  // REQUIRES: data.size() <= kMaxDictionaryLen
+  explicit Dictionary(std::vector<std::uint8_t> data);
+
+  absl::Span<const std::uint8_t> data() const;
+
+  // Compress `input` against the dictionary and append the result to
+  // `output`. The format is that of LzCompressor, with matches which may
+  // reach back into the dictionary.
+  //
+  // REQUIRES: input.size() <= kMaxDictionaryValueLen
+  void Compress(absl::Span<const std::uint8_t> input,
+                std::vector<std::uint8_t>* output) const;
+
+  // Decompress `compressed`, which was compressed against this dictionary,
+  // into `dst`, which is exactly UncompressedLength bytes long.
+  absl::Status Uncompress(absl::Span<const std::uint8_t> compressed,
+                          absl::Span<std::uint8_t> dst) const;
+
+ private:
+  std::vector<std::uint8_t> data_;
+  // Last position plus one of every hashed 4 byte sequence of data_
+  std::vector<std::uint32_t> table_;
+};
+
+// Build a dictionary of at most `max_len` bytes from the content which
+// occurs in many of `samples`. Returns an empty dictionary if the samples
+// have nothing in common.
+std::vector<std::uint8_t> TrainDictionary(
+    const std::vector<std::string>& samples, std::size_t max_len);
+
+// DictionarySampler keeps a uniform sample of the values offered to it, of a
+// bounded total size, for training a dictionary.
+//
+// Safe for concurrent use by multiple threads.
+class DictionarySampler {
+ public:
+  // Dictionaries are at most `dictionary_len` bytes long, and trained from
+  // samples of at most kSamplesPerDictionaryByte times as many bytes.
+  explicit DictionarySampler(std::size_t dictionary_len);
+
+  // Offer `value` as a sample. Values longer than kMaxDictionaryValueLen are
+  // ignored.
+  void Add(absl::Span<const std::uint8_t> value);
+
+  // Train a dictionary from the samples taken since the last call, or
+  // return nullptr if there are too few of them.
+  std::shared_ptr<const Dictionary> Train();
+
+  static const std::size_t kSamplesPerDictionaryByte = 16;
+  static const std::size_t kMinSamples = 16;
+
+ private:
+  const std::size_t dictionary_len_;
+  absl::Mutex lock_;
+  std::vector<std::string> samples_;
+  std::size_t sample_bytes_;
+  // Number of values offered since the last Train
+  std::uint64_t offered_;
+  std::uint64_t rand_state_;
+};
+
+}  // namespace compression
+}  // namespace mybitcask
+
+#endif  // MYBITCASK_INCLUDE_INTERNAL_COMPRESSION_H_
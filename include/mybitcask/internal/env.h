@@ -0,0 +1,85 @@
+#ifndef MYBITCASK_INCLUDE_INTERNAL_ENV_H_
+#define MYBITCASK_INCLUDE_INTERNAL_ENV_H_
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "ghc/filesystem.hpp"
+#include "mybitcask/internal/io.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mybitcask {
+
+const std::string kErrFileNotFound = "file not found";
+
+// Env owns every operation a database does on its files, so that a database
+// can be kept somewhere else than on the local filesystem, e.g. in memory by
+// NewMemEnv for tests and CPU-only benchmarks.
+//
+// Implementations are safe for concurrent use by multiple threads.
+class Env {
+ public:
+  Env() = default;
+  Env(const Env&) = delete;
+  Env& operator=(const Env&) = delete;
+
+  virtual ~Env() = default;
+
+  // Return the Env of the local filesystem, which is never destroyed.
+  static Env* Default();
+
+  // Open an existing file for sequential reads
+  virtual absl::StatusOr<std::unique_ptr<io::SequentialReader>>
+  NewSequentialReader(const ghc::filesystem::path& filename) noexcept = 0;
+
+  // Open a file for appends, creating it if it does not exist
+  virtual absl::StatusOr<std::unique_ptr<io::SequentialWriter>>
+  NewSequentialWriter(const ghc::filesystem::path& filename) noexcept = 0;
+
+  // Open an existing file for random reads
+  virtual absl::StatusOr<std::unique_ptr<io::RandomAccessReader>>
+  NewRandomAccessReader(const ghc::filesystem::path& filename) noexcept = 0;
+
+  // Open an existing file, which is no longer written, for random reads
+  // through a memory map
+  virtual absl::StatusOr<std::unique_ptr<io::RandomAccessReader>>
+  NewMmapReader(const ghc::filesystem::path& filename) noexcept = 0;
+
+  virtual bool FileExists(const ghc::filesystem::path& filename) noexcept = 0;
+
+  virtual absl::StatusOr<std::uint64_t> GetFileSize(
+      const ghc::filesystem::path& filename) noexcept = 0;
+
+  // Return the names of the files in directory `dir`
+  virtual absl::StatusOr<std::vector<std::string>> GetChildren(
+      const ghc::filesystem::path& dir) noexcept = 0;
+
+  // Removing a file which does not exist is not an error. Readers opened
+  // before the removal can still read it. Empty directories are removed
+  // the same way.
+  virtual absl::Status RemoveFile(
+      const ghc::filesystem::path& filename) noexcept = 0;
+
+  // Rename file `src` to `target`, replacing `target` if it exists
+  virtual absl::Status RenameFile(
+      const ghc::filesystem::path& src,
+      const ghc::filesystem::path& target) noexcept = 0;
+
+  // Discard everything after the first `size` bytes of a file
+  virtual absl::Status TruncateFile(const ghc::filesystem::path& filename,
+                                    std::uint64_t size) noexcept = 0;
+
+  // Create directory `dir` and its missing parents
+  virtual absl::Status CreateDir(const ghc::filesystem::path& dir) noexcept = 0;
+};
+
+// Return an Env keeping files in memory. Files are lost when the Env is
+// destroyed, which must happen after every database using it is closed.
+std::unique_ptr<Env> NewMemEnv();
+
+}  // namespace mybitcask
+
+#endif  // MYBITCASK_INCLUDE_INTERNAL_ENV_H_
@@ -0,0 +1,135 @@
+#ifndef MYBITCASK_INCLUDE_INTERNAL_FAULT_INJECTION_ENV_H_
+#define MYBITCASK_INCLUDE_INTERNAL_FAULT_INJECTION_ENV_H_
+
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "env.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <random>
+
+namespace mybitcask {
+
+// Operations of an Env faults are injected into
+enum class FileOp : std::uint32_t {
+  // Opening a reader or a writer
+  kOpen,
+  // Sequential and random reads
+  kRead,
+  kAppend,
+  kSync,
+  // Truncating a writer or a file
+  kTruncate,
+  kRemove,
+  kRename,
+  // FileExists, GetFileSize and GetChildren. Only latency is injected into
+  // FileExists.
+  kStat,
+  kNumFileOps,
+};
+
+// Files faults are injected into, by their name. Temporary hint files are
+// hint files.
+enum class FaultFileType : std::uint32_t {
+  kLogFile,
+  kHintFile,
+  // Any other file, and directories
+  kOtherFile,
+  kNumFaultFileTypes,
+};
+
+const char* FileOpName(FileOp op);
+
+// Fault injected into operations, before they run
+struct Fault {
+  enum class Distribution {
+    // Every delay is `latency`
+    kFixed,
+    // Delays are uniformly distributed between 0 and `latency`
+    kUniform,
+    // Delays are exponentially distributed with a mean of `latency`
+    kExponential,
+  };
+
+  // Fraction of the operations the fault is injected into
+  double probability = 1.0;
+  absl::Duration latency = absl::ZeroDuration();
+  Distribution distribution = Distribution::kFixed;
+  // If not OK, returned by the operation instead of running it, e.g.
+  // absl::ResourceExhaustedError for a full disk
+  absl::Status error;
+};
+
+// FaultInjectionEnv runs the operations of another Env, delaying them or
+// failing them as told by the faults set per operation and file type, to
+// see how a database behaves when its device is slow or failing. Readers
+// and writers opened before a fault is set are affected by it.
+//
+// Safe for concurrent use by multiple threads.
+class FaultInjectionEnv final : public Env {
+ public:
+  // Operations are run by `base`, which must outlive this Env. Delays and
+  // probabilities are drawn from a generator seeded with `seed`.
+  explicit FaultInjectionEnv(Env* base, std::uint64_t seed = 0);
+
+  // Inject `fault` into operation `op` on files of type `file_type`,
+  // replacing the fault injected so far
+  void SetFault(FileOp op, FaultFileType file_type, const Fault& fault);
+  // Same, on files of any type
+  void SetFault(FileOp op, const Fault& fault);
+  // Stop injecting faults
+  void ClearFaults();
+
+  // Number of operations `op` a fault was injected into
+  std::uint64_t injected(FileOp op) const;
+
+  absl::StatusOr<std::unique_ptr<io::SequentialReader>> NewSequentialReader(
+      const ghc::filesystem::path& filename) noexcept override;
+  absl::StatusOr<std::unique_ptr<io::SequentialWriter>> NewSequentialWriter(
+      const ghc::filesystem::path& filename) noexcept override;
+  absl::StatusOr<std::unique_ptr<io::RandomAccessReader>>
+  NewRandomAccessReader(
+      const ghc::filesystem::path& filename) noexcept override;
+  absl::StatusOr<std::unique_ptr<io::RandomAccessReader>> NewMmapReader(
+      const ghc::filesystem::path& filename) noexcept override;
+  bool FileExists(const ghc::filesystem::path& filename) noexcept override;
+  absl::StatusOr<std::uint64_t> GetFileSize(
+      const ghc::filesystem::path& filename) noexcept override;
+  absl::StatusOr<std::vector<std::string>> GetChildren(
+      const ghc::filesystem::path& dir) noexcept override;
+  absl::Status RemoveFile(
+      const ghc::filesystem::path& filename) noexcept override;
+  absl::Status RenameFile(
+      const ghc::filesystem::path& src,
+      const ghc::filesystem::path& target) noexcept override;
+  absl::Status TruncateFile(const ghc::filesystem::path& filename,
+                            std::uint64_t size) noexcept override;
+  absl::Status CreateDir(const ghc::filesystem::path& dir) noexcept override;
+
+  // Sleep for the delay of the fault injected into `op` on files of type
+  // `file_type`, if any, and return its error.
+  absl::Status Inject(FileOp op, FaultFileType file_type) noexcept;
+
+ private:
+  static constexpr std::size_t kNumFaults =
+      static_cast<std::size_t>(FileOp::kNumFileOps) *
+      static_cast<std::size_t>(FaultFileType::kNumFaultFileTypes);
+
+  Env* const base_;
+  absl::Mutex lock_;
+  std::array<Fault, kNumFaults> faults_ ABSL_GUARDED_BY(lock_);
+  // Set once a fault is set, so that operations do not take the lock as
+  // long as none is
+  std::atomic<bool> active_;
+  std::mt19937_64 engine_ ABSL_GUARDED_BY(lock_);
+  std::array<std::atomic<std::uint64_t>,
+             static_cast<std::size_t>(FileOp::kNumFileOps)>
+      injected_;
+};
+
+}  // namespace mybitcask
+
+#endif  // MYBITCASK_INCLUDE_INTERNAL_FAULT_INJECTION_ENV_H_
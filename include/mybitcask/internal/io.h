@@ -9,6 +9,7 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <vector>
 
 namespace mybitcask {
 namespace io {
@@ -74,9 +75,15 @@ class SequentialWriter {
   // then it must be guaranteed that no bytes were written.
   //
   // REQUIRES: External synchronization
-  virtual absl::StatusOr<std::uint32_t> Append(
+  virtual absl::StatusOr<std::uint64_t> Append(
       absl::Span<const std::uint8_t> src) noexcept = 0;
 
+  // Discard everything after the first `size` bytes, so that the next Append
+  // writes at offset `size`. Used to roll back a partially written entry.
+  //
+  // REQUIRES: External synchronization
+  virtual absl::Status Truncate(std::uint64_t size) noexcept = 0;
+
   // Attempts to sync data to underlying storage. If an error was encountered, a
   // non-OK status will be returned.
   //
@@ -84,9 +91,54 @@ class SequentialWriter {
   virtual absl::Status Sync() noexcept = 0;
 
   // Returns the current size of this writer.
-  virtual std::uint32_t Size() const noexcept = 0;
+  virtual std::uint64_t Size() const noexcept = 0;
+};
+
+// Default buffer size of Scanner
+const std::size_t kScanBufferSize = 64 * 1024;
+
+// Scanner reads a SequentialReader through a large buffer, so that parsing
+// many small records issues one read per buffer instead of one per record.
+// Memory usage is bounded by the buffer size (or the largest record peeked).
+class Scanner {
+ public:
+  explicit Scanner(std::unique_ptr<SequentialReader>&& reader,
+                   std::size_t buffer_size = kScanBufferSize);
+
+  Scanner(const Scanner&) = delete;
+  Scanner& operator=(const Scanner&) = delete;
+
+  // Buffer at least `n` bytes, returning how many bytes are buffered. Fewer
+  // than `n` bytes are buffered only if EOF is reached.
+  absl::StatusOr<std::size_t> Peek(std::size_t n) noexcept;
+
+  // Buffered bytes, valid until the next call of Peek or Skip
+  const std::uint8_t* data() const { return buf_.data() + begin_; }
+
+  // Consume `n` bytes. Bytes that are not buffered are skipped in the
+  // underlying reader without being read.
+  absl::Status Skip(std::uint64_t n) noexcept;
+
+  // Number of bytes consumed so far
+  std::uint64_t offset() const { return offset_; }
+
+  // Discard the buffered bytes, once the underlying reader was moved to the
+  // byte at `offset` by other means than Skip.
+  void Reset(std::uint64_t offset);
+
+ private:
+  std::unique_ptr<SequentialReader> reader_;
+  std::vector<std::uint8_t> buf_;
+  // Buffered bytes are buf_[begin_, end_)
+  std::size_t begin_;
+  std::size_t end_;
+  std::uint64_t offset_;
 };
 
+// Open a file as SequentialReader
+absl::StatusOr<std::unique_ptr<SequentialReader>> OpenSequentialFileReader(
+    ghc::filesystem::path&& filename) noexcept;
+
 // Open a file as SequentialWriter
 absl::StatusOr<std::unique_ptr<SequentialWriter>> OpenSequentialFileWriter(
     ghc::filesystem::path&& filename) noexcept;
@@ -1,23 +1,35 @@
 #ifndef MYBITCASK_INCLUDE_INTERNAL_LOG_H_
 #define MYBITCASK_INCLUDE_INTERNAL_LOG_H_
 
+#include "compression.h"
+#include "env.h"
+#include "io.h"
 #include "store.h"
 
 #include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "absl/types/span.h"
 
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 namespace mybitcask {
 
 struct Position;
 
+namespace store {
+namespace hint {
+class Builder;
+}  // namespace hint
+}  // namespace store
+
 namespace log {
 
 // kErrBadEntry is an error. that indicates log entry is invalid.
@@ -25,19 +37,158 @@ namespace log {
 // * The entry has an invalid CRC
 // * The entry has wrong length
 const std::string kErrBadEntry = "bad log entry";
-const std::string kErrBadKeyLength = "key length must be between (0, 255]";
-const std::string kErrBadValueLength =
-    "value length must be between (0, 65535)";
+const std::string kErrBadKeyLength = "key length must be between (0, 65535]";
+const std::string kErrBadValueLength = "value length must be between (0, 2^40]";
+const std::string kErrUnsupportedVersion = "unsupported log file version";
+const std::string kErrUnknownCompression = "unknown compression type";
+
+const std::uint64_t kMaxKeyLen = 0xFFFF;
+const std::uint64_t kMaxValueLen = 1ULL << 40;
+
+// Values are streamed in pieces of at most kStreamChunkSize bytes
+const std::size_t kStreamChunkSize = 1024 * 1024;
+
+// Format versions of log files. Log files written before the format was
+// versioned have no file header and are kLegacyVersion. kBlockFormatVersion
+// files hold the file header and entries of kFormatVersion, block framed by
+// the store, see store::kBlockSize.
+const std::uint32_t kLegacyVersion = 0;
+const std::uint32_t kFormatVersion = 1;
+const std::uint32_t kBlockFormatVersion = 2;
+
+// Return the file header written at the beginning of new log files of
+// format `version`, whose values compressed with
+// compression::kLzDictCompression are compressed against `dictionary`.
+std::vector<std::uint8_t> FileHeader(
+    absl::Span<const std::uint8_t> dictionary = {},
+    std::uint32_t version = kFormatVersion);
+
+// Return the length of a log entry of the current format with a key of
+// `key_len` bytes and a value of `value_len` bytes.
+std::uint64_t EntryLen(std::uint64_t key_len, std::uint64_t value_len);
+
+// Entries may expire, their expiry time being a Unix time in milliseconds.
+// An expiry time of 0 means the entry never expires.
+std::uint64_t NowMillis();
+
+// Return true if an entry with expiry time `expire_at` has expired.
+inline bool Expired(std::uint64_t expire_at) {
+  return expire_at != 0 && expire_at <= NowMillis();
+}
+
+// Read the format version of log file `log_file_path`. Returns nullopt if the
+// file is empty.
+absl::StatusOr<absl::optional<std::uint32_t>> ReadFormatVersion(
+    const ghc::filesystem::path& log_file_path,
+    Env* env = Env::Default()) noexcept;
+
+// Read the dictionary in the file header of log file `log_file_path`. Returns
+// an empty dictionary if the file has none.
+absl::StatusOr<std::vector<std::uint8_t>> ReadDictionary(
+    const ghc::filesystem::path& log_file_path,
+    Env* env = Env::Default()) noexcept;
+
+// TornTail tells where the intact entries of a log file end
+struct TornTail {
+  // Length of the file up to the end of its last intact entry
+  std::uint64_t valid_len;
+  // Length of the file
+  std::uint64_t file_len;
+};
+
+// Find the torn tail of log file `log_file_path`, left by a crash while
+// entries were appended to it. The tail starts at the first entry which is
+// incomplete, or which starts in the last `verify_len` bytes of the file
+// and fails verification. Entries before are only checked for being
+// complete, and a malformed one is an error rather than a torn tail.
+// `verify_len` should exceed the longest entry header and key, so that the
+// start of a torn entry is always verified.
+absl::StatusOr<TornTail> FindTornTail(
+    const ghc::filesystem::path& log_file_path, std::uint64_t verify_len,
+    Env* env = Env::Default()) noexcept;
+
+// Receives a value read by Reader::ReadStream piece by piece
+using ValueSink = std::function<absl::Status(absl::Span<const std::uint8_t>)>;
 
 namespace log_internal {
 
 const std::uint32_t kCrc32Len = 4;
+
+// Header of kFormatVersion log files, a magic number followed by the
+// version and the length of the dictionary which follows the header
+const std::uint64_t kFileMagic = 0x73676f6c6b62796dULL;  // "mybklogs"
+const std::uint32_t kFileMagicLen = 8;
+const std::uint32_t kFileHeaderLen = 16;
+
+// Decode the length of the dictionary following `header`, the kFileHeaderLen
+// bytes long header of a kFormatVersion log file.
+std::uint32_t DecodeDictionaryLen(absl::Span<const std::uint8_t> header);
+
+// Decode the format version from the first `data.size()` bytes of a log file.
+// Returns nullopt if more bytes are needed to tell.
+absl::optional<std::uint32_t> DecodeFormatVersion(
+    absl::Span<const std::uint8_t> data);
+
+// If bit kTombstoneFlag of the flags of an entry is set, the entry is a
+// tombstone
+const std::uint8_t kTombstoneFlag = 0x01;
+// Bits of the flags of an entry holding the compression type of its value
+const std::uint8_t kCompressionShift = 1;
+const std::uint8_t kCompressionMask = 0x0E;
+// If bit kExpireFlag of the flags of an entry is set, the value length is
+// followed by the expiry time of the entry
+const std::uint8_t kExpireFlag = 0x10;
+// flags and three varint64s
+const std::size_t kMaxEntryHeaderLen = 1 + 3 * 10;
+
+// EntryHeader is the decoded header of a kFormatVersion log entry
+struct EntryHeader {
+  bool tombstone;
+  // Compression type of the value, value_len being its compressed length
+  std::uint8_t compression;
+  std::uint64_t key_len;
+  std::uint64_t value_len;
+  // Expiry time of the entry, 0 if it never expires
+  std::uint64_t expire_at;
+  // Encoded length of the header
+  std::size_t header_len;
+};
+
+// Return the encoded length of an entry header.
+std::size_t EntryHeaderLen(std::uint64_t key_len, std::uint64_t value_len,
+                           std::uint64_t expire_at = 0);
+
+// Encode `header` into `dst`, which must have room for kMaxEntryHeaderLen
+// bytes, and return the encoded length.
+std::size_t EncodeEntryHeader(const EntryHeader& header, std::uint8_t* dst);
+
+// Return the error Writer returns for an entry with a key of `key_len`
+// bytes and a value of `value_len` bytes compressed with `compression`, if
+// any. `value_len` is nullopt for a tombstone.
+absl::Status CheckEntry(std::uint64_t key_len,
+                        absl::optional<std::uint64_t> value_len,
+                        std::uint8_t compression);
+
+// Check an entry as CheckEntry does, and append its encoded header and key
+// to `dst`. In the log they are followed by the value and the CRC32C of the
+// header, key and value. Returns the header of the entry.
+absl::StatusOr<EntryHeader> EncodeEntryPrefix(
+    absl::Span<const std::uint8_t> key,
+    absl::optional<std::uint64_t> value_len, std::uint8_t compression,
+    std::uint64_t expire_at, std::vector<std::uint8_t>* dst);
+
+// Decode an entry header from the beginning of `src`. Returns false if the
+// header is truncated or malformed.
+bool DecodeEntryHeader(absl::Span<const std::uint8_t> src,
+                       EntryHeader* header);
+
+// Header of kLegacyVersion log entries
 const std::uint32_t kKeyLenLen = 1;
 const std::uint32_t kValLenLen = 2;
 const std::uint32_t kHeaderLen = kCrc32Len + kKeyLenLen + kValLenLen;
 
-// RawHeader represents log entry header which contains CRC32C, key_size and
-// value_size
+// RawHeader represents the header of a kLegacyVersion log entry, which
+// contains CRC32C, key_size and value_size
 class RawHeader final {
  public:
   RawHeader(std::uint8_t* const data);
@@ -57,13 +208,52 @@ class RawHeader final {
   // Calculate crc32 from key_size, value_size and kv_buf
   std::uint32_t calc_actual_crc(const std::uint8_t* kv_data) const;
 
+  std::uint32_t crc32() const;
+
  private:
   std::uint16_t raw_value_len() const;
 
-  std::uint32_t crc32() const;
-
   std::uint8_t* const data_;
 };
+
+// Decode the header of the entry at the beginning of the bytes buffered by
+// `scanner`, which reads a log file of format `version`, and buffer the key
+// after it. Returns false at the end of the file.
+absl::StatusOr<bool> PeekEntry(io::Scanner* scanner, std::uint32_t version,
+                               EntryHeader* header) noexcept;
+
+// Return the length of the checksum after the value of an entry
+std::uint32_t TrailerLen(std::uint32_t version);
+
+// Return the offset among the entries of a log file of format `version` of
+// the byte at `file_offset`, which differ in block framed files.
+std::uint64_t ContentOffset(std::uint32_t version, std::uint64_t file_offset);
+
+// Inverse of ContentOffset
+std::uint64_t FileOffset(std::uint32_t version, std::uint64_t content_offset);
+
+// FileFormat tells how the entries of a log file are encoded
+struct FileFormat {
+  std::uint32_t version;
+  // Dictionary of kLzDictCompression values, nullptr if the file has none
+  std::shared_ptr<const compression::Dictionary> dictionary;
+};
+
+// Formats of the log files read by a Reader, read from their file headers
+// once
+struct FormatCache {
+  absl::Mutex lock;
+  std::unordered_map<store::file_id_t, FileFormat> formats;
+};
+
+// Dictionary the values appended by a Writer are compressed against
+struct WriterDictionary {
+  absl::Mutex lock;
+  std::shared_ptr<const compression::Dictionary> dictionary;
+  // Incremented whenever the dictionary changes
+  std::uint64_t epoch = 0;
+};
+
 }  // namespace log_internal
 
 class Entry;
@@ -76,48 +266,141 @@ class Reader {
 
   // Create LogReader
   // If "checksum" is true, verify checksums if available.
-  Reader(store::Store* src, bool checksum);
+  // Values compressed by the built-in compressor can always be decompressed,
+  // `compressor` is required to decompress the ones compressed by a custom
+  // compressor.
+  Reader(store::Store* src, bool checksum,
+         std::shared_ptr<const compression::Compressor> compressor = nullptr);
 
   // Read a log entry at the specified position.
   // Return true and store value part of entry to `value` if read successfully.
   // Else return false.
-  // If checksum is not required, write the corresponding value directly to
-  // `value`. Else read out the entire entry first, and then copy the value part
-  // of the entry to value.
+  // The value is read directly into `value`. If checksum is required, the
+  // header and key of the entry are read as well and the CRC is verified
+  // over the whole entry. Compressed values are stored as they are in the
+  // log, see ReadValue.
   //
   // Safe for concurrent use by multiple threads.
-  absl::StatusOr<bool> Read(const Position& pos, std::uint8_t key_len,
+  absl::StatusOr<bool> Read(const Position& pos, std::uint32_t key_len,
                             std::uint8_t* value) noexcept;
 
+  // Same as Read, but compressed values are decompressed. `alloc` is called
+  // once with the length of the value and returns the buffer the value is
+  // read or decompressed into.
+  //
+  // Safe for concurrent use by multiple threads.
+  absl::StatusOr<bool> ReadValue(
+      const Position& pos, std::uint32_t key_len,
+      const std::function<std::uint8_t*(std::uint64_t)>& alloc) noexcept;
+
   // Read a log entry a t the specified position. Returns ok status and log
-  // entry if read successfully. Else return non-ok status
+  // entry if read successfully. Else return non-ok status. The value of the
+  // entry is not decompressed.
   //
   // Safe for concurrent use by multiple threads.
   absl::StatusOr<absl::optional<Entry>> Read(const Position& pos,
-                                             std::uint8_t key_len) noexcept;
+                                             std::uint32_t key_len) noexcept;
+
+  // Same as ReadValue, but the value is passed to `sink` in pieces of at
+  // most kStreamChunkSize bytes, so memory usage does not depend on the
+  // length of uncompressed values. If checksum is required, a CRC mismatch
+  // is reported after the whole value was passed to `sink`.
+  //
+  // Safe for concurrent use by multiple threads.
+  absl::StatusOr<bool> ReadStream(const Position& pos, std::uint32_t key_len,
+                                  const ValueSink& sink) noexcept;
+
+  // Same as ReadStream, but compressed values are passed to `sink` as they
+  // are stored in the log.
+  //
+  // Safe for concurrent use by multiple threads.
+  absl::StatusOr<bool> ReadStoredStream(const Position& pos,
+                                        std::uint32_t key_len,
+                                        const ValueSink& sink) noexcept;
 
   // Returns an key iterator
   KeyIter key_iter(store::file_id_t log_file_id) const;
 
+  // Env the log files are read through
+  Env* env() const { return src_->env(); }
+
  private:
+  // Read the value at `pos` into `buf` piece by piece, passing each piece to
+  // `sink`.
+  absl::StatusOr<bool> read_value(const Position& pos, std::uint32_t key_len,
+                                  absl::Span<std::uint8_t> buf,
+                                  const ValueSink& sink) noexcept;
+
+  // Returns the format of log file `file_id`, or nullptr if its file header
+  // can not be read yet.
+  absl::StatusOr<const log_internal::FileFormat*> file_format(
+      store::file_id_t file_id) noexcept;
+
+  // Read log file `file_id` of format `version` from `offset` on into `dst`,
+  // leaving out the block trailers of block framed files.
+  absl::StatusOr<std::size_t> read_at(std::uint32_t version,
+                                      store::file_id_t file_id,
+                                      std::uint64_t offset,
+                                      absl::Span<std::uint8_t> dst) noexcept;
+
+  // Returns the compressor of compression type `type`, or nullptr if it is
+  // unknown.
+  const compression::Compressor* compressor(std::uint8_t type) const;
+
   store::Store* src_;
   bool checksum_;
+  std::shared_ptr<const compression::Compressor> compressor_;
+  std::unique_ptr<log_internal::FormatCache> formats_;
 };
 
 class Writer {
  public:
+  // Produces the value of an entry added by AppendStream, by passing
+  // consecutive pieces of the value to the given function
+  using ValueProducer = std::function<absl::Status(const store::PieceWriter&)>;
+
   Writer() = default;
 
   explicit Writer(store::Store* dest);
 
+  // Create a Writer which also records every appended entry in
+  // `hint_builder`, so the hint file of a closed log file can be written
+  // without scanning it. Writing it is up to the owner of `hint_builder`.
+  Writer(store::Store* dest, store::hint::Builder* hint_builder);
+
+  // Compress the values of at least `min_value_len` bytes added by Append
+  // and AppendIf with `compressor`, unless that does not make them smaller.
+  // nullptr disables compression.
+  //
+  // REQUIRES: no concurrent appends
+  void SetCompression(std::shared_ptr<const compression::Compressor> compressor,
+                      std::uint64_t min_value_len);
+
+  // Compress values against `dictionary`, which the latest log file of the
+  // underlying dest and the files it creates start with. Values are
+  // compressed against it in preference to the compressor, subject to the
+  // same minimum length.
+  //
+  // REQUIRES: no concurrent appends
+  void SetDictionary(std::shared_ptr<const compression::Dictionary> dictionary);
+
+  // Same as SetDictionary, but entries are appended to a log file starting
+  // with `dictionary` from now on, usually a new one. nullptr stops
+  // compressing against a dictionary.
+  //
+  // Safe for concurrent use by multiple threads.
+  absl::Status ChangeDictionary(
+      std::shared_ptr<const compression::Dictionary> dictionary) noexcept;
+
   // Add an log entry to the end of the underlying dest. Returns ok status and
   // the offset and length of the added entry if append successfully. Else
-  // return non-ok status
+  // return non-ok status. The entry expires at `expire_at`, see Expired.
   //
   // Safe for concurrent use by multiple threads.
   absl::Status Append(
       absl::Span<const std::uint8_t> key, absl::Span<const std::uint8_t> value,
-      const std::function<void(Position)>& success_callback) noexcept;
+      const std::function<void(Position)>& success_callback,
+      std::uint64_t expire_at = 0) noexcept;
 
   // Add a tombstone log entry to the end of the underlying dest. Returns ok
   // status and the offset and length of the added entry if append successfully.
@@ -132,17 +415,78 @@ class Writer {
       absl::Span<const std::uint8_t> key,
       const std::function<void(Position)>& success_callback) noexcept;
 
+  // Same as Append, but the entry is only added if `precondition` returns
+  // true. `precondition` is evaluated atomically with the append, so no other
+  // entry can be added in between. Returns true if the entry was added.
+  //
+  // Safe for concurrent use by multiple threads.
+  absl::StatusOr<bool> AppendIf(
+      absl::Span<const std::uint8_t> key, absl::Span<const std::uint8_t> value,
+      const std::function<bool()>& precondition,
+      const std::function<void(Position)>& success_callback,
+      std::uint64_t expire_at = 0) noexcept;
+
+  // Same as AppendTombstone, but the entry is only added if `precondition`
+  // returns true. See AppendIf.
+  //
+  // Safe for concurrent use by multiple threads.
+  absl::StatusOr<bool> AppendTombstoneIf(
+      absl::Span<const std::uint8_t> key,
+      const std::function<bool()>& precondition,
+      const std::function<void(Position)>& success_callback) noexcept;
+
+  // Same as Append, but the value of `value_len` bytes is written piece by
+  // piece by `produce`. If `produce` fails or does not produce exactly
+  // `value_len` bytes, nothing is added.
+  //
+  // Other entries can not be added while `produce` runs.
+  //
+  // Safe for concurrent use by multiple threads.
+  absl::Status AppendStream(
+      absl::Span<const std::uint8_t> key, std::uint64_t value_len,
+      const ValueProducer& produce,
+      const std::function<void(Position)>& success_callback,
+      std::uint64_t expire_at = 0) noexcept;
+
+  // Same as AppendStream, but the entry is only added if `precondition`
+  // returns true. See AppendIf. The produced value is already compressed
+  // with compression type `compression`, and is stored as it is.
+  //
+  // Safe for concurrent use by multiple threads.
+  absl::StatusOr<bool> AppendStreamIf(
+      absl::Span<const std::uint8_t> key, std::uint64_t value_len,
+      const ValueProducer& produce, const std::function<bool()>& precondition,
+      const std::function<void(Position)>& success_callback,
+      std::uint8_t compression = compression::kNoCompression,
+      std::uint64_t expire_at = 0) noexcept;
+
  private:
-  absl::Status AppendInner(
+  // `value_len` if empty means tombstone entry, whose `produce` is nullptr.
+  // If `precondition` is nullptr the entry is added unconditionally.
+  absl::StatusOr<bool> AppendInner(
+      absl::Span<const std::uint8_t> key,
+      absl::optional<std::uint64_t> value_len, std::uint8_t compression,
+      std::uint64_t expire_at, const ValueProducer* produce,
+      const std::function<bool()>* precondition,
+      const std::function<void(Position)>& success_callback) noexcept;
+
+  // Same as AppendInner, but `value` is compressed first if compression is
+  // enabled and worthwhile.
+  absl::StatusOr<bool> AppendValue(
       absl::Span<const std::uint8_t> key, absl::Span<const std::uint8_t> value,
+      std::uint64_t expire_at, const std::function<bool()>* precondition,
       const std::function<void(Position)>& success_callback) noexcept;
 
   store::Store* dest_;
+  store::hint::Builder* hint_builder_;
+  std::shared_ptr<const compression::Compressor> compressor_;
+  std::uint64_t min_compress_len_;
+  std::unique_ptr<log_internal::WriterDictionary> dictionary_;
 };
 
 class Entry final {
  public:
-  Entry(std::uint32_t length);
+  Entry(std::uint64_t length);
 
   absl::Span<const std::uint8_t> key() const;
 
@@ -152,20 +496,21 @@ class Entry final {
   const std::uint8_t* raw_ptr() const { return ptr_.get(); }
   std::uint8_t* raw_ptr() { return ptr_.get(); }
 
-  void set_key_len(std::uint8_t key_len) { key_len_ = key_len; }
-  void set_value_len(std::uint16_t value_len) { value_len_ = value_len; }
-
-  std::uint8_t key_len_;
-  std::uint16_t value_len_;
+  std::uint32_t header_len_;
+  std::uint32_t key_len_;
+  std::uint64_t value_len_;
   std::unique_ptr<std::uint8_t[]> ptr_;
 
   friend absl::StatusOr<absl::optional<Entry>> Reader::Read(
-      const Position& pos, std::uint8_t key_len) noexcept;
+      const Position& pos, std::uint32_t key_len) noexcept;
 };
 
 struct ValuePos {
-  std::uint16_t value_len;
-  std::uint32_t value_pos;
+  std::uint64_t value_len;
+  std::uint64_t value_pos;
+  std::uint8_t compression;
+  // Expiry time of the entry, 0 if it never expires
+  std::uint64_t expire_at;
 };
 
 template <typename Container>
@@ -200,67 +545,112 @@ GetData(Container& c) {
 
 class KeyIter {
  public:
-  KeyIter(store::Store* src, store::file_id_t log_file_id);
+  explicit KeyIter(ghc::filesystem::path&& log_file_path,
+                   Env* env = Env::Default());
 
   // Folds keys into an accumulator by applying an operation, returning the
   // final result.
+  //
+  // The log file is scanned once through a buffer of io::kScanBufferSize
+  // bytes, values are skipped without being copied. The blocks of block
+  // framed files holding entry headers and keys are verified, the entries
+  // in corrupt blocks are left out.
   template <typename T, typename Container>
   absl::StatusOr<T> Fold(
       T init, const std::function<T(T&&, Key<Container>&&)>& f) noexcept {
     auto&& acc = std::move(init);
 
-    std::uint32_t offset = 0;
-    while (true) {
-      // read header
-      std::uint8_t header_data[log_internal::kHeaderLen]{};
-      auto read_len = src_->ReadAt(store::Position(log_file_id_, offset),
-                                   {header_data, log_internal::kHeaderLen});
+    auto reader = env_->NewSequentialReader(log_file_path_);
+    if (!reader.ok()) {
+      return reader.status();
+    }
+    auto version = ReadFormatVersion(log_file_path_, env_);
+    if (!version.ok()) {
+      return version.status();
+    }
+    if (!version->has_value()) {
+      // empty file
+      return acc;
+    }
+    if (**version > kBlockFormatVersion) {
+      return absl::InternalError(kErrUnsupportedVersion);
+    }
+    std::unique_ptr<io::SequentialReader> source = std::move(reader).value();
+    // Entries are read from the content of block framed files, and the
+    // scan resumes after the blocks which fail verification
+    store::BlockReader* blocks = nullptr;
+    if (**version == kBlockFormatVersion) {
+      blocks = new store::BlockReader(std::move(source));
+      source.reset(blocks);
+    }
+    io::Scanner scanner(std::move(source));
+    if (**version != kLegacyVersion) {
+      auto read_len = scanner.Peek(log_internal::kFileHeaderLen);
       if (!read_len.ok()) {
         return read_len.status();
       }
-      if (*read_len == 0) {
+      if (*read_len < log_internal::kFileHeaderLen) {
+        return absl::InternalError(kErrBadEntry);
+      }
+      auto status = scanner.Skip(
+          log_internal::kFileHeaderLen +
+          static_cast<std::uint64_t>(log_internal::DecodeDictionaryLen(
+              absl::MakeSpan(scanner.data(), log_internal::kFileHeaderLen))));
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    log_internal::EntryHeader header{};
+    while (true) {
+      // read header and key
+      auto found = log_internal::PeekEntry(&scanner, **version, &header);
+      if (!found.ok()) {
+        if (blocks == nullptr || !absl::IsDataLoss(found.status())) {
+          return found.status();
+        }
+        auto next = blocks->Resync();
+        if (!next.ok()) {
+          return next.status();
+        }
+        if (!next->has_value()) {
+          break;
+        }
+        scanner.Reset(**next);
+        continue;
+      }
+      if (!*found) {
         // end of file
         break;
       }
-      if (*read_len != log_internal::kHeaderLen) {
-        return absl::InternalError(kErrBadEntry);
-      }
-      log_internal::RawHeader header(header_data);
-
-      // read key
-      offset += log_internal::kHeaderLen;
-
       Container key_data{};
-      key_container_internal::Resize(key_data, header.key_len());
-      read_len = src_->ReadAt(
-          store::Position(log_file_id_, offset),
-          {key_container_internal::GetData<Container, std::uint8_t>(key_data),
-           key_data.size()});
-      if (!read_len.ok()) {
-        return read_len.status();
+      key_container_internal::Resize(key_data, header.key_len);
+      std::memcpy(
+          key_container_internal::GetData<Container, std::uint8_t>(key_data),
+          scanner.data() + header.header_len, header.key_len);
+
+      std::uint64_t key_end = header.header_len + header.key_len;
+      auto value_pos =
+          log_internal::FileOffset(**version, scanner.offset() + key_end);
+      acc = f(std::move(acc),
+              Key<Container>{std::move(key_data),
+                             header.tombstone
+                                 ? absl::nullopt
+                                 : absl::make_optional(
+                                       ValuePos{header.value_len, value_pos,
+                                                header.compression,
+                                                header.expire_at})});
+      auto status = scanner.Skip(key_end + header.value_len +
+                                 log_internal::TrailerLen(**version));
+      if (!status.ok()) {
+        return status;
       }
-
-      if (*read_len != header.key_len()) {
-        return absl::InternalError(kErrBadEntry);
-      }
-      offset += header.key_len();
-      acc = f(std::move(acc), Key<Container>{std::move(key_data),
-                                             header.is_tombstone()
-                                                 ? absl::nullopt
-                                                 : absl::make_optional(ValuePos{
-                                                       header.value_len(),
-                                                       offset  // value_pos
-                                                   })
-
-                              });
-      offset += header.value_len();
     }
     return acc;
   }
 
  private:
-  store::Store* src_;
-  store::file_id_t log_file_id_;
+  ghc::filesystem::path log_file_path_;
+  Env* env_;
 };
 
 }  // namespace log
@@ -0,0 +1,152 @@
+#ifndef MYBITCASK_INCLUDE_INTERNAL_PERF_CONTEXT_H_
+#define MYBITCASK_INCLUDE_INTERNAL_PERF_CONTEXT_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace mybitcask {
+
+// What the perf context of a thread records
+enum class PerfLevel : std::uint8_t {
+  kDisable,
+  // Counts only
+  kEnableCount,
+  // Counts and nanoseconds
+  kEnableTime,
+};
+
+// PerfContext breaks down the work done by one thread into the stages of
+// the operations it ran. Each thread has its own, which only records once
+// enabled by SetPerfLevel, so a single slow request can be broken down:
+//
+//   SetPerfLevel(PerfLevel::kEnableTime);
+//   GetPerfContext()->Reset();
+//   db->Get(key, &value);
+//   std::cout << GetPerfContext()->ToString(true);
+//   SetPerfLevel(PerfLevel::kDisable);
+//
+// Time spent waiting for a lock is counted in the wait of the lock, not in
+// the stage which took it.
+struct PerfContext {
+  // Set every count to zero
+  void Reset();
+
+  // One "name = value" pair per count, separated by commas, leaving out the
+  // ones which are zero if `exclude_zero`
+  std::string ToString(bool exclude_zero = false) const;
+
+  // MyBitcask::Get
+  std::uint64_t get_count = 0;
+  std::uint64_t get_nanos = 0;
+  // MyBitcask::Insert and InsertStream
+  std::uint64_t insert_count = 0;
+  std::uint64_t insert_nanos = 0;
+
+  // Waiting for the index lock, reading and updating the index
+  std::uint64_t index_lock_wait_nanos = 0;
+  std::uint64_t index_lookup_nanos = 0;
+  std::uint64_t index_update_nanos = 0;
+
+  // log::Reader reads of values, and decompressing the values read
+  std::uint64_t log_read_count = 0;
+  std::uint64_t log_read_nanos = 0;
+  std::uint64_t decompress_nanos = 0;
+  // Verifying the CRC of the entries read
+  std::uint64_t read_checksum_nanos = 0;
+
+  // Waiting for the lock of the readers of the store, and opening readers
+  std::uint64_t reader_lock_wait_nanos = 0;
+  std::uint64_t reader_open_count = 0;
+  // Reads of log files by Store::ReadAt and ReadContentAt
+  std::uint64_t read_at_count = 0;
+  std::uint64_t read_at_bytes = 0;
+  std::uint64_t read_at_nanos = 0;
+
+  // log::Writer appends, including the store append and sync
+  std::uint64_t log_append_count = 0;
+  std::uint64_t log_append_nanos = 0;
+  // Encoding the entry header and computing the CRC of the entries written
+  std::uint64_t encode_nanos = 0;
+  std::uint64_t write_checksum_nanos = 0;
+
+  // Waiting for the append lock of the store
+  std::uint64_t store_lock_wait_nanos = 0;
+  // Writes to the latest log file
+  std::uint64_t store_write_count = 0;
+  std::uint64_t store_write_bytes = 0;
+  std::uint64_t store_write_nanos = 0;
+  // Closing the latest log file and creating a new one
+  std::uint64_t rollover_count = 0;
+  std::uint64_t rollover_nanos = 0;
+  // Store::Sync
+  std::uint64_t sync_count = 0;
+  std::uint64_t sync_nanos = 0;
+};
+
+namespace perf_internal {
+
+extern thread_local PerfLevel perf_level;
+extern thread_local PerfContext perf_context;
+
+}  // namespace perf_internal
+
+// Set what the perf context of the calling thread records, kDisable by
+// default
+inline void SetPerfLevel(PerfLevel level) {
+  perf_internal::perf_level = level;
+}
+
+inline PerfLevel GetPerfLevel() { return perf_internal::perf_level; }
+
+// Return the perf context of the calling thread
+inline PerfContext* GetPerfContext() {
+  return &perf_internal::perf_context;
+}
+
+// Add `count` to a count of the perf context of the calling thread, unless
+// it is disabled
+inline void PerfCount(std::uint64_t PerfContext::*metric,
+                      std::uint64_t count = 1) {
+  if (perf_internal::perf_level >= PerfLevel::kEnableCount) {
+    perf_internal::perf_context.*metric += count;
+  }
+}
+
+// PerfTimer adds the nanoseconds from its construction to Stop, or to its
+// destruction, to a count of the perf context of the calling thread, if the
+// thread records time.
+class PerfTimer final {
+ public:
+  explicit PerfTimer(std::uint64_t PerfContext::*metric)
+      : metric_(perf_internal::perf_level >= PerfLevel::kEnableTime
+                    ? metric
+                    : nullptr) {
+    if (metric_ != nullptr) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~PerfTimer() { Stop(); }
+
+  PerfTimer(const PerfTimer&) = delete;
+  PerfTimer& operator=(const PerfTimer&) = delete;
+
+  void Stop() {
+    if (metric_ != nullptr) {
+      perf_internal::perf_context.*metric_ += static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start_)
+              .count());
+      metric_ = nullptr;
+    }
+  }
+
+ private:
+  std::uint64_t PerfContext::*metric_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace mybitcask
+
+#endif  // MYBITCASK_INCLUDE_INTERNAL_PERF_CONTEXT_H_
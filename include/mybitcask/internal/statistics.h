@@ -0,0 +1,173 @@
+#ifndef MYBITCASK_INCLUDE_INTERNAL_STATISTICS_H_
+#define MYBITCASK_INCLUDE_INTERNAL_STATISTICS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace mybitcask {
+
+// Counters of Statistics, which only increase
+enum class Ticker : std::uint32_t {
+  // Get calls which found the key, and which did not
+  kGetHits,
+  kGetMisses,
+  // Values read from the index, where small values may be inlined, and
+  // values read from the log files
+  kInlineValueHits,
+  kInlineValueMisses,
+  // Bytes appended to and read from the log files
+  kBytesWritten,
+  kBytesRead,
+  // Syncs of the latest log file
+  kSyncs,
+  // Log files created once the latest one exceeded dead_bytes_threshold
+  kRollovers,
+  // Log files compacted, bytes of hint and log entries compactions read and
+  // wrote, and bytes of log and hint files they removed minus bytes written
+  kFilesCompacted,
+  kCompactionBytesRead,
+  kCompactionBytesWritten,
+  kCompactionBytesReclaimed,
+  // Hint files written, and their bytes
+  kHintFilesWritten,
+  kHintBytesWritten,
+  // Bytes of the keys and values written by users, before encoding
+  kUserBytesWritten,
+  kNumTickers,
+};
+
+// Distributions of Statistics, in microseconds
+enum class Histogram : std::uint32_t {
+  kGetMicros,
+  kInsertMicros,
+  kDeleteMicros,
+  kSyncMicros,
+  // Time to write the hint file of a log file
+  kHintGenerationMicros,
+  kNumHistograms,
+};
+
+// Values of Statistics which are set rather than accumulated, updated by
+// MyBitcask::GetStatistics
+enum class Gauge : std::uint32_t {
+  // Keys in the index
+  kIndexKeys,
+  // Estimated memory taken by the index, including inlined values
+  kIndexMemoryBytes,
+  // Bytes taken by inlined values
+  kInlineValueBytes,
+  // Bytes of the log entries of the keys in the index
+  kLiveDataBytes,
+  // Bytes of the log files and the hint files in the database directory
+  kLogFileBytes,
+  kHintFileBytes,
+  kNumGauges,
+};
+
+const char* TickerName(Ticker ticker);
+const char* HistogramName(Histogram histogram);
+const char* GaugeName(Gauge gauge);
+
+struct HistogramData {
+  std::uint64_t count = 0;
+  std::uint64_t sum = 0;
+  std::uint64_t min = 0;
+  std::uint64_t max = 0;
+  double average = 0;
+  // Percentiles, interpolated within the bucket they fall in
+  double p50 = 0;
+  double p99 = 0;
+  double p999 = 0;
+};
+
+// Statistics counts what the engine does at low overhead. Threads update
+// shards of their own, which are aggregated when read.
+class Statistics final {
+ public:
+  Statistics();
+  ~Statistics();
+
+  Statistics(const Statistics&) = delete;
+  Statistics& operator=(const Statistics&) = delete;
+
+  // Safe for concurrent use by multiple threads.
+  void Add(Ticker ticker, std::uint64_t count = 1) noexcept;
+  void Record(Histogram histogram, std::uint64_t value) noexcept;
+  void Set(Gauge gauge, std::uint64_t value) noexcept;
+
+  // Safe for concurrent use by multiple threads, but updates made
+  // meanwhile may only be partly seen.
+  std::uint64_t Get(Ticker ticker) const noexcept;
+  HistogramData Get(Histogram histogram) const noexcept;
+  std::uint64_t Get(Gauge gauge) const noexcept;
+
+  // Reset the tickers and histograms to zero
+  void Reset() noexcept;
+
+  // Bytes of log and hint files per byte of live data, as of the last
+  // update of the gauges. 0 if no data is live.
+  double SpaceAmplification() const noexcept;
+
+  // Bytes written to log and hint files, by both users and merges, per
+  // byte written by users. 0 if users wrote nothing.
+  double WriteAmplification() const noexcept;
+
+  // One line per ticker, histogram and gauge, followed by the space and
+  // write amplification
+  std::string ToString() const;
+
+ private:
+  struct Shard;
+
+  std::unique_ptr<Shard[]> shards_;
+  std::array<std::atomic<std::uint64_t>,
+             static_cast<std::size_t>(Gauge::kNumGauges)>
+      gauges_;
+};
+
+// Records the microseconds from its construction to its destruction into a
+// histogram of `statistics`, unless it is nullptr
+class StopWatch final {
+ public:
+  StopWatch(Statistics* statistics, Histogram histogram)
+      : statistics_(statistics), histogram_(histogram) {
+    if (statistics_ != nullptr) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~StopWatch() {
+    if (statistics_ != nullptr) {
+      statistics_->Record(
+          histogram_,
+          static_cast<std::uint64_t>(
+              std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now() - start_)
+                  .count()));
+    }
+  }
+
+  StopWatch(const StopWatch&) = delete;
+  StopWatch& operator=(const StopWatch&) = delete;
+
+ private:
+  Statistics* statistics_;
+  Histogram histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Add `count` to a ticker of `statistics` unless it is nullptr
+inline void RecordTick(Statistics* statistics, Ticker ticker,
+                       std::uint64_t count = 1) {
+  if (statistics != nullptr) {
+    statistics->Add(ticker, count);
+  }
+}
+
+}  // namespace mybitcask
+
+#endif  // MYBITCASK_INCLUDE_INTERNAL_STATISTICS_H_
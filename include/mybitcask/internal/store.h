@@ -1,14 +1,21 @@
 #ifndef MYBITCASK_INUCLDE_INTERNAL_STORE_H_
 #define MYBITCASK_INUCLDE_INTERNAL_STORE_H_
 
+#include "env.h"
 #include "io.h"
+#include "statistics.h"
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
 #include "ghc/filesystem.hpp"
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -22,49 +29,211 @@ using file_id_t = std::uint32_t;
 
 // Position represents a position in db files.
 struct Position {
-  Position(file_id_t file_id, std::uint32_t offset_in_file);
+  Position(file_id_t file_id, std::uint64_t offset_in_file);
 
   file_id_t file_id;
-  std::uint32_t offset_in_file;
+  std::uint64_t offset_in_file;
 };
 
+// Files written by a block framed Store are divided into kBlockSize byte
+// blocks, each ending with a trailer:
+//
+// +-- - - - - - - - --+--------------------+---------------+
+// |      content      | first_entry(32bit) | CRC32C(32bit) |
+// +-- - - - - - - - --+--------------------+---------------+
+//  (kBlockContentLen)
+//
+// `first_entry` is the offset in the block of the first entry starting in
+// it, kNoEntry if none does, and the CRC covers the content and
+// `first_entry`. The content of a file is the content of its blocks one
+// after another, entries span blocks freely. The last block of a file has
+// no trailer until its content is complete.
+//
+// A scan verifies every block it reads at once, and after a corrupt block
+// resumes at the first entry of the next intact one.
+const std::uint32_t kBlockSize = 32 * 1024;
+const std::uint32_t kBlockTrailerLen = 8;
+const std::uint32_t kBlockContentLen = kBlockSize - kBlockTrailerLen;
+const std::uint32_t kNoEntry = 0xFFFFFFFF;
+
+const std::string kErrCorruptBlock = "corrupt block";
+
+// Return the offset in the content of a block framed file of the byte at
+// `file_offset`. Offsets in a trailer map to the content which follows it.
+std::uint64_t BlockContentOffset(std::uint64_t file_offset);
+
+// Return the offset in a block framed file of the content byte at
+// `content_offset`.
+std::uint64_t BlockFileOffset(std::uint64_t content_offset);
+
+// BlockReader reads the content of a block framed file, verifying the CRC of
+// every complete block it reads. The file is read kScanBlocks blocks at a
+// time, at block boundaries. Blocks skipped over entirely are not read.
+class BlockReader final : public io::SequentialReader {
+ public:
+  explicit BlockReader(std::unique_ptr<io::SequentialReader>&& file);
+
+  // Same as SequentialReader::Read, but returns a DataLoss error with
+  // kErrCorruptBlock, without reading anything, once the next byte is in a
+  // corrupt block.
+  absl::StatusOr<std::size_t> Read(
+      absl::Span<std::uint8_t> dst) noexcept override;
+
+  absl::Status Skip(std::uint64_t n) noexcept override;
+
+  // After Read failed with kErrCorruptBlock, move to the first entry
+  // starting in an intact block after the corrupt one and return its
+  // content offset. Returns nullopt if there is none before the last block,
+  // whose first entry is not known until it is complete.
+  absl::StatusOr<absl::optional<std::uint64_t>> Resync() noexcept;
+
+  // Number of corrupt blocks passed over by Resync
+  std::uint64_t corrupt_blocks() const { return corrupt_blocks_; }
+
+  static const std::size_t kScanBlocks = 8;
+
+ private:
+  // Buffer the blocks from the one holding pos_ on, unless it is buffered.
+  absl::Status load() noexcept;
+
+  std::unique_ptr<io::SequentialReader> file_;
+  // Offset of the next byte file_ reads
+  std::uint64_t file_offset_;
+  // Blocks read from file offset chunk_offset_, chunk_len_ bytes long
+  std::vector<std::uint8_t> chunk_;
+  std::uint64_t chunk_offset_;
+  std::size_t chunk_len_;
+  // Whether each complete block of chunk_ is intact
+  std::vector<bool> intact_;
+  // File offset of the next content byte
+  std::uint64_t pos_;
+  std::uint64_t corrupt_blocks_;
+};
+
+// Appends one piece of an entry written by Store::AppendStream
+using PieceWriter = std::function<absl::Status(absl::Span<const std::uint8_t>)>;
+
 class Store {
  public:
   absl::StatusOr<std::size_t> ReadAt(const Position& pos,
                                      absl::Span<std::uint8_t> dst) noexcept;
 
+  // Same as ReadAt, but `pos` is in a block framed file and `dst` is filled
+  // with its content from `pos` on, leaving out block trailers.
+  absl::StatusOr<std::size_t> ReadContentAt(
+      const Position& pos, absl::Span<std::uint8_t> dst) noexcept;
+
   absl::Status Append(
       absl::Span<const std::uint8_t> src,
       const std::function<void(Position)>& success_callback = [](Position) {
       }) noexcept;
 
+  // Same as Append, but `precondition` is evaluated before `src` is written
+  // and no other append can happen between the evaluation and the write.
+  // Returns false and writes nothing if the precondition does not hold.
+  absl::StatusOr<bool> AppendIf(
+      absl::Span<const std::uint8_t> src,
+      const std::function<bool()>& precondition,
+      const std::function<void(Position)>& success_callback) noexcept;
+
+  // Same as AppendIf, but the entry of `len` bytes is written piece by piece
+  // by `fill`, so it never has to be held in memory at once. If `fill`
+  // fails or does not write exactly `len` bytes, the pieces already written
+  // are discarded and the error is returned. If `precondition` is nullptr
+  // the entry is added unconditionally.
+  //
+  // `fill` runs while other appends are blocked, but it may read from the
+  // store.
+  absl::StatusOr<bool> AppendStream(
+      std::uint64_t len,
+      const std::function<absl::Status(const PieceWriter&)>& fill,
+      const std::function<bool()>* precondition,
+      const std::function<void(Position)>& success_callback) noexcept;
+
   absl::Status Sync() noexcept;
 
+  // Write `file_header` at the beginning of new files from now on, and make
+  // sure the latest file starts with it: entries appended after this call
+  // go to a new file, unless the latest file has no entries yet, in which
+  // case its header is replaced. `callback` is called once the latest file
+  // starts with `file_header`, before any other entry is appended.
+  absl::Status SetFileHeader(std::vector<std::uint8_t> file_header,
+                             const std::function<void()>& callback) noexcept;
+
+  // Add `count` log files written outside the store after the latest file,
+  // which is closed: `add` is called with the id of the first of them and
+  // must put them in place. No entry is appended while `add` runs, and
+  // entries appended after this call go to a new file after them.
+  absl::Status AddFiles(
+      file_id_t count,
+      const std::function<absl::Status(file_id_t)>& add) noexcept;
+
   Store() = delete;
+  // `file_header` is written at the beginning of every new file. If
+  // `block_framed` is true, files are block framed, see kBlockSize. The
+  // latest file must then be a new one, since the state of its last block
+  // is not recovered. Reads, appends and syncs are counted in `statistics`
+  // unless it is nullptr. Files are opened through `env`.
   Store(const ghc::filesystem::path path, file_id_t latest_file_id,
-        std::uint32_t dead_bytes_threshold);
+        std::uint32_t dead_bytes_threshold,
+        std::vector<std::uint8_t> file_header = {}, bool block_framed = false,
+        Statistics* statistics = nullptr, Env* env = Env::Default());
 
   const ghc::filesystem::path& Path();
 
+  Env* env() const { return env_; }
+
+  bool block_framed() const { return block_framed_; }
+
+  std::size_t dead_bytes_threshold() const { return dead_bytes_threshold_; }
+
   ~Store();
 
  private:
+  // REQUIRES: latest_file_lock_ held by writer
+  absl::Status append_locked(
+      std::uint64_t len,
+      const std::function<absl::Status(const PieceWriter&)>& fill,
+      const std::function<void(Position)>& success_callback);
+
+  // Write `data` at the end of the latest file, adding block trailers if
+  // files are block framed.
+  //
+  // REQUIRES: latest_file_lock_ held by writer
+  absl::Status write_locked(absl::Span<const std::uint8_t> data);
+
+  // Open the writer of the latest file, writing the file header if the file
+  // is empty.
+  //
+  // REQUIRES: latest_file_lock_ held by writer
+  absl::Status open_latest_locked(file_id_t file_id);
+
   // Get io::RandomAccessReader through the file ID,
   // and return nullptr if the file does not exist
   absl::StatusOr<io::RandomAccessReader*> reader(file_id_t file_id);
 
-  // Latest file id
-  file_id_t latest_file_id_;
+  // Latest file id. Written under latest_file_lock_, but read without it so
+  // that readers never wait for appends.
+  std::atomic<file_id_t> latest_file_id_;
   // Latest file writer
   std::unique_ptr<io::SequentialWriter> latest_writer_;
-  // Latest file reader
-  std::unique_ptr<io::RandomAccessReader> latest_reader_;
+  // Length of the header the latest file was created with, 0 if it existed
+  // before the store was opened
+  std::uint64_t latest_header_len_;
   absl::Mutex latest_file_lock_;
+  std::vector<std::uint8_t> file_header_;
+  const bool block_framed_;
+  // CRC of the content of the last block of the latest file written so far
+  std::uint32_t block_crc_;
+  // first_entry of the last block of the latest file
+  std::uint32_t block_first_entry_;
 
   // Database file path
   ghc::filesystem::path path_;
   // Once the current writer exceeds dead_bytes_threshold_ A new file is created
   const std::size_t dead_bytes_threshold_;
+  Statistics* statistics_;
+  Env* const env_;
 
   // All readers
   std::unordered_map<file_id_t, std::unique_ptr<io::RandomAccessReader>>
@@ -1,11 +1,17 @@
 #ifndef MYBITCASK_SRC_WORKER_H_
 #define MYBITCASK_SRC_WORKER_H_
+
+#include "absl/status/status.h"
+
 namespace mybitcask {
 namespace worker {
 
+// A Worker is a background job. It is run by the scheduler of the database
+// or called directly.
 class Worker {
  public:
-  virtual void Start(std::size_t interval_seconds) = 0;
+  // Run the job of this worker once in the calling thread.
+  virtual absl::Status RunOnce() noexcept = 0;
 
   virtual ~Worker() = default;
 };
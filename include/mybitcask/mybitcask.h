@@ -5,7 +5,11 @@
 #define NOMINMAX
 #endif
 
+#include "internal/compression.h"
+#include "internal/env.h"
 #include "internal/log.h"
+#include "internal/perf_context.h"
+#include "internal/statistics.h"
 #include "internal/store.h"
 #include "internal/worker.h"
 
@@ -13,26 +17,469 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "ghc/filesystem.hpp"
 #include "spdlog/spdlog.h"
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace mybitcask {
 
+class Scheduler;
+class ThreadPool;
+
+namespace worker {
+template <typename Container>
+class Merge;
+}  // namespace worker
+
+namespace store {
+namespace hint {
+class FileWriter;
+}  // namespace hint
+}  // namespace store
+
 struct Position {
   store::file_id_t file_id;
-  std::uint32_t value_pos;
-  std::uint16_t value_len;
+  // Compression type of the value, value_len being its compressed length
+  std::uint8_t compression;
+  std::uint64_t value_pos;
+  std::uint64_t value_len;
+  // Expiry time of the entry, 0 if it never expires, see log::Expired
+  std::uint64_t expire_at;
+};
+
+inline bool operator==(const Position& a, const Position& b) {
+  return a.file_id == b.file_id && a.compression == b.compression &&
+         a.value_pos == b.value_pos && a.value_len == b.value_len &&
+         a.expire_at == b.expire_at;
+}
+
+// IndexEntry is the index entry of a key
+struct IndexEntry {
+  // Position of the latest value of the key
+  Position pos;
+  // If the value is inlined, its length byte followed by the value, see
+  // Options::inline_value_max_len. nullptr otherwise.
+  std::unique_ptr<std::uint8_t[]> value;
+};
+
+// A point-in-time view of the database, see MyBitcask::GetSnapshot
+class Snapshot final {
+ public:
+  // Number of writes to the database the snapshot sees
+  std::uint64_t sequence() const noexcept { return sequence_; }
+
+ private:
+  explicit Snapshot(std::uint64_t sequence) : sequence_(sequence) {}
+
+  const std::uint64_t sequence_;
+
+  friend class MyBitcask;
+};
+
+struct ReadOptions {
+  // If not nullptr, reads see the database as it was when `snapshot` was
+  // taken. Otherwise they see the latest writes.
+  const Snapshot* snapshot = nullptr;
+};
+
+class MyBitcask;
+
+// Iterator visits the keys of the database in order as of a snapshot, see
+// MyBitcask::NewIterator. The value of each key visited is read from the
+// log when the iterator is positioned on it.
+//
+// Not safe for concurrent use, but iterators of the same database may be
+// used by different threads.
+class Iterator final {
+ public:
+  // Whether the iterator is positioned on a key. Check status once it is
+  // not.
+  bool Valid() const noexcept { return valid_; }
+
+  // Position at the first key
+  void SeekToFirst() noexcept;
+
+  // Position at the first key at or after `target`
+  void Seek(absl::string_view target) noexcept;
+
+  // REQUIRES: Valid()
+  void Next() noexcept;
+
+  // REQUIRES: Valid()
+  const std::string& key() const noexcept { return key_; }
+  const std::string& value() const noexcept { return value_; }
+
+  // Not ok if reading a value failed, which makes the iterator invalid
+  const absl::Status& status() const noexcept { return status_; }
+
+ private:
+  Iterator(MyBitcask* db, std::shared_ptr<const Snapshot> snapshot);
+
+  // Position at the first key visible to the snapshot after `key_`, or at
+  // `key_` itself if `inclusive`
+  void seek(bool inclusive);
+
+  MyBitcask* db_;
+  std::shared_ptr<const Snapshot> snapshot_;
+  bool valid_;
+  std::string key_;
+  std::string value_;
+  absl::Status status_;
+
+  friend class MyBitcask;
+};
+
+// WriteBatch holds inserts and deletes applied in order by MyBitcask::Write
+class WriteBatch final {
+ public:
+  void Insert(std::string key, std::string value);
+  void Delete(std::string key);
+  void Clear() noexcept { ops_.clear(); }
+  std::size_t size() const noexcept { return ops_.size(); }
+
+ private:
+  struct Op {
+    std::string key;
+    // nullopt if the key is deleted
+    absl::optional<std::string> value;
+  };
+  std::vector<Op> ops_;
+
+  friend class MyBitcask;
+};
+
+// Called with the result of MyBitcask::GetAsync and the value found
+using GetCallback =
+    std::function<void(absl::StatusOr<bool> found, std::string value)>;
+
+// Called with the result of MyBitcask::InsertAsync and WriteAsync
+using WriteCallback = std::function<void(absl::Status status)>;
+
+// Receives a value read by MyBitcask::GetStream piece by piece
+using ValueSink = log::ValueSink;
+
+// Fills `dst` with the next bytes of a value written by
+// MyBitcask::InsertStream, returning how many bytes were filled
+using ValueSource =
+    std::function<absl::StatusOr<std::size_t>(absl::Span<std::uint8_t> dst)>;
+
+const std::string kErrTornTail = "the latest log file has a torn tail";
+const std::string kErrBadTtl = "ttl must be positive";
+const std::string kErrNoMergeOperator = "no merge operator is set";
+const std::string kErrBadMergeOperand =
+    "the merge operator cannot apply the operand";
+const std::string kErrLoaderFinished = "the bulk loader is finished";
+const std::string kErrBuilderFinished = "the log file builder is finished";
+const std::string kErrNotIngestible = "not a log file built by LogFileBuilder";
+
+// Updates a value with an operand passed to MyBitcask::MergeValue, e.g.
+// adds to a counter or appends to a list
+class MergeOperator {
+ public:
+  virtual ~MergeOperator() = default;
+
+  // Set `new_value` to `existing_value` updated with `operand`.
+  // `existing_value` is nullptr if the key does not exist. Returns false if
+  // the operand cannot be applied to the value.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual bool Merge(absl::string_view key,
+                     const std::string* existing_value,
+                     absl::string_view operand,
+                     std::string* new_value) const = 0;
+};
+
+// Adds integer operands to values holding an integer, both in decimal. A
+// missing key counts as 0.
+std::shared_ptr<const MergeOperator> Int64AddOperator();
+
+// Appends operands to values, separated by `delimiter`
+std::shared_ptr<const MergeOperator> StringAppendOperator(char delimiter);
+
+// How Open treats a torn tail of the latest log file, left by a crash while
+// entries were appended to it
+enum class RecoveryMode {
+  // Open fails with a DataLoss error
+  kAbsoluteConsistency,
+  // The torn tail is truncated, dropping the entries in it, see
+  // MyBitcask::recovery_report
+  kTruncateTornTail,
+};
+
+struct Options {
+  // Once the current log file exceeds dead_bytes_threshold a new file is
+  // created
+  std::uint32_t dead_bytes_threshold = 128 * 1024 * 1024;
+
+  // If true, verify checksums of log entries on read
+  bool checksum = false;
+
+  // If true, background workers log to `<data_dir>/logs/mybitcask.txt`
+  bool out_log = false;
+
+  // A log file is merged once the ratio of its live data to its total data
+  // drops to merge_threshold or below
+  float merge_threshold = 0.2f;
+
+  // Number of threads merging log files concurrently
+  std::size_t merge_threads = 1;
+
+  // Number of threads running background jobs (hint file generation and
+  // merge)
+  std::size_t background_threads = 2;
+
+  // A merge is started each time another this many bytes of log entries are
+  // overwritten or deleted. The garbage merges reclaim is deducted, garbage
+  // in files not worth merging yet keeps counting. If 0, it is
+  // dead_bytes_threshold * (1 - merge_threshold), the garbage needed for a
+  // full log file to be merged.
+  std::uint64_t merge_trigger_bytes = 0;
+
+  // If not nullptr, values inserted by Insert are compressed by compressor
+  // when they are at least compression_min_value_len bytes long and
+  // compression makes them smaller. Values inserted by InsertStream are never
+  // compressed. Values compressed by a custom compressor can only be read
+  // back while it is set.
+  std::shared_ptr<const compression::Compressor> compressor = nullptr;
+
+  std::uint64_t compression_min_value_len = 64;
+
+  // If not 0, merges train a dictionary of at most this many bytes from a
+  // sample of the live values they move, and values of at least
+  // compression_min_value_len bytes are compressed against the latest
+  // dictionary from then on, in preference to `compressor`. Every log file
+  // stores the dictionary its values are compressed against, and every
+  // value stays readable on its own. Suits many small values sharing
+  // structure, e.g. serialized records.
+  std::size_t compression_dictionary_len = 0;
+
+  // If true, new log files are divided into blocks of store::kBlockSize
+  // bytes with a checksum each. Opening the database verifies the blocks it
+  // reads entries from and leaves out the entries of corrupt blocks instead
+  // of failing. Every Open starts a new log file. Log files of either
+  // layout are read regardless of this option.
+  bool block_format = false;
+
+  RecoveryMode recovery_mode = RecoveryMode::kTruncateTornTail;
+
+  // Expired keys are never returned, and are removed from the index every
+  // expiry_sweep_interval_ms milliseconds by a sweep which holds the index
+  // lock for at most expiry_sweep_batch keys at a time. If 0, expired keys
+  // stay in the index until they are overwritten or merged.
+  std::uint32_t expiry_sweep_interval_ms = 1000;
+  std::size_t expiry_sweep_batch = 1024;
+
+  // If not 0, values of at most inline_value_max_len bytes are kept in the
+  // index next to their position, and reading them never touches the log
+  // files. Inlined values take at most inline_values_budget bytes, values
+  // beyond the budget are read from the log files. Open reads the values to
+  // inline from the log files. At most kMaxInlineValueLen.
+  std::size_t inline_value_max_len = 0;
+  std::uint64_t inline_values_budget = 64 * 1024 * 1024;
+
+  // Applies the operands passed to MyBitcask::MergeValue, nullptr if they
+  // are not supported
+  std::shared_ptr<const MergeOperator> merge_operator = nullptr;
+
+  // Number of threads serving GetAsync. Writes issued by InsertAsync and
+  // WriteAsync are served by one more thread, in the order they are issued.
+  std::size_t io_threads = 2;
+
+  // Count reads, writes, syncs, merges and hint files, and record the
+  // latency of Get, Insert and Delete, see MyBitcask::GetStatistics
+  bool enable_statistics = false;
+  // If statistics are enabled and this is not 0, the space and write
+  // amplification are logged every stats_dump_interval_ms milliseconds
+  std::uint32_t stats_dump_interval_ms = 10 * 60 * 1000;
+
+  // The files of the database are accessed through env, which must outlive
+  // the database, e.g. one returned by NewMemEnv. The log of the background
+  // workers (see out_log) is always written to the local filesystem.
+  Env* env = Env::Default();
+};
+
+const std::size_t kMaxInlineValueLen = 255;
+
+// What Open dropped to recover from a crash
+struct RecoveryReport {
+  // Log file whose torn tail was truncated, 0 if none was
+  store::file_id_t file_id = 0;
+  // Length the file was truncated to
+  std::uint64_t truncated_len = 0;
+  // Bytes dropped from the end of the file
+  std::uint64_t dropped_bytes = 0;
+};
+
+struct CompactOptions {
+  // A log file is compacted only if the ratio of its live data to its total
+  // data is at or below merge_threshold. The default compacts every file.
+  float merge_threshold = 1.0f;
+
+  // Maximum bytes per second of live entries rewritten, 0 means unlimited
+  std::uint64_t rate_limit_bytes_per_second = 0;
+};
+
+struct CompactionStats {
+  // Number of log files compacted and removed
+  std::size_t files_compacted = 0;
+  // Bytes of hint entries and live log entries read
+  std::uint64_t bytes_read = 0;
+  // Bytes of live log entries written to the latest log file
+  std::uint64_t bytes_written = 0;
+  // Bytes of log and hint files removed, minus bytes_written. Files kept
+  // for snapshots are not removed yet, and not counted.
+  std::int64_t bytes_reclaimed = 0;
+};
+
+class LogFileBuilder;
+
+// Returns a builder of the log file at `log_file_path` and its hint file,
+// replacing any file at their paths. The files are written through `env`.
+absl::StatusOr<std::unique_ptr<LogFileBuilder>> NewLogFileBuilder(
+    const ghc::filesystem::path& log_file_path, Env* env = Env::Default());
+
+// LogFileBuilder writes a log file and its hint file outside of any
+// database, e.g. in an offline job, to be moved into a database by
+// MyBitcask::IngestFiles. Entries are encoded as the database encodes them
+// and written through a large buffer, and the files are only synced by
+// Finish. A key added more than once keeps the last value added. Values are
+// stored uncompressed.
+//
+// Not safe for concurrent use.
+class LogFileBuilder final {
+ public:
+  LogFileBuilder(const LogFileBuilder&) = delete;
+  LogFileBuilder& operator=(const LogFileBuilder&) = delete;
+
+  // Removes the files unless Finish succeeded
+  ~LogFileBuilder();
+
+  // Path of the hint file of the log file at `log_file_path`, whose
+  // extension is replaced with ".hint"
+  static ghc::filesystem::path HintFilePath(
+      const ghc::filesystem::path& log_file_path);
+
+  // Once Add fails, so do the following calls and Finish
+  absl::Status Add(absl::string_view key, absl::string_view value) noexcept;
+
+  // Write out the buffered entries and sync the log file, then write the
+  // hint file
+  absl::Status Finish() noexcept;
+
+  std::uint64_t num_entries() const noexcept { return num_entries_; }
+
+  // Length of the log file, the entries not written out yet included
+  std::uint64_t file_len() const noexcept { return file_len_; }
+
+  // Length of the file header, which the log file starts with
+  std::uint64_t header_len() const noexcept { return header_len_; }
+
+ private:
+  LogFileBuilder(Env* env, const ghc::filesystem::path& log_file_path);
+
+  absl::Status flush_buffer() noexcept;
+
+  Env* env_;
+  ghc::filesystem::path log_file_path_;
+  std::unique_ptr<io::SequentialWriter> writer_;
+  std::unique_ptr<store::hint::FileWriter> hint_writer_;
+  std::vector<std::uint8_t> buf_;
+  std::uint64_t file_len_;
+  std::uint64_t header_len_;
+  std::uint64_t num_entries_;
+  absl::Status status_;
+  bool finished_;
+
+  friend absl::StatusOr<std::unique_ptr<LogFileBuilder>> NewLogFileBuilder(
+      const ghc::filesystem::path& log_file_path, Env* env);
+};
+
+// BulkLoader loads many entries into a database at once, much faster than
+// inserting them: they are written to new log files by LogFileBuilder,
+// rolled over as the database rolls its log files over, which are then
+// ingested, see MyBitcask::IngestFiles. Keys may be added in any order, a
+// key added more than once keeps the last value added. The entries become
+// visible together once Finish succeeds, replacing the values their keys
+// had. Nothing is loaded if Finish is not called or fails.
+//
+// See MyBitcask::NewBulkLoader and NewBulkLoader.
+//
+// Not safe for concurrent use.
+class BulkLoader final {
+ public:
+  BulkLoader(const BulkLoader&) = delete;
+  BulkLoader& operator=(const BulkLoader&) = delete;
+
+  // Removes the files written unless Finish succeeded
+  ~BulkLoader();
+
+  // Once Add fails, so do the following calls and Finish
+  absl::Status Add(absl::string_view key, absl::string_view value) noexcept;
+
+  // Finish the files and move them into the database. The files are
+  // numbered after its latest log file, and new entries go to a log file
+  // after them.
+  absl::Status Finish() noexcept;
+
+  // Number of entries added
+  std::uint64_t num_entries() const noexcept { return num_entries_; }
+
+ private:
+  // `db` is nullptr if the database in `data_dir` is not open
+  BulkLoader(MyBitcask* db, Env* env, const ghc::filesystem::path& data_dir,
+             std::uint32_t dead_bytes_threshold);
+
+  // Create the directory the files are written to, emptying it if it was
+  // left over
+  absl::Status init() noexcept;
+  // Finish the file being built, if any
+  absl::Status finish_file() noexcept;
+  // Move the files into the database, which is not open, after its latest
+  // log file, log files before their hint files. If moving one fails, the
+  // ones moved are removed.
+  absl::Status move_files() noexcept;
+  // Remove the files not moved into the database
+  void remove_files() noexcept;
+
+  MyBitcask* db_;
+  Env* env_;
+  ghc::filesystem::path data_dir_;
+  // Directory the files are written to before they are moved into
+  // data_dir_, file k being named as log file k
+  ghc::filesystem::path staging_dir_;
+  std::uint32_t dead_bytes_threshold_;
+  std::unique_ptr<LogFileBuilder> builder_;
+  // Log files started, the one of builder_ included
+  std::vector<ghc::filesystem::path> files_;
+  std::uint64_t num_entries_;
+  absl::Status status_;
+  bool finished_;
+
+  friend class MyBitcask;
+  friend absl::StatusOr<std::unique_ptr<BulkLoader>> NewBulkLoader(
+      const ghc::filesystem::path& data_dir, const Options& options);
 };
 
 class MyBitcask {
  public:
-  MyBitcask(std::unique_ptr<store::Store>&& store, log::Reader&& log_reader,
-            log::Writer&& log_writer,
-            absl::btree_map<std::string, Position>&& index);
+  MyBitcask(std::unique_ptr<store::Store>&& store,
+            std::unique_ptr<store::hint::Builder>&& hint_builder,
+            log::Reader&& log_reader, log::Writer&& log_writer,
+            absl::btree_map<std::string, IndexEntry>&& index);
+
+  ~MyBitcask();
 
   // If the database contains an entry for `key` store the
   // corresponding value in `value` and return true
@@ -40,37 +487,349 @@ class MyBitcask {
   absl::StatusOr<bool> Get(absl::string_view key, std::string* value,
                            int try_num = 2) noexcept;
 
+  // Same as Get, as of `options.snapshot`
+  absl::StatusOr<bool> Get(const ReadOptions& options, absl::string_view key,
+                           std::string* value) noexcept;
+
+  // Get every key of `keys`, storing the value of `keys[i]` in
+  // `(*values)[i]` and its result at index i of the returned vector. The
+  // keys are read as of the same point in time, a snapshot taken by
+  // MultiGet unless `options.snapshot` is set.
+  std::vector<absl::StatusOr<bool>> MultiGet(
+      const ReadOptions& options, const std::vector<absl::string_view>& keys,
+      std::vector<std::string>* values) noexcept;
+
+  // Returns an iterator over the keys as of `options.snapshot`, or as of a
+  // snapshot taken now if it is not set. The iterator is not positioned.
+  //
+  // REQUIRES: the iterator is destroyed before the database
+  std::unique_ptr<Iterator> NewIterator(const ReadOptions& options) noexcept;
+
+  // Take a snapshot of the database, for reads through ReadOptions. Taking
+  // one does not copy the index: while snapshots are held, writes keep the
+  // versions they replace, and log files merged away are removed once the
+  // last snapshot is released. The snapshot is released when the returned
+  // pointer is destroyed.
+  //
+  // REQUIRES: the snapshot is released before the database is destroyed
+  std::shared_ptr<const Snapshot> GetSnapshot() noexcept;
+
+  // Same as Get, but the value is passed to `sink` in pieces of at most
+  // log::kStreamChunkSize bytes, so values of any length can be read with
+  // bounded memory. If checksums are verified, a corrupted value is
+  // reported after it was passed to `sink`.
+  absl::StatusOr<bool> GetStream(absl::string_view key,
+                                 const ValueSink& sink) noexcept;
+
   // Writes a key/value pair into store
   absl::Status Insert(const std::string& key,
                       const std::string& value) noexcept;
 
+  // Same as Insert, but the key expires `ttl` from now: it is not found
+  // anymore and its entries are dropped by merges, without a Delete. An
+  // infinite `ttl` never expires.
+  absl::Status Insert(const std::string& key, const std::string& value,
+                      absl::Duration ttl) noexcept;
+
+  // Writes a key and a value of `value_len` bytes read from `source` into
+  // store, with memory usage bounded by log::kStreamChunkSize. Nothing is
+  // written if `source` fails or ends before `value_len` bytes.
+  absl::Status InsertStream(const std::string& key, std::uint64_t value_len,
+                            const ValueSource& source) noexcept;
+
   absl::Status Delete(const std::string& key) noexcept;
 
+  // Set the value of `key` to `desired`, or delete it if nullopt, only if
+  // its value is `expected`, or it does not exist if nullopt. The comparison
+  // and the write are atomic. Returns whether the value was swapped. The
+  // new value never expires.
+  absl::StatusOr<bool> CompareAndSwap(
+      const std::string& key, const absl::optional<std::string>& expected,
+      const absl::optional<std::string>& desired) noexcept;
+
+  // Update the value of `key` with `operand` by Options::merge_operator,
+  // atomically, e.g. increment a counter without a separate Get and Insert.
+  // Returns a FailedPrecondition error if no merge operator is set, and an
+  // InvalidArgument error if it cannot apply `operand`. The new value never
+  // expires.
+  absl::Status MergeValue(const std::string& key,
+                          absl::string_view operand) noexcept;
+
+  // Apply the inserts and deletes of `batch` in order, stopping at the
+  // first one which fails. The batch is not atomic: a crash may leave only
+  // some of them applied.
+  absl::Status Write(const WriteBatch& batch) noexcept;
+
+  // Same as Get, but returns right away and calls `callback` once the value
+  // is read, from an internal I/O thread. `options.snapshot` must be held
+  // until then. Callbacks should not block, since they delay the operations
+  // queued after them.
+  void GetAsync(const ReadOptions& options, std::string key,
+                GetCallback callback) noexcept;
+  // Same as above, the future holding the value or nullopt if the key was
+  // not found
+  std::future<absl::StatusOr<absl::optional<std::string>>> GetAsync(
+      const ReadOptions& options, std::string key) noexcept;
+
+  // Same as Insert and Write, but return right away and call `callback`
+  // once the write is synced, from an internal I/O thread. Asynchronous
+  // writes are appended to the log and completed in the order they are
+  // issued, any number of them can be in flight.
+  void InsertAsync(std::string key, std::string value,
+                   WriteCallback callback) noexcept;
+  std::future<absl::Status> InsertAsync(std::string key,
+                                        std::string value) noexcept;
+  void WriteAsync(WriteBatch batch, WriteCallback callback) noexcept;
+  std::future<absl::Status> WriteAsync(WriteBatch batch) noexcept;
+
+  // Generates missing hint files and then merges every log file whose live
+  // data ratio is at or below `Options::merge_threshold`, using
+  // `Options::merge_threads` threads. The background scheduler runs the
+  // same jobs when log files are closed and when enough garbage has
+  // accumulated.
+  absl::Status Merge() noexcept;
+
+  // Compacts the given closed log files: the live entries of each file whose
+  // live data ratio is at or below `options.merge_threshold` are moved to the
+  // latest log file and the file is removed. Returns InvalidArgument if a
+  // file does not exist or is the latest log file, in which case nothing is
+  // compacted.
+  absl::StatusOr<CompactionStats> CompactFiles(
+      const std::vector<store::file_id_t>& file_ids,
+      const CompactOptions& options) noexcept;
+
+  // Compacts all closed log files, see CompactFiles.
+  absl::StatusOr<CompactionStats> CompactAll(
+      const CompactOptions& options) noexcept;
+
+  // Same as CompactFiles and CompactAll, but the compaction runs on a
+  // background thread. If the database is closed before the compaction
+  // starts, the result is a Cancelled error.
+  std::future<absl::StatusOr<CompactionStats>> CompactFilesAsync(
+      const std::vector<store::file_id_t>& file_ids,
+      const CompactOptions& options) noexcept;
+  std::future<absl::StatusOr<CompactionStats>> CompactAllAsync(
+      const CompactOptions& options) noexcept;
+
+  // Move the log files at `paths`, written by LogFileBuilder, into the
+  // database with their hint files, as new log files after the latest one
+  // in the order of `paths`. Their entries become visible at once,
+  // replacing the values of their keys, a key in several files keeping the
+  // value of the last one. The files are renamed through Options::env, so
+  // they must be on the filesystem of the database. Nothing is ingested if
+  // a file is missing or is not such a log file. Ingested values are not
+  // inlined before the database is reopened.
+  absl::Status IngestFiles(
+      const std::vector<ghc::filesystem::path>& paths) noexcept;
+
+  // Returns a loader of entries into the database, see BulkLoader. The
+  // database stays usable while entries are loaded.
+  //
+  // REQUIRES: the loader is destroyed before the database
+  absl::StatusOr<std::unique_ptr<BulkLoader>> NewBulkLoader() noexcept;
+
+  // Stop starting background jobs and wait for the running ones to finish.
+  void PauseBackgroundWork() noexcept;
+
+  // Resume background jobs stopped by PauseBackgroundWork. Jobs that became
+  // eligible in between start right away.
+  void ResumeBackgroundWork() noexcept;
+
+  // What Open dropped to recover from a crash
+  const RecoveryReport& recovery_report() const noexcept {
+    return recovery_report_;
+  }
+
+  // Return the statistics counted since Open, with the gauges updated, or
+  // nullptr unless Options::enable_statistics is set. Updating the gauges
+  // reads the whole index and lists the database directory.
+  std::shared_ptr<const Statistics> GetStatistics() noexcept;
+
  private:
+  // A version of a key replaced while snapshots were held
+  struct KeyVersion {
+    // Sequence number of the write which replaced it, the version is seen by
+    // the snapshots taken before
+    std::uint64_t until;
+    // nullopt if the key did not exist
+    absl::optional<Position> pos;
+  };
+
+  absl::StatusOr<bool> get(const Snapshot* snapshot, absl::string_view key,
+                           std::string* value, int try_num) noexcept;
   absl::optional<Position> get_position(absl::string_view key);
-  bool key_valid(const log::Key<std::string>& key);
-  absl::Status re_insert(log::Key<std::string>&& key);
-  void setup_worker(bool out_log);
+  // Return the position of the value of `key` as of `snapshot`, or the
+  // latest one if it is nullptr, unless the key is missing or expired. If
+  // the value is inlined, `*inlined` is set to true and the value is copied
+  // to `value` unless it is nullptr.
+  absl::optional<Position> lookup(const Snapshot* snapshot,
+                                  absl::string_view key, std::string* value,
+                                  bool* inlined);
+  // Return the first key after `key`, or at `key` if `inclusive`, which
+  // exists as of `snapshot`. Returns nullopt if there is none.
+  absl::optional<std::string> next_key(const Snapshot* snapshot,
+                                       absl::string_view key, bool inclusive);
+  // REQUIRES: index_rwlock_ held
+  absl::optional<Position> find_locked(const Snapshot* snapshot,
+                                       absl::string_view key,
+                                       std::string* value, bool* inlined);
+  // Record that `key`, whose index entry is `entry` or nullptr if it does
+  // not exist, is written, keeping its version for the snapshots held.
+  //
+  // REQUIRES: index_rwlock_ held for writing
+  void record_write(const std::string& key, const IndexEntry* entry);
+  void release_snapshot(const Snapshot* snapshot);
+  // Remove a log file and its hint file once no snapshot needs them.
+  // Returns whether they are removed at once.
+  bool remove_merged_file(store::file_id_t file_id);
+  // Point `key` at `pos` in the index, inlining `value` if it is not empty,
+  // and return the length of the log entry it replaces
+  std::uint64_t put_index(const std::string& key, const Position& pos,
+                          absl::Span<const std::uint8_t> value);
+  // Same as put_index for every key of `entries`, sorted and distinct,
+  // without inlining their values
+  std::uint64_t put_index_sorted(
+      std::vector<std::pair<std::string, Position>>* entries);
+  // Inline `value` into `entry` if it is small enough and fits in the
+  // budget, replacing the value inlined before
+  //
+  // REQUIRES: index_rwlock_ held for writing
+  void inline_value(IndexEntry* entry, absl::Span<const std::uint8_t> value);
+  // REQUIRES: index_rwlock_ held for writing
+  void drop_inline_value(IndexEntry* entry);
+  // Inline the small values of the keys in the index, read from the log
+  absl::Status load_inline_values();
+  bool key_valid(store::file_id_t file_id, const log::Key<std::string>& key);
+  absl::StatusOr<bool> re_insert(store::file_id_t file_id,
+                                 log::Key<std::string>&& key);
+  std::future<absl::StatusOr<CompactionStats>> compact_async(
+      std::function<absl::StatusOr<CompactionStats>()> compact);
+  void setup_worker(const Options& options);
+  // Write the hint files of closed log files
+  absl::Status flush_hints() noexcept;
+  // Account `garbage_bytes` bytes of log entries which are no longer live.
+  void add_garbage(std::uint64_t garbage_bytes);
+  // Run of the merge job
+  void merge_job();
+  // Compress new values against a dictionary trained from the values
+  // sampled by the merges since the last call
+  void train_dictionary();
+  // Remove the expired keys from the index
+  void sweep_expired();
+  // Update the gauges of statistics_ from the index and the files
+  //
+  // REQUIRES: statistics_ is not nullptr
+  void update_gauges();
+  // Log the space and write amplification to the worker logger
+  void dump_statistics();
+  absl::Status insert(const std::string& key, const std::string& value,
+                      std::uint64_t expire_at);
+  // Remove `key` from the index and return the length of the log entry it
+  // pointed at, 0 if the key did not exist
+  std::uint64_t erase_index(const std::string& key);
+
+  // Called with the value of a key, nullptr if it does not exist. Sets the
+  // new value, left nullopt to delete the key, and returns whether to write
+  // it.
+  using Updater = std::function<absl::StatusOr<bool>(
+      const std::string* value, absl::optional<std::string>* new_value)>;
+  // Read the value of `key` and write the one set by `update`. The write
+  // only happens if the key was not written since it was read, else it is
+  // read again. Returns what `update` returned.
+  absl::StatusOr<bool> read_modify_write(const std::string& key,
+                                         const Updater& update);
 
-  absl::btree_map<std::string, Position> index_;
+  // Declared before the members which count into it, nullptr unless
+  // statistics are enabled
+  std::shared_ptr<Statistics> statistics_;
+  absl::btree_map<std::string, IndexEntry> index_;
   absl::Mutex index_rwlock_;
+  std::size_t inline_value_max_len_;
+  std::uint64_t inline_values_budget_;
+  // Bytes taken by inlined values, guarded by index_rwlock_
+  std::uint64_t inline_bytes_;
+  // The members below are guarded by index_rwlock_.
+  // Number of writes to the index
+  std::uint64_t sequence_;
+  // Sequence numbers of the snapshots held
+  std::multiset<std::uint64_t> snapshots_;
+  // Versions of keys replaced while snapshots were held, oldest first
+  absl::btree_map<std::string, std::vector<KeyVersion>> history_;
+  // Keys of history_ in the order their versions were added, so versions
+  // no snapshot sees anymore are dropped oldest first
+  std::deque<std::pair<std::uint64_t, std::string>> history_order_;
+  // Log files merged while snapshots were held
+  std::vector<store::file_id_t> obsolete_files_;
   std::unique_ptr<store::Store> store_;
+  std::unique_ptr<store::hint::Builder> hint_builder_;
   log::Reader log_reader_;
   log::Writer log_writer_;
 
   std::unique_ptr<worker::Worker> generate_hint_worker_;
-  std::unique_ptr<worker::Worker> merge_worker_;
+  std::unique_ptr<worker::Merge<std::string>> merge_worker_;
   std::shared_ptr<spdlog::logger> logger_;
 
+  // Samples the values moved by merges, nullptr unless dictionary
+  // compression is enabled
+  std::unique_ptr<compression::DictionarySampler> dictionary_sampler_;
+
+  RecoveryReport recovery_report_;
+  std::shared_ptr<const MergeOperator> merge_operator_;
+
+  // Serve asynchronous reads, and writes in order on a single thread
+  std::unique_ptr<ThreadPool> read_pool_;
+  std::unique_ptr<ThreadPool> write_pool_;
+
+  // Garbage not reclaimed by merges yet
+  std::atomic<std::uint64_t> garbage_bytes_;
+  std::uint64_t merge_trigger_bytes_;
+  // Merge job runs retried in a row, only used by the merge job
+  int merge_retries_;
+  // Whether the index may hold keys which expire
+  std::atomic<bool> expiring_keys_;
+  std::size_t expiry_sweep_batch_;
+  // Declared last, so the jobs are stopped before anything they use is
+  // destroyed
+  std::unique_ptr<Scheduler> scheduler_;
+  std::size_t hint_job_;
+  std::size_t merge_job_;
+  std::size_t sweep_job_;
+  std::size_t stats_dump_job_;
+
+  friend class Iterator;
+  friend class BulkLoader;
   friend absl::StatusOr<std::unique_ptr<MyBitcask>> Open(
-      const ghc::filesystem::path& data_dir, std::uint32_t dead_bytes_threshold,
-      bool checksum, bool out_log);
+      const ghc::filesystem::path& data_dir, const Options& options);
 };
 
+absl::StatusOr<std::unique_ptr<MyBitcask>> Open(
+    const ghc::filesystem::path& data_dir, const Options& options);
+
 absl::StatusOr<std::unique_ptr<MyBitcask>> Open(
     const ghc::filesystem::path& data_dir, std::uint32_t dead_bytes_threshold,
     bool checksum, bool out_log = false);
 
+// Generates hint files for the log files in `data_dir`, using `threads`
+// threads which each work on a different log file. Log files that already
+// have a hint file are skipped unless `overwrite` is true. The latest log file
+// is always skipped since new entries are appended to it.
+//
+// Each log file is scanned once and memory usage does not depend on its
+// size. Intended for backfilling hint files of a database which is not open.
+// Files are accessed through `env`.
+absl::Status GenerateHintFiles(const ghc::filesystem::path& data_dir,
+                               std::size_t threads, bool overwrite = false,
+                               Env* env = Env::Default());
+
+// Returns a loader of entries into the database in `data_dir`, which is not
+// open, see BulkLoader. A torn tail of its latest log file is recovered
+// first, as Open would. Of `options`, only dead_bytes_threshold,
+// recovery_mode and env are used.
+//
+// REQUIRES: the database is not opened before the loader is destroyed
+absl::StatusOr<std::unique_ptr<BulkLoader>> NewBulkLoader(
+    const ghc::filesystem::path& data_dir, const Options& options);
+
 }  // namespace mybitcask
 
 #endif  // MYBITCASK_INCLUDE_MYBITCASK_H_
@@ -1,5 +1,8 @@
 #include <algorithm>
+#include <cstdint>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <regex>
 #include <set>
 #include <string>
@@ -8,16 +11,26 @@
 #include "clipp.h"
 #include "replxx.hxx"
 
+#include "absl/strings/numbers.h"
 #include "mybitcask/mybitcask.h"
 
 const std::string kPrompt = "\x1b[1;32mmykv\x1b[0m> ";
 // words to be completed
 const std::vector<std::string> kCommands = {
-    "help", "quit", "clear", "get ", "set ", "rm ",
+    "help", "quit",    "clear", "get ",   "set ",
+    "rm ",  "compact", "stats", "import ",
 };
 
 const std::vector<std::string> kCommandsHint = {
-    "help", "quit", "clear", "get <key>", "set <key> <value>", "rm <key>",
+    "help",
+    "quit",
+    "clear",
+    "get <key>",
+    "set <key> <value> [ttl_seconds]",
+    "rm <key>",
+    "compact [file_id...]",
+    "stats",
+    "import <file>",
 };
 
 enum class CommandType : char {
@@ -28,12 +41,17 @@ enum class CommandType : char {
   QUIT,
   CLEAR,
   HELP,
+  COMPACT,
+  STATS,
+  IMPORT,
 };
 
 const std::unordered_map<std::string, CommandType> kCommandsMap = {
     {"set", CommandType::SET},     {"get", CommandType::GET},
     {"rm", CommandType::RM},       {"quit", CommandType::QUIT},
     {"clear", CommandType::CLEAR}, {"help", CommandType::HELP},
+    {"compact", CommandType::COMPACT}, {"stats", CommandType::STATS},
+    {"import", CommandType::IMPORT},
 };
 
 // EatCommandType returns `CommandType` and Remove command name string from
@@ -90,24 +108,78 @@ int utf8str_codepoint_len(char const* s, int utf8len);
 void setup_replxx(replxx::Replxx& rx);
 std::ostream& error() { return std::cerr << "(error): "; }
 
+// Load the lines of file `path` into `db` through a bulk loader, each line
+// being a key, then spaces or tabs, then the value up to the end of the
+// line. Returns the number of entries loaded.
+absl::StatusOr<std::uint64_t> Import(mybitcask::MyBitcask* db,
+                                     const std::string& path) {
+  std::ifstream in(path);
+  if (!in) {
+    return absl::NotFoundError("unable to open " + path);
+  }
+  auto loader = db->NewBulkLoader();
+  if (!loader.ok()) {
+    return loader.status();
+  }
+  std::string line;
+  for (std::uint64_t line_num = 1; std::getline(in, line); line_num++) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      continue;
+    }
+    auto key_end = line.find_first_of(" \t");
+    auto value_begin = line.find_first_not_of(" \t", key_end);
+    if (key_end == 0 || value_begin == std::string::npos) {
+      return absl::InvalidArgumentError("line " + std::to_string(line_num) +
+                                        " is not a key and a value");
+    }
+    auto status = (*loader)->Add(absl::string_view(line).substr(0, key_end),
+                                 absl::string_view(line).substr(value_begin));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  auto status = (*loader)->Finish();
+  if (!status.ok()) {
+    return status;
+  }
+  return (*loader)->num_entries();
+}
+
 int main(int argc, char** argv) {
   std::string dbpath;
-  bool check_crc = false;
-  std::uint32_t dead_bytes_threshold = 128 * 1024 * 1024;
+  mybitcask::Options options;
+  bool compress = false;
 
   auto cli = (clipp::value("db path", dbpath),
               clipp::option("-c", "--checksum")
-                  .set(check_crc)
+                  .set(options.checksum)
                   .doc("Enable CRC verification"),
               clipp::option("-d", "--dead_bytes_threshold")
-                  .set(dead_bytes_threshold)
-                  .doc("maximum single log file size"));
+                  .set(options.dead_bytes_threshold)
+                  .doc("maximum single log file size"),
+              clipp::option("-t", "--merge_threads")
+                  .set(options.merge_threads)
+                  .doc("number of threads merging log files"),
+              clipp::option("-z", "--compress")
+                  .set(compress)
+                  .doc("Compress inserted values"),
+              clipp::option("-b", "--block_format")
+                  .set(options.block_format)
+                  .doc("Write block framed log files"));
   if (!clipp::parse(argc, argv, cli)) {
     std::cerr << clipp::make_man_page(cli, argv[0]);
     return 0;
   };
+  if (compress) {
+    options.compressor = mybitcask::compression::LzCompressor();
+  }
+  // Shown by the stats command
+  options.enable_statistics = true;
 
-  auto db = mybitcask::Open(dbpath, dead_bytes_threshold, check_crc);
+  auto db = mybitcask::Open(dbpath, options);
   if (!db.ok()) {
     error() << "Unable to start mybitask. error: " << db.status() << std::endl;
     return 0;
@@ -147,13 +219,23 @@ int main(int argc, char** argv) {
         rx.clear_screen();
         break;
       case CommandType::HELP:
-        std::cout << "set <key> <value>"
-                  << "\tSet the value of a string key to a string" << std::endl
+        std::cout << "set <key> <value> [ttl_seconds]"
+                  << "\tSet the value of a string key to a string, expiring "
+                  << "after ttl_seconds if given" << std::endl
                   << "get <key>"
                   << "\t\tGet the string value of a given string key"
                   << std::endl
                   << "rm <key>"
                   << "\t\tRemove a given key" << std::endl
+                  << "compact [file_id...]"
+                  << "\tCompact the given log files, or all of them"
+                  << std::endl
+                  << "stats"
+                  << "\t\t\tDisplays the statistics counted since start"
+                  << std::endl
+                  << "import <file>"
+                  << "\t\tLoad the lines of a file, each a key and a value "
+                  << "separated by spaces, in bulk" << std::endl
                   << "help"
                   << "\t\t\tDisplays the help output" << std::endl
                   << "quit"
@@ -189,12 +271,72 @@ int main(int argc, char** argv) {
         if (value.empty()) {
           error() << "Value is required" << std::endl;
         }
-        auto status = (*db)->Insert(key, value);
+        auto ttl = EatString(input);
+        // Expiry is kept in milliseconds, which must not overflow
+        std::int64_t ttl_seconds = 0;
+        if (!ttl.empty() &&
+            (!absl::SimpleAtoi(ttl, &ttl_seconds) || ttl_seconds <= 0 ||
+             ttl_seconds > std::numeric_limits<std::int64_t>::max() / 1000)) {
+          error() << "ttl_seconds must be a positive number" << std::endl;
+          break;
+        }
+        auto status =
+            ttl.empty()
+                ? (*db)->Insert(key, value)
+                : (*db)->Insert(key, value, absl::Seconds(ttl_seconds));
         if (!status.ok()) {
           error() << status << std::endl;
         }
         break;
       }
+      case CommandType::COMPACT: {
+        std::vector<mybitcask::store::file_id_t> file_ids;
+        bool bad_file_id = false;
+        for (auto arg = EatString(input); !arg.empty();
+             arg = EatString(input)) {
+          mybitcask::store::file_id_t file_id;
+          if (!absl::SimpleAtoi(arg, &file_id)) {
+            bad_file_id = true;
+            break;
+          }
+          file_ids.push_back(file_id);
+        }
+        if (bad_file_id) {
+          error() << "File id must be a number" << std::endl;
+          break;
+        }
+        mybitcask::CompactOptions compact_options;
+        auto stats = file_ids.empty()
+                         ? (*db)->CompactAll(compact_options)
+                         : (*db)->CompactFiles(file_ids, compact_options);
+        if (!stats.ok()) {
+          error() << stats.status() << std::endl;
+          break;
+        }
+        std::cout << "files compacted: " << stats->files_compacted << std::endl
+                  << "bytes read: " << stats->bytes_read << std::endl
+                  << "bytes written: " << stats->bytes_written << std::endl
+                  << "bytes reclaimed: " << stats->bytes_reclaimed
+                  << std::endl;
+        break;
+      }
+      case CommandType::STATS:
+        std::cout << (*db)->GetStatistics()->ToString();
+        break;
+      case CommandType::IMPORT: {
+        auto path = EatString(input);
+        if (path.empty()) {
+          error() << "File is required" << std::endl;
+          break;
+        }
+        auto imported = Import(db->get(), path);
+        if (!imported.ok()) {
+          error() << imported.status() << std::endl;
+          break;
+        }
+        std::cout << "entries imported: " << *imported << std::endl;
+        break;
+      }
       case CommandType::RM: {
         auto key = EatString(input);
         if (key.empty()) {
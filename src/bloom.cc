@@ -0,0 +1,92 @@
+#include "bloom.h"
+
+#include <algorithm>
+#include "absl/base/internal/endian.h"
+
+namespace mybitcask {
+namespace bloom {
+
+// Filters with more probes than this are treated as malformed
+const std::uint8_t kMaxProbes = 30;
+
+std::uint32_t Hash(absl::Span<const std::uint8_t> key) {
+  // Similar to murmur hash
+  const std::uint32_t m = 0xc6a4a793;
+  const std::uint32_t r = 24;
+  const std::uint8_t* data = key.data();
+  const std::uint8_t* limit = data + key.size();
+  std::uint32_t h =
+      0xbc9f1d34 ^ (static_cast<std::uint32_t>(key.size()) * m);
+
+  while (data + 4 <= limit) {
+    h += absl::little_endian::Load32(data);
+    h *= m;
+    h ^= (h >> 16);
+    data += 4;
+  }
+  switch (limit - data) {
+    case 3:
+      h += static_cast<std::uint32_t>(data[2]) << 16;
+      // fall through
+    case 2:
+      h += static_cast<std::uint32_t>(data[1]) << 8;
+      // fall through
+    case 1:
+      h += static_cast<std::uint32_t>(data[0]);
+      h *= m;
+      h ^= (h >> r);
+      break;
+  }
+  return h;
+}
+
+void CreateFilter(absl::Span<const std::uint32_t> key_hashes,
+                  std::size_t bits_per_key, std::vector<std::uint8_t>* dst) {
+  // k = bits_per_key * ln(2) minimizes the false positive rate
+  auto num_probes = static_cast<std::uint8_t>(std::min<std::size_t>(
+      std::max<std::size_t>(bits_per_key * 69 / 100, 1), kMaxProbes));
+
+  // A small filter of few keys would have a high false positive rate
+  std::size_t bits = std::max<std::size_t>(key_hashes.size() * bits_per_key, 64);
+  std::size_t bytes = (bits + 7) / 8;
+  bits = bytes * 8;
+
+  std::size_t init_size = dst->size();
+  dst->resize(init_size + bytes, 0);
+  dst->push_back(num_probes);
+  std::uint8_t* array = dst->data() + init_size;
+  for (auto h : key_hashes) {
+    // Double hashing, the second hash is the first one rotated by 17 bits
+    const std::uint32_t delta = (h >> 17) | (h << 15);
+    for (std::uint8_t j = 0; j < num_probes; j++) {
+      const std::uint32_t bitpos = h % bits;
+      array[bitpos / 8] |= (1 << (bitpos % 8));
+      h += delta;
+    }
+  }
+}
+
+bool KeyMayMatch(std::uint32_t key_hash,
+                 absl::Span<const std::uint8_t> filter) {
+  if (filter.size() < 2) {
+    return true;
+  }
+  const std::size_t bits = (filter.size() - 1) * 8;
+  const std::uint8_t num_probes = filter[filter.size() - 1];
+  if (num_probes == 0 || num_probes > kMaxProbes) {
+    return true;
+  }
+  std::uint32_t h = key_hash;
+  const std::uint32_t delta = (h >> 17) | (h << 15);
+  for (std::uint8_t j = 0; j < num_probes; j++) {
+    const std::uint32_t bitpos = h % bits;
+    if ((filter[bitpos / 8] & (1 << (bitpos % 8))) == 0) {
+      return false;
+    }
+    h += delta;
+  }
+  return true;
+}
+
+}  // namespace bloom
+}  // namespace mybitcask
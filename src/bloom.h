@@ -0,0 +1,28 @@
+#ifndef MYBITCASK_SRC_BLOOM_H_
+#define MYBITCASK_SRC_BLOOM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "absl/types/span.h"
+
+namespace mybitcask {
+namespace bloom {
+
+// Return a hash of `key` which is stable across processes and platforms,
+// so it can be persisted.
+std::uint32_t Hash(absl::Span<const std::uint8_t> key);
+
+// Build a bloom filter of the keys whose hashes are `key_hashes` using
+// `bits_per_key` bits per key, and append it to `dst`.
+void CreateFilter(absl::Span<const std::uint32_t> key_hashes,
+                  std::size_t bits_per_key, std::vector<std::uint8_t>* dst);
+
+// Return false if the key whose hash is `key_hash` is definitely not in
+// `filter` built by CreateFilter. A malformed filter matches every key.
+bool KeyMayMatch(std::uint32_t key_hash, absl::Span<const std::uint8_t> filter);
+
+}  // namespace bloom
+}  // namespace mybitcask
+
+#endif  // MYBITCASK_SRC_BLOOM_H_
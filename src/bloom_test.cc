@@ -0,0 +1,52 @@
+#include "bloom.h"
+
+#include <string>
+#include "gtest/gtest.h"
+
+namespace mybitcask {
+namespace bloom {
+
+std::uint32_t StringHash(const std::string& s) {
+  return Hash({reinterpret_cast<const std::uint8_t*>(s.data()), s.size()});
+}
+
+TEST(BloomTest, EmptyFilter) {
+  std::vector<std::uint8_t> filter;
+  CreateFilter({}, 10, &filter);
+  EXPECT_FALSE(KeyMayMatch(StringHash("hello"), absl::MakeSpan(filter)));
+  EXPECT_FALSE(KeyMayMatch(StringHash("world"), absl::MakeSpan(filter)));
+}
+
+TEST(BloomTest, MalformedFilterMatchesAll) {
+  std::vector<std::uint8_t> filter;
+  EXPECT_TRUE(KeyMayMatch(StringHash("hello"), absl::MakeSpan(filter)));
+  filter = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+  EXPECT_TRUE(KeyMayMatch(StringHash("hello"), absl::MakeSpan(filter)));
+}
+
+TEST(BloomTest, FalsePositiveRate) {
+  const int kKeys = 10000;
+  std::vector<std::uint32_t> hashes;
+  for (int i = 0; i < kKeys; i++) {
+    hashes.push_back(StringHash("key" + std::to_string(i)));
+  }
+  std::vector<std::uint8_t> filter;
+  CreateFilter(absl::MakeSpan(hashes), 10, &filter);
+  EXPECT_LE(filter.size(), kKeys * 10 / 8 + 2);
+
+  // No false negatives
+  for (auto h : hashes) {
+    ASSERT_TRUE(KeyMayMatch(h, absl::MakeSpan(filter)));
+  }
+  int false_positives = 0;
+  for (int i = 0; i < kKeys; i++) {
+    if (KeyMayMatch(StringHash("missing" + std::to_string(i)),
+                    absl::MakeSpan(filter))) {
+      false_positives++;
+    }
+  }
+  EXPECT_LT(false_positives, kKeys * 2 / 100);
+}
+
+}  // namespace bloom
+}  // namespace mybitcask
@@ -0,0 +1,147 @@
+#include "mybitcask/mybitcask.h"
+#include "store_dbfiles.h"
+#include "store_filename.h"
+
+namespace mybitcask {
+
+BulkLoader::BulkLoader(MyBitcask* db, Env* env,
+                       const ghc::filesystem::path& data_dir,
+                       std::uint32_t dead_bytes_threshold)
+    : db_(db),
+      env_(env),
+      data_dir_(data_dir),
+      staging_dir_(data_dir / store::TempFilename("bulk_load")),
+      dead_bytes_threshold_(dead_bytes_threshold),
+      builder_(nullptr),
+      files_(),
+      num_entries_(0),
+      status_(),
+      finished_(false) {}
+
+BulkLoader::~BulkLoader() {
+  if (!finished_) {
+    remove_files();
+  }
+}
+
+absl::Status BulkLoader::init() noexcept {
+  auto status = env_->CreateDir(staging_dir_);
+  if (!status.ok()) {
+    return status;
+  }
+  auto children = env_->GetChildren(staging_dir_);
+  if (!children.ok()) {
+    return children.status();
+  }
+  for (const auto& child : *children) {
+    status = env_->RemoveFile(staging_dir_ / child);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status BulkLoader::Add(absl::string_view key,
+                             absl::string_view value) noexcept {
+  if (finished_) {
+    return absl::FailedPreconditionError(kErrLoaderFinished);
+  }
+  if (!status_.ok()) {
+    return status_;
+  }
+  // A bad entry leaves the loader usable
+  auto status = log::log_internal::CheckEntry(key.size(), value.size(),
+                                              compression::kNoCompression);
+  if (!status.ok()) {
+    return status;
+  }
+  // Files roll over as the ones of the store do
+  if (builder_ != nullptr && builder_->num_entries() > 0 &&
+      builder_->file_len() + log::EntryLen(key.size(), value.size()) >
+          dead_bytes_threshold_) {
+    status_ = finish_file();
+  }
+  if (status_.ok() && builder_ == nullptr) {
+    auto path = staging_dir_ / store::LogFilename(static_cast<store::file_id_t>(
+                                   files_.size() + 1));
+    auto builder = NewLogFileBuilder(path, env_);
+    if (builder.ok()) {
+      builder_ = std::move(builder).value();
+      files_.push_back(path);
+    } else {
+      status_ = builder.status();
+    }
+  }
+  if (status_.ok()) {
+    status_ = builder_->Add(key, value);
+  }
+  if (!status_.ok()) {
+    return status_;
+  }
+  num_entries_++;
+  return absl::OkStatus();
+}
+
+absl::Status BulkLoader::Finish() noexcept {
+  if (finished_) {
+    return absl::FailedPreconditionError(kErrLoaderFinished);
+  }
+  if (status_.ok()) {
+    status_ = finish_file();
+  }
+  if (status_.ok()) {
+    status_ = db_ != nullptr ? db_->IngestFiles(files_) : move_files();
+  }
+  if (!status_.ok()) {
+    return status_;
+  }
+  finished_ = true;
+  return env_->RemoveFile(staging_dir_);
+}
+
+absl::Status BulkLoader::finish_file() noexcept {
+  if (builder_ == nullptr) {
+    return absl::OkStatus();
+  }
+  auto status = builder_->Finish();
+  builder_.reset();
+  return status;
+}
+
+absl::Status BulkLoader::move_files() noexcept {
+  store::DBFiles dbfiles(data_dir_, env_);
+  auto first_file_id =
+      dbfiles.log_files().empty() ? 1 : dbfiles.latest_file_id() + 1;
+  // A hint file without its log file is ignored, the other way around the
+  // log file is scanned instead
+  for (std::size_t i = 0; i < files_.size(); i++) {
+    auto file_id = first_file_id + static_cast<store::file_id_t>(i);
+    auto status =
+        env_->RenameFile(files_[i], data_dir_ / store::LogFilename(file_id));
+    if (status.ok()) {
+      status = env_->RenameFile(LogFileBuilder::HintFilePath(files_[i]),
+                                data_dir_ / store::HintFilename(file_id));
+    }
+    if (!status.ok()) {
+      for (auto moved = first_file_id; moved <= file_id; moved++) {
+        auto _ = env_->RemoveFile(data_dir_ / store::HintFilename(moved));
+        _ = env_->RemoveFile(data_dir_ / store::LogFilename(moved));
+      }
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+void BulkLoader::remove_files() noexcept {
+  // Removes its files
+  builder_.reset();
+  for (const auto& path : files_) {
+    auto _ = env_->RemoveFile(LogFileBuilder::HintFilePath(path));
+    _ = env_->RemoveFile(path);
+  }
+  auto _ = env_->RemoveFile(staging_dir_);
+}
+
+}  // namespace mybitcask
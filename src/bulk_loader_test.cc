@@ -0,0 +1,227 @@
+#include "gtest/gtest.h"
+#include "mybitcask/mybitcask.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace mybitcask {
+
+namespace {
+
+std::string Key(int i) { return "key" + std::to_string(i); }
+
+std::string Value(int i) { return std::string(100, 'a' + i % 26); }
+
+void ExpectValue(MyBitcask* db, const std::string& key,
+                 const std::string& expected) {
+  std::string value;
+  auto found = db->Get(key, &value);
+  ASSERT_TRUE(found.ok()) << found.status();
+  ASSERT_TRUE(*found) << key;
+  EXPECT_EQ(value, expected) << key;
+}
+
+}  // namespace
+
+TEST(BulkLoaderTest, ClosedDatabase) {
+  auto env = NewMemEnv();
+  Options options;
+  options.env = env.get();
+  options.dead_bytes_threshold = 4 * 1024;
+  options.checksum = true;
+  {
+    auto mybitcask = Open("/db", options);
+    ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+    ASSERT_TRUE((*mybitcask)->Insert(Key(0), "old").ok());
+    ASSERT_TRUE((*mybitcask)->Insert("kept", "old").ok());
+  }
+
+  auto loader = NewBulkLoader("/db", options);
+  ASSERT_TRUE(loader.ok()) << loader.status();
+  // Unsorted, a key loaded twice keeps the last value
+  for (int i = 499; i >= 0; i--) {
+    ASSERT_TRUE((*loader)->Add(Key(i), Value(i)).ok());
+  }
+  ASSERT_TRUE((*loader)->Add(Key(7), "last").ok());
+  EXPECT_FALSE((*loader)->Add("", "value").ok());
+  // Empty values are rejected as Insert rejects them
+  auto status = (*loader)->Add("empty", "");
+  EXPECT_EQ(status.message(), log::kErrBadValueLength);
+  ASSERT_TRUE((*loader)->Finish().ok());
+  EXPECT_EQ((*loader)->num_entries(), 501);
+  EXPECT_FALSE((*loader)->Add(Key(1), "late").ok());
+  loader->reset();
+
+  {
+    auto mybitcask = Open("/db", options);
+    ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+    auto db = mybitcask->get();
+    ExpectValue(db, "kept", "old");
+    ExpectValue(db, Key(7), "last");
+    std::string value;
+    EXPECT_FALSE(*db->Get("empty", &value));
+    for (int i = 0; i < 500; i++) {
+      if (i != 7) {
+        ExpectValue(db, Key(i), Value(i));
+      }
+    }
+    // Appended after the loaded files, whose hint files stay complete
+    ASSERT_TRUE(db->Insert(Key(1), "new").ok());
+  }
+  auto mybitcask = Open("/db", options);
+  ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+  ExpectValue(mybitcask->get(), Key(1), "new");
+  ExpectValue(mybitcask->get(), Key(2), Value(2));
+}
+
+TEST(BulkLoaderTest, OpenDatabase) {
+  auto env = NewMemEnv();
+  Options options;
+  options.env = env.get();
+  options.dead_bytes_threshold = 4 * 1024;
+  options.merge_threshold = 1.0f;
+  auto mybitcask = Open("/db", options);
+  ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+  auto db = mybitcask->get();
+  ASSERT_TRUE(db->Insert(Key(0), "old").ok());
+  ASSERT_TRUE(db->Insert("kept", "old").ok());
+
+  auto loader = db->NewBulkLoader();
+  ASSERT_TRUE(loader.ok()) << loader.status();
+  for (int i = 0; i < 500; i += 2) {
+    ASSERT_TRUE((*loader)->Add(Key(i), Value(i)).ok());
+  }
+  for (int i = 1; i < 500; i += 2) {
+    ASSERT_TRUE((*loader)->Add(Key(i), Value(i)).ok());
+  }
+  // Nothing is visible before Finish
+  ExpectValue(db, Key(0), "old");
+  std::string value;
+  EXPECT_FALSE(*db->Get(Key(1), &value));
+
+  auto snapshot = db->GetSnapshot();
+  ASSERT_TRUE((*loader)->Finish().ok());
+  loader->reset();
+  ExpectValue(db, "kept", "old");
+  for (int i = 0; i < 500; i++) {
+    ExpectValue(db, Key(i), Value(i));
+  }
+  ReadOptions read_options;
+  read_options.snapshot = snapshot.get();
+  ASSERT_TRUE(*db->Get(read_options, Key(0), &value));
+  EXPECT_EQ(value, "old");
+  EXPECT_FALSE(*db->Get(read_options, Key(1), &value));
+  snapshot.reset();
+
+  // Writes after the load win over it, also once merged and reopened
+  ASSERT_TRUE(db->Insert(Key(1), "new").ok());
+  ASSERT_TRUE(db->Delete(Key(2)).ok());
+  auto stats = db->CompactAll(CompactOptions());
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  mybitcask->reset();
+  mybitcask = Open("/db", options);
+  ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+  db = mybitcask->get();
+  ExpectValue(db, Key(1), "new");
+  EXPECT_FALSE(*db->Get(Key(2), &value));
+  ExpectValue(db, Key(499), Value(499));
+  ExpectValue(db, "kept", "old");
+}
+
+TEST(BulkLoaderTest, Abandoned) {
+  auto env = NewMemEnv();
+  Options options;
+  options.env = env.get();
+  options.dead_bytes_threshold = 4 * 1024;
+  auto mybitcask = Open("/db", options);
+  ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+  auto db = mybitcask->get();
+  ASSERT_TRUE(db->Insert(Key(0), "old").ok());
+  auto files = env->GetChildren("/db");
+  ASSERT_TRUE(files.ok());
+  std::sort(files->begin(), files->end());
+
+  {
+    auto loader = db->NewBulkLoader();
+    ASSERT_TRUE(loader.ok()) << loader.status();
+    for (int i = 0; i < 100; i++) {
+      ASSERT_TRUE((*loader)->Add(Key(i), Value(i)).ok());
+    }
+  }
+  auto after = env->GetChildren("/db");
+  ASSERT_TRUE(after.ok());
+  std::sort(after->begin(), after->end());
+  EXPECT_EQ(*after, *files);
+  ExpectValue(db, Key(0), "old");
+
+  // Loading nothing changes nothing
+  auto loader = db->NewBulkLoader();
+  ASSERT_TRUE(loader.ok()) << loader.status();
+  ASSERT_TRUE((*loader)->Finish().ok());
+  ASSERT_TRUE(db->Insert(Key(1), "new").ok());
+  ExpectValue(db, Key(1), "new");
+}
+
+TEST(BulkLoaderTest, IngestFiles) {
+  auto env = NewMemEnv();
+  Options options;
+  options.env = env.get();
+  options.checksum = true;
+  auto mybitcask = Open("/db", options);
+  ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+  auto db = mybitcask->get();
+  ASSERT_TRUE(db->Insert(Key(0), "old").ok());
+  ASSERT_TRUE(db->Insert("kept", "old").ok());
+
+  // Built without the database, the second file overriding the first
+  std::vector<ghc::filesystem::path> paths = {"/ext/part-0.log",
+                                              "/ext/part-1.log"};
+  for (std::size_t f = 0; f < paths.size(); f++) {
+    auto builder = NewLogFileBuilder(paths[f], env.get());
+    ASSERT_TRUE(builder.ok()) << builder.status();
+    for (int i = 0; i < 100; i++) {
+      ASSERT_TRUE(
+          (*builder)->Add(Key(i), f == 0 ? "first" : Value(i)).ok());
+    }
+    ASSERT_TRUE((*builder)->Add("part", std::to_string(f)).ok());
+    EXPECT_EQ((*builder)->Add("empty", "").message(),
+              log::kErrBadValueLength);
+    ASSERT_TRUE((*builder)->Finish().ok());
+  }
+  EXPECT_TRUE(env->FileExists("/ext/part-1.hint"));
+  {
+    // An abandoned builder leaves nothing behind
+    auto builder = NewLogFileBuilder("/ext/part-2.log", env.get());
+    ASSERT_TRUE(builder.ok()) << builder.status();
+    ASSERT_TRUE((*builder)->Add(Key(0), "abandoned").ok());
+  }
+  EXPECT_EQ(env->GetChildren("/ext")->size(), 4);
+
+  // Nothing is ingested if a file is missing
+  auto missing = paths;
+  missing.push_back("/ext/part-2.log");
+  EXPECT_FALSE(db->IngestFiles(missing).ok());
+  EXPECT_EQ(env->GetChildren("/ext")->size(), 4);
+  ExpectValue(db, Key(0), "old");
+
+  ASSERT_TRUE(db->IngestFiles(paths).ok());
+  EXPECT_TRUE(env->GetChildren("/ext")->empty());
+  for (auto db : {mybitcask->get(), static_cast<MyBitcask*>(nullptr)}) {
+    if (db == nullptr) {
+      mybitcask->reset();
+      mybitcask = Open("/db", options);
+      ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+      db = mybitcask->get();
+    }
+    ExpectValue(db, "kept", "old");
+    ExpectValue(db, "part", "1");
+    std::string value;
+    EXPECT_FALSE(*db->Get("empty", &value));
+    for (int i = 0; i < 100; i++) {
+      ExpectValue(db, Key(i), Value(i));
+    }
+  }
+}
+
+}  // namespace mybitcask
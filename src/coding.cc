@@ -0,0 +1,46 @@
+#include "coding.h"
+
+namespace mybitcask {
+namespace coding {
+
+std::size_t VarintLength(std::uint64_t v) {
+  std::size_t len = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    len++;
+  }
+  return len;
+}
+
+std::uint8_t* EncodeVarint64(std::uint8_t* dst, std::uint64_t v) {
+  while (v >= 0x80) {
+    *(dst++) = static_cast<std::uint8_t>(v | 0x80);
+    v >>= 7;
+  }
+  *(dst++) = static_cast<std::uint8_t>(v);
+  return dst;
+}
+
+void PutVarint64(std::vector<std::uint8_t>* dst, std::uint64_t v) {
+  std::uint8_t buf[kMaxVarint64Len];
+  auto end = EncodeVarint64(buf, v);
+  dst->insert(dst->end(), buf, end);
+}
+
+const std::uint8_t* DecodeVarint64(const std::uint8_t* p,
+                                   const std::uint8_t* limit,
+                                   std::uint64_t* v) {
+  std::uint64_t result = 0;
+  for (std::uint32_t shift = 0; shift <= 63 && p < limit; shift += 7) {
+    std::uint64_t byte = *(p++);
+    result |= (byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      *v = result;
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace coding
+}  // namespace mybitcask
@@ -0,0 +1,34 @@
+#ifndef MYBITCASK_SRC_CODING_H_
+#define MYBITCASK_SRC_CODING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mybitcask {
+namespace coding {
+
+// Maximum length of a varint encoded 64-bit integer
+const std::size_t kMaxVarint64Len = 10;
+
+// Return the length of the varint encoding of `v`.
+std::size_t VarintLength(std::uint64_t v);
+
+// Write the varint encoding of `v` to `dst`, which must have room for
+// kMaxVarint64Len bytes, and return a pointer just past the last byte
+// written.
+std::uint8_t* EncodeVarint64(std::uint8_t* dst, std::uint64_t v);
+
+// Append the varint encoding of `v` to `dst`.
+void PutVarint64(std::vector<std::uint8_t>* dst, std::uint64_t v);
+
+// Decode a varint from [p, limit) into `v` and return a pointer just past
+// the decoded bytes. Returns nullptr if the varint is truncated or
+// malformed.
+const std::uint8_t* DecodeVarint64(const std::uint8_t* p,
+                                   const std::uint8_t* limit, std::uint64_t* v);
+
+}  // namespace coding
+}  // namespace mybitcask
+
+#endif  // MYBITCASK_SRC_CODING_H_
@@ -0,0 +1,40 @@
+#include "coding.h"
+
+#include <limits>
+#include "gtest/gtest.h"
+
+namespace mybitcask {
+namespace coding {
+
+TEST(CodingTest, Varint64RoundTrip) {
+  std::vector<std::uint64_t> values = {0, 1, 0x7F, 0x80, 0xFFFF,
+                                       0xFFFFFFFFULL, 0x100000000ULL};
+  values.push_back(std::numeric_limits<std::uint64_t>::max());
+  std::vector<std::uint8_t> buf;
+  for (auto v : values) {
+    PutVarint64(&buf, v);
+  }
+  const std::uint8_t* p = buf.data();
+  const std::uint8_t* limit = buf.data() + buf.size();
+  for (auto v : values) {
+    std::uint64_t actual = 0;
+    auto next = DecodeVarint64(p, limit, &actual);
+    ASSERT_NE(next, nullptr);
+    EXPECT_EQ(actual, v);
+    EXPECT_EQ(static_cast<std::size_t>(next - p), VarintLength(v));
+    p = next;
+  }
+  EXPECT_EQ(p, limit);
+}
+
+TEST(CodingTest, TruncatedVarint) {
+  std::vector<std::uint8_t> buf;
+  PutVarint64(&buf, 0xFFFFFFFFULL);
+  std::uint64_t v = 0;
+  EXPECT_EQ(DecodeVarint64(buf.data(), buf.data() + buf.size() - 1, &v),
+            nullptr);
+  EXPECT_EQ(DecodeVarint64(buf.data(), buf.data(), &v), nullptr);
+}
+
+}  // namespace coding
+}  // namespace mybitcask
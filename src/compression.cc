@@ -0,0 +1,400 @@
+#include "mybitcask/internal/compression.h"
+
+#include "coding.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace mybitcask {
+namespace compression {
+
+namespace {
+
+// The LZ format is `varint(uncompressed length) | sequence*`. Every sequence
+// is a token byte holding a literal length (high nibble) and a match length
+// minus kMinMatch (low nibble), a length nibble of 15 being extended by
+// bytes up to 255 each, followed by the literals and the little-endian 2
+// byte offset of the match. The last sequence may stop after its literals.
+const std::size_t kMinMatch = 4;
+const std::size_t kMaxOffset = 0xFFFF;
+const int kMinHashBits = 8;
+const int kMaxHashBits = 14;
+const std::size_t kLengthMask = 15;
+
+constexpr char kErrCorrupt[] = "corrupt compressed value";
+
+inline std::uint32_t Load32(const std::uint8_t* p) {
+  std::uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline std::uint32_t Hash(std::uint32_t v, int bits) {
+  return (v * 2654435761U) >> (32 - bits);
+}
+
+void PutLength(std::vector<std::uint8_t>* out, std::size_t len) {
+  for (; len >= 255; len -= 255) {
+    out->push_back(255);
+  }
+  out->push_back(static_cast<std::uint8_t>(len));
+}
+
+// Emit a sequence, `match_len` being 0 for the trailing literals.
+void PutSequence(std::vector<std::uint8_t>* out, const std::uint8_t* literals,
+                 std::size_t literal_len, std::size_t offset,
+                 std::size_t match_len) {
+  auto literal_nibble = std::min(literal_len, kLengthMask);
+  auto match_nibble =
+      match_len == 0 ? 0 : std::min(match_len - kMinMatch, kLengthMask);
+  out->push_back(static_cast<std::uint8_t>(literal_nibble << 4 | match_nibble));
+  if (literal_nibble == kLengthMask) {
+    PutLength(out, literal_len - kLengthMask);
+  }
+  out->insert(out->end(), literals, literals + literal_len);
+  if (match_len == 0) {
+    return;
+  }
+  out->push_back(static_cast<std::uint8_t>(offset));
+  out->push_back(static_cast<std::uint8_t>(offset >> 8));
+  if (match_nibble == kLengthMask) {
+    PutLength(out, match_len - kMinMatch - kLengthMask);
+  }
+}
+
+// Add an extended length to `len`, failing if it exceeds `max`.
+bool GetLength(const std::uint8_t** p, const std::uint8_t* limit,
+               std::size_t max, std::size_t* len) {
+  while (*p < limit) {
+    std::uint8_t byte = *((*p)++);
+    *len += byte;
+    if (*len > max) {
+      return false;
+    }
+    if (byte != 255) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Compress `input`, whose matches may also reach back into `dict`, a
+// dictionary preceding it whose 4 byte sequences are hashed into
+// `dict_table`.
+void LzCompress(absl::Span<const std::uint8_t> dict,
+                absl::Span<const std::uint32_t> dict_table,
+                absl::Span<const std::uint8_t> input,
+                std::vector<std::uint8_t>* output) {
+  const std::uint8_t* base = input.data();
+  const std::size_t n = input.size();
+  coding::PutVarint64(output, n);
+
+  // The table shrinks with the input, so small values are cheap to compress
+  int bits = kMinHashBits;
+  while (bits < kMaxHashBits && (std::size_t{1} << bits) < n) {
+    bits++;
+  }
+  // Last position plus one of every hashed 4 byte sequence of the input
+  std::vector<std::size_t> table(std::size_t{1} << bits, 0);
+  std::size_t anchor = 0;
+  std::size_t pos = 0;
+  while (pos + kMinMatch <= n) {
+    auto v = Load32(base + pos);
+    auto& slot = table[Hash(v, bits)];
+    std::size_t candidate = slot;
+    slot = pos + 1;
+    std::size_t offset = 0;
+    std::size_t match_len = 0;
+    if (candidate != 0 && pos - (candidate - 1) <= kMaxOffset &&
+        Load32(base + candidate - 1) == v) {
+      candidate--;
+      offset = pos - candidate;
+      match_len = kMinMatch;
+      while (pos + match_len < n &&
+             base[candidate + match_len] == base[pos + match_len]) {
+        match_len++;
+      }
+    } else if (!dict_table.empty()) {
+      candidate = dict_table[Hash(v, kMaxHashBits)];
+      if (candidate != 0 && pos + dict.size() - (candidate - 1) <= kMaxOffset &&
+          Load32(dict.data() + candidate - 1) == v) {
+        candidate--;
+        offset = pos + dict.size() - candidate;
+        match_len = kMinMatch;
+        // A match stops at the end of the dictionary
+        while (pos + match_len < n && candidate + match_len < dict.size() &&
+               dict[candidate + match_len] == base[pos + match_len]) {
+          match_len++;
+        }
+      }
+    }
+    if (match_len == 0) {
+      pos++;
+      continue;
+    }
+    PutSequence(output, base + anchor, pos - anchor, offset, match_len);
+    pos += match_len;
+    anchor = pos;
+  }
+  if (anchor < n) {
+    PutSequence(output, base + anchor, n - anchor, 0, 0);
+  }
+}
+
+absl::StatusOr<std::uint64_t> LzUncompressedLength(
+    absl::Span<const std::uint8_t> compressed) {
+  std::uint64_t len = 0;
+  if (coding::DecodeVarint64(compressed.data(),
+                             compressed.data() + compressed.size(),
+                             &len) == nullptr) {
+    return absl::InvalidArgumentError(kErrCorrupt);
+  }
+  return len;
+}
+
+absl::Status LzUncompress(absl::Span<const std::uint8_t> dict,
+                          absl::Span<const std::uint8_t> compressed,
+                          absl::Span<std::uint8_t> dst) {
+  const std::uint8_t* limit = compressed.data() + compressed.size();
+  std::uint64_t len = 0;
+  const std::uint8_t* p =
+      coding::DecodeVarint64(compressed.data(), limit, &len);
+  if (p == nullptr || len != dst.size()) {
+    return absl::InvalidArgumentError(kErrCorrupt);
+  }
+
+  std::uint8_t* out = dst.data();
+  const std::size_t n = dst.size();
+  std::size_t op = 0;
+  while (p < limit) {
+    std::uint8_t token = *(p++);
+    std::size_t literal_len = token >> 4;
+    if (literal_len == kLengthMask &&
+        !GetLength(&p, limit, n, &literal_len)) {
+      return absl::InvalidArgumentError(kErrCorrupt);
+    }
+    if (literal_len > static_cast<std::size_t>(limit - p) ||
+        literal_len > n - op) {
+      return absl::InvalidArgumentError(kErrCorrupt);
+    }
+    std::memcpy(out + op, p, literal_len);
+    p += literal_len;
+    op += literal_len;
+    if (p == limit) {
+      break;
+    }
+
+    if (limit - p < 2) {
+      return absl::InvalidArgumentError(kErrCorrupt);
+    }
+    std::size_t offset = p[0] | static_cast<std::size_t>(p[1]) << 8;
+    p += 2;
+    std::size_t match_len = (token & kLengthMask) + kMinMatch;
+    if ((token & kLengthMask) == kLengthMask &&
+        !GetLength(&p, limit, n, &match_len)) {
+      return absl::InvalidArgumentError(kErrCorrupt);
+    }
+    if (offset == 0 || offset > op + dict.size() || match_len > n - op) {
+      return absl::InvalidArgumentError(kErrCorrupt);
+    }
+    if (offset > op) {
+      // The match starts in the dictionary
+      auto back = offset - op;
+      auto from_dict = std::min(back, match_len);
+      std::memcpy(out + op, dict.data() + dict.size() - back, from_dict);
+      op += from_dict;
+      match_len -= from_dict;
+    }
+    if (offset >= match_len) {
+      std::memcpy(out + op, out + op - offset, match_len);
+      op += match_len;
+    } else {
+      // Overlapping match repeats the last `offset` bytes
+      for (std::size_t i = 0; i < match_len; i++, op++) {
+        out[op] = out[op - offset];
+      }
+    }
+  }
+  if (op != n) {
+    return absl::InvalidArgumentError(kErrCorrupt);
+  }
+  return absl::OkStatus();
+}
+
+class Lz : public Compressor {
+ public:
+  std::uint8_t type() const override { return kLzCompression; }
+
+  void Compress(absl::Span<const std::uint8_t> input,
+                std::vector<std::uint8_t>* output) const override {
+    LzCompress({}, {}, input, output);
+  }
+
+  absl::StatusOr<std::uint64_t> UncompressedLength(
+      absl::Span<const std::uint8_t> compressed) const override {
+    return LzUncompressedLength(compressed);
+  }
+
+  absl::Status Uncompress(absl::Span<const std::uint8_t> compressed,
+                          absl::Span<std::uint8_t> dst) const override {
+    return LzUncompress({}, compressed, dst);
+  }
+};
+
+// Windows of kWindowLen bytes are the unit of content shared by samples
+const std::size_t kWindowLen = 8;
+
+inline std::uint64_t Load64(const char* p) {
+  std::uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+}  // namespace
+
+std::shared_ptr<const Compressor> LzCompressor() {
+  static const std::shared_ptr<const Compressor> lz = std::make_shared<Lz>();
+  return lz;
+}
+
+Dictionary::Dictionary(std::vector<std::uint8_t> data)
+    : data_(std::move(data)), table_(std::size_t{1} << kMaxHashBits, 0) {
+  for (std::size_t pos = 0; pos + kMinMatch <= data_.size(); pos++) {
+    table_[Hash(Load32(data_.data() + pos), kMaxHashBits)] =
+        static_cast<std::uint32_t>(pos + 1);
+  }
+}
+
+absl::Span<const std::uint8_t> Dictionary::data() const {
+  return absl::MakeSpan(data_);
+}
+
+void Dictionary::Compress(absl::Span<const std::uint8_t> input,
+                          std::vector<std::uint8_t>* output) const {
+  LzCompress(absl::MakeSpan(data_), absl::MakeSpan(table_), input, output);
+}
+
+absl::Status Dictionary::Uncompress(absl::Span<const std::uint8_t> compressed,
+                                    absl::Span<std::uint8_t> dst) const {
+  return LzUncompress(absl::MakeSpan(data_), compressed, dst);
+}
+
+std::vector<std::uint8_t> TrainDictionary(
+    const std::vector<std::string>& samples, std::size_t max_len) {
+  max_len = std::min(max_len, kMaxDictionaryLen);
+  // Number of samples containing each window
+  std::unordered_map<std::uint64_t, std::uint32_t> frequency;
+  for (auto& sample : samples) {
+    std::unordered_set<std::uint64_t> seen;
+    for (std::size_t pos = 0; pos + kWindowLen <= sample.size(); pos++) {
+      auto window = Load64(sample.data() + pos);
+      if (seen.insert(window).second) {
+        frequency[window]++;
+      }
+    }
+  }
+
+  // Runs of windows common to enough samples form the candidate segments,
+  // scored by how often their windows occur
+  const std::uint32_t min_frequency = std::max<std::uint32_t>(
+      2, static_cast<std::uint32_t>(samples.size() / 16));
+  std::unordered_map<std::string, std::uint64_t> segments;
+  for (auto& sample : samples) {
+    std::size_t pos = 0;
+    while (pos + kWindowLen <= sample.size()) {
+      if (frequency[Load64(sample.data() + pos)] < min_frequency) {
+        pos++;
+        continue;
+      }
+      std::size_t start = pos;
+      std::uint64_t score = 0;
+      while (pos + kWindowLen <= sample.size()) {
+        auto f = frequency[Load64(sample.data() + pos)];
+        if (f < min_frequency) {
+          break;
+        }
+        score += f;
+        pos++;
+      }
+      auto segment = sample.substr(start, pos - start + kWindowLen - 1);
+      auto& best = segments[segment];
+      best = std::max(best, score);
+    }
+  }
+
+  std::vector<std::pair<std::uint64_t, const std::string*>> ranked;
+  ranked.reserve(segments.size());
+  for (auto& segment : segments) {
+    ranked.emplace_back(segment.second, &segment.first);
+  }
+  std::sort(ranked.begin(), ranked.end(),
+            [](const std::pair<std::uint64_t, const std::string*>& a,
+               const std::pair<std::uint64_t, const std::string*>& b) {
+              return a.first != b.first ? a.first > b.first
+                                        : *a.second < *b.second;
+            });
+  std::string dictionary;
+  for (auto& candidate : ranked) {
+    auto& segment = *candidate.second;
+    if (dictionary.size() + segment.size() > max_len ||
+        dictionary.find(segment) != std::string::npos) {
+      continue;
+    }
+    dictionary += segment;
+  }
+  return std::vector<std::uint8_t>(dictionary.begin(), dictionary.end());
+}
+
+DictionarySampler::DictionarySampler(std::size_t dictionary_len)
+    : dictionary_len_(std::min(dictionary_len, kMaxDictionaryLen)),
+      sample_bytes_(0),
+      offered_(0),
+      rand_state_(0x9E3779B97F4A7C15ULL) {}
+
+void DictionarySampler::Add(absl::Span<const std::uint8_t> value) {
+  if (value.empty() || value.size() > kMaxDictionaryValueLen) {
+    return;
+  }
+  const std::size_t budget = dictionary_len_ * kSamplesPerDictionaryByte;
+  absl::MutexLock guard(&lock_);
+  offered_++;
+  if (sample_bytes_ + value.size() <= budget) {
+    samples_.emplace_back(value.begin(), value.end());
+    sample_bytes_ += value.size();
+    return;
+  }
+  // Reservoir sampling, a later value replaces a random sample
+  rand_state_ ^= rand_state_ << 13;
+  rand_state_ ^= rand_state_ >> 7;
+  rand_state_ ^= rand_state_ << 17;
+  auto i = rand_state_ % offered_;
+  if (i >= samples_.size() ||
+      sample_bytes_ - samples_[i].size() + value.size() > budget) {
+    return;
+  }
+  sample_bytes_ = sample_bytes_ - samples_[i].size() + value.size();
+  samples_[i].assign(value.begin(), value.end());
+}
+
+std::shared_ptr<const Dictionary> DictionarySampler::Train() {
+  std::vector<std::string> samples;
+  {
+    absl::MutexLock guard(&lock_);
+    if (samples_.size() < kMinSamples) {
+      return nullptr;
+    }
+    samples.swap(samples_);
+    sample_bytes_ = 0;
+    offered_ = 0;
+  }
+  auto data = TrainDictionary(samples, dictionary_len_);
+  if (data.empty()) {
+    return nullptr;
+  }
+  return std::make_shared<Dictionary>(std::move(data));
+}
+
+}  // namespace compression
+}  // namespace mybitcask
@@ -0,0 +1,142 @@
+#include "mybitcask/internal/compression.h"
+
+#include "gtest/gtest.h"
+#include "test_util.h"
+
+#include <string>
+#include <vector>
+
+namespace mybitcask {
+namespace compression {
+
+std::vector<std::uint8_t> ToBytes(const std::string& s) {
+  return std::vector<std::uint8_t>(s.begin(), s.end());
+}
+
+TEST(LzCompressorTest, RoundTrip) {
+  auto lz = LzCompressor();
+  EXPECT_EQ(lz->type(), kLzCompression);
+
+  std::string repeated;
+  for (int i = 0; i < 1000; i++) {
+    repeated += "mybitcask value " + std::to_string(i % 10);
+  }
+  std::vector<std::string> cases = {
+      "",
+      "a",
+      "abcd",
+      std::string(100000, 'x'),
+      repeated,
+      test::RandomString(100000),
+      test::RandomString(17) + std::string(300, 'y') + test::RandomString(5),
+  };
+  for (auto& c : cases) {
+    auto input = ToBytes(c);
+    std::vector<std::uint8_t> compressed;
+    lz->Compress(absl::MakeSpan(input), &compressed);
+    auto len = lz->UncompressedLength(absl::MakeSpan(compressed));
+    ASSERT_TRUE(len.ok()) << len.status();
+    ASSERT_EQ(*len, input.size());
+    std::vector<std::uint8_t> output(*len);
+    auto status =
+        lz->Uncompress(absl::MakeSpan(compressed), absl::MakeSpan(output));
+    ASSERT_TRUE(status.ok()) << status;
+    EXPECT_EQ(output, input);
+  }
+
+  std::vector<std::uint8_t> compressed;
+  auto input = ToBytes(repeated);
+  lz->Compress(absl::MakeSpan(input), &compressed);
+  EXPECT_LT(compressed.size(), input.size() / 4);
+}
+
+TEST(LzCompressorTest, RejectCorruptInput) {
+  auto lz = LzCompressor();
+  auto input = ToBytes(std::string(1000, 'a') + "tail");
+  std::vector<std::uint8_t> compressed;
+  lz->Compress(absl::MakeSpan(input), &compressed);
+
+  std::vector<std::uint8_t> output(input.size());
+  auto truncated = absl::MakeSpan(compressed).subspan(0, compressed.size() - 1);
+  EXPECT_FALSE(lz->Uncompress(truncated, absl::MakeSpan(output)).ok());
+
+  std::vector<std::uint8_t> shorter(input.size() - 1);
+  EXPECT_FALSE(
+      lz->Uncompress(absl::MakeSpan(compressed), absl::MakeSpan(shorter)).ok());
+
+  // Every corruption is either detected or decodes to some output, but never
+  // writes out of bounds
+  for (std::size_t i = 0; i < compressed.size(); i++) {
+    auto corrupted = compressed;
+    corrupted[i] ^= 0x5A;
+    (void)lz->Uncompress(absl::MakeSpan(corrupted), absl::MakeSpan(output));
+  }
+}
+
+// Records sharing structure, like serialized objects of the same type
+std::vector<std::string> StructuredValues(int n) {
+  std::vector<std::string> values;
+  for (int i = 0; i < n; i++) {
+    values.push_back(
+        "{\"user_id\": " + std::to_string(100000 + i * 7) +
+        ", \"name\": \"" + test::RandomString(8) +
+        "\", \"email_verified\": true, \"preferences\": {\"theme\": "
+        "\"dark\", \"language\": \"en-US\", \"notifications\": "
+        "[\"email\", \"push\"]}, \"token\": \"" +
+        test::RandomString(16) + "\"}");
+  }
+  return values;
+}
+
+TEST(DictionaryTest, RoundTrip) {
+  auto samples = StructuredValues(200);
+  auto data = TrainDictionary(samples, 4096);
+  ASSERT_FALSE(data.empty());
+  EXPECT_LE(data.size(), 4096);
+  Dictionary dictionary(data);
+
+  std::size_t plain_len = 0;
+  std::size_t dictionary_len = 0;
+  auto values = StructuredValues(50);
+  values.push_back("x");
+  values.push_back(test::RandomString(1000));
+  for (auto& value : values) {
+    auto input = ToBytes(value);
+    std::vector<std::uint8_t> compressed;
+    dictionary.Compress(absl::MakeSpan(input), &compressed);
+    dictionary_len += compressed.size();
+    std::vector<std::uint8_t> plain;
+    LzCompressor()->Compress(absl::MakeSpan(input), &plain);
+    plain_len += plain.size();
+
+    std::vector<std::uint8_t> output(input.size());
+    auto status = dictionary.Uncompress(absl::MakeSpan(compressed),
+                                        absl::MakeSpan(output));
+    ASSERT_TRUE(status.ok()) << status;
+    EXPECT_EQ(output, input);
+    // Values compressed against a dictionary need it
+    if (compressed.size() < input.size() / 2) {
+      EXPECT_FALSE(
+          LzCompressor()
+              ->Uncompress(absl::MakeSpan(compressed), absl::MakeSpan(output))
+              .ok());
+    }
+  }
+  EXPECT_LT(dictionary_len * 2, plain_len);
+}
+
+TEST(DictionaryTest, Sampler) {
+  DictionarySampler sampler(1024);
+  EXPECT_EQ(sampler.Train(), nullptr);
+  for (auto& value : StructuredValues(1000)) {
+    sampler.Add(ToBytes(value));
+  }
+  auto dictionary = sampler.Train();
+  ASSERT_NE(dictionary, nullptr);
+  EXPECT_LE(dictionary->data().size(), 1024);
+  // Samples are used once
+  EXPECT_EQ(sampler.Train(), nullptr);
+}
+
+}  // namespace compression
+}  // namespace mybitcask
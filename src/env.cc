@@ -0,0 +1,116 @@
+#include "mybitcask/internal/env.h"
+
+namespace mybitcask {
+
+namespace {
+
+// FileEnv keeps files on the local filesystem, through the io functions of
+// the platform. Those create missing files when opening random access
+// readers, so the files are checked for first.
+class FileEnv final : public Env {
+ public:
+  absl::StatusOr<std::unique_ptr<io::SequentialReader>> NewSequentialReader(
+      const ghc::filesystem::path& filename) noexcept override {
+    return io::OpenSequentialFileReader(ghc::filesystem::path(filename));
+  }
+
+  absl::StatusOr<std::unique_ptr<io::SequentialWriter>> NewSequentialWriter(
+      const ghc::filesystem::path& filename) noexcept override {
+    return io::OpenSequentialFileWriter(ghc::filesystem::path(filename));
+  }
+
+  absl::StatusOr<std::unique_ptr<io::RandomAccessReader>>
+  NewRandomAccessReader(
+      const ghc::filesystem::path& filename) noexcept override {
+    if (!FileExists(filename)) {
+      return absl::NotFoundError(kErrFileNotFound);
+    }
+    return io::OpenRandomAccessFileReader(ghc::filesystem::path(filename));
+  }
+
+  absl::StatusOr<std::unique_ptr<io::RandomAccessReader>> NewMmapReader(
+      const ghc::filesystem::path& filename) noexcept override {
+    if (!FileExists(filename)) {
+      return absl::NotFoundError(kErrFileNotFound);
+    }
+    return io::OpenMmapRandomAccessFileReader(ghc::filesystem::path(filename));
+  }
+
+  bool FileExists(const ghc::filesystem::path& filename) noexcept override {
+    std::error_code ec;
+    return ghc::filesystem::exists(filename, ec);
+  }
+
+  absl::StatusOr<std::uint64_t> GetFileSize(
+      const ghc::filesystem::path& filename) noexcept override {
+    auto size = io::GetFileSize(filename);
+    if (!size.ok()) {
+      return size.status();
+    }
+    return *size;
+  }
+
+  absl::StatusOr<std::vector<std::string>> GetChildren(
+      const ghc::filesystem::path& dir) noexcept override {
+    std::error_code ec;
+    ghc::filesystem::directory_iterator it(dir, ec);
+    std::vector<std::string> children;
+    for (; !ec && it != ghc::filesystem::directory_iterator();
+         it.increment(ec)) {
+      children.push_back(it->path().filename().string());
+    }
+    if (ec) {
+      return absl::InternalError(ec.message());
+    }
+    return children;
+  }
+
+  absl::Status RemoveFile(
+      const ghc::filesystem::path& filename) noexcept override {
+    std::error_code ec;
+    ghc::filesystem::remove(filename, ec);
+    if (ec) {
+      return absl::InternalError(ec.message());
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status RenameFile(
+      const ghc::filesystem::path& src,
+      const ghc::filesystem::path& target) noexcept override {
+    std::error_code ec;
+    ghc::filesystem::rename(src, target, ec);
+    if (ec) {
+      return absl::InternalError(ec.message());
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status TruncateFile(const ghc::filesystem::path& filename,
+                            std::uint64_t size) noexcept override {
+    std::error_code ec;
+    ghc::filesystem::resize_file(filename, size, ec);
+    if (ec) {
+      return absl::InternalError(ec.message());
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status CreateDir(const ghc::filesystem::path& dir) noexcept override {
+    std::error_code ec;
+    ghc::filesystem::create_directories(dir, ec);
+    if (ec) {
+      return absl::InternalError(ec.message());
+    }
+    return absl::OkStatus();
+  }
+};
+
+}  // namespace
+
+Env* Env::Default() {
+  static Env* const env = new FileEnv();
+  return env;
+}
+
+}  // namespace mybitcask
@@ -0,0 +1,238 @@
+#include "mybitcask/internal/env.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include "absl/synchronization/mutex.h"
+
+namespace mybitcask {
+
+namespace {
+
+// Contents of a file, shared by the MemEnv and the readers and writers of
+// the file, so that a removed file stays readable by its open readers.
+class MemFile {
+ public:
+  std::size_t Read(std::uint64_t offset, absl::Span<std::uint8_t> dst) {
+    absl::ReaderMutexLock l(&lock_);
+    if (offset >= data_.size()) {
+      return 0;
+    }
+    auto read_len = std::min<std::uint64_t>(dst.size(), data_.size() - offset);
+    std::memcpy(dst.data(), data_.data() + offset, read_len);
+    return static_cast<std::size_t>(read_len);
+  }
+
+  std::uint64_t Append(absl::Span<const std::uint8_t> src) {
+    absl::MutexLock l(&lock_);
+    std::uint64_t offset = data_.size();
+    data_.insert(data_.end(), src.begin(), src.end());
+    return offset;
+  }
+
+  void Truncate(std::uint64_t size) {
+    absl::MutexLock l(&lock_);
+    data_.resize(size);
+  }
+
+  std::uint64_t Size() {
+    absl::ReaderMutexLock l(&lock_);
+    return data_.size();
+  }
+
+ private:
+  absl::Mutex lock_;
+  std::vector<std::uint8_t> data_ ABSL_GUARDED_BY(lock_);
+};
+
+class MemSequentialReader final : public io::SequentialReader {
+ public:
+  explicit MemSequentialReader(std::shared_ptr<MemFile>&& file)
+      : file_(std::move(file)), offset_(0) {}
+
+  absl::StatusOr<std::size_t> Read(
+      absl::Span<std::uint8_t> dst) noexcept override {
+    auto read_len = file_->Read(offset_, dst);
+    offset_ += read_len;
+    return read_len;
+  }
+
+  absl::Status Skip(std::uint64_t offset) noexcept override {
+    offset_ = std::min(offset_ + offset, file_->Size());
+    return absl::OkStatus();
+  }
+
+ private:
+  std::shared_ptr<MemFile> file_;
+  std::uint64_t offset_;
+};
+
+class MemRandomAccessReader final : public io::RandomAccessReader {
+ public:
+  explicit MemRandomAccessReader(std::shared_ptr<MemFile>&& file)
+      : file_(std::move(file)) {}
+
+  absl::StatusOr<std::size_t> ReadAt(
+      std::uint64_t offset, absl::Span<std::uint8_t> dst) noexcept override {
+    return file_->Read(offset, dst);
+  }
+
+ private:
+  std::shared_ptr<MemFile> file_;
+};
+
+class MemSequentialWriter final : public io::SequentialWriter {
+ public:
+  explicit MemSequentialWriter(std::shared_ptr<MemFile>&& file)
+      : file_(std::move(file)) {}
+
+  absl::StatusOr<std::uint64_t> Append(
+      absl::Span<const std::uint8_t> src) noexcept override {
+    return file_->Append(src);
+  }
+
+  absl::Status Truncate(std::uint64_t size) noexcept override {
+    file_->Truncate(size);
+    return absl::OkStatus();
+  }
+
+  absl::Status Sync() noexcept override { return absl::OkStatus(); }
+
+  std::uint64_t Size() const noexcept override { return file_->Size(); }
+
+ private:
+  std::shared_ptr<MemFile> file_;
+};
+
+// MemEnv keeps files in a map from their normalized path. Directories are
+// implicit: a directory exists as long as a path may be below it.
+class MemEnv final : public Env {
+ public:
+  absl::StatusOr<std::unique_ptr<io::SequentialReader>> NewSequentialReader(
+      const ghc::filesystem::path& filename) noexcept override {
+    auto file = find(filename);
+    if (file == nullptr) {
+      return absl::NotFoundError(kErrFileNotFound);
+    }
+    return std::unique_ptr<io::SequentialReader>(
+        new MemSequentialReader(std::move(file)));
+  }
+
+  absl::StatusOr<std::unique_ptr<io::SequentialWriter>> NewSequentialWriter(
+      const ghc::filesystem::path& filename) noexcept override {
+    std::shared_ptr<MemFile> file;
+    {
+      absl::MutexLock l(&lock_);
+      auto& entry = files_[Key(filename)];
+      if (entry == nullptr) {
+        entry = std::make_shared<MemFile>();
+      }
+      file = entry;
+    }
+    return std::unique_ptr<io::SequentialWriter>(
+        new MemSequentialWriter(std::move(file)));
+  }
+
+  absl::StatusOr<std::unique_ptr<io::RandomAccessReader>>
+  NewRandomAccessReader(
+      const ghc::filesystem::path& filename) noexcept override {
+    auto file = find(filename);
+    if (file == nullptr) {
+      return absl::NotFoundError(kErrFileNotFound);
+    }
+    return std::unique_ptr<io::RandomAccessReader>(
+        new MemRandomAccessReader(std::move(file)));
+  }
+
+  absl::StatusOr<std::unique_ptr<io::RandomAccessReader>> NewMmapReader(
+      const ghc::filesystem::path& filename) noexcept override {
+    return NewRandomAccessReader(filename);
+  }
+
+  bool FileExists(const ghc::filesystem::path& filename) noexcept override {
+    return find(filename) != nullptr;
+  }
+
+  absl::StatusOr<std::uint64_t> GetFileSize(
+      const ghc::filesystem::path& filename) noexcept override {
+    auto file = find(filename);
+    if (file == nullptr) {
+      return absl::NotFoundError(kErrFileNotFound);
+    }
+    return file->Size();
+  }
+
+  absl::StatusOr<std::vector<std::string>> GetChildren(
+      const ghc::filesystem::path& dir) noexcept override {
+    auto key = Key(dir);
+    std::vector<std::string> children;
+    absl::MutexLock l(&lock_);
+    for (const auto& entry : files_) {
+      ghc::filesystem::path path(entry.first);
+      if (path.parent_path().generic_string() == key) {
+        children.push_back(path.filename().string());
+      }
+    }
+    return children;
+  }
+
+  absl::Status RemoveFile(
+      const ghc::filesystem::path& filename) noexcept override {
+    absl::MutexLock l(&lock_);
+    files_.erase(Key(filename));
+    return absl::OkStatus();
+  }
+
+  absl::Status RenameFile(
+      const ghc::filesystem::path& src,
+      const ghc::filesystem::path& target) noexcept override {
+    absl::MutexLock l(&lock_);
+    auto it = files_.find(Key(src));
+    if (it == files_.end()) {
+      return absl::NotFoundError(kErrFileNotFound);
+    }
+    auto file = std::move(it->second);
+    files_.erase(it);
+    files_[Key(target)] = std::move(file);
+    return absl::OkStatus();
+  }
+
+  absl::Status TruncateFile(const ghc::filesystem::path& filename,
+                            std::uint64_t size) noexcept override {
+    auto file = find(filename);
+    if (file == nullptr) {
+      return absl::NotFoundError(kErrFileNotFound);
+    }
+    file->Truncate(size);
+    return absl::OkStatus();
+  }
+
+  absl::Status CreateDir(const ghc::filesystem::path&) noexcept override {
+    return absl::OkStatus();
+  }
+
+ private:
+  static std::string Key(const ghc::filesystem::path& path) {
+    auto key = path.lexically_normal().generic_string();
+    // "dir/" and "dir" name the same directory
+    if (key.size() > 1 && key.back() == '/') {
+      key.pop_back();
+    }
+    return key;
+  }
+
+  std::shared_ptr<MemFile> find(const ghc::filesystem::path& filename) {
+    absl::MutexLock l(&lock_);
+    auto it = files_.find(Key(filename));
+    return it != files_.end() ? it->second : nullptr;
+  }
+
+  absl::Mutex lock_;
+  std::map<std::string, std::shared_ptr<MemFile>> files_ ABSL_GUARDED_BY(lock_);
+};
+
+}  // namespace
+
+std::unique_ptr<Env> NewMemEnv() { return std::unique_ptr<Env>(new MemEnv()); }
+
+}  // namespace mybitcask
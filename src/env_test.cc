@@ -0,0 +1,203 @@
+#include "mybitcask/internal/env.h"
+
+#include "gtest/gtest.h"
+#include "mybitcask/mybitcask.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace mybitcask {
+
+namespace {
+
+std::string ReadAll(io::SequentialReader* reader) {
+  std::string data;
+  std::uint8_t buf[4];
+  for (;;) {
+    auto read_len = reader->Read(absl::MakeSpan(buf));
+    EXPECT_TRUE(read_len.ok());
+    if (!read_len.ok() || *read_len == 0) {
+      return data;
+    }
+    data.append(reinterpret_cast<const char*>(buf), *read_len);
+  }
+}
+
+// Every Env behaves the same on the files of a database
+void TestFiles(Env* env, const ghc::filesystem::path& dir) {
+  auto a = dir / "a";
+  EXPECT_FALSE(env->FileExists(a));
+  EXPECT_FALSE(env->NewSequentialReader(a).ok());
+  EXPECT_FALSE(env->NewRandomAccessReader(a).ok());
+  EXPECT_FALSE(env->GetFileSize(a).ok());
+  EXPECT_TRUE(env->RemoveFile(a).ok());
+
+  {
+    auto writer = env->NewSequentialWriter(a);
+    ASSERT_TRUE(writer.ok());
+    EXPECT_EQ(*(*writer)->Append(test::StrSpan("hello ")), 0);
+    EXPECT_EQ(*(*writer)->Append(test::StrSpan("world")), 6);
+    EXPECT_EQ((*writer)->Size(), 11);
+    EXPECT_TRUE((*writer)->Sync().ok());
+  }
+  EXPECT_TRUE(env->FileExists(a));
+  EXPECT_EQ(*env->GetFileSize(a), 11);
+
+  // Writers append to existing files
+  {
+    auto writer = env->NewSequentialWriter(a);
+    ASSERT_TRUE(writer.ok());
+    EXPECT_EQ((*writer)->Size(), 11);
+    EXPECT_EQ(*(*writer)->Append(test::StrSpan("!!")), 11);
+    EXPECT_TRUE((*writer)->Truncate(12).ok());
+    EXPECT_EQ(*(*writer)->Append(test::StrSpan("?")), 12);
+    EXPECT_TRUE((*writer)->Sync().ok());
+  }
+
+  auto reader = env->NewSequentialReader(a);
+  ASSERT_TRUE(reader.ok());
+  EXPECT_TRUE((*reader)->Skip(6).ok());
+  EXPECT_EQ(ReadAll(reader->get()), "world!?");
+
+  auto random = env->NewRandomAccessReader(a);
+  ASSERT_TRUE(random.ok());
+  std::uint8_t buf[5];
+  EXPECT_EQ(*(*random)->ReadAt(6, absl::MakeSpan(buf)), 5);
+  EXPECT_EQ(std::string(reinterpret_cast<char*>(buf), 5), "world");
+  auto mmap = env->NewMmapReader(a);
+  ASSERT_TRUE(mmap.ok());
+  EXPECT_EQ(*(*mmap)->ReadAt(0, absl::MakeSpan(buf)), 5);
+  EXPECT_EQ(std::string(reinterpret_cast<char*>(buf), 5), "hello");
+
+  EXPECT_TRUE(env->TruncateFile(a, 5).ok());
+  EXPECT_EQ(*env->GetFileSize(a), 5);
+
+  auto b = dir / "b";
+  EXPECT_FALSE(env->RenameFile(b, a).ok());
+  ASSERT_TRUE(env->NewSequentialWriter(b).ok());
+  auto children = env->GetChildren(dir);
+  ASSERT_TRUE(children.ok());
+  std::sort(children->begin(), children->end());
+  EXPECT_EQ(*children, std::vector<std::string>({"a", "b"}));
+
+  // Renaming replaces the target
+  EXPECT_TRUE(env->RenameFile(a, b).ok());
+  EXPECT_FALSE(env->FileExists(a));
+  EXPECT_EQ(*env->GetFileSize(b), 5);
+  EXPECT_EQ(*env->GetChildren(dir), std::vector<std::string>({"b"}));
+
+  // Open readers still read a removed file
+  reader = env->NewSequentialReader(b);
+  ASSERT_TRUE(reader.ok());
+  EXPECT_TRUE(env->RemoveFile(b).ok());
+  EXPECT_FALSE(env->FileExists(b));
+  EXPECT_EQ(ReadAll(reader->get()), "hello");
+  EXPECT_TRUE(env->GetChildren(dir)->empty());
+}
+
+}  // namespace
+
+TEST(EnvTest, Default) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  TestFiles(Env::Default(), tmpdir->path());
+
+  auto sub = tmpdir->path() / "sub" / "dir";
+  EXPECT_TRUE(Env::Default()->CreateDir(sub).ok());
+  EXPECT_TRUE(ghc::filesystem::is_directory(sub));
+  EXPECT_FALSE(Env::Default()->GetChildren(tmpdir->path() / "none").ok());
+}
+
+TEST(EnvTest, Mem) {
+  auto env = NewMemEnv();
+  TestFiles(env.get(), "/db");
+  EXPECT_TRUE(env->CreateDir("/db").ok());
+
+  // Paths naming the same file are the same file, files in subdirectories
+  // are not children
+  ASSERT_TRUE(env->NewSequentialWriter("/db/./sub/../c").ok());
+  ASSERT_TRUE(env->NewSequentialWriter("/db/sub/d").ok());
+  EXPECT_TRUE(env->FileExists("/db/c"));
+  EXPECT_EQ(*env->GetChildren("/db/"), std::vector<std::string>({"c"}));
+  EXPECT_TRUE(env->GetChildren("/none")->empty());
+  EXPECT_FALSE(ghc::filesystem::exists("/db/c"));
+}
+
+TEST(EnvTest, MyBitcaskOnMemEnv) {
+  auto env = NewMemEnv();
+  // Never created on the local filesystem
+  ghc::filesystem::path db_path = "/mybitcask_mem_env_test";
+  Options options;
+  options.env = env.get();
+  options.dead_bytes_threshold = 1024;
+  options.merge_threshold = 1.0f;
+  options.checksum = true;
+  {
+    auto mybitcask = Open(db_path, options);
+    ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+    auto db = mybitcask->get();
+    for (int i = 0; i < 100; i++) {
+      ASSERT_TRUE(
+          db->Insert("key" + std::to_string(i), std::string(100, 'a' + i % 26))
+              .ok());
+    }
+    ASSERT_TRUE(db->Delete("key0").ok());
+    auto stats = db->CompactAll(CompactOptions());
+    ASSERT_TRUE(stats.ok()) << stats.status();
+    EXPECT_GT(stats->files_compacted, 0);
+  }
+  EXPECT_FALSE(ghc::filesystem::exists(db_path));
+  EXPECT_FALSE(env->GetChildren(db_path)->empty());
+
+  // Reopened from the log and hint files in the Env
+  auto mybitcask = Open(db_path, options);
+  ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+  std::string value;
+  EXPECT_FALSE(*(*mybitcask)->Get("key0", &value));
+  for (int i = 1; i < 100; i++) {
+    auto found = (*mybitcask)->Get("key" + std::to_string(i), &value);
+    ASSERT_TRUE(found.ok() && *found);
+    EXPECT_EQ(value, std::string(100, 'a' + i % 26));
+  }
+}
+
+TEST(EnvTest, GenerateHintFilesOnMemEnv) {
+  auto env = NewMemEnv();
+  ghc::filesystem::path db_path = "/mybitcask_mem_env_test";
+  Options options;
+  options.env = env.get();
+  options.dead_bytes_threshold = 1024;
+  {
+    auto mybitcask = Open(db_path, options);
+    ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+    (*mybitcask)->PauseBackgroundWork();
+    for (int i = 0; i < 100; i++) {
+      ASSERT_TRUE((*mybitcask)
+                      ->Insert("key" + std::to_string(i),
+                               std::string(100, 'a' + i % 26))
+                      .ok());
+    }
+  }
+  auto children = env->GetChildren(db_path);
+  ASSERT_TRUE(children.ok());
+  std::size_t log_files = 0;
+  for (const auto& child : *children) {
+    if (ghc::filesystem::path(child).extension() == ".hint") {
+      ASSERT_TRUE(env->RemoveFile(db_path / child).ok());
+    } else if (ghc::filesystem::path(child).extension() == ".log") {
+      log_files++;
+    }
+  }
+  ASSERT_GT(log_files, 2);
+
+  ASSERT_TRUE(GenerateHintFiles(db_path, 2, false, env.get()).ok());
+  for (std::size_t file_id = 1; file_id < log_files; file_id++) {
+    EXPECT_TRUE(env->FileExists(db_path /
+                                (std::to_string(file_id) + ".hint")));
+  }
+  EXPECT_FALSE(ghc::filesystem::exists(db_path));
+}
+
+}  // namespace mybitcask
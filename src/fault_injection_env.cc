@@ -0,0 +1,342 @@
+#include "mybitcask/internal/fault_injection_env.h"
+
+#include <thread>
+
+namespace mybitcask {
+
+const char* FileOpName(FileOp op) {
+  switch (op) {
+    case FileOp::kOpen:
+      return "open";
+    case FileOp::kRead:
+      return "read";
+    case FileOp::kAppend:
+      return "append";
+    case FileOp::kSync:
+      return "sync";
+    case FileOp::kTruncate:
+      return "truncate";
+    case FileOp::kRemove:
+      return "remove";
+    case FileOp::kRename:
+      return "rename";
+    case FileOp::kStat:
+      return "stat";
+    default:
+      return "unknown";
+  }
+}
+
+namespace {
+
+std::size_t FaultIndex(FileOp op, FaultFileType file_type) {
+  return static_cast<std::size_t>(op) *
+             static_cast<std::size_t>(FaultFileType::kNumFaultFileTypes) +
+         static_cast<std::size_t>(file_type);
+}
+
+// Log files are named "<id>.log", hint files "<id>.hint" and temporary hint
+// files "<id>.hint.<n>.tmp"
+FaultFileType GetFaultFileType(const ghc::filesystem::path& filename) {
+  auto name = filename.filename().string();
+  auto dot = name.find('.');
+  if (dot == std::string::npos) {
+    return FaultFileType::kOtherFile;
+  }
+  auto suffix = name.substr(dot + 1, name.find('.', dot + 1) - dot - 1);
+  if (suffix == "log") {
+    return FaultFileType::kLogFile;
+  }
+  if (suffix == "hint") {
+    return FaultFileType::kHintFile;
+  }
+  return FaultFileType::kOtherFile;
+}
+
+class FaultInjectionSequentialReader final : public io::SequentialReader {
+ public:
+  FaultInjectionSequentialReader(std::unique_ptr<io::SequentialReader>&& base,
+                                 FaultInjectionEnv* env,
+                                 FaultFileType file_type)
+      : base_(std::move(base)), env_(env), file_type_(file_type) {}
+
+  absl::StatusOr<std::size_t> Read(
+      absl::Span<std::uint8_t> dst) noexcept override {
+    auto status = env_->Inject(FileOp::kRead, file_type_);
+    if (!status.ok()) {
+      return status;
+    }
+    return base_->Read(dst);
+  }
+
+  absl::Status Skip(std::uint64_t offset) noexcept override {
+    return base_->Skip(offset);
+  }
+
+ private:
+  std::unique_ptr<io::SequentialReader> base_;
+  FaultInjectionEnv* env_;
+  FaultFileType file_type_;
+};
+
+class FaultInjectionRandomAccessReader final : public io::RandomAccessReader {
+ public:
+  FaultInjectionRandomAccessReader(
+      std::unique_ptr<io::RandomAccessReader>&& base, FaultInjectionEnv* env,
+      FaultFileType file_type)
+      : base_(std::move(base)), env_(env), file_type_(file_type) {}
+
+  absl::StatusOr<std::size_t> ReadAt(
+      std::uint64_t offset, absl::Span<std::uint8_t> dst) noexcept override {
+    auto status = env_->Inject(FileOp::kRead, file_type_);
+    if (!status.ok()) {
+      return status;
+    }
+    return base_->ReadAt(offset, dst);
+  }
+
+ private:
+  std::unique_ptr<io::RandomAccessReader> base_;
+  FaultInjectionEnv* env_;
+  FaultFileType file_type_;
+};
+
+class FaultInjectionSequentialWriter final : public io::SequentialWriter {
+ public:
+  FaultInjectionSequentialWriter(std::unique_ptr<io::SequentialWriter>&& base,
+                                 FaultInjectionEnv* env,
+                                 FaultFileType file_type)
+      : base_(std::move(base)), env_(env), file_type_(file_type) {}
+
+  absl::StatusOr<std::uint64_t> Append(
+      absl::Span<const std::uint8_t> src) noexcept override {
+    auto status = env_->Inject(FileOp::kAppend, file_type_);
+    if (!status.ok()) {
+      return status;
+    }
+    return base_->Append(src);
+  }
+
+  absl::Status Truncate(std::uint64_t size) noexcept override {
+    auto status = env_->Inject(FileOp::kTruncate, file_type_);
+    if (!status.ok()) {
+      return status;
+    }
+    return base_->Truncate(size);
+  }
+
+  absl::Status Sync() noexcept override {
+    auto status = env_->Inject(FileOp::kSync, file_type_);
+    if (!status.ok()) {
+      return status;
+    }
+    return base_->Sync();
+  }
+
+  std::uint64_t Size() const noexcept override { return base_->Size(); }
+
+ private:
+  std::unique_ptr<io::SequentialWriter> base_;
+  FaultInjectionEnv* env_;
+  FaultFileType file_type_;
+};
+
+}  // namespace
+
+FaultInjectionEnv::FaultInjectionEnv(Env* base, std::uint64_t seed)
+    : base_(base), faults_(), active_(false), engine_(seed) {
+  for (auto& injected : injected_) {
+    injected.store(0);
+  }
+}
+
+void FaultInjectionEnv::SetFault(FileOp op, FaultFileType file_type,
+                                 const Fault& fault) {
+  absl::MutexLock guard(&lock_);
+  faults_[FaultIndex(op, file_type)] = fault;
+  active_.store(true);
+}
+
+void FaultInjectionEnv::SetFault(FileOp op, const Fault& fault) {
+  for (std::size_t t = 0;
+       t < static_cast<std::size_t>(FaultFileType::kNumFaultFileTypes); t++) {
+    SetFault(op, static_cast<FaultFileType>(t), fault);
+  }
+}
+
+void FaultInjectionEnv::ClearFaults() {
+  absl::MutexLock guard(&lock_);
+  faults_.fill(Fault());
+  active_.store(false);
+}
+
+std::uint64_t FaultInjectionEnv::injected(FileOp op) const {
+  return injected_[static_cast<std::size_t>(op)].load();
+}
+
+absl::Status FaultInjectionEnv::Inject(FileOp op,
+                                       FaultFileType file_type) noexcept {
+  if (!active_.load(std::memory_order_relaxed)) {
+    return absl::OkStatus();
+  }
+  absl::Duration delay;
+  absl::Status error;
+  {
+    absl::MutexLock guard(&lock_);
+    const auto& fault = faults_[FaultIndex(op, file_type)];
+    if (fault.latency == absl::ZeroDuration() && fault.error.ok()) {
+      return absl::OkStatus();
+    }
+    if (fault.probability < 1.0 &&
+        std::uniform_real_distribution<double>(0, 1)(engine_) >=
+            fault.probability) {
+      return absl::OkStatus();
+    }
+    switch (fault.distribution) {
+      case Fault::Distribution::kFixed:
+        delay = fault.latency;
+        break;
+      case Fault::Distribution::kUniform:
+        delay = fault.latency *
+                std::uniform_real_distribution<double>(0, 1)(engine_);
+        break;
+      case Fault::Distribution::kExponential:
+        delay = fault.latency *
+                std::exponential_distribution<double>(1.0)(engine_);
+        break;
+    }
+    error = fault.error;
+  }
+  injected_[static_cast<std::size_t>(op)].fetch_add(1);
+  if (delay > absl::ZeroDuration()) {
+    std::this_thread::sleep_for(absl::ToChronoNanoseconds(delay));
+  }
+  return error;
+}
+
+absl::StatusOr<std::unique_ptr<io::SequentialReader>>
+FaultInjectionEnv::NewSequentialReader(
+    const ghc::filesystem::path& filename) noexcept {
+  auto file_type = GetFaultFileType(filename);
+  auto status = Inject(FileOp::kOpen, file_type);
+  if (!status.ok()) {
+    return status;
+  }
+  auto reader = base_->NewSequentialReader(filename);
+  if (!reader.ok()) {
+    return reader.status();
+  }
+  return std::unique_ptr<io::SequentialReader>(
+      new FaultInjectionSequentialReader(std::move(reader).value(), this,
+                                         file_type));
+}
+
+absl::StatusOr<std::unique_ptr<io::SequentialWriter>>
+FaultInjectionEnv::NewSequentialWriter(
+    const ghc::filesystem::path& filename) noexcept {
+  auto file_type = GetFaultFileType(filename);
+  auto status = Inject(FileOp::kOpen, file_type);
+  if (!status.ok()) {
+    return status;
+  }
+  auto writer = base_->NewSequentialWriter(filename);
+  if (!writer.ok()) {
+    return writer.status();
+  }
+  return std::unique_ptr<io::SequentialWriter>(
+      new FaultInjectionSequentialWriter(std::move(writer).value(), this,
+                                         file_type));
+}
+
+absl::StatusOr<std::unique_ptr<io::RandomAccessReader>>
+FaultInjectionEnv::NewRandomAccessReader(
+    const ghc::filesystem::path& filename) noexcept {
+  auto file_type = GetFaultFileType(filename);
+  auto status = Inject(FileOp::kOpen, file_type);
+  if (!status.ok()) {
+    return status;
+  }
+  auto reader = base_->NewRandomAccessReader(filename);
+  if (!reader.ok()) {
+    return reader.status();
+  }
+  return std::unique_ptr<io::RandomAccessReader>(
+      new FaultInjectionRandomAccessReader(std::move(reader).value(), this,
+                                           file_type));
+}
+
+absl::StatusOr<std::unique_ptr<io::RandomAccessReader>>
+FaultInjectionEnv::NewMmapReader(
+    const ghc::filesystem::path& filename) noexcept {
+  auto file_type = GetFaultFileType(filename);
+  auto status = Inject(FileOp::kOpen, file_type);
+  if (!status.ok()) {
+    return status;
+  }
+  auto reader = base_->NewMmapReader(filename);
+  if (!reader.ok()) {
+    return reader.status();
+  }
+  return std::unique_ptr<io::RandomAccessReader>(
+      new FaultInjectionRandomAccessReader(std::move(reader).value(), this,
+                                           file_type));
+}
+
+bool FaultInjectionEnv::FileExists(
+    const ghc::filesystem::path& filename) noexcept {
+  auto _ = Inject(FileOp::kStat, GetFaultFileType(filename));
+  return base_->FileExists(filename);
+}
+
+absl::StatusOr<std::uint64_t> FaultInjectionEnv::GetFileSize(
+    const ghc::filesystem::path& filename) noexcept {
+  auto status = Inject(FileOp::kStat, GetFaultFileType(filename));
+  if (!status.ok()) {
+    return status;
+  }
+  return base_->GetFileSize(filename);
+}
+
+absl::StatusOr<std::vector<std::string>> FaultInjectionEnv::GetChildren(
+    const ghc::filesystem::path& dir) noexcept {
+  auto status = Inject(FileOp::kStat, FaultFileType::kOtherFile);
+  if (!status.ok()) {
+    return status;
+  }
+  return base_->GetChildren(dir);
+}
+
+absl::Status FaultInjectionEnv::RemoveFile(
+    const ghc::filesystem::path& filename) noexcept {
+  auto status = Inject(FileOp::kRemove, GetFaultFileType(filename));
+  if (!status.ok()) {
+    return status;
+  }
+  return base_->RemoveFile(filename);
+}
+
+absl::Status FaultInjectionEnv::RenameFile(
+    const ghc::filesystem::path& src,
+    const ghc::filesystem::path& target) noexcept {
+  auto status = Inject(FileOp::kRename, GetFaultFileType(target));
+  if (!status.ok()) {
+    return status;
+  }
+  return base_->RenameFile(src, target);
+}
+
+absl::Status FaultInjectionEnv::TruncateFile(
+    const ghc::filesystem::path& filename, std::uint64_t size) noexcept {
+  auto status = Inject(FileOp::kTruncate, GetFaultFileType(filename));
+  if (!status.ok()) {
+    return status;
+  }
+  return base_->TruncateFile(filename, size);
+}
+
+absl::Status FaultInjectionEnv::CreateDir(
+    const ghc::filesystem::path& dir) noexcept {
+  return base_->CreateDir(dir);
+}
+
+}  // namespace mybitcask
@@ -0,0 +1,122 @@
+#include "mybitcask/internal/fault_injection_env.h"
+
+#include "gtest/gtest.h"
+#include "mybitcask/mybitcask.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <string>
+
+namespace mybitcask {
+
+namespace {
+
+double MillisSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+}  // namespace
+
+TEST(FaultInjectionEnvTest, Faults) {
+  auto base = NewMemEnv();
+  FaultInjectionEnv env(base.get());
+  auto log = env.NewSequentialWriter("/db/1.log");
+  auto hint = env.NewSequentialWriter("/db/1.hint.0.tmp");
+  ASSERT_TRUE(log.ok() && hint.ok());
+
+  Fault slow;
+  slow.latency = absl::Milliseconds(20);
+  env.SetFault(FileOp::kSync, FaultFileType::kLogFile, slow);
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE((*log)->Sync().ok());
+  EXPECT_GE(MillisSince(start), 20);
+  start = std::chrono::steady_clock::now();
+  EXPECT_TRUE((*hint)->Sync().ok());
+  EXPECT_LT(MillisSince(start), 20);
+  EXPECT_EQ(env.injected(FileOp::kSync), 1);
+
+  Fault no_space;
+  no_space.error = absl::ResourceExhaustedError("no space left on device");
+  env.SetFault(FileOp::kAppend, no_space);
+  auto offset = (*hint)->Append(test::StrSpan("entry"));
+  EXPECT_EQ(offset.status().code(), absl::StatusCode::kResourceExhausted);
+  EXPECT_EQ((*hint)->Size(), 0);
+  EXPECT_EQ(env.injected(FileOp::kAppend), 1);
+
+  // Faults are injected into a fraction of the operations
+  no_space.probability = 0.5;
+  env.SetFault(FileOp::kAppend, FaultFileType::kLogFile, no_space);
+  int failed = 0;
+  for (int i = 0; i < 1000; i++) {
+    failed += (*log)->Append(test::StrSpan("e")).ok() ? 0 : 1;
+  }
+  EXPECT_GT(failed, 400);
+  EXPECT_LT(failed, 600);
+  EXPECT_EQ((*log)->Size(), 1000 - failed);
+
+  Fault unreadable;
+  unreadable.error = absl::DataLossError("bad sector");
+  env.SetFault(FileOp::kRead, FaultFileType::kLogFile, unreadable);
+  auto reader = env.NewRandomAccessReader("/db/1.log");
+  ASSERT_TRUE(reader.ok());
+  std::uint8_t buf[1];
+  EXPECT_FALSE((*reader)->ReadAt(0, absl::MakeSpan(buf)).ok());
+
+  env.ClearFaults();
+  EXPECT_TRUE((*hint)->Append(test::StrSpan("entry")).ok());
+  EXPECT_EQ(*(*reader)->ReadAt(0, absl::MakeSpan(buf)), 1);
+  start = std::chrono::steady_clock::now();
+  EXPECT_TRUE((*log)->Sync().ok());
+  EXPECT_LT(MillisSince(start), 20);
+}
+
+TEST(FaultInjectionEnvTest, MyBitcaskOnFailingDevice) {
+  auto base = NewMemEnv();
+  FaultInjectionEnv env(base.get());
+  Options options;
+  options.env = &env;
+  options.checksum = true;
+  auto mybitcask = Open("/db", options);
+  ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+  auto db = mybitcask->get();
+  ASSERT_TRUE(db->Insert("a", "1").ok());
+
+  // A full disk fails inserts, which leave nothing behind
+  Fault no_space;
+  no_space.error = absl::ResourceExhaustedError("no space left on device");
+  env.SetFault(FileOp::kAppend, FaultFileType::kLogFile, no_space);
+  EXPECT_FALSE(db->Insert("b", "2").ok());
+  std::string value;
+  EXPECT_FALSE(*db->Get("b", &value));
+
+  // So do failing reads
+  Fault unreadable;
+  unreadable.error = absl::DataLossError("bad sector");
+  env.SetFault(FileOp::kRead, FaultFileType::kLogFile, unreadable);
+  EXPECT_FALSE(db->Get("a", &value).ok());
+
+  env.ClearFaults();
+  ASSERT_TRUE(db->Insert("b", "2").ok());
+  ASSERT_TRUE(*db->Get("a", &value));
+  EXPECT_EQ(value, "1");
+
+  // Slow syncs slow down inserts
+  Fault slow;
+  slow.latency = absl::Milliseconds(20);
+  env.SetFault(FileOp::kSync, FaultFileType::kLogFile, slow);
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(db->Insert("c", "3").ok());
+  EXPECT_GE(MillisSince(start), 20);
+  env.ClearFaults();
+
+  mybitcask->reset();
+  mybitcask = Open("/db", options);
+  ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+  for (const auto& key : {"a", "b", "c"}) {
+    EXPECT_TRUE(*(*mybitcask)->Get(key, &value)) << key;
+  }
+}
+
+}  // namespace mybitcask
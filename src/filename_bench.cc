@@ -0,0 +1,56 @@
+// Parsing the names of the files of a database directory, as DBFiles does
+// for every file on Open and before every merge
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "benchmark/benchmark.h"
+
+#include "store_filename.h"
+
+namespace mybitcask {
+namespace store {
+namespace {
+
+void ParseFilenames(benchmark::State& state,
+                    const std::vector<std::string>& filenames) {
+  std::uint32_t file_id = 0;
+  FileType type;
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        ParseFilename(filenames[i++ % filenames.size()], &file_id, &type));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ParseLogFilename(benchmark::State& state) {
+  std::vector<std::string> filenames;
+  for (std::uint32_t file_id = 0; file_id < 1000; file_id++) {
+    filenames.push_back(LogFilename(file_id * 7919));
+  }
+  ParseFilenames(state, filenames);
+}
+BENCHMARK(BM_ParseLogFilename);
+
+void BM_ParseHintFilename(benchmark::State& state) {
+  std::vector<std::string> filenames;
+  for (std::uint32_t file_id = 0; file_id < 1000; file_id++) {
+    filenames.push_back(HintFilename(file_id * 7919));
+  }
+  ParseFilenames(state, filenames);
+}
+BENCHMARK(BM_ParseHintFilename);
+
+// Temporary files and files of other programs are rejected
+void BM_ParseOtherFilename(benchmark::State& state) {
+  ParseFilenames(state, {TempFilename(LogFilename(42)), "LOCK", "logs",
+                         "mybitcask.txt", "42.log.bak"});
+}
+BENCHMARK(BM_ParseOtherFilename);
+
+}  // namespace
+}  // namespace store
+}  // namespace mybitcask
+
+BENCHMARK_MAIN();
@@ -0,0 +1,62 @@
+// Parsing hint files with hint::KeyIter::Fold, as recovery and merges do
+
+#include <cstdint>
+#include <string>
+#include "benchmark/benchmark.h"
+
+#include "store_hint.h"
+#include "test_util.h"
+
+namespace mybitcask {
+namespace store {
+namespace hint {
+namespace {
+
+const std::size_t kEntries = 1000 * 1000;
+const file_id_t kFileId = 1;
+
+// A directory with the hint file of kEntries entries of 16 byte keys
+const ghc::filesystem::path& HintDir() {
+  static auto dir = []() {
+    auto tmpdir = test::MakeTempDir("mybitcask_bench_");
+    FileWriter writer(tmpdir->path(), kFileId);
+    for (std::size_t i = 0; i < kEntries; i++) {
+      auto key = test::RandomString(16);
+      auto status = writer.Add(
+          test::StrSpan(key),
+          log::ValuePos{100, static_cast<std::uint64_t>(i) * 128, 0, 0});
+      if (!status.ok()) {
+        break;
+      }
+    }
+    auto _ = writer.Finish();
+    return std::move(tmpdir).value();
+  }();
+  return dir.path();
+}
+
+void BM_KeyIterFold(benchmark::State& state) {
+  auto& dir = HintDir();
+  auto file_len = ghc::filesystem::file_size(dir / HintFilename(kFileId));
+  for (auto _ : state) {
+    auto keys = KeyIter(&dir, kFileId)
+                    .Fold<std::size_t, std::string>(
+                        0, [](std::size_t&& n, log::Key<std::string>&&) {
+                          return n + 1;
+                        });
+    if (!keys.ok() || *keys != kEntries) {
+      state.SkipWithError("fold failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kEntries);
+  state.SetBytesProcessed(state.iterations() * file_len);
+}
+BENCHMARK(BM_KeyIterFold)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace hint
+}  // namespace store
+}  // namespace mybitcask
+
+BENCHMARK_MAIN();
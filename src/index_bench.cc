@@ -0,0 +1,159 @@
+// Lookups and inserts in an index of the type MyBitcask keeps in memory,
+// from 1M keys up to --max_keys keys (10M by default, every index holds all
+// its keys in memory at once).
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "absl/container/btree_map.h"
+#include "absl/strings/strip.h"
+#include "absl/strings/numbers.h"
+#include "benchmark/benchmark.h"
+
+#include "mybitcask/mybitcask.h"
+
+namespace mybitcask {
+namespace {
+
+using Index = absl::btree_map<std::string, IndexEntry>;
+
+std::string Key(std::uint64_t i) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "key%012llu",
+                static_cast<unsigned long long>(i));
+  return buf;
+}
+
+// The index of `n` keys holds Key(KeyAt(i)) for every i < n, so the odd
+// keys in between are missing
+std::uint64_t KeyAt(std::uint64_t i) { return i * 2; }
+
+// The index of `n` keys, built once and kept for the following benchmarks
+Index& IndexOf(std::uint64_t n) {
+  static std::map<std::uint64_t, Index> indexes;
+  auto it = indexes.find(n);
+  if (it != indexes.end()) {
+    return it->second;
+  }
+  // Only one index is kept, so they do not add up
+  indexes.clear();
+  auto& index = indexes[n];
+  for (std::uint64_t i = 0; i < n; i++) {
+    index.emplace_hint(index.end(), Key(KeyAt(i)),
+                       IndexEntry{Position{0, 0, i * 128, 100, 0}, nullptr});
+  }
+  return index;
+}
+
+void BM_IndexLookup(benchmark::State& state) {
+  auto n = static_cast<std::uint64_t>(state.range(0));
+  auto& index = IndexOf(n);
+  std::mt19937_64 engine(42);
+  std::uniform_int_distribution<std::uint64_t> dist(0, n - 1);
+  std::vector<std::string> keys;
+  for (int i = 0; i < 4096; i++) {
+    keys.push_back(Key(KeyAt(dist(engine))));
+  }
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index.find(keys[i++ % keys.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_IndexLookupMissing(benchmark::State& state) {
+  auto n = static_cast<std::uint64_t>(state.range(0));
+  auto& index = IndexOf(n);
+  std::mt19937_64 engine(42);
+  std::uniform_int_distribution<std::uint64_t> dist(0, n - 1);
+  std::vector<std::string> keys;
+  for (int i = 0; i < 4096; i++) {
+    keys.push_back(Key(KeyAt(dist(engine)) + 1));
+  }
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index.find(keys[i++ % keys.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Inserts keys missing from the index at random places
+void BM_IndexInsert(benchmark::State& state) {
+  auto n = static_cast<std::uint64_t>(state.range(0));
+  auto& index = IndexOf(n);
+  std::mt19937_64 engine(42);
+  std::uniform_int_distribution<std::uint64_t> dist(0, n - 1);
+  std::vector<std::string> inserted;
+  for (auto _ : state) {
+    auto key = Key(KeyAt(dist(engine)) + 1);
+    auto result =
+        index.emplace(key, IndexEntry{Position{1, 0, 0, 100, 0}, nullptr});
+    if (result.second) {
+      inserted.push_back(std::move(key));
+    }
+  }
+  // Outside of the timed loop
+  for (auto& key : inserted) {
+    index.erase(key);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Replaces the position of existing keys, as overwrites do
+void BM_IndexUpdate(benchmark::State& state) {
+  auto n = static_cast<std::uint64_t>(state.range(0));
+  auto& index = IndexOf(n);
+  std::mt19937_64 engine(42);
+  std::uniform_int_distribution<std::uint64_t> dist(0, n - 1);
+  std::uint64_t value_pos = 0;
+  for (auto _ : state) {
+    auto it = index.find(Key(KeyAt(dist(engine))));
+    it->second.pos.value_pos = value_pos++;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+}  // namespace mybitcask
+
+int main(int argc, char** argv) {
+  std::int64_t max_keys = 10 * 1000 * 1000;
+  // --max_keys is ours, the other flags are Google Benchmark's
+  std::vector<char*> args;
+  for (int i = 0; i < argc; i++) {
+    absl::string_view arg(argv[i]);
+    if (absl::ConsumePrefix(&arg, "--max_keys=")) {
+      if (!absl::SimpleAtoi(arg, &max_keys) || max_keys < 1) {
+        std::fprintf(stderr, "invalid --max_keys\n");
+        return 1;
+      }
+      continue;
+    }
+    args.push_back(argv[i]);
+  }
+  const std::vector<std::pair<const char*, void (*)(benchmark::State&)>>
+      benchmarks = {
+          {"BM_IndexLookup", mybitcask::BM_IndexLookup},
+          {"BM_IndexLookupMissing", mybitcask::BM_IndexLookupMissing},
+          {"BM_IndexInsert", mybitcask::BM_IndexInsert},
+          {"BM_IndexUpdate", mybitcask::BM_IndexUpdate}};
+  // Grouped by index size, so each index is built once
+  for (std::int64_t n = 1000 * 1000; n <= max_keys; n *= 10) {
+    for (auto& bm : benchmarks) {
+      benchmark::RegisterBenchmark(bm.first, bm.second)
+          ->ArgName("keys")
+          ->Arg(n);
+    }
+  }
+  int args_len = static_cast<int>(args.size());
+  benchmark::Initialize(&args_len, args.data());
+  if (benchmark::ReportUnrecognizedArguments(args_len, args.data())) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
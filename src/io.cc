@@ -1,5 +1,7 @@
 #include "mybitcask/internal/io.h"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 
 namespace mybitcask {
@@ -10,39 +12,159 @@ class FStreamSequentialWriter : public SequentialWriter {
   FStreamSequentialWriter() = delete;
   ~FStreamSequentialWriter() override { file_.close(); }
 
-  absl::StatusOr<std::uint32_t> Append(
+  absl::StatusOr<std::uint64_t> Append(
       absl::Span<const std::uint8_t> src) noexcept override {
     file_.write(reinterpret_cast<const char*>(src.data()), src.size());
     if (file_.fail()) {
       return absl::InternalError("write failed");
     }
-    std::uint32_t offset = current_offset_;
+    std::uint64_t offset = current_offset_;
     current_offset_ += src.size();
     return offset;
   }
 
+  absl::Status Truncate(std::uint64_t size) noexcept override {
+    // The file is opened in append mode, so writes continue at the new end
+    file_.clear();
+    file_.flush();
+    std::error_code ec;
+    ghc::filesystem::resize_file(filename_, size, ec);
+    if (ec) {
+      return absl::InternalError(ec.message());
+    }
+    current_offset_ = size;
+    return absl::OkStatus();
+  }
+
   absl::Status Sync() noexcept override {
     file_.flush();
     return absl::OkStatus();
   }
 
-  std::uint32_t Size() const noexcept override { return current_offset_; }
+  std::uint64_t Size() const noexcept override { return current_offset_; }
 
  private:
   FStreamSequentialWriter(ghc::filesystem::path&& filename,
-                          std::ofstream&& file, std::uint32_t current_offset)
+                          std::ofstream&& file, std::uint64_t current_offset)
       : filename_(std::move(filename)),
         file_(std::move(file)),
         current_offset_(current_offset) {}
 
   std::ofstream file_;
-  std::uint32_t current_offset_;
+  std::uint64_t current_offset_;
   const ghc::filesystem::path filename_;
 
   friend absl::StatusOr<std::unique_ptr<SequentialWriter>>
   OpenSequentialFileWriter(ghc::filesystem::path&& filename) noexcept;
 };
 
+class FStreamSequentialReader : public SequentialReader {
+ public:
+  FStreamSequentialReader() = delete;
+  ~FStreamSequentialReader() override { file_.close(); }
+
+  absl::StatusOr<std::size_t> Read(
+      absl::Span<std::uint8_t> dst) noexcept override {
+    file_.read(reinterpret_cast<char*>(dst.data()), dst.size());
+    if (file_.bad()) {
+      return absl::InternalError("read failed");
+    }
+    auto read_len = static_cast<std::size_t>(file_.gcount());
+    if (file_.eof()) {
+      // Reaching EOF is not an error, following reads return 0
+      file_.clear();
+      file_.seekg(0, std::ios::end);
+    }
+    return read_len;
+  }
+
+  absl::Status Skip(std::uint64_t offset) noexcept override {
+    auto current = static_cast<std::uint64_t>(file_.tellg());
+    auto target = std::min(current + offset, size_);
+    file_.seekg(static_cast<std::streamoff>(target), std::ios::beg);
+    if (file_.fail()) {
+      return absl::InternalError("seek failed");
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  FStreamSequentialReader(std::ifstream&& file, std::uint64_t size)
+      : file_(std::move(file)), size_(size) {}
+
+  std::ifstream file_;
+  const std::uint64_t size_;
+
+  friend absl::StatusOr<std::unique_ptr<SequentialReader>>
+  OpenSequentialFileReader(ghc::filesystem::path&& filename) noexcept;
+};
+
+Scanner::Scanner(std::unique_ptr<SequentialReader>&& reader,
+                 std::size_t buffer_size)
+    : reader_(std::move(reader)),
+      buf_(buffer_size),
+      begin_(0),
+      end_(0),
+      offset_(0) {}
+
+absl::StatusOr<std::size_t> Scanner::Peek(std::size_t n) noexcept {
+  if (end_ - begin_ >= n) {
+    return end_ - begin_;
+  }
+  // Move the buffered bytes to the front, and grow the buffer if a single
+  // peek does not fit.
+  if (begin_ > 0) {
+    std::memmove(buf_.data(), buf_.data() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+  }
+  if (buf_.size() < n) {
+    buf_.resize(n);
+  }
+  while (end_ < n) {
+    auto read_len =
+        reader_->Read(absl::MakeSpan(buf_.data() + end_, buf_.size() - end_));
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    if (*read_len == 0) {
+      break;
+    }
+    end_ += *read_len;
+  }
+  return end_;
+}
+
+absl::Status Scanner::Skip(std::uint64_t n) noexcept {
+  offset_ += n;
+  auto buffered = static_cast<std::uint64_t>(end_ - begin_);
+  if (n <= buffered) {
+    begin_ += static_cast<std::size_t>(n);
+    return absl::OkStatus();
+  }
+  begin_ = end_ = 0;
+  return reader_->Skip(n - buffered);
+}
+
+void Scanner::Reset(std::uint64_t offset) {
+  begin_ = end_ = 0;
+  offset_ = offset;
+}
+
+absl::StatusOr<std::unique_ptr<SequentialReader>> OpenSequentialFileReader(
+    ghc::filesystem::path&& filename) noexcept {
+  std::ifstream file(filename, std::fstream::in | std::fstream::binary);
+  if (!file.is_open()) {
+    return absl::InternalError(kErrOpenFailed);
+  }
+  auto filesize = GetFileSize(filename);
+  if (!filesize.ok()) {
+    return absl::Status(filesize.status());
+  }
+  return std::unique_ptr<SequentialReader>(
+      new FStreamSequentialReader(std::move(file), *filesize));
+}
+
 absl::StatusOr<std::unique_ptr<SequentialWriter>> OpenSequentialFileWriter(
     ghc::filesystem::path&& filename) noexcept {
   std::ofstream file(
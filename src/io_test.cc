@@ -36,6 +36,83 @@ TEST(IoTest, SequentialWriter) {
   EXPECT_EQ(read_data.str(), test_data);
 }
 
+TEST(IoTest, SequentialReader) {
+  auto tempfile = test::MakeTempFile("mybitcask_test_", ".tmp");
+  ASSERT_TRUE(tempfile.ok());
+
+  const std::string test_data = "test data.";
+
+  std::ofstream tempfile_stream(tempfile->path());
+  tempfile_stream << test_data;
+  tempfile_stream.close();
+
+  auto filename = tempfile->path();
+  auto reader = OpenSequentialFileReader(std::move(filename));
+  ASSERT_TRUE(reader.ok());
+
+  std::uint8_t buf[4]{};
+  auto actual_size = (*reader)->Read(buf);
+  ASSERT_TRUE(actual_size.ok());
+  ASSERT_EQ(*actual_size, 4);
+  EXPECT_EQ(std::string(reinterpret_cast<char*>(buf), 4), "test");
+
+  ASSERT_TRUE((*reader)->Skip(1).ok());
+  actual_size = (*reader)->Read(buf);
+  ASSERT_TRUE(actual_size.ok());
+  ASSERT_EQ(*actual_size, 4);
+  EXPECT_EQ(std::string(reinterpret_cast<char*>(buf), 4), "data");
+
+  // short read at the end of file
+  actual_size = (*reader)->Read(buf);
+  ASSERT_TRUE(actual_size.ok());
+  ASSERT_EQ(*actual_size, 1);
+
+  ASSERT_TRUE((*reader)->Skip(100).ok());
+  actual_size = (*reader)->Read(buf);
+  ASSERT_TRUE(actual_size.ok());
+  ASSERT_EQ(*actual_size, 0);
+}
+
+TEST(IoTest, Scanner) {
+  auto tempfile = test::MakeTempFile("mybitcask_test_", ".tmp");
+  ASSERT_TRUE(tempfile.ok());
+
+  const std::string test_data = "0123456789abcdefghij";
+
+  std::ofstream tempfile_stream(tempfile->path());
+  tempfile_stream << test_data;
+  tempfile_stream.close();
+
+  auto filename = tempfile->path();
+  auto reader = OpenSequentialFileReader(std::move(filename));
+  ASSERT_TRUE(reader.ok());
+  // buffer smaller than a single peek
+  Scanner scanner(std::move(reader).value(), 4);
+
+  auto buffered = scanner.Peek(6);
+  ASSERT_TRUE(buffered.ok());
+  ASSERT_GE(*buffered, 6);
+  EXPECT_EQ(std::string(reinterpret_cast<const char*>(scanner.data()), 6),
+            "012345");
+  ASSERT_TRUE(scanner.Skip(3).ok());
+  buffered = scanner.Peek(4);
+  ASSERT_TRUE(buffered.ok());
+  EXPECT_EQ(std::string(reinterpret_cast<const char*>(scanner.data()), 4),
+            "3456");
+  // skip past the buffered bytes
+  ASSERT_TRUE(scanner.Skip(10).ok());
+  EXPECT_EQ(scanner.offset(), 13);
+  buffered = scanner.Peek(10);
+  ASSERT_TRUE(buffered.ok());
+  ASSERT_EQ(*buffered, 7);
+  EXPECT_EQ(std::string(reinterpret_cast<const char*>(scanner.data()), 7),
+            "defghij");
+  ASSERT_TRUE(scanner.Skip(7).ok());
+  buffered = scanner.Peek(1);
+  ASSERT_TRUE(buffered.ok());
+  EXPECT_EQ(*buffered, 0);
+}
+
 TEST(IoTest, RandomAccessFileReader) {
   auto tempfile = test::MakeTempFile("mybitcask_test_", ".tmp");
   ASSERT_TRUE(tempfile.ok());
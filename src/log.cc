@@ -1,17 +1,49 @@
 #include "mybitcask/internal/log.h"
 
 #include "absl/base/internal/endian.h"
+#include "absl/time/clock.h"
 #include "assert.h"
+#include "coding.h"
 #include "crc32c/crc32c.h"
 #include "mybitcask/internal/log.h"
+#include "mybitcask/internal/perf_context.h"
 #include "mybitcask/mybitcask.h"
+#include "store_filename.h"
+#include "store_hint.h"
 
+#include <algorithm>
 #include <cstring>
 
 namespace mybitcask {
 namespace log {
 
-// Format of log entry on disk
+// A log file of kFormatVersion starts with a file header:
+//
+// +--------------+----------------+-------------------+-- - - - - --+
+// | magic(64bit) | version(32bit) | dict_len(32bit)   | dictionary  |
+// +--------------+----------------+-------------------+-- - - - - --+
+//
+// The dictionary is empty unless values are compressed against it, it is
+// written once when the file is created. The header is followed by log
+// entries:
+//
+// |<-------------------- CRC coverage -------------------->|
+// +-------+---------+-----------+-- - - --+-- - - --+--------+
+// | flags | key_len | value_len |   key   |   val   | CRC32C |
+// +-------+---------+-----------+-- - - --+-- - - --+--------+
+//  (8bits) (varint)  (varint)                         (32bits)
+//
+// The CRC follows the value, so an entry can be written while its value is
+// still being produced. Bit 0 of the flags marks tombstones and bits 1-3 hold
+// the compression type of the value, in which case `val_len` is the length
+// of the compressed value.
+//
+// Log files of kBlockFormatVersion hold the same file header and entries,
+// which are the content of the blocks the file is divided into, see
+// store::kBlockSize. Their positions are file offsets, so reading an entry
+// which spans blocks leaves out the block trailers in between.
+//
+// Log files of kLegacyVersion have no file header, and their entries are
 //
 //          |<---------- CRC coverage ----------->|
 //              +---- length of ----+
@@ -25,12 +57,419 @@ namespace log {
 //                       +----- size of -----+
 
 // Tombstone is a special mark that indicates that a record once occupied the
-// slot but does so no longer. When the `val_len` value in the log entry is
-// kTombstone(0xFFFF), it means delete the record corresponding to the key. In
-// this case the `val` in this log entry is empty
+// slot but does so no longer. When the `val_len` value in a kLegacyVersion
+// log entry is kTombstone(0xFFFF), it means delete the record corresponding
+// to the key. In this case the `val` in this log entry is empty
 const std::uint16_t kTombstone = 0xFFFF;
 
+std::vector<std::uint8_t> FileHeader(absl::Span<const std::uint8_t> dictionary,
+                                     std::uint32_t version) {
+  std::vector<std::uint8_t> header(log_internal::kFileHeaderLen);
+  absl::little_endian::Store64(header.data(), log_internal::kFileMagic);
+  absl::little_endian::Store32(&header[log_internal::kFileMagicLen], version);
+  absl::little_endian::Store32(&header[log_internal::kFileMagicLen + 4],
+                               static_cast<std::uint32_t>(dictionary.size()));
+  header.insert(header.end(), dictionary.begin(), dictionary.end());
+  return header;
+}
+
+std::uint64_t EntryLen(std::uint64_t key_len, std::uint64_t value_len) {
+  return log_internal::EntryHeaderLen(key_len, value_len) + key_len +
+         value_len + log_internal::kCrc32Len;
+}
+
+std::uint64_t NowMillis() {
+  return static_cast<std::uint64_t>(absl::ToUnixMillis(absl::Now()));
+}
+
+absl::StatusOr<absl::optional<std::uint32_t>> ReadFormatVersion(
+    const ghc::filesystem::path& log_file_path, Env* env) noexcept {
+  if (!env->FileExists(log_file_path)) {
+    return absl::nullopt;
+  }
+  auto reader = env->NewSequentialReader(log_file_path);
+  if (!reader.ok()) {
+    return reader.status();
+  }
+  std::uint8_t header[log_internal::kFileHeaderLen]{};
+  std::size_t header_len = 0;
+  while (header_len < log_internal::kFileHeaderLen) {
+    auto read_len = (*reader)->Read(
+        absl::MakeSpan(header + header_len, sizeof(header) - header_len));
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    if (*read_len == 0) {
+      break;
+    }
+    header_len += *read_len;
+  }
+  if (header_len == 0) {
+    return absl::nullopt;
+  }
+  auto version =
+      log_internal::DecodeFormatVersion(absl::MakeSpan(header, header_len));
+  if (!version.has_value()) {
+    return absl::InternalError(kErrBadEntry);
+  }
+  return version;
+}
+
+absl::StatusOr<std::vector<std::uint8_t>> ReadDictionary(
+    const ghc::filesystem::path& log_file_path, Env* env) noexcept {
+  auto version = ReadFormatVersion(log_file_path, env);
+  if (!version.ok()) {
+    return version.status();
+  }
+  if (!version->has_value() || **version == kLegacyVersion) {
+    return std::vector<std::uint8_t>();
+  }
+  auto reader = env->NewSequentialReader(log_file_path);
+  if (!reader.ok()) {
+    return reader.status();
+  }
+  std::unique_ptr<io::SequentialReader> source = std::move(reader).value();
+  if (**version == kBlockFormatVersion) {
+    source.reset(new store::BlockReader(std::move(source)));
+  }
+  io::Scanner scanner(std::move(source));
+  auto read_len = scanner.Peek(log_internal::kFileHeaderLen);
+  if (!read_len.ok()) {
+    return read_len.status();
+  }
+  std::size_t header_len =
+      log_internal::kFileHeaderLen +
+      log_internal::DecodeDictionaryLen(
+          absl::MakeSpan(scanner.data(), log_internal::kFileHeaderLen));
+  read_len = scanner.Peek(header_len);
+  if (!read_len.ok()) {
+    return read_len.status();
+  }
+  if (*read_len < header_len) {
+    return absl::InternalError(kErrBadEntry);
+  }
+  return std::vector<std::uint8_t>(
+      scanner.data() + log_internal::kFileHeaderLen,
+      scanner.data() + header_len);
+}
+
+absl::StatusOr<TornTail> FindTornTail(
+    const ghc::filesystem::path& log_file_path, std::uint64_t verify_len,
+    Env* env) noexcept {
+  auto file_len = env->GetFileSize(log_file_path);
+  if (!file_len.ok()) {
+    return file_len.status();
+  }
+  TornTail tail{*file_len, *file_len};
+  auto version = ReadFormatVersion(log_file_path, env);
+  if (!version.ok()) {
+    if (*file_len < log_internal::kFileHeaderLen) {
+      // a torn file header
+      tail.valid_len = 0;
+      return tail;
+    }
+    return version.status();
+  }
+  if (!version->has_value()) {
+    return tail;
+  }
+  if (**version > kBlockFormatVersion) {
+    return absl::InternalError(kErrUnsupportedVersion);
+  }
+  auto reader = env->NewSequentialReader(log_file_path);
+  if (!reader.ok()) {
+    return reader.status();
+  }
+  std::unique_ptr<io::SequentialReader> source = std::move(reader).value();
+  if (**version == kBlockFormatVersion) {
+    source.reset(new store::BlockReader(std::move(source)));
+  }
+  io::Scanner scanner(std::move(source));
+  auto content_len = log_internal::ContentOffset(**version, *file_len);
+  auto verify_from = content_len > verify_len ? content_len - verify_len : 0;
+
+  if (**version != kLegacyVersion) {
+    auto read_len = scanner.Peek(log_internal::kFileHeaderLen);
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    std::uint64_t header_len =
+        log_internal::kFileHeaderLen +
+        static_cast<std::uint64_t>(log_internal::DecodeDictionaryLen(
+            absl::MakeSpan(scanner.data(), log_internal::kFileHeaderLen)));
+    if (header_len > content_len) {
+      tail.valid_len = 0;
+      return tail;
+    }
+    auto status = scanner.Skip(header_len);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  // Feed the next `n` bytes to the CRC of the current entry
+  std::uint32_t crc = 0;
+  auto extend_crc = [&](std::uint64_t n) -> absl::Status {
+    while (n > 0) {
+      auto piece = static_cast<std::size_t>(
+          std::min<std::uint64_t>(n, io::kScanBufferSize));
+      auto read_len = scanner.Peek(piece);
+      if (!read_len.ok()) {
+        return read_len.status();
+      }
+      if (*read_len < piece) {
+        return absl::InternalError(kErrBadEntry);
+      }
+      crc = crc32c::Extend(crc, scanner.data(), piece);
+      auto status = scanner.Skip(piece);
+      if (!status.ok()) {
+        return status;
+      }
+      n -= piece;
+    }
+    return absl::OkStatus();
+  };
+  auto load_crc = [&](std::uint32_t* expected) -> absl::Status {
+    auto read_len = scanner.Peek(log_internal::kCrc32Len);
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    if (*read_len < log_internal::kCrc32Len) {
+      return absl::InternalError(kErrBadEntry);
+    }
+    *expected = absl::little_endian::Load32(scanner.data());
+    return scanner.Skip(log_internal::kCrc32Len);
+  };
+
+  // Entries fail verification with these errors, others are I/O errors
+  auto unverified = [](const absl::Status& status) {
+    return absl::IsDataLoss(status) || status.message() == kErrBadEntry;
+  };
+  log_internal::EntryHeader header{};
+  while (true) {
+    auto entry_offset = scanner.offset();
+    auto found = log_internal::PeekEntry(&scanner, **version, &header);
+    if (!found.ok()) {
+      if (entry_offset < verify_from || !unverified(found.status())) {
+        return found.status();
+      }
+      tail.valid_len = log_internal::FileOffset(**version, entry_offset);
+      return tail;
+    }
+    if (!*found) {
+      return tail;
+    }
+    std::uint64_t entry_len = header.header_len + header.key_len +
+                              header.value_len +
+                              log_internal::TrailerLen(**version);
+    if (entry_len > content_len - entry_offset) {
+      tail.valid_len = log_internal::FileOffset(**version, entry_offset);
+      return tail;
+    }
+    if (entry_offset < verify_from) {
+      auto status = scanner.Skip(entry_len);
+      if (!status.ok()) {
+        return status;
+      }
+      continue;
+    }
+    std::uint32_t expected_crc = 0;
+    crc = 0;
+    auto status = absl::OkStatus();
+    if (**version == kLegacyVersion) {
+      // The CRC leads the entry and covers the rest of it
+      status = load_crc(&expected_crc);
+      if (status.ok()) {
+        status = extend_crc(entry_len - log_internal::kCrc32Len);
+      }
+    } else {
+      status = extend_crc(entry_len - log_internal::kCrc32Len);
+      if (status.ok()) {
+        status = load_crc(&expected_crc);
+      }
+    }
+    if (!status.ok() && !unverified(status)) {
+      return status;
+    }
+    if (!status.ok() || crc != expected_crc) {
+      tail.valid_len = log_internal::FileOffset(**version, entry_offset);
+      return tail;
+    }
+  }
+}
+
 namespace log_internal {
+
+std::uint32_t DecodeDictionaryLen(absl::Span<const std::uint8_t> header) {
+  return absl::little_endian::Load32(&header[kFileMagicLen + 4]);
+}
+
+absl::optional<std::uint32_t> DecodeFormatVersion(
+    absl::Span<const std::uint8_t> data) {
+  if (data.size() < kFileMagicLen) {
+    return absl::nullopt;
+  }
+  if (absl::little_endian::Load64(data.data()) != kFileMagic) {
+    return kLegacyVersion;
+  }
+  if (data.size() < kFileHeaderLen) {
+    return absl::nullopt;
+  }
+  return absl::little_endian::Load32(&data[kFileMagicLen]);
+}
+
+std::size_t EntryHeaderLen(std::uint64_t key_len, std::uint64_t value_len,
+                           std::uint64_t expire_at) {
+  return 1 + coding::VarintLength(key_len) + coding::VarintLength(value_len) +
+         (expire_at != 0 ? coding::VarintLength(expire_at) : 0);
+}
+
+std::size_t EncodeEntryHeader(const EntryHeader& header, std::uint8_t* dst) {
+  auto p = dst;
+  *(p++) = static_cast<std::uint8_t>(
+      (header.tombstone ? kTombstoneFlag : 0) |
+      (header.compression << kCompressionShift & kCompressionMask) |
+      (header.expire_at != 0 ? kExpireFlag : 0));
+  p = coding::EncodeVarint64(p, header.key_len);
+  p = coding::EncodeVarint64(p, header.value_len);
+  if (header.expire_at != 0) {
+    p = coding::EncodeVarint64(p, header.expire_at);
+  }
+  return static_cast<std::size_t>(p - dst);
+}
+
+absl::Status CheckEntry(std::uint64_t key_len,
+                        absl::optional<std::uint64_t> value_len,
+                        std::uint8_t compression) {
+  if (key_len == 0 || key_len > kMaxKeyLen) {
+    return absl::InternalError(kErrBadKeyLength);
+  }
+  if (value_len.has_value() && (*value_len == 0 || *value_len > kMaxValueLen)) {
+    return absl::InternalError(kErrBadValueLength);
+  }
+  if (compression > compression::kMaxCompressionType) {
+    return absl::InternalError(kErrUnknownCompression);
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<EntryHeader> EncodeEntryPrefix(
+    absl::Span<const std::uint8_t> key,
+    absl::optional<std::uint64_t> value_len, std::uint8_t compression,
+    std::uint64_t expire_at, std::vector<std::uint8_t>* dst) {
+  auto status = CheckEntry(key.size(), value_len, compression);
+  if (!status.ok()) {
+    return status;
+  }
+  EntryHeader header{!value_len.has_value(), compression, key.size(),
+                     value_len.value_or(0), expire_at, 0};
+  auto begin = dst->size();
+  dst->resize(begin + kMaxEntryHeaderLen + key.size());
+  header.header_len = EncodeEntryHeader(header, dst->data() + begin);
+  std::memcpy(dst->data() + begin + header.header_len, key.data(),
+              key.size());
+  dst->resize(begin + header.header_len + key.size());
+  return header;
+}
+
+bool DecodeEntryHeader(absl::Span<const std::uint8_t> src,
+                       EntryHeader* header) {
+  if (src.empty()) {
+    return false;
+  }
+  auto limit = src.data() + src.size();
+  header->tombstone = (src[0] & kTombstoneFlag) != 0;
+  header->compression = (src[0] & kCompressionMask) >> kCompressionShift;
+  auto p = coding::DecodeVarint64(src.data() + 1, limit, &header->key_len);
+  if (p == nullptr) {
+    return false;
+  }
+  p = coding::DecodeVarint64(p, limit, &header->value_len);
+  if (p == nullptr) {
+    return false;
+  }
+  header->expire_at = 0;
+  if ((src[0] & kExpireFlag) != 0) {
+    p = coding::DecodeVarint64(p, limit, &header->expire_at);
+    if (p == nullptr || header->expire_at == 0) {
+      return false;
+    }
+  }
+  if (header->key_len == 0 || header->key_len > kMaxKeyLen ||
+      header->value_len > kMaxValueLen ||
+      (header->tombstone &&
+       (header->value_len != 0 || header->expire_at != 0 ||
+        header->compression != compression::kNoCompression))) {
+    return false;
+  }
+  header->header_len = static_cast<std::size_t>(p - src.data());
+  return true;
+}
+
+absl::StatusOr<bool> PeekEntry(io::Scanner* scanner, std::uint32_t version,
+                               EntryHeader* header) noexcept {
+  if (version == kLegacyVersion) {
+    auto read_len = scanner->Peek(kHeaderLen);
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    if (*read_len == 0) {
+      return false;
+    }
+    if (*read_len < kHeaderLen) {
+      return absl::InternalError(kErrBadEntry);
+    }
+    std::uint8_t header_data[kHeaderLen]{};
+    std::memcpy(header_data, scanner->data(), kHeaderLen);
+    RawHeader raw_header(header_data);
+    header->tombstone = raw_header.is_tombstone();
+    header->compression = compression::kNoCompression;
+    header->key_len = raw_header.key_len();
+    header->value_len = raw_header.value_len();
+    header->expire_at = 0;
+    header->header_len = kHeaderLen;
+  } else {
+    auto read_len = scanner->Peek(kMaxEntryHeaderLen);
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    if (*read_len == 0) {
+      return false;
+    }
+    if (!DecodeEntryHeader(
+            absl::MakeSpan(scanner->data(),
+                           std::min<std::size_t>(*read_len,
+                                                 kMaxEntryHeaderLen)),
+            header)) {
+      return absl::InternalError(kErrBadEntry);
+    }
+  }
+  std::size_t key_end = header->header_len + header->key_len;
+  auto read_len = scanner->Peek(key_end);
+  if (!read_len.ok()) {
+    return read_len.status();
+  }
+  if (*read_len < key_end) {
+    return absl::InternalError(kErrBadEntry);
+  }
+  return true;
+}
+
+std::uint32_t TrailerLen(std::uint32_t version) {
+  return version == kLegacyVersion ? 0 : kCrc32Len;
+}
+
+std::uint64_t ContentOffset(std::uint32_t version, std::uint64_t file_offset) {
+  return version == kBlockFormatVersion ? store::BlockContentOffset(file_offset)
+                                        : file_offset;
+}
+
+std::uint64_t FileOffset(std::uint32_t version, std::uint64_t content_offset) {
+  return version == kBlockFormatVersion
+             ? store::BlockFileOffset(content_offset)
+             : content_offset;
+}
+
 RawHeader::RawHeader(std::uint8_t* const data) : data_(data) {}
 
 std::uint8_t RawHeader::key_len() const { return data_[kCrc32Len]; }
@@ -74,60 +513,274 @@ std::uint32_t RawHeader::crc32() const {
 
 }  // namespace log_internal
 
-Entry::Entry(std::uint32_t length)
-    : ptr_(new uint8_t[length]), key_len_(0), value_len_(0) {}
+Entry::Entry(std::uint64_t length)
+    : header_len_(0), key_len_(0), value_len_(0), ptr_(new uint8_t[length]) {}
 
 absl::Span<const std::uint8_t> Entry::key() const {
-  return {raw_ptr() + log_internal::kHeaderLen, key_len_};
+  return {raw_ptr() + header_len_, key_len_};
 }
 
 absl::Span<const std::uint8_t> Entry::value() const {
-  return {raw_ptr() + log_internal::kHeaderLen + key_len_, value_len_};
+  return {raw_ptr() + header_len_ + key_len_, value_len_};
 }
 
-Reader::Reader(store::Store* src, bool checksum)
-    : src_(src), checksum_(checksum) {}
+Reader::Reader(store::Store* src, bool checksum,
+               std::shared_ptr<const compression::Compressor> compressor)
+    : src_(src),
+      checksum_(checksum),
+      compressor_(std::move(compressor)),
+      formats_(new log_internal::FormatCache()) {}
 
-absl::StatusOr<bool> Reader::Read(const Position& pos, std::uint8_t key_len,
+absl::StatusOr<bool> Reader::Read(const Position& pos, std::uint32_t key_len,
                                   std::uint8_t* value) noexcept {
-  if (checksum_) {
-    auto entry = Read(pos, key_len);
-    if (!entry.ok()) {
-      return entry.status();
+  return read_value(pos, key_len, absl::MakeSpan(value, pos.value_len),
+                    [](absl::Span<const std::uint8_t>) {
+                      // the value is read in place
+                      return absl::OkStatus();
+                    });
+}
+
+absl::StatusOr<bool> Reader::ReadValue(
+    const Position& pos, std::uint32_t key_len,
+    const std::function<std::uint8_t*(std::uint64_t)>& alloc) noexcept {
+  if (pos.compression == compression::kNoCompression) {
+    return Read(pos, key_len, alloc(pos.value_len));
+  }
+  const compression::Compressor* codec = nullptr;
+  const compression::Dictionary* dictionary = nullptr;
+  if (pos.compression == compression::kLzDictCompression) {
+    // The dictionary of the file is read along with its format
+    auto format = file_format(pos.file_id);
+    if (!format.ok()) {
+      return format.status();
     }
-    if (!entry->has_value()) {
+    if (*format == nullptr) {
+      // entry does not exist
       return false;
     }
-    auto entry_val = (*entry)->value();
-    std::memcpy(value, entry_val.data(), entry_val.length());
-    return true;
+    if ((*format)->dictionary == nullptr) {
+      return absl::InternalError(kErrBadEntry);
+    }
+    dictionary = (*format)->dictionary.get();
+    codec = compression::LzCompressor().get();
+  } else {
+    codec = compressor(pos.compression);
+    if (codec == nullptr) {
+      return absl::InternalError(kErrUnknownCompression);
+    }
+  }
+  std::vector<std::uint8_t> compressed(pos.value_len);
+  auto found = Read(pos, key_len, compressed.data());
+  if (!found.ok() || !*found) {
+    return found;
+  }
+  auto value_len = codec->UncompressedLength(absl::MakeSpan(compressed));
+  if (!value_len.ok() || *value_len == 0 || *value_len > kMaxValueLen) {
+    return absl::InternalError(kErrBadEntry);
   }
+  auto dst = absl::MakeSpan(alloc(*value_len), *value_len);
+  PerfTimer timer(&PerfContext::decompress_nanos);
+  auto status = dictionary != nullptr
+                    ? dictionary->Uncompress(absl::MakeSpan(compressed), dst)
+                    : codec->Uncompress(absl::MakeSpan(compressed), dst);
+  if (!status.ok()) {
+    return absl::InternalError(kErrBadEntry);
+  }
+  return true;
+}
 
-  auto dst = absl::MakeSpan(value, pos.value_len);
-  auto read_len =
-      src_->ReadAt(store::Position(pos.file_id, pos.value_pos), dst);
-  if (!read_len.ok()) {
-    return read_len.status();
+absl::StatusOr<bool> Reader::ReadStream(const Position& pos,
+                                        std::uint32_t key_len,
+                                        const ValueSink& sink) noexcept {
+  if (pos.compression == compression::kNoCompression) {
+    return ReadStoredStream(pos, key_len, sink);
   }
-  if (*read_len == 0) {
-    // entry does not exist
+  // A compressed value is decompressed as a whole
+  std::vector<std::uint8_t> value;
+  auto found = ReadValue(pos, key_len, [&](std::uint64_t len) {
+    value.resize(len);
+    return value.data();
+  });
+  if (!found.ok() || !*found) {
+    return found;
+  }
+  auto data = absl::MakeSpan(value);
+  for (std::size_t offset = 0; offset < data.size();
+       offset += kStreamChunkSize) {
+    auto status = sink(data.subspan(offset, kStreamChunkSize));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return true;
+}
+
+absl::StatusOr<bool> Reader::ReadStoredStream(const Position& pos,
+                                              std::uint32_t key_len,
+                                              const ValueSink& sink) noexcept {
+  std::vector<std::uint8_t> buf(
+      std::min<std::uint64_t>(pos.value_len, kStreamChunkSize));
+  return read_value(pos, key_len, absl::MakeSpan(buf), sink);
+}
+
+absl::StatusOr<bool> Reader::read_value(const Position& pos,
+                                        std::uint32_t key_len,
+                                        absl::Span<std::uint8_t> buf,
+                                        const ValueSink& sink) noexcept {
+  if (pos.value_len == 0) {
+    // tombstone entries have no value
     return false;
   }
-  if (*read_len != dst.length()) {
-    return absl::InternalError(kErrBadEntry);
+  PerfTimer timer(&PerfContext::log_read_nanos);
+  PerfCount(&PerfContext::log_read_count);
+  std::uint32_t version = kLegacyVersion;
+  std::uint32_t crc = 0;
+  std::uint32_t expected_crc = 0;
+  // A value within the content of one block is read the same way from files
+  // of every format, any other value needs the format of its file
+  bool in_block = pos.value_pos % store::kBlockSize + pos.value_len <=
+                  store::kBlockContentLen;
+  if (checksum_ || !in_block) {
+    auto format = file_format(pos.file_id);
+    if (!format.ok()) {
+      return format.status();
+    }
+    if (*format == nullptr) {
+      // entry does not exist
+      return false;
+    }
+    version = (*format)->version;
+  }
+  auto value_offset = log_internal::ContentOffset(version, pos.value_pos);
+  if (checksum_) {
+    std::size_t header_len =
+        version == kLegacyVersion
+            ? log_internal::kHeaderLen
+            : log_internal::EntryHeaderLen(key_len, pos.value_len,
+                                           pos.expire_at);
+    if (value_offset < header_len + key_len) {
+      return absl::InternalError(kErrBadEntry);
+    }
+    // header and key
+    std::vector<std::uint8_t> prefix(header_len + key_len);
+    auto read_len = read_at(
+        version, pos.file_id,
+        log_internal::FileOffset(version, value_offset - prefix.size()),
+        absl::MakeSpan(prefix));
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    if (*read_len == 0) {
+      // entry does not exist
+      return false;
+    }
+    if (*read_len != prefix.size()) {
+      return absl::InternalError(kErrBadEntry);
+    }
+    if (version == kLegacyVersion) {
+      log_internal::RawHeader header(prefix.data());
+      if (header.is_tombstone() || header.key_len() != key_len ||
+          header.value_len() != pos.value_len) {
+        return absl::InternalError(kErrBadEntry);
+      }
+      expected_crc = header.crc32();
+      PerfTimer crc_timer(&PerfContext::read_checksum_nanos);
+      crc = crc32c::Crc32c(&prefix[log_internal::kCrc32Len],
+                           prefix.size() - log_internal::kCrc32Len);
+    } else {
+      log_internal::EntryHeader header{};
+      if (!log_internal::DecodeEntryHeader(absl::MakeSpan(prefix), &header) ||
+          header.tombstone || header.compression != pos.compression ||
+          header.key_len != key_len || header.value_len != pos.value_len ||
+          header.expire_at != pos.expire_at ||
+          header.header_len != header_len) {
+        return absl::InternalError(kErrBadEntry);
+      }
+      PerfTimer crc_timer(&PerfContext::read_checksum_nanos);
+      crc = crc32c::Crc32c(prefix.data(), prefix.size());
+    }
+  }
+
+  std::uint64_t offset = 0;
+  while (offset < pos.value_len) {
+    auto piece = buf.subspan(
+        0, static_cast<std::size_t>(
+               std::min<std::uint64_t>(buf.size(), pos.value_len - offset)));
+    auto read_len = read_at(
+        version, pos.file_id,
+        log_internal::FileOffset(version, value_offset + offset), piece);
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    if (*read_len == 0 && offset == 0) {
+      // entry does not exist
+      return false;
+    }
+    if (*read_len != piece.size()) {
+      return absl::InternalError(kErrBadEntry);
+    }
+    if (checksum_) {
+      PerfTimer crc_timer(&PerfContext::read_checksum_nanos);
+      crc = crc32c::Extend(crc, piece.data(), piece.size());
+    }
+    auto status = sink(piece);
+    if (!status.ok()) {
+      return status;
+    }
+    offset += piece.size();
+  }
+
+  if (checksum_) {
+    if (version != kLegacyVersion) {
+      std::uint8_t trailer[log_internal::kCrc32Len]{};
+      auto read_len = read_at(
+          version, pos.file_id,
+          log_internal::FileOffset(version, value_offset + pos.value_len),
+          absl::MakeSpan(trailer));
+      if (!read_len.ok()) {
+        return read_len.status();
+      }
+      if (*read_len != sizeof(trailer)) {
+        return absl::InternalError(kErrBadEntry);
+      }
+      expected_crc = absl::little_endian::Load32(trailer);
+    }
+    if (crc != expected_crc) {
+      return absl::InternalError(kErrBadEntry);
+    }
   }
   return true;
 }
 
 absl::StatusOr<absl::optional<Entry>> Reader::Read(
-    const Position& pos, std::uint8_t key_len) noexcept {
-  std::uint32_t entry_len = log_internal::kHeaderLen + key_len + pos.value_len;
+    const Position& pos, std::uint32_t key_len) noexcept {
+  auto format = file_format(pos.file_id);
+  if (!format.ok()) {
+    return format.status();
+  }
+  if (*format == nullptr) {
+    // entry does not exist
+    return absl::nullopt;
+  }
+  auto version = (*format)->version;
+  std::uint32_t header_len =
+      version == kLegacyVersion
+          ? log_internal::kHeaderLen
+          : static_cast<std::uint32_t>(
+                log_internal::EntryHeaderLen(key_len, pos.value_len,
+                                             pos.expire_at));
+  auto value_offset = log_internal::ContentOffset(version, pos.value_pos);
+  if (value_offset < header_len + key_len) {
+    return absl::InternalError(kErrBadEntry);
+  }
+  std::uint64_t entry_len = header_len + key_len + pos.value_len +
+                            log_internal::TrailerLen(version);
   Entry entry(entry_len);
 
-  auto read_len =
-      src_->ReadAt(store::Position(pos.file_id, pos.value_pos - key_len -
-                                                    log_internal::kHeaderLen),
-                   {entry.raw_ptr(), entry_len});
+  auto read_len = read_at(
+      version, pos.file_id,
+      log_internal::FileOffset(version, value_offset - key_len - header_len),
+      {entry.raw_ptr(), static_cast<std::size_t>(entry_len)});
   if (!read_len.ok()) {
     return read_len.status();
   }
@@ -138,91 +791,363 @@ absl::StatusOr<absl::optional<Entry>> Reader::Read(
   if (*read_len != entry_len) {
     return absl::InternalError(kErrBadEntry);
   }
-  log_internal::RawHeader header(entry.raw_ptr());
-  entry.set_key_len(header.key_len());
-  entry.set_value_len(header.value_len());
 
-  // check crc
-  if (checksum_ && !header.CheckCrc(entry.key().data())) {
-    return absl::InternalError(kErrBadEntry);
+  bool tombstone;
+  if (version == kLegacyVersion) {
+    log_internal::RawHeader header(entry.raw_ptr());
+    tombstone = header.is_tombstone();
+    entry.header_len_ = header_len;
+    entry.key_len_ = header.key_len();
+    entry.value_len_ = header.value_len();
+    if (entry.key_len_ != key_len || entry.value_len_ > pos.value_len) {
+      return absl::InternalError(kErrBadEntry);
+    }
+    // check crc
+    if (checksum_ && !header.CheckCrc(entry.key().data())) {
+      return absl::InternalError(kErrBadEntry);
+    }
+  } else {
+    log_internal::EntryHeader header{};
+    if (!log_internal::DecodeEntryHeader(
+            {entry.raw_ptr(), static_cast<std::size_t>(entry_len)},
+            &header) ||
+        header.header_len != header_len || header.key_len != key_len ||
+        header.value_len != pos.value_len ||
+        header.expire_at != pos.expire_at) {
+      return absl::InternalError(kErrBadEntry);
+    }
+    tombstone = header.tombstone;
+    entry.header_len_ = header_len;
+    entry.key_len_ = key_len;
+    entry.value_len_ = header.value_len;
+    // check crc
+    auto crc_offset = entry_len - log_internal::kCrc32Len;
+    if (checksum_ &&
+        crc32c::Crc32c(entry.raw_ptr(), crc_offset) !=
+            absl::little_endian::Load32(entry.raw_ptr() + crc_offset)) {
+      return absl::InternalError(kErrBadEntry);
+    }
   }
-  if (header.is_tombstone()) {
+  if (tombstone) {
     return absl::nullopt;
   }
   return entry;
 }
 
 KeyIter Reader::key_iter(store::file_id_t log_file_id) const {
-  return KeyIter(src_, log_file_id);
+  return KeyIter(src_->Path() / store::LogFilename(log_file_id),
+                 src_->env());
+}
+
+absl::StatusOr<const log_internal::FileFormat*> Reader::file_format(
+    store::file_id_t file_id) noexcept {
+  {
+    absl::ReaderMutexLock guard(&formats_->lock);
+    auto it = formats_->formats.find(file_id);
+    if (it != formats_->formats.end()) {
+      return &it->second;
+    }
+  }
+  // A legacy entry is at least as long as the magic number, and the file
+  // header of a newer log file is written together with its first entry
+  std::uint8_t header[log_internal::kFileHeaderLen]{};
+  auto read_len =
+      src_->ReadAt(store::Position(file_id, 0),
+                   absl::MakeSpan(header, log_internal::kFileMagicLen));
+  if (!read_len.ok()) {
+    return read_len.status();
+  }
+  auto version =
+      log_internal::DecodeFormatVersion(absl::MakeSpan(header, *read_len));
+  if (!version.has_value() && *read_len == log_internal::kFileMagicLen) {
+    read_len = src_->ReadAt(store::Position(file_id, 0),
+                            absl::MakeSpan(header, sizeof(header)));
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    version =
+        log_internal::DecodeFormatVersion(absl::MakeSpan(header, *read_len));
+  }
+  if (!version.has_value()) {
+    return nullptr;
+  }
+  if (*version > kBlockFormatVersion) {
+    return absl::InternalError(kErrUnsupportedVersion);
+  }
+  log_internal::FileFormat format{*version, nullptr};
+  std::uint32_t dictionary_len =
+      *version == kLegacyVersion
+          ? 0
+          : log_internal::DecodeDictionaryLen(absl::MakeSpan(header));
+  if (dictionary_len > 0) {
+    std::vector<std::uint8_t> dictionary(dictionary_len);
+    read_len = read_at(*version, file_id, log_internal::kFileHeaderLen,
+                       absl::MakeSpan(dictionary));
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    if (*read_len != dictionary.size()) {
+      return nullptr;
+    }
+    format.dictionary =
+        std::make_shared<compression::Dictionary>(std::move(dictionary));
+  }
+  absl::MutexLock guard(&formats_->lock);
+  return &formats_->formats.emplace(file_id, std::move(format)).first->second;
+}
+
+absl::StatusOr<std::size_t> Reader::read_at(
+    std::uint32_t version, store::file_id_t file_id, std::uint64_t offset,
+    absl::Span<std::uint8_t> dst) noexcept {
+  if (version == kBlockFormatVersion) {
+    return src_->ReadContentAt(store::Position(file_id, offset), dst);
+  }
+  return src_->ReadAt(store::Position(file_id, offset), dst);
+}
+
+const compression::Compressor* Reader::compressor(std::uint8_t type) const {
+  if (compressor_ != nullptr && compressor_->type() == type) {
+    return compressor_.get();
+  }
+  if (type == compression::kLzCompression) {
+    return compression::LzCompressor().get();
+  }
+  return nullptr;
+}
+
+Writer::Writer(store::Store* dest)
+    : dest_(dest),
+      hint_builder_(nullptr),
+      min_compress_len_(0),
+      dictionary_(new log_internal::WriterDictionary()) {}
+
+Writer::Writer(store::Store* dest, store::hint::Builder* hint_builder)
+    : dest_(dest),
+      hint_builder_(hint_builder),
+      min_compress_len_(0),
+      dictionary_(new log_internal::WriterDictionary()) {}
+
+void Writer::SetCompression(
+    std::shared_ptr<const compression::Compressor> compressor,
+    std::uint64_t min_value_len) {
+  compressor_ = std::move(compressor);
+  min_compress_len_ = min_value_len;
+}
+
+void Writer::SetDictionary(
+    std::shared_ptr<const compression::Dictionary> dictionary) {
+  absl::MutexLock guard(&dictionary_->lock);
+  dictionary_->dictionary = std::move(dictionary);
+  dictionary_->epoch++;
 }
 
-Writer::Writer(store::Store* dest) : dest_(dest) {}
+absl::Status Writer::ChangeDictionary(
+    std::shared_ptr<const compression::Dictionary> dictionary) noexcept {
+  auto version = dest_->block_framed() ? kBlockFormatVersion : kFormatVersion;
+  auto header = dictionary != nullptr ? FileHeader(dictionary->data(), version)
+                                      : FileHeader({}, version);
+  // Runs under the store append lock, so every value appended afterwards
+  // lands in a file starting with `dictionary`
+  return dest_->SetFileHeader(std::move(header),
+                              [&]() { SetDictionary(dictionary); });
+}
 
 absl::Status Writer::AppendTombstone(
     absl::Span<const std::uint8_t> key,
     const std::function<void(Position)>& success_callback) noexcept {
-  return AppendInner(key, {}, success_callback);
+  return AppendInner(key, absl::nullopt, compression::kNoCompression, 0,
+                     nullptr, nullptr, success_callback)
+      .status();
 }
 
 absl::Status Writer::Append(
     absl::Span<const std::uint8_t> key, absl::Span<const std::uint8_t> value,
-    const std::function<void(Position)>& success_callback) noexcept {
-  if (value.size() == 0) {
-    return absl::InternalError(kErrBadValueLength);
-  }
-  return AppendInner(key, value, success_callback);
+    const std::function<void(Position)>& success_callback,
+    std::uint64_t expire_at) noexcept {
+  return AppendValue(key, value, expire_at, nullptr, success_callback)
+      .status();
+}
+
+absl::StatusOr<bool> Writer::AppendIf(
+    absl::Span<const std::uint8_t> key, absl::Span<const std::uint8_t> value,
+    const std::function<bool()>& precondition,
+    const std::function<void(Position)>& success_callback,
+    std::uint64_t expire_at) noexcept {
+  return AppendValue(key, value, expire_at, &precondition, success_callback);
 }
 
-absl::Status Writer::AppendInner(
+absl::StatusOr<bool> Writer::AppendValue(
     absl::Span<const std::uint8_t> key, absl::Span<const std::uint8_t> value,
+    std::uint64_t expire_at, const std::function<bool()>* precondition,
     const std::function<void(Position)>& success_callback) noexcept {
-  if (key.size() == 0 || key.size() > 0xFF) {
-    return absl::InternalError(kErrBadKeyLength);
-  }
-  if (value.size() >= kTombstone) {
+  if (value.empty()) {
     return absl::InternalError(kErrBadValueLength);
   }
+  while (true) {
+    std::shared_ptr<const compression::Dictionary> dictionary;
+    std::uint64_t epoch;
+    {
+      absl::ReaderMutexLock guard(&dictionary_->lock);
+      dictionary = dictionary_->dictionary;
+      epoch = dictionary_->epoch;
+    }
+    std::vector<std::uint8_t> compressed;
+    auto type = compression::kNoCompression;
+    auto stored = value;
+    if (value.size() >= min_compress_len_) {
+      if (dictionary != nullptr &&
+          value.size() <= compression::kMaxDictionaryValueLen) {
+        dictionary->Compress(value, &compressed);
+        if (compressed.size() < value.size()) {
+          type = compression::kLzDictCompression;
+          stored = absl::MakeSpan(compressed);
+        }
+      }
+      if (type == compression::kNoCompression && compressor_ != nullptr) {
+        compressed.clear();
+        compressor_->Compress(value, &compressed);
+        if (compressed.size() < value.size()) {
+          type = compressor_->type();
+          stored = absl::MakeSpan(compressed);
+        }
+      }
+    }
+    ValueProducer produce = [&](const store::PieceWriter& write) {
+      return write(stored);
+    };
+    if (type != compression::kLzDictCompression) {
+      return AppendInner(key, stored.size(), type, expire_at, &produce,
+                         precondition, success_callback);
+    }
+    // The value must land in a file starting with the dictionary it was
+    // compressed against, otherwise it is compressed again
+    bool stale = false;
+    std::function<bool()> check = [&]() {
+      {
+        absl::ReaderMutexLock guard(&dictionary_->lock);
+        stale = dictionary_->epoch != epoch;
+      }
+      return !stale && (precondition == nullptr || (*precondition)());
+    };
+    auto appended = AppendInner(key, stored.size(), type, expire_at,
+                                &produce, &check, success_callback);
+    if (!appended.ok() || *appended || !stale) {
+      return appended;
+    }
+  }
+}
 
-  auto key_len = static_cast<std::uint8_t>(key.size());
-  auto value_len = static_cast<std::uint16_t>(value.size());
+absl::StatusOr<bool> Writer::AppendTombstoneIf(
+    absl::Span<const std::uint8_t> key,
+    const std::function<bool()>& precondition,
+    const std::function<void(Position)>& success_callback) noexcept {
+  return AppendInner(key, absl::nullopt, compression::kNoCompression, 0,
+                     nullptr, &precondition, success_callback);
+}
 
-  std::uint32_t buf_len = log_internal::kHeaderLen + key_len + value_len;
-  std::unique_ptr<std::uint8_t[]> buf(new std::uint8_t[buf_len]);
+absl::Status Writer::AppendStream(
+    absl::Span<const std::uint8_t> key, std::uint64_t value_len,
+    const ValueProducer& produce,
+    const std::function<void(Position)>& success_callback,
+    std::uint64_t expire_at) noexcept {
+  return AppendInner(key, value_len, compression::kNoCompression, expire_at,
+                     &produce, nullptr, success_callback)
+      .status();
+}
 
-  log_internal::RawHeader header(buf.get());
-  header.set_key_len(key_len);
-  std::memcpy(&buf[log_internal::kHeaderLen], key.data(), key_len);
+absl::StatusOr<bool> Writer::AppendStreamIf(
+    absl::Span<const std::uint8_t> key, std::uint64_t value_len,
+    const ValueProducer& produce, const std::function<bool()>& precondition,
+    const std::function<void(Position)>& success_callback,
+    std::uint8_t compression, std::uint64_t expire_at) noexcept {
+  return AppendInner(key, value_len, compression, expire_at, &produce,
+                     &precondition, success_callback);
+}
 
-  if (value.size() > 0) {
-    header.set_value_len(value_len);
-    std::memcpy(&buf[log_internal::kHeaderLen + key.size()], value.data(),
-                value_len);
-  } else {
-    header.set_tombstone();
+absl::StatusOr<bool> Writer::AppendInner(
+    absl::Span<const std::uint8_t> key,
+    absl::optional<std::uint64_t> value_len, std::uint8_t compression,
+    std::uint64_t expire_at, const ValueProducer* produce,
+    const std::function<bool()>* precondition,
+    const std::function<void(Position)>& success_callback) noexcept {
+  PerfTimer timer(&PerfContext::log_append_nanos);
+  PerfTimer encode_timer(&PerfContext::encode_nanos);
+  // header and key
+  std::vector<std::uint8_t> prefix;
+  auto encoded = log_internal::EncodeEntryPrefix(key, value_len, compression,
+                                                 expire_at, &prefix);
+  if (!encoded.ok()) {
+    return encoded.status();
   }
+  PerfCount(&PerfContext::log_append_count);
+  const auto& header = *encoded;
+  std::uint64_t entry_len =
+      prefix.size() + header.value_len + log_internal::kCrc32Len;
+  encode_timer.Stop();
 
-  header.set_crc32(header.calc_actual_crc(&buf[log_internal::kHeaderLen]));
+  auto fill = [&](const store::PieceWriter& write) -> absl::Status {
+    PerfTimer crc_timer(&PerfContext::write_checksum_nanos);
+    auto crc = crc32c::Crc32c(prefix.data(), prefix.size());
+    crc_timer.Stop();
+    auto status = write(absl::MakeSpan(prefix));
+    if (!status.ok()) {
+      return status;
+    }
+    if (produce != nullptr) {
+      std::uint64_t produced = 0;
+      status = (*produce)(
+          [&](absl::Span<const std::uint8_t> piece) -> absl::Status {
+            produced += piece.size();
+            if (produced > header.value_len) {
+              return absl::InternalError(kErrBadValueLength);
+            }
+            {
+              PerfTimer crc_timer(&PerfContext::write_checksum_nanos);
+              crc = crc32c::Extend(crc, piece.data(), piece.size());
+            }
+            return write(piece);
+          });
+      if (!status.ok()) {
+        return status;
+      }
+      if (produced != header.value_len) {
+        return absl::InternalError(kErrBadValueLength);
+      }
+    }
+    std::uint8_t trailer[log_internal::kCrc32Len]{};
+    absl::little_endian::Store32(trailer, crc);
+    return write(absl::MakeSpan(trailer));
+  };
 
-  auto status = dest_->Append({buf.get(), buf_len}, [=, &success_callback](
-                                                        store::Position pos) {
-    success_callback(Position{
-        pos.file_id,
-        pos.offset_in_file + log_internal::kHeaderLen + key_len,  // value_pos
-        value_len                                                 // value_len
-    });
-  });
-  if (!status.ok()) {
-    return status;
+  auto callback = [&](store::Position pos) {
+    auto version = dest_->block_framed() ? kBlockFormatVersion : kFormatVersion;
+    std::uint64_t value_pos = log_internal::FileOffset(
+        version, log_internal::ContentOffset(version, pos.offset_in_file) +
+                     header.header_len + key.size());
+    if (hint_builder_ != nullptr) {
+      // Runs under the store append lock, so entries are added in log order
+      hint_builder_->Add(pos.file_id, key,
+                         header.tombstone ? absl::nullopt
+                                          : absl::make_optional(ValuePos{
+                                                header.value_len, value_pos,
+                                                compression, expire_at}));
+    }
+    success_callback(Position{pos.file_id, compression, value_pos,
+                              header.value_len, expire_at});
+  };
+  auto appended = dest_->AppendStream(entry_len, fill, precondition, callback);
+  if (!appended.ok() || !*appended) {
+    return appended;
   }
-  status = dest_->Sync();
+  auto status = dest_->Sync();
   if (!status.ok()) {
     return status;
   }
-  return absl::OkStatus();
+  return true;
 }
 
-KeyIter::KeyIter(store::Store* src, store::file_id_t log_file_id)
-    : src_(src), log_file_id_(log_file_id) {}
+KeyIter::KeyIter(ghc::filesystem::path&& log_file_path, Env* env)
+    : log_file_path_(std::move(log_file_path)), env_(env) {}
 
 }  // namespace log
 }  // namespace mybitcask
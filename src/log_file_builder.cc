@@ -0,0 +1,142 @@
+#include "absl/base/internal/endian.h"
+#include "crc32c/crc32c.h"
+#include "mybitcask/mybitcask.h"
+#include "store_hint.h"
+
+namespace mybitcask {
+
+namespace {
+
+// Entries are buffered until this many bytes are encoded
+const std::size_t kBuildBufferSize = 4 * 1024 * 1024;
+
+absl::Span<const std::uint8_t> U8Span(absl::string_view s) {
+  return {reinterpret_cast<const std::uint8_t*>(s.data()), s.size()};
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<LogFileBuilder>> NewLogFileBuilder(
+    const ghc::filesystem::path& log_file_path, Env* env) {
+  if (log_file_path.extension() == ".hint") {
+    return absl::InvalidArgumentError(
+        "the log file would be its own hint file");
+  }
+  auto status = env->RemoveFile(log_file_path);
+  if (!status.ok()) {
+    return status;
+  }
+  status = env->RemoveFile(LogFileBuilder::HintFilePath(log_file_path));
+  if (!status.ok()) {
+    return status;
+  }
+  std::unique_ptr<LogFileBuilder> builder(
+      new LogFileBuilder(env, log_file_path));
+  auto writer = env->NewSequentialWriter(log_file_path);
+  if (!writer.ok()) {
+    return writer.status();
+  }
+  builder->writer_ = std::move(writer).value();
+  return builder;
+}
+
+LogFileBuilder::LogFileBuilder(Env* env,
+                               const ghc::filesystem::path& log_file_path)
+    : env_(env),
+      log_file_path_(log_file_path),
+      writer_(nullptr),
+      hint_writer_(new store::hint::FileWriter(HintFilePath(log_file_path),
+                                               env)),
+      buf_(log::FileHeader({}, log::kFormatVersion)),
+      file_len_(buf_.size()),
+      header_len_(buf_.size()),
+      num_entries_(0),
+      status_(),
+      finished_(false) {}
+
+LogFileBuilder::~LogFileBuilder() {
+  if (!finished_) {
+    writer_.reset();
+    // Removes its temporary file
+    hint_writer_.reset();
+    auto _ = env_->RemoveFile(log_file_path_);
+  }
+}
+
+ghc::filesystem::path LogFileBuilder::HintFilePath(
+    const ghc::filesystem::path& log_file_path) {
+  return ghc::filesystem::path(log_file_path).replace_extension(".hint");
+}
+
+absl::Status LogFileBuilder::Add(absl::string_view key,
+                                 absl::string_view value) noexcept {
+  if (finished_) {
+    return absl::FailedPreconditionError(kErrBuilderFinished);
+  }
+  if (!status_.ok()) {
+    return status_;
+  }
+  // Encoded and checked as log::Writer encodes and checks entries
+  auto begin = buf_.size();
+  auto header = log::log_internal::EncodeEntryPrefix(
+      U8Span(key), value.size(), compression::kNoCompression, 0, &buf_);
+  if (!header.ok()) {
+    return header.status();
+  }
+  auto value_offset = buf_.size() - begin;
+  buf_.insert(buf_.end(), value.begin(), value.end());
+  std::uint8_t trailer[log::log_internal::kCrc32Len]{};
+  absl::little_endian::Store32(
+      trailer, crc32c::Crc32c(&buf_[begin], buf_.size() - begin));
+  buf_.insert(buf_.end(), trailer, trailer + log::log_internal::kCrc32Len);
+  auto entry_len = buf_.size() - begin;
+
+  status_ = hint_writer_->Add(
+      U8Span(key), log::ValuePos{value.size(), file_len_ + value_offset,
+                                 compression::kNoCompression, 0});
+  if (!status_.ok()) {
+    return status_;
+  }
+  file_len_ += entry_len;
+  num_entries_++;
+  if (buf_.size() >= kBuildBufferSize) {
+    status_ = flush_buffer();
+  }
+  return status_;
+}
+
+absl::Status LogFileBuilder::Finish() noexcept {
+  if (finished_) {
+    return absl::FailedPreconditionError(kErrBuilderFinished);
+  }
+  if (!status_.ok()) {
+    return status_;
+  }
+  status_ = flush_buffer();
+  if (status_.ok()) {
+    status_ = writer_->Sync();
+  }
+  if (status_.ok()) {
+    writer_.reset();
+    status_ = hint_writer_->Finish();
+  }
+  if (!status_.ok()) {
+    return status_;
+  }
+  finished_ = true;
+  return absl::OkStatus();
+}
+
+absl::Status LogFileBuilder::flush_buffer() noexcept {
+  if (buf_.empty()) {
+    return absl::OkStatus();
+  }
+  auto offset = writer_->Append(absl::MakeSpan(buf_));
+  if (!offset.ok()) {
+    return offset.status();
+  }
+  buf_.clear();
+  return absl::OkStatus();
+}
+
+}  // namespace mybitcask
@@ -0,0 +1,96 @@
+// Encoding and decoding of log entry headers, and the checksum of legacy
+// entries
+
+#include <cstdint>
+#include <vector>
+#include "benchmark/benchmark.h"
+
+#include "mybitcask/internal/log.h"
+#include "test_util.h"
+
+namespace mybitcask {
+namespace log {
+namespace log_internal {
+namespace {
+
+EntryHeader MakeHeader(std::uint64_t value_len, bool expires) {
+  return EntryHeader{false, 0, 16, value_len,
+                     expires ? NowMillis() + 60 * 1000 : 0, 0};
+}
+
+void BM_EncodeEntryHeader(benchmark::State& state) {
+  auto header = MakeHeader(state.range(0), state.range(1) != 0);
+  std::uint8_t buf[kMaxEntryHeaderLen];
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(EncodeEntryHeader(header, buf));
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_EncodeEntryHeader)
+    ->ArgNames({"value_len", "expires"})
+    ->ArgsProduct({{100, 1 << 20}, {0, 1}});
+
+void BM_DecodeEntryHeader(benchmark::State& state) {
+  auto header = MakeHeader(state.range(0), state.range(1) != 0);
+  std::uint8_t buf[kMaxEntryHeaderLen];
+  auto len = EncodeEntryHeader(header, buf);
+  EntryHeader decoded{};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        DecodeEntryHeader(absl::MakeConstSpan(buf, len), &decoded));
+    benchmark::DoNotOptimize(decoded);
+  }
+}
+BENCHMARK(BM_DecodeEntryHeader)
+    ->ArgNames({"value_len", "expires"})
+    ->ArgsProduct({{100, 1 << 20}, {0, 1}});
+
+void BM_RawHeaderEncode(benchmark::State& state) {
+  std::uint8_t buf[kHeaderLen];
+  for (auto _ : state) {
+    RawHeader header(buf);
+    header.set_key_len(16);
+    header.set_value_len(100);
+    header.set_crc32(0x12345678);
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_RawHeaderEncode);
+
+void BM_RawHeaderDecode(benchmark::State& state) {
+  std::uint8_t buf[kHeaderLen];
+  RawHeader(buf).set_key_len(16);
+  RawHeader(buf).set_value_len(100);
+  for (auto _ : state) {
+    RawHeader header(buf);
+    benchmark::DoNotOptimize(header.key_len());
+    benchmark::DoNotOptimize(header.value_len());
+    benchmark::DoNotOptimize(header.is_tombstone());
+    benchmark::DoNotOptimize(header.crc32());
+  }
+}
+BENCHMARK(BM_RawHeaderDecode);
+
+void BM_CalcActualCrc(benchmark::State& state) {
+  const std::uint8_t key_len = 16;
+  auto value_len = static_cast<std::uint16_t>(state.range(0));
+  std::vector<std::uint8_t> entry(kHeaderLen + key_len + value_len);
+  auto kv = test::RandomString(key_len + value_len);
+  std::copy(kv.begin(), kv.end(), entry.begin() + kHeaderLen);
+  RawHeader header(entry.data());
+  header.set_key_len(key_len);
+  header.set_value_len(value_len);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        header.calc_actual_crc(entry.data() + kHeaderLen));
+  }
+  state.SetBytesProcessed(state.iterations() * (key_len + value_len));
+}
+BENCHMARK(BM_CalcActualCrc)->Arg(16)->Arg(256)->Arg(4096)->Arg(32768);
+
+}  // namespace
+}  // namespace log_internal
+}  // namespace log
+}  // namespace mybitcask
+
+BENCHMARK_MAIN();
@@ -0,0 +1,132 @@
+// Random reads through the pread and mmap io::RandomAccessReaders, and of
+// log entries through log::Reader::Read. The store reads closed log files
+// through mmap and the latest one through pread.
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "benchmark/benchmark.h"
+
+#include "mybitcask/internal/io.h"
+#include "mybitcask/internal/log.h"
+#include "mybitcask/internal/store.h"
+#include "store_dbfiles.h"
+#include "test_util.h"
+
+namespace mybitcask {
+namespace {
+
+const std::size_t kFileLen = 64 * 1024 * 1024;
+
+// A file of kFileLen random bytes, written once
+const ghc::filesystem::path& DataFile() {
+  static auto file = []() {
+    auto tmpfile = test::MakeTempFile("mybitcask_bench_", ".data");
+    std::ofstream out(tmpfile->path(), std::ios::binary);
+    std::string chunk = test::RandomString(1024 * 1024);
+    for (std::size_t written = 0; written < kFileLen;
+         written += chunk.size()) {
+      out << chunk;
+    }
+    return std::move(tmpfile).value();
+  }();
+  return file.path();
+}
+
+void ReadAt(benchmark::State& state, bool mmap) {
+  auto path = DataFile();
+  auto reader = mmap ? io::OpenMmapRandomAccessFileReader(std::move(path))
+                     : io::OpenRandomAccessFileReader(std::move(path));
+  if (!reader.ok()) {
+    state.SkipWithError("cannot open the data file");
+    return;
+  }
+  auto len = static_cast<std::size_t>(state.range(0));
+  std::vector<std::uint8_t> buf(len);
+  std::mt19937_64 engine(42);
+  std::uniform_int_distribution<std::uint64_t> offset(0, kFileLen - len);
+  for (auto _ : state) {
+    auto read = (*reader)->ReadAt(offset(engine), absl::MakeSpan(buf));
+    if (!read.ok()) {
+      state.SkipWithError("read failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+void BM_PreadReadAt(benchmark::State& state) { ReadAt(state, false); }
+BENCHMARK(BM_PreadReadAt)->Arg(100)->Arg(4096)->Arg(65536);
+
+void BM_MmapReadAt(benchmark::State& state) { ReadAt(state, true); }
+BENCHMARK(BM_MmapReadAt)->Arg(100)->Arg(4096)->Arg(65536);
+
+const std::uint32_t kKeyLen = 16;
+const std::uint32_t kDeadBytesThreshold = 32 * 1024 * 1024;
+
+// A store of two log files filled with entries of 100 byte values, the
+// first one closed
+struct LogFiles {
+  test::TempFile dir;
+  std::unique_ptr<store::Store> store;
+  std::vector<Position> closed;
+  std::vector<Position> latest;
+};
+
+LogFiles& Files() {
+  static auto files = []() {
+    auto tmpdir = test::MakeTempDir("mybitcask_bench_");
+    auto path = tmpdir->path();
+    LogFiles files{std::move(tmpdir).value(), nullptr, {}, {}};
+    files.store = std::unique_ptr<store::Store>(new store::Store(
+        path, store::DBFiles(path).latest_file_id(), kDeadBytesThreshold,
+        log::FileHeader()));
+    log::Writer writer(files.store.get());
+    auto value = test::RandomString(100);
+    while (files.latest.size() < 100000) {
+      auto key = test::RandomString(kKeyLen);
+      auto status = writer.Append(
+          test::StrSpan(key), test::StrSpan(value), [&](Position pos) {
+            bool first_file = files.closed.empty() ||
+                              pos.file_id == files.closed[0].file_id;
+            (first_file ? files.closed : files.latest).push_back(pos);
+          });
+      if (!status.ok()) {
+        break;
+      }
+    }
+    return files;
+  }();
+  return files;
+}
+
+void Read(benchmark::State& state, bool closed) {
+  auto& files = Files();
+  auto& positions = closed ? files.closed : files.latest;
+  log::Reader reader(files.store.get(), state.range(0) != 0);
+  std::vector<std::uint8_t> value(100);
+  std::mt19937_64 engine(42);
+  std::uniform_int_distribution<std::size_t> index(0, positions.size() - 1);
+  for (auto _ : state) {
+    auto found = reader.Read(positions[index(engine)], kKeyLen, value.data());
+    if (!found.ok() || !*found) {
+      state.SkipWithError("read failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * value.size());
+}
+
+void BM_ReadClosedFile(benchmark::State& state) { Read(state, true); }
+BENCHMARK(BM_ReadClosedFile)->ArgName("checksum")->Arg(0)->Arg(1);
+
+void BM_ReadLatestFile(benchmark::State& state) { Read(state, false); }
+BENCHMARK(BM_ReadLatestFile)->ArgName("checksum")->Arg(0)->Arg(1);
+
+}  // namespace
+}  // namespace mybitcask
+
+BENCHMARK_MAIN();
@@ -11,6 +11,9 @@
 #include "gtest/gtest.h"
 #include "test_util.h"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <memory>
 #include <random>
 
@@ -20,10 +23,10 @@ namespace log {
 absl::StatusOr<absl::optional<Entry>> log_read(Reader* log_reader,
                                                const Position& pos,
                                                const std::string& key) {
-  auto entry = log_reader->Read(pos, static_cast<std::uint8_t>(key.length()));
+  auto entry = log_reader->Read(pos, static_cast<std::uint32_t>(key.length()));
   std::vector<std::uint8_t> value;
   value.resize(pos.value_len);
-  auto exist = log_reader->Read(pos, static_cast<std::uint8_t>(key.length()),
+  auto exist = log_reader->Read(pos, static_cast<std::uint32_t>(key.length()),
                                 value.data());
   EXPECT_EQ(entry.ok(), exist.ok());
   if (entry.ok()) {
@@ -40,7 +43,7 @@ TEST(LogReaderWriterTest, NormalReadWriter) {
   ASSERT_TRUE(tmpdir.ok());
   store::Store store(tmpdir->path(),
                      store::DBFiles(tmpdir->path()).latest_file_id(),
-                     128 * 1024 * 1024);
+                     128 * 1024 * 1024, FileHeader());
   Reader log_reader(&store, false);
   Writer log_writer(&store);
 
@@ -54,6 +57,7 @@ TEST(LogReaderWriterTest, NormalReadWriter) {
       {"lbw", "nb"},
       {"玩游戏一定要", "啸"},
       {test::RandomString(0xFF), test::RandomString(0xFFFF - 1)},
+      {test::RandomString(kMaxKeyLen), test::RandomString(0x10000 + 1)},
   };
 
   absl::Status append_status;
@@ -85,6 +89,58 @@ TEST(LogReaderWriterTest, NormalReadWriter) {
   }
 }
 
+TEST(LogReaderWriterTest, ExpiringEntry) {
+  auto tmpdir = test::MakeTempDir("mybitcask_log_");
+  ASSERT_TRUE(tmpdir.ok());
+  store::Store store(tmpdir->path(),
+                     store::DBFiles(tmpdir->path()).latest_file_id(),
+                     128 * 1024 * 1024, FileHeader());
+  Reader log_reader(&store, true);
+  Writer log_writer(&store);
+
+  std::uint64_t expire_at = NowMillis() + 3600 * 1000;
+  std::vector<Position> positions;
+  for (auto e : {std::uint64_t{0}, expire_at, std::uint64_t{1}}) {
+    ASSERT_TRUE(log_writer
+                    .Append(test::StrSpan("key"), test::StrSpan("value"),
+                            [&](Position pos) { positions.push_back(pos); },
+                            e)
+                    .ok());
+  }
+  EXPECT_EQ(positions[0].expire_at, 0);
+  EXPECT_EQ(positions[1].expire_at, expire_at);
+  EXPECT_FALSE(Expired(positions[0].expire_at));
+  EXPECT_FALSE(Expired(positions[1].expire_at));
+  EXPECT_TRUE(Expired(positions[2].expire_at));
+  // The expiry time follows the value length in the entry header
+  EXPECT_EQ(positions[2].value_pos - positions[1].value_pos,
+            std::string("value").size() + log_internal::kCrc32Len +
+                log_internal::EntryHeaderLen(3, 5, 1) + 3);
+
+  for (auto& pos : positions) {
+    auto entry = log_read(&log_reader, pos, "key");
+    ASSERT_TRUE(entry.ok()) << entry.status();
+    ASSERT_TRUE(entry->has_value());
+    EXPECT_EQ((*entry)->value(), test::StrSpan("value"));
+  }
+  // The expiry time is part of the entry
+  auto wrong = positions[1];
+  wrong.expire_at++;
+  EXPECT_FALSE(log_read(&log_reader, wrong, "key").ok());
+
+  std::vector<std::uint64_t> folded;
+  struct Void {};
+  auto status = log_reader.key_iter(positions[0].file_id)
+                    .Fold<Void, std::string>(
+                        Void(), [&](Void&&, Key<std::string>&& key) {
+                          folded.push_back(key.value_pos->expire_at);
+                          return Void();
+                        });
+  ASSERT_TRUE(status.ok()) << status.status();
+  EXPECT_EQ(folded,
+            (std::vector<std::uint64_t>{0, expire_at, std::uint64_t{1}}));
+}
+
 class StoreUtil {
  public:
   StoreUtil(store::Store* inner) : store_(inner), offset_(0) {}
@@ -137,8 +193,8 @@ TEST(LogWriterTest, ReadWrongEntry) {
   auto offset = w.offset();
   auto status = store.Sync();
   ASSERT_TRUE(status.ok());
-  auto entry_opt =
-      log_read(&log_reader, Position{1, log_internal::kHeaderLen + 1, 1}, "a");
+  auto entry_opt = log_read(
+      &log_reader, Position{1, 0, log_internal::kHeaderLen + 1, 1, 0}, "a");
   EXPECT_FALSE(entry_opt.ok()) << "read an entry with bad crc should fail";
   EXPECT_EQ(entry_opt.status().message(), kErrBadEntry)
       << "read an entry with bad crc should return kErrBadEntry";
@@ -152,8 +208,8 @@ TEST(LogWriterTest, ReadWrongEntry) {
   ASSERT_TRUE(status.ok());
   entry_opt =
       log_read(&log_reader,
-               Position{1, log_internal::kHeaderLen + offset,
-                        static_cast<std::uint16_t>(w.offset() - offset)},
+               Position{1, 0, log_internal::kHeaderLen + offset,
+                        static_cast<std::uint16_t>(w.offset() - offset), 0},
                "a");
   offset = w.offset();
   EXPECT_FALSE(entry_opt.ok()) << "read an entry with bad crc should fail";
@@ -166,7 +222,7 @@ TEST(LogWriterTest, AppendWithWrongKVLength) {
   ASSERT_TRUE(tmpdir.ok());
   store::Store store(tmpdir->path(),
                      store::DBFiles(tmpdir->path()).latest_file_id(),
-                     128 * 1024 * 1024);
+                     128 * 1024 * 1024, FileHeader());
   Writer log_writer(&store);
 
   // Append entry with empty key
@@ -190,15 +246,16 @@ TEST(LogWriterTest, AppendWithWrongKVLength) {
       << "append entry with empty value should return kErrBadValueLength";
 
   // Append entry with an oversized key
-  status =
-      log_writer.Append(test::StrSpan(test::RandomString(0x100, 0x100 + 100)),
-                        test::StrSpan("not care"), [](Position) {});
+  status = log_writer.Append(
+      test::StrSpan(test::RandomString(0x10000, 0x10000 + 100)),
+      test::StrSpan("not care"), [](Position) {});
   EXPECT_FALSE(status.ok()) << "append entry with an oversized key should fail";
   EXPECT_EQ(status.message(), kErrBadKeyLength)
       << "append entry with an oversized key should return kErrBadKeyLength";
 
   status = log_writer.AppendTombstone(
-      test::StrSpan(test::RandomString(0x100, 0x100 + 100)), [](Position) {});
+      test::StrSpan(test::RandomString(0x10000, 0x10000 + 100)),
+      [](Position) {});
   EXPECT_FALSE(status.ok())
       << "append tombstone entry with an oversized key should fail";
   EXPECT_EQ(status.message(), kErrBadKeyLength)
@@ -206,9 +263,10 @@ TEST(LogWriterTest, AppendWithWrongKVLength) {
          "kErrBadKeyLength";
 
   // Append entry with an oversized value
-  status = log_writer.Append(
-      test::StrSpan("not care"),
-      test::StrSpan(test::RandomString(0xFFFF, 0xFFFF + 200)), [](Position) {});
+  status = log_writer.AppendStream(
+      test::StrSpan("not care"), kMaxValueLen + 1,
+      [](const store::PieceWriter&) { return absl::OkStatus(); },
+      [](Position) {});
   EXPECT_FALSE(status.ok())
       << "append entry with an oversized value should fail";
   EXPECT_EQ(status.message(), kErrBadValueLength)
@@ -216,11 +274,446 @@ TEST(LogWriterTest, AppendWithWrongKVLength) {
          "kErrBadValueLength";
 }
 
+TEST(LogWriterTest, AppendStreamWithShortValue) {
+  auto tmpdir = test::MakeTempDir("mybitcask_log_");
+  ASSERT_TRUE(tmpdir.ok());
+  store::Store store(tmpdir->path(),
+                     store::DBFiles(tmpdir->path()).latest_file_id(),
+                     128 * 1024 * 1024, FileHeader());
+  Writer log_writer(&store);
+  Reader log_reader(&store, true);
+
+  // A value shorter than announced is rolled back
+  bool called = false;
+  auto status = log_writer.AppendStream(
+      test::StrSpan("short"), 10,
+      [](const store::PieceWriter& write) {
+        return write(test::StrSpan("12345"));
+      },
+      [&](Position) { called = true; });
+  EXPECT_EQ(status.message(), kErrBadValueLength);
+  EXPECT_FALSE(called);
+
+  Position position{};
+  status = log_writer.Append(test::StrSpan("key"), test::StrSpan("value"),
+                             [&](Position pos) { position = pos; });
+  ASSERT_TRUE(status.ok());
+  auto entry_opt = log_read(&log_reader, position, "key");
+  ASSERT_TRUE(entry_opt.ok()) << entry_opt.status();
+  ASSERT_TRUE(entry_opt->has_value());
+  EXPECT_EQ((*entry_opt)->value(), test::StrSpan("value"));
+
+  std::vector<std::string> keys;
+  struct Void {};
+  auto folded = log_reader.key_iter(1).Fold<Void, std::string>(
+      Void(), [&](Void&&, Key<std::string>&& key) {
+        keys.push_back(key.key_data);
+        return Void();
+      });
+  ASSERT_TRUE(folded.ok()) << folded.status();
+  EXPECT_EQ(keys, std::vector<std::string>{"key"});
+}
+
+TEST(LogReaderWriterTest, StreamLargeValue) {
+  auto tmpdir = test::MakeTempDir("mybitcask_log_");
+  ASSERT_TRUE(tmpdir.ok());
+  store::Store store(tmpdir->path(),
+                     store::DBFiles(tmpdir->path()).latest_file_id(),
+                     128 * 1024 * 1024, FileHeader());
+  Writer log_writer(&store);
+  Reader log_reader(&store, true);
+
+  // Spans several stream chunks, and is not a multiple of the piece size
+  std::string value = test::RandomString(3 * kStreamChunkSize + 12345);
+  const std::size_t kPieceLen = 64 * 1024;
+  Position position{};
+  auto status = log_writer.AppendStream(
+      test::StrSpan("large"), value.size(),
+      [&](const store::PieceWriter& write) {
+        for (std::size_t i = 0; i < value.size(); i += kPieceLen) {
+          auto s = write(test::StrSpan(value).subspan(i, kPieceLen));
+          if (!s.ok()) {
+            return s;
+          }
+        }
+        return absl::OkStatus();
+      },
+      [&](Position pos) { position = pos; });
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(position.value_len, value.size());
+
+  std::string streamed;
+  std::size_t max_piece = 0;
+  auto found = log_reader.ReadStream(
+      position, 5, [&](absl::Span<const std::uint8_t> piece) {
+        max_piece = std::max(max_piece, piece.size());
+        streamed.append(reinterpret_cast<const char*>(piece.data()),
+                        piece.size());
+        return absl::OkStatus();
+      });
+  ASSERT_TRUE(found.ok()) << found.status();
+  ASSERT_TRUE(*found);
+  EXPECT_LE(max_piece, kStreamChunkSize);
+  EXPECT_TRUE(streamed == value);
+
+  auto entry_opt = log_read(&log_reader, position, "large");
+  ASSERT_TRUE(entry_opt.ok()) << entry_opt.status();
+  ASSERT_TRUE(entry_opt->has_value());
+  EXPECT_EQ((*entry_opt)->value(), test::StrSpan(value));
+}
+
+TEST(LogReaderWriterTest, CompressedValue) {
+  auto tmpdir = test::MakeTempDir("mybitcask_log_");
+  ASSERT_TRUE(tmpdir.ok());
+  store::Store store(tmpdir->path(),
+                     store::DBFiles(tmpdir->path()).latest_file_id(),
+                     128 * 1024 * 1024, FileHeader());
+  Writer log_writer(&store);
+  log_writer.SetCompression(compression::LzCompressor(), 16);
+  Reader log_reader(&store, true);
+
+  struct TestCase {
+    std::string key;
+    std::string value;
+    bool compressed;
+  };
+  std::vector<TestCase> cases = {
+      // below the threshold
+      {"short", std::string(15, 'a'), false},
+      {"repeated", std::string(10000, 'b'), true},
+      // does not get smaller
+      {"random", test::RandomString(1000), false},
+  };
+  for (auto& c : cases) {
+    Position position{};
+    auto status =
+        log_writer.Append(test::StrSpan(c.key), test::StrSpan(c.value),
+                          [&](Position pos) { position = pos; });
+    ASSERT_TRUE(status.ok()) << status;
+    EXPECT_EQ(position.compression != compression::kNoCompression,
+              c.compressed)
+        << c.key;
+    EXPECT_EQ(position.value_len < c.value.size(), c.compressed) << c.key;
+
+    std::string value;
+    auto found = log_reader.ReadValue(
+        position, static_cast<std::uint32_t>(c.key.size()),
+        [&](std::uint64_t len) {
+          value.resize(len);
+          return reinterpret_cast<std::uint8_t*>(&value[0]);
+        });
+    ASSERT_TRUE(found.ok()) << found.status();
+    ASSERT_TRUE(*found);
+    EXPECT_EQ(value, c.value) << c.key;
+
+    std::string streamed;
+    found = log_reader.ReadStream(
+        position, static_cast<std::uint32_t>(c.key.size()),
+        [&](absl::Span<const std::uint8_t> piece) {
+          streamed.append(reinterpret_cast<const char*>(piece.data()),
+                          piece.size());
+          return absl::OkStatus();
+        });
+    ASSERT_TRUE(found.ok()) << found.status();
+    EXPECT_EQ(streamed, c.value) << c.key;
+  }
+
+  struct Void {};
+  std::vector<std::uint8_t> compressions;
+  auto folded = log_reader.key_iter(1).Fold<Void, std::string>(
+      Void(), [&](Void&&, Key<std::string>&& key) {
+        compressions.push_back(key.value_pos->compression);
+        return Void();
+      });
+  ASSERT_TRUE(folded.ok()) << folded.status();
+  EXPECT_EQ(compressions,
+            (std::vector<std::uint8_t>{compression::kNoCompression,
+                                       compression::kLzCompression,
+                                       compression::kNoCompression}));
+}
+
+TEST(LogReaderWriterTest, DictionaryCompressedValue) {
+  auto tmpdir = test::MakeTempDir("mybitcask_log_");
+  ASSERT_TRUE(tmpdir.ok());
+  auto record = [](int i) {
+    return "{\"id\": " + std::to_string(i) +
+           ", \"kind\": \"structured record\", \"tags\": "
+           "[\"alpha\", \"beta\", \"gamma\"]}";
+  };
+  std::vector<std::string> samples;
+  for (int i = 0; i < 100; i++) {
+    samples.push_back(record(i));
+  }
+  auto dictionary = std::make_shared<compression::Dictionary>(
+      compression::TrainDictionary(samples, 1024));
+  ASSERT_FALSE(dictionary->data().empty());
+
+  store::Store store(tmpdir->path(), 1, 128 * 1024 * 1024,
+                     FileHeader(dictionary->data()));
+  Writer log_writer(&store);
+  log_writer.SetCompression(nullptr, 16);
+  log_writer.SetDictionary(dictionary);
+  Reader log_reader(&store, true);
+
+  auto append = [&](const std::string& key, const std::string& value) {
+    Position position{};
+    auto status =
+        log_writer.Append(test::StrSpan(key), test::StrSpan(value),
+                          [&](Position pos) { position = pos; });
+    EXPECT_TRUE(status.ok()) << status;
+    return position;
+  };
+  auto expect_value = [&](const Position& position, const std::string& key,
+                          const std::string& expected) {
+    std::string value;
+    auto found = log_reader.ReadValue(
+        position, static_cast<std::uint32_t>(key.size()),
+        [&](std::uint64_t len) {
+          value.resize(len);
+          return reinterpret_cast<std::uint8_t*>(&value[0]);
+        });
+    ASSERT_TRUE(found.ok()) << found.status();
+    ASSERT_TRUE(*found);
+    EXPECT_EQ(value, expected);
+  };
+
+  auto first = append("first", record(1000));
+  EXPECT_EQ(first.file_id, 1);
+  EXPECT_EQ(first.compression, compression::kLzDictCompression);
+  EXPECT_LT(first.value_len, record(1000).size() / 2);
+  expect_value(first, "first", record(1000));
+
+  // Values appended after a dictionary change go to a new log file
+  auto other = std::make_shared<compression::Dictionary>(
+      std::vector<std::uint8_t>(64, 'x'));
+  ASSERT_TRUE(log_writer.ChangeDictionary(other).ok());
+  auto second = append("second", std::string(100, 'x') + record(2000));
+  EXPECT_EQ(second.file_id, 2);
+  EXPECT_EQ(second.compression, compression::kLzDictCompression);
+  expect_value(second, "second", std::string(100, 'x') + record(2000));
+  expect_value(first, "first", record(1000));
+
+  struct Void {};
+  std::vector<std::string> keys;
+  for (store::file_id_t file_id = 1; file_id <= 2; file_id++) {
+    auto folded = log_reader.key_iter(file_id).Fold<Void, std::string>(
+        Void(), [&](Void&&, Key<std::string>&& key) {
+          keys.push_back(key.key_data);
+          return Void();
+        });
+    ASSERT_TRUE(folded.ok()) << folded.status();
+  }
+  EXPECT_EQ(keys, (std::vector<std::string>{"first", "second"}));
+  auto stored = ReadDictionary(tmpdir->path() / "2.log");
+  ASSERT_TRUE(stored.ok()) << stored.status();
+  EXPECT_EQ(*stored, std::vector<std::uint8_t>(64, 'x'));
+}
+
+TEST(LogReaderTest, ReadLegacyEntries) {
+  auto tmpdir = test::MakeTempDir("mybitcask_log_");
+  ASSERT_TRUE(tmpdir.ok());
+  // A log file without a file header is read as kLegacyVersion
+  store::Store store(tmpdir->path(),
+                     store::DBFiles(tmpdir->path()).latest_file_id(),
+                     128 * 1024 * 1024);
+  Reader log_reader(&store, true);
+
+  std::uint8_t entry[log_internal::kHeaderLen + 5]{};
+  log_internal::RawHeader header(entry);
+  header.set_key_len(3);
+  header.set_value_len(2);
+  std::memcpy(&entry[log_internal::kHeaderLen], "keyvv", 5);
+  header.set_crc32(header.calc_actual_crc(&entry[log_internal::kHeaderLen]));
+  ASSERT_TRUE(store.Append(absl::MakeSpan(entry)).ok());
+  ASSERT_TRUE(store.Sync().ok());
+
+  auto entry_opt = log_read(
+      &log_reader, Position{1, 0, log_internal::kHeaderLen + 3, 2, 0}, "key");
+  ASSERT_TRUE(entry_opt.ok()) << entry_opt.status();
+  ASSERT_TRUE(entry_opt->has_value());
+  EXPECT_EQ((*entry_opt)->value(), test::StrSpan("vv"));
+
+  struct Void {};
+  std::vector<ValuePos> value_pos;
+  auto folded = log_reader.key_iter(1).Fold<Void, std::string>(
+      Void(), [&](Void&&, Key<std::string>&& key) {
+        EXPECT_EQ(key.key_data, "key");
+        value_pos.push_back(*key.value_pos);
+        return Void();
+      });
+  ASSERT_TRUE(folded.ok()) << folded.status();
+  ASSERT_EQ(value_pos.size(), 1);
+  EXPECT_EQ(value_pos[0].value_pos, log_internal::kHeaderLen + 3);
+  EXPECT_EQ(value_pos[0].value_len, 2);
+}
+
+TEST(LogReaderWriterTest, BlockFramedFile) {
+  auto tmpdir = test::MakeTempDir("mybitcask_log_");
+  ASSERT_TRUE(tmpdir.ok());
+  std::vector<std::pair<std::string, std::string>> entries;
+  std::vector<Position> positions;
+  {
+    store::Store store(tmpdir->path(), 1, 128 * 1024 * 1024,
+                       FileHeader({}, kBlockFormatVersion), true);
+    Writer log_writer(&store);
+    Reader log_reader(&store, true);
+    for (int i = 0; i < 300; i++) {
+      entries.emplace_back(
+          test::RandomString(1, 64),
+          test::RandomString(1, i % 20 == 0 ? 100000 : 2000));
+      ASSERT_TRUE(log_writer
+                      .Append(test::StrSpan(entries.back().first),
+                              test::StrSpan(entries.back().second),
+                              [&](Position pos) { positions.push_back(pos); })
+                      .ok());
+    }
+    // Entries spanning blocks are read back with their checksums verified
+    for (std::size_t i = 0; i < entries.size(); i++) {
+      auto entry_opt = log_read(&log_reader, positions[i], entries[i].first);
+      ASSERT_TRUE(entry_opt.ok()) << entry_opt.status();
+      ASSERT_TRUE(entry_opt->has_value());
+      EXPECT_EQ((*entry_opt)->value(), test::StrSpan(entries[i].second));
+    }
+  }
+  auto path = tmpdir->path() / "1.log";
+  auto version = ReadFormatVersion(path);
+  ASSERT_TRUE(version.ok());
+  EXPECT_EQ(**version, kBlockFormatVersion);
+
+  auto fold = [&]() {
+    struct Void {};
+    std::vector<std::pair<std::string, std::uint64_t>> keys;
+    auto folded = KeyIter(ghc::filesystem::path(path))
+                      .Fold<Void, std::string>(
+                          Void(), [&](Void&&, Key<std::string>&& key) {
+                            keys.emplace_back(key.key_data,
+                                              key.value_pos->value_pos);
+                            return Void();
+                          });
+    EXPECT_TRUE(folded.ok()) << folded.status();
+    return keys;
+  };
+  auto keys = fold();
+  ASSERT_EQ(keys.size(), entries.size());
+  for (std::size_t i = 0; i < entries.size(); i++) {
+    EXPECT_EQ(keys[i].first, entries[i].first);
+    EXPECT_EQ(keys[i].second, positions[i].value_pos);
+  }
+
+  // The entries whose header or key is in a corrupt block are left out
+  auto corrupt_block = positions[150].value_pos / store::kBlockSize;
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(static_cast<std::streamoff>(corrupt_block * store::kBlockSize +
+                                           store::kBlockContentLen - 1));
+    file.put('\x5A');
+  }
+  auto begin = corrupt_block * store::kBlockContentLen;
+  auto end = begin + store::kBlockContentLen;
+  std::vector<std::pair<std::string, std::uint64_t>> expected;
+  for (std::size_t i = 0; i < entries.size(); i++) {
+    auto key_end = store::BlockContentOffset(positions[i].value_pos);
+    auto start = key_end - entries[i].first.size() -
+                 log_internal::EntryHeaderLen(entries[i].first.size(),
+                                              entries[i].second.size());
+    if (key_end <= begin || start >= end) {
+      expected.emplace_back(entries[i].first, positions[i].value_pos);
+    }
+  }
+  ASSERT_LT(expected.size(), entries.size());
+  EXPECT_EQ(fold(), expected);
+}
+
+TEST(FindTornTailTest, CutAndCorruptTail) {
+  for (bool block_framed : {false, true}) {
+    auto tmpdir = test::MakeTempDir("mybitcask_log_");
+    ASSERT_TRUE(tmpdir.ok());
+    auto path = tmpdir->path() / "1.log";
+    // File offsets of the ends of the entries
+    std::vector<std::uint64_t> ends;
+    {
+      auto version = block_framed ? kBlockFormatVersion : kFormatVersion;
+      store::Store store(tmpdir->path(), 1, 128 * 1024 * 1024,
+                         FileHeader({}, version), block_framed);
+      Writer log_writer(&store);
+      for (int i = 0; i < 200; i++) {
+        auto key = test::RandomString(1, 32);
+        auto value = test::RandomString(1, i % 50 == 0 ? 70000 : 1000);
+        ASSERT_TRUE(log_writer
+                        .Append(test::StrSpan(key), test::StrSpan(value),
+                                [&](Position pos) {
+                                  ends.push_back(log_internal::FileOffset(
+                                      version,
+                                      log_internal::ContentOffset(
+                                          version, pos.value_pos) +
+                                          value.size() +
+                                          log_internal::kCrc32Len));
+                                })
+                        .ok());
+      }
+    }
+    auto file_len = io::GetFileSize(path);
+    ASSERT_TRUE(file_len.ok());
+    auto tail = FindTornTail(path, 1024 * 1024);
+    ASSERT_TRUE(tail.ok()) << tail.status();
+    EXPECT_EQ(tail->valid_len, *file_len);
+    EXPECT_EQ(tail->file_len, *file_len);
+
+    std::mt19937 engine(block_framed ? 1 : 2);
+    std::uniform_int_distribution<std::uint64_t> dist(0, *file_len - 1);
+    for (int trial = 0; trial < 20; trial++) {
+      // A write cut short, maybe followed by garbage
+      auto cut = dist(engine);
+      ghc::filesystem::path torn = tmpdir->path() / "torn.log";
+      ghc::filesystem::copy_file(
+          path, torn, ghc::filesystem::copy_options::overwrite_existing);
+      ghc::filesystem::resize_file(torn, cut);
+      if (trial % 2 == 1) {
+        std::ofstream file(torn, std::ios::binary | std::ios::app);
+        file << test::RandomString(1, 100);
+      }
+      tail = FindTornTail(torn, 1024 * 1024);
+      ASSERT_TRUE(tail.ok()) << tail.status();
+      auto last_end = std::upper_bound(ends.begin(), ends.end(), cut);
+      auto expected = last_end == ends.begin() ? 0 : *std::prev(last_end);
+      if (expected == 0) {
+        // the file header is intact
+        expected = std::min<std::uint64_t>(cut, log_internal::kFileHeaderLen);
+        if (expected < log_internal::kFileHeaderLen) {
+          expected = 0;
+        }
+      }
+      EXPECT_EQ(tail->valid_len, expected) << "cut at " << cut;
+    }
+
+    // The checksum of an entry is only verified near the end of the file
+    {
+      std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+      file.seekp(static_cast<std::streamoff>(*file_len - 1));
+      file.put('\x5A');
+    }
+    auto last_start = ends[ends.size() - 2];
+    tail = FindTornTail(path, 1024 * 1024);
+    ASSERT_TRUE(tail.ok()) << tail.status();
+    EXPECT_EQ(tail->valid_len, last_start);
+    // The window is measured in content bytes, which leave out block
+    // trailers
+    auto version = block_framed ? kBlockFormatVersion : kFormatVersion;
+    tail = FindTornTail(path,
+                        log_internal::ContentOffset(version, *file_len) -
+                            log_internal::ContentOffset(version, last_start) -
+                            1);
+    ASSERT_TRUE(tail.ok()) << tail.status();
+    EXPECT_EQ(tail->valid_len, *file_len);
+  }
+}
+
 TEST(KeyIterTest, Fold) {
   auto tmpdir = test::MakeTempDir("mybitcask_log_");
   ASSERT_TRUE(tmpdir.ok());
   store::Store store(tmpdir->path(),
-                     store::DBFiles(tmpdir->path()).latest_file_id(), 512);
+                     store::DBFiles(tmpdir->path()).latest_file_id(), 512,
+                     FileHeader());
   Writer log_writer(&store);
   Reader log_reader(&store, false);
 
@@ -0,0 +1,60 @@
+// Appending entries through log::Writer to a store in a temporary
+// directory, which mostly measures encoding, checksums and buffered writes
+// since nothing is synced
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "benchmark/benchmark.h"
+
+#include "mybitcask/internal/log.h"
+#include "mybitcask/internal/store.h"
+#include "store_dbfiles.h"
+#include "store_hint.h"
+#include "test_util.h"
+
+namespace mybitcask {
+namespace log {
+namespace {
+
+const std::uint32_t kDeadBytesThreshold = 64 * 1024 * 1024;
+
+void AppendEntries(benchmark::State& state, bool build_hints) {
+  auto tmpdir = test::MakeTempDir("mybitcask_bench_");
+  if (!tmpdir.ok()) {
+    state.SkipWithError("cannot create a temporary directory");
+    return;
+  }
+  store::Store store(tmpdir->path(),
+                     store::DBFiles(tmpdir->path()).latest_file_id(),
+                     kDeadBytesThreshold, FileHeader());
+  store::hint::Builder builder(tmpdir->path());
+  auto writer = build_hints ? Writer(&store, &builder) : Writer(&store);
+
+  auto value = test::RandomString(static_cast<std::size_t>(state.range(0)));
+  std::uint64_t i = 0;
+  for (auto _ : state) {
+    auto key = "key" + std::to_string(i++);
+    auto status = writer.Append(test::StrSpan(key), test::StrSpan(value),
+                                [](Position) {});
+    if (!status.ok()) {
+      state.SkipWithError("append failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+void BM_Append(benchmark::State& state) { AppendEntries(state, false); }
+BENCHMARK(BM_Append)->Arg(16)->Arg(100)->Arg(4096);
+
+void BM_AppendWithHints(benchmark::State& state) {
+  AppendEntries(state, true);
+}
+BENCHMARK(BM_AppendWithHints)->Arg(16)->Arg(100)->Arg(4096);
+
+}  // namespace
+}  // namespace log
+}  // namespace mybitcask
+
+BENCHMARK_MAIN();
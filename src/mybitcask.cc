@@ -1,90 +1,1223 @@
 #include "mybitcask/mybitcask.h"
+#include "absl/strings/numbers.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/time/time.h"
 #include "spdlog/sinks/rotating_file_sink.h"
+#include "rate_limiter.h"
+#include "scheduler.h"
 #include "store_dbfiles.h"
+#include "store_hint.h"
+#include "thread_pool.h"
 #include "worker_generate_hint.h"
 #include "worker_merge.h"
 
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
 namespace mybitcask {
 
-const std::size_t kWorkerIntervalSeconds = 30;
+// Merges also run periodically, since garbage accumulated before the
+// database was opened is not accounted
+const absl::Duration kMergeInterval = absl::Seconds(30);
 const std::size_t kSpdlogMaxFileSize = 5 * 1024 * 1024;
 const std::size_t kSpdlogMaxFiles = 10;
 const std::string kSpdlogFilename = "logs/mybitcask.txt";
+// Entries starting in the last kRecoveryVerifyLen bytes of the latest log
+// file have their checksum verified by Open, the ones a crash may have torn
+const std::uint64_t kRecoveryVerifyLen = 1024 * 1024;
+// Times CompactAll lists the files again when merges remove some of them
+// before they are compacted
+const int kCompactAllAttempts = 3;
+// Times in a row the merge job runs again at once when it fails or has to
+// leave out a file without a hint file, before waiting for kMergeInterval
+const int kMergeRetries = 3;
 
 absl::Span<const std::uint8_t> MakeU8Span(const std::string& s) {
   return {reinterpret_cast<const std::uint8_t*>(s.data()), s.size()};
 }
 
+namespace {
+void RemoveLogFile(Env* env, const ghc::filesystem::path& path,
+                   store::file_id_t file_id) {
+  auto _ = env->RemoveFile(path / store::HintFilename(file_id));
+  _ = env->RemoveFile(path / store::LogFilename(file_id));
+}
+
+// A crash while entries were appended leaves the latest log file with a
+// torn tail, which is cut off before anything reads the file, unless
+// `recovery_mode` forbids it. Returns what was cut off.
+absl::StatusOr<RecoveryReport> RecoverTornTail(const store::DBFiles& dbfiles,
+                                               RecoveryMode recovery_mode,
+                                               Env* env) {
+  RecoveryReport recovery_report;
+  auto latest_file_id = dbfiles.latest_file_id();
+  auto latest_path = dbfiles.path() / store::LogFilename(latest_file_id);
+  if (!env->FileExists(latest_path)) {
+    return recovery_report;
+  }
+  auto tail = log::FindTornTail(latest_path, kRecoveryVerifyLen, env);
+  if (!tail.ok()) {
+    return tail.status();
+  }
+  if (tail->valid_len < tail->file_len) {
+    if (recovery_mode == RecoveryMode::kAbsoluteConsistency) {
+      return absl::DataLossError(kErrTornTail);
+    }
+    auto status = env->TruncateFile(latest_path, tail->valid_len);
+    if (!status.ok()) {
+      return status;
+    }
+    recovery_report.file_id = latest_file_id;
+    recovery_report.truncated_len = tail->valid_len;
+    recovery_report.dropped_bytes = tail->file_len - tail->valid_len;
+  }
+  return recovery_report;
+}
+}  // namespace
+
 MyBitcask::MyBitcask(std::unique_ptr<store::Store>&& store,
+                     std::unique_ptr<store::hint::Builder>&& hint_builder,
                      log::Reader&& log_reader, log::Writer&& log_writer,
-                     absl::btree_map<std::string, Position>&& index)
-    : store_(std::move(store)),
-      index_(std::move(index)),
+                     absl::btree_map<std::string, IndexEntry>&& index)
+    : index_(std::move(index)),
       index_rwlock_(),
+      inline_value_max_len_(0),
+      inline_values_budget_(0),
+      inline_bytes_(0),
+      sequence_(0),
+      store_(std::move(store)),
+      hint_builder_(std::move(hint_builder)),
       log_reader_(std::move(log_reader)),
       log_writer_(std::move(log_writer)),
       generate_hint_worker_(nullptr),
       merge_worker_(nullptr),
-      logger_(nullptr) {}
+      logger_(nullptr),
+      garbage_bytes_(0),
+      merge_trigger_bytes_(0),
+      merge_retries_(0),
+      expiring_keys_(false),
+      expiry_sweep_batch_(0),
+      scheduler_(nullptr),
+      hint_job_(0),
+      merge_job_(0),
+      sweep_job_(0),
+      stats_dump_job_(0) {}
+
+MyBitcask::~MyBitcask() {
+  // Queued asynchronous operations are completed first
+  write_pool_.reset();
+  read_pool_.reset();
+  if (scheduler_ != nullptr) {
+    scheduler_->Shutdown();
+  }
+  auto _ = hint_builder_->Flush();
+  for (auto file_id : obsolete_files_) {
+    RemoveLogFile(store_->env(), store_->Path(), file_id);
+  }
+}
 
 absl::StatusOr<bool> MyBitcask::Get(absl::string_view key, std::string* value,
                                     int try_num) noexcept {
-  auto pos = get_position(key);
-  if (!pos.has_value()) {
-    return false;
+  return get(nullptr, key, value, try_num);
+}
+
+absl::StatusOr<bool> MyBitcask::Get(const ReadOptions& options,
+                                    absl::string_view key,
+                                    std::string* value) noexcept {
+  return get(options.snapshot, key, value, 2);
+}
+
+std::vector<absl::StatusOr<bool>> MyBitcask::MultiGet(
+    const ReadOptions& options, const std::vector<absl::string_view>& keys,
+    std::vector<std::string>* values) noexcept {
+  std::shared_ptr<const Snapshot> snapshot;
+  auto read_at = options.snapshot;
+  if (read_at == nullptr) {
+    snapshot = GetSnapshot();
+    read_at = snapshot.get();
   }
-  std::uint8_t* value_ptr;
-  std::vector<std::uint8_t> trash;
-  if (value) {
-    value->resize(pos->value_len);
-    value_ptr = const_cast<std::uint8_t*>(
-        reinterpret_cast<const std::uint8_t*>(value->data()));
+  values->resize(keys.size());
+  std::vector<absl::StatusOr<bool>> results;
+  results.reserve(keys.size());
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    results.push_back(get(read_at, keys[i], &(*values)[i], 2));
+  }
+  return results;
+}
+
+std::unique_ptr<Iterator> MyBitcask::NewIterator(
+    const ReadOptions& options) noexcept {
+  std::shared_ptr<const Snapshot> snapshot;
+  if (options.snapshot == nullptr) {
+    snapshot = GetSnapshot();
   } else {
-    trash.resize(pos->value_len);
-    value_ptr = trash.data();
+    // The snapshot is owned by the caller
+    snapshot = std::shared_ptr<const Snapshot>(options.snapshot,
+                                               [](const Snapshot*) {});
   }
-  auto found =
-      log_reader_.Read(*pos, static_cast<std::uint8_t>(key.size()), value_ptr);
+  return std::unique_ptr<Iterator>(new Iterator(this, std::move(snapshot)));
+}
+
+std::shared_ptr<const Snapshot> MyBitcask::GetSnapshot() noexcept {
+  absl::WriterMutexLock guard(&index_rwlock_);
+  snapshots_.insert(sequence_);
+  return std::shared_ptr<const Snapshot>(new Snapshot(sequence_),
+                                         [this](const Snapshot* snapshot) {
+                                           release_snapshot(snapshot);
+                                           delete snapshot;
+                                         });
+}
 
-  if (!found.ok()) {
-    return found.status();
+void MyBitcask::release_snapshot(const Snapshot* snapshot) {
+  std::vector<store::file_id_t> obsolete_files;
+  {
+    absl::WriterMutexLock guard(&index_rwlock_);
+    snapshots_.erase(snapshots_.find(snapshot->sequence_));
+    // Versions replaced before the oldest snapshot left was taken are not
+    // seen by any snapshot anymore
+    auto oldest = snapshots_.empty() ? sequence_ : *snapshots_.begin();
+    while (!history_order_.empty() && history_order_.front().first <= oldest) {
+      auto it = history_.find(history_order_.front().second);
+      it->second.erase(it->second.begin());
+      if (it->second.empty()) {
+        history_.erase(it);
+      }
+      history_order_.pop_front();
+    }
+    if (snapshots_.empty()) {
+      obsolete_files.swap(obsolete_files_);
+    }
+  }
+  for (auto file_id : obsolete_files) {
+    RemoveLogFile(store_->env(), store_->Path(), file_id);
   }
-  if (!*found) {
-    if (try_num > 0) {
-      return Get(key, value, try_num - 1);
+}
+
+void MyBitcask::record_write(const std::string& key, const IndexEntry* entry) {
+  sequence_++;
+  if (snapshots_.empty()) {
+    return;
+  }
+  history_[key].push_back(KeyVersion{
+      sequence_,
+      entry != nullptr ? absl::make_optional(entry->pos) : absl::nullopt});
+  history_order_.emplace_back(sequence_, key);
+}
+
+bool MyBitcask::remove_merged_file(store::file_id_t file_id) {
+  {
+    absl::WriterMutexLock guard(&index_rwlock_);
+    // Snapshots may read the old versions in the file
+    if (!snapshots_.empty()) {
+      obsolete_files_.push_back(file_id);
+      return false;
     }
-    return false;
   }
+  RemoveLogFile(store_->env(), store_->Path(), file_id);
   return true;
 }
 
+absl::StatusOr<bool> MyBitcask::get(const Snapshot* snapshot,
+                                    absl::string_view key, std::string* value,
+                                    int try_num) noexcept {
+  auto statistics = statistics_.get();
+  StopWatch watch(statistics, Histogram::kGetMicros);
+  PerfTimer timer(&PerfContext::get_nanos);
+  PerfCount(&PerfContext::get_count);
+  std::vector<std::uint8_t> trash;
+  for (;; try_num--) {
+    bool inlined = false;
+    auto pos = lookup(snapshot, key, value, &inlined);
+    if (!pos.has_value()) {
+      RecordTick(statistics, Ticker::kGetMisses);
+      return false;
+    }
+    if (inlined) {
+      RecordTick(statistics, Ticker::kGetHits);
+      RecordTick(statistics, Ticker::kInlineValueHits);
+      return true;
+    }
+    // Compressed values are decompressed straight into `value`
+    auto found = log_reader_.ReadValue(
+        *pos, static_cast<std::uint32_t>(key.size()),
+        [&](std::uint64_t value_len) -> std::uint8_t* {
+          if (value) {
+            value->resize(value_len);
+            return const_cast<std::uint8_t*>(
+                reinterpret_cast<const std::uint8_t*>(value->data()));
+          }
+          trash.resize(value_len);
+          return trash.data();
+        });
+
+    if (!found.ok()) {
+      return found.status();
+    }
+    if (*found) {
+      RecordTick(statistics, Ticker::kGetHits);
+      RecordTick(statistics, Ticker::kInlineValueMisses);
+      return true;
+    }
+    // The entry was moved by a merge meanwhile
+    if (try_num <= 0) {
+      RecordTick(statistics, Ticker::kGetMisses);
+      return false;
+    }
+  }
+}
+
+absl::StatusOr<bool> MyBitcask::GetStream(absl::string_view key,
+                                          const ValueSink& sink) noexcept {
+  for (int try_num = 2;; try_num--) {
+    std::string value;
+    bool inlined = false;
+    auto pos = lookup(nullptr, key, &value, &inlined);
+    if (!pos.has_value()) {
+      return false;
+    }
+    if (inlined) {
+      auto status = sink(MakeU8Span(value));
+      if (!status.ok()) {
+        return status;
+      }
+      return true;
+    }
+    // Nothing is passed to `sink` if the entry is not found
+    auto found = log_reader_.ReadStream(
+        *pos, static_cast<std::uint32_t>(key.size()), sink);
+    if (!found.ok() || *found || try_num == 0) {
+      return found;
+    }
+  }
+}
+
 absl::Status MyBitcask::Insert(const std::string& key,
                                const std::string& value) noexcept {
-  return log_writer_.Append(MakeU8Span(key), MakeU8Span(value),
-                            [&](Position pos) {
-                              absl::WriterMutexLock guard(&index_rwlock_);
-                              index_.insert_or_assign(key, pos);
-                            });
+  return insert(key, value, 0);
+}
+
+absl::Status MyBitcask::Insert(const std::string& key,
+                               const std::string& value,
+                               absl::Duration ttl) noexcept {
+  if (ttl <= absl::ZeroDuration()) {
+    return absl::InvalidArgumentError(kErrBadTtl);
+  }
+  if (ttl == absl::InfiniteDuration()) {
+    return insert(key, value, 0);
+  }
+  // Rounded up, so the key never expires before `ttl` elapsed
+  auto ttl_ms =
+      absl::ToInt64Milliseconds(absl::Ceil(ttl, absl::Milliseconds(1)));
+  expiring_keys_.store(true);
+  return insert(key, value,
+                log::NowMillis() + static_cast<std::uint64_t>(ttl_ms));
+}
+
+absl::Status MyBitcask::insert(const std::string& key,
+                               const std::string& value,
+                               std::uint64_t expire_at) {
+  StopWatch watch(statistics_.get(), Histogram::kInsertMicros);
+  PerfTimer timer(&PerfContext::insert_nanos);
+  PerfCount(&PerfContext::insert_count);
+  std::uint64_t garbage_bytes = 0;
+  auto status = log_writer_.Append(
+      MakeU8Span(key), MakeU8Span(value),
+      [&](Position pos) {
+        garbage_bytes = put_index(key, pos, MakeU8Span(value));
+      },
+      expire_at);
+  if (status.ok()) {
+    RecordTick(statistics_.get(), Ticker::kUserBytesWritten,
+               key.size() + value.size());
+    add_garbage(garbage_bytes);
+  }
+  return status;
+}
+
+absl::Status MyBitcask::InsertStream(const std::string& key,
+                                     std::uint64_t value_len,
+                                     const ValueSource& source) noexcept {
+  StopWatch watch(statistics_.get(), Histogram::kInsertMicros);
+  PerfTimer timer(&PerfContext::insert_nanos);
+  PerfCount(&PerfContext::insert_count);
+  std::vector<std::uint8_t> buf(
+      std::min<std::uint64_t>(value_len, log::kStreamChunkSize));
+  auto produce = [&](const store::PieceWriter& write) -> absl::Status {
+    std::uint64_t remaining = value_len;
+    while (remaining > 0) {
+      auto dst = absl::MakeSpan(buf).subspan(
+          0, static_cast<std::size_t>(
+                 std::min<std::uint64_t>(buf.size(), remaining)));
+      auto filled = source(dst);
+      if (!filled.ok()) {
+        return filled.status();
+      }
+      if (*filled == 0) {
+        // The writer reports that the value is too short
+        break;
+      }
+      if (*filled > dst.size()) {
+        return absl::InternalError(log::kErrBadValueLength);
+      }
+      auto status = write(dst.subspan(0, *filled));
+      if (!status.ok()) {
+        return status;
+      }
+      remaining -= *filled;
+    }
+    return absl::OkStatus();
+  };
+  std::uint64_t garbage_bytes = 0;
+  auto status = log_writer_.AppendStream(
+      MakeU8Span(key), value_len, produce,
+      [&](Position pos) { garbage_bytes = put_index(key, pos, {}); });
+  if (status.ok()) {
+    RecordTick(statistics_.get(), Ticker::kUserBytesWritten,
+               key.size() + value_len);
+    add_garbage(garbage_bytes);
+  }
+  return status;
 }
 
 absl::Status MyBitcask::Delete(const std::string& key) noexcept {
-  return log_writer_.AppendTombstone(MakeU8Span(key), [&](Position) {
-    absl::WriterMutexLock guard(&index_rwlock_);
-    index_.erase(key);
+  StopWatch watch(statistics_.get(), Histogram::kDeleteMicros);
+  std::uint64_t garbage_bytes = 0;
+  auto status = log_writer_.AppendTombstone(
+      MakeU8Span(key), [&](Position) { garbage_bytes = erase_index(key); });
+  if (status.ok()) {
+    RecordTick(statistics_.get(), Ticker::kUserBytesWritten, key.size());
+    add_garbage(garbage_bytes);
+  }
+  return status;
+}
+
+std::uint64_t MyBitcask::erase_index(const std::string& key) {
+  PerfTimer lock_timer(&PerfContext::index_lock_wait_nanos);
+  absl::WriterMutexLock guard(&index_rwlock_);
+  lock_timer.Stop();
+  PerfTimer timer(&PerfContext::index_update_nanos);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return 0;
+  }
+  auto garbage_bytes = log::EntryLen(key.size(), it->second.pos.value_len);
+  record_write(key, &it->second);
+  drop_inline_value(&it->second);
+  index_.erase(it);
+  return garbage_bytes;
+}
+
+absl::StatusOr<bool> MyBitcask::CompareAndSwap(
+    const std::string& key, const absl::optional<std::string>& expected,
+    const absl::optional<std::string>& desired) noexcept {
+  return read_modify_write(
+      key,
+      [&](const std::string* value,
+          absl::optional<std::string>* new_value) -> absl::StatusOr<bool> {
+        if (expected.has_value() ? value == nullptr || *value != *expected
+                                 : value != nullptr) {
+          return false;
+        }
+        *new_value = desired;
+        return true;
+      });
+}
+
+absl::Status MyBitcask::MergeValue(const std::string& key,
+                                   absl::string_view operand) noexcept {
+  if (merge_operator_ == nullptr) {
+    return absl::FailedPreconditionError(kErrNoMergeOperator);
+  }
+  auto merged = read_modify_write(
+      key,
+      [&](const std::string* value,
+          absl::optional<std::string>* new_value) -> absl::StatusOr<bool> {
+        std::string merged_value;
+        if (!merge_operator_->Merge(key, value, operand, &merged_value)) {
+          return absl::InvalidArgumentError(kErrBadMergeOperand);
+        }
+        *new_value = std::move(merged_value);
+        return true;
+      });
+  return merged.status();
+}
+
+absl::StatusOr<bool> MyBitcask::read_modify_write(const std::string& key,
+                                                  const Updater& update) {
+  while (true) {
+    std::string value;
+    bool inlined = false;
+    auto pos = lookup(nullptr, key, &value, &inlined);
+    if (pos.has_value() && !inlined) {
+      auto found = log_reader_.ReadValue(
+          *pos, static_cast<std::uint32_t>(key.size()),
+          [&](std::uint64_t value_len) {
+            value.resize(value_len);
+            return reinterpret_cast<std::uint8_t*>(&value[0]);
+          });
+      if (!found.ok()) {
+        return found.status();
+      }
+      if (!*found) {
+        // Moved by a merge in between
+        continue;
+      }
+    }
+    absl::optional<std::string> new_value;
+    auto updated = update(pos.has_value() ? &value : nullptr, &new_value);
+    if (!updated.ok() || !*updated) {
+      return updated;
+    }
+    // Checked atomically with the append, so no write of the key can come
+    // in between
+    auto unchanged = [&]() {
+      auto current = get_position(key);
+      if (current.has_value() && log::Expired(current->expire_at)) {
+        current = absl::nullopt;
+      }
+      return current == pos;
+    };
+    std::uint64_t garbage_bytes = 0;
+    absl::StatusOr<bool> written = true;
+    if (new_value.has_value()) {
+      written = log_writer_.AppendIf(
+          MakeU8Span(key), MakeU8Span(*new_value), unchanged,
+          [&](Position new_pos) {
+            garbage_bytes = put_index(key, new_pos, MakeU8Span(*new_value));
+          });
+    } else if (pos.has_value()) {
+      written = log_writer_.AppendTombstoneIf(
+          MakeU8Span(key), unchanged,
+          [&](Position) { garbage_bytes = erase_index(key); });
+    }
+    if (!written.ok()) {
+      return written.status();
+    }
+    if (*written) {
+      if (new_value.has_value() || pos.has_value()) {
+        RecordTick(statistics_.get(), Ticker::kUserBytesWritten,
+                   key.size() + (new_value.has_value() ? new_value->size()
+                                                       : 0));
+      }
+      add_garbage(garbage_bytes);
+      return true;
+    }
+  }
+}
+
+namespace {
+
+class Int64Add final : public MergeOperator {
+ public:
+  bool Merge(absl::string_view, const std::string* existing_value,
+             absl::string_view operand,
+             std::string* new_value) const override {
+    std::int64_t value = 0;
+    std::int64_t delta = 0;
+    if ((existing_value != nullptr &&
+         !absl::SimpleAtoi(*existing_value, &value)) ||
+        !absl::SimpleAtoi(operand, &delta)) {
+      return false;
+    }
+    // Wraps around on overflow
+    *new_value = std::to_string(static_cast<std::int64_t>(
+        static_cast<std::uint64_t>(value) + static_cast<std::uint64_t>(delta)));
+    return true;
+  }
+};
+
+class StringAppend final : public MergeOperator {
+ public:
+  explicit StringAppend(char delimiter) : delimiter_(delimiter) {}
+
+  bool Merge(absl::string_view, const std::string* existing_value,
+             absl::string_view operand,
+             std::string* new_value) const override {
+    new_value->clear();
+    if (existing_value != nullptr) {
+      new_value->reserve(existing_value->size() + 1 + operand.size());
+      new_value->append(*existing_value);
+      new_value->push_back(delimiter_);
+    }
+    new_value->append(operand.data(), operand.size());
+    return true;
+  }
+
+ private:
+  char delimiter_;
+};
+
+}  // namespace
+
+std::shared_ptr<const MergeOperator> Int64AddOperator() {
+  return std::make_shared<Int64Add>();
+}
+
+std::shared_ptr<const MergeOperator> StringAppendOperator(char delimiter) {
+  return std::make_shared<StringAppend>(delimiter);
+}
+
+void WriteBatch::Insert(std::string key, std::string value) {
+  ops_.push_back(Op{std::move(key), absl::make_optional(std::move(value))});
+}
+
+void WriteBatch::Delete(std::string key) {
+  ops_.push_back(Op{std::move(key), absl::nullopt});
+}
+
+absl::Status MyBitcask::Write(const WriteBatch& batch) noexcept {
+  for (auto& op : batch.ops_) {
+    auto status = op.value.has_value() ? Insert(op.key, *op.value)
+                                       : Delete(op.key);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+void MyBitcask::GetAsync(const ReadOptions& options, std::string key,
+                         GetCallback callback) noexcept {
+  auto snapshot = options.snapshot;
+  auto shared_key = std::make_shared<std::string>(std::move(key));
+  read_pool_->Schedule([this, snapshot, shared_key, callback]() {
+    std::string value;
+    auto found = get(snapshot, *shared_key, &value, 2);
+    callback(std::move(found), std::move(value));
   });
 }
 
+std::future<absl::StatusOr<absl::optional<std::string>>> MyBitcask::GetAsync(
+    const ReadOptions& options, std::string key) noexcept {
+  auto promise = std::make_shared<
+      std::promise<absl::StatusOr<absl::optional<std::string>>>>();
+  GetAsync(options, std::move(key),
+           [promise](absl::StatusOr<bool> found, std::string value) {
+             if (!found.ok()) {
+               promise->set_value(found.status());
+             } else if (*found) {
+               promise->set_value(absl::make_optional(std::move(value)));
+             } else {
+               promise->set_value(absl::optional<std::string>());
+             }
+           });
+  return promise->get_future();
+}
+
+void MyBitcask::InsertAsync(std::string key, std::string value,
+                            WriteCallback callback) noexcept {
+  WriteBatch batch;
+  batch.Insert(std::move(key), std::move(value));
+  WriteAsync(std::move(batch), std::move(callback));
+}
+
+std::future<absl::Status> MyBitcask::InsertAsync(std::string key,
+                                                 std::string value) noexcept {
+  WriteBatch batch;
+  batch.Insert(std::move(key), std::move(value));
+  return WriteAsync(std::move(batch));
+}
+
+void MyBitcask::WriteAsync(WriteBatch batch, WriteCallback callback) noexcept {
+  auto shared_batch = std::make_shared<WriteBatch>(std::move(batch));
+  // A single thread appends the writes, so they complete in log order
+  write_pool_->Schedule([this, shared_batch, callback]() {
+    callback(Write(*shared_batch));
+  });
+}
+
+std::future<absl::Status> MyBitcask::WriteAsync(WriteBatch batch) noexcept {
+  auto promise = std::make_shared<std::promise<absl::Status>>();
+  WriteAsync(std::move(batch),
+             [promise](absl::Status status) { promise->set_value(status); });
+  return promise->get_future();
+}
+
 absl::optional<Position> MyBitcask::get_position(absl::string_view key) {
   absl::ReaderMutexLock guard(&index_rwlock_);
   auto const search = index_.find(key);
   if (search == index_.cend()) {
     return absl::nullopt;
   }
-  return search->second;
+  return search->second.pos;
+}
+
+absl::optional<Position> MyBitcask::lookup(const Snapshot* snapshot,
+                                           absl::string_view key,
+                                           std::string* value,
+                                           bool* inlined) {
+  PerfTimer lock_timer(&PerfContext::index_lock_wait_nanos);
+  absl::ReaderMutexLock guard(&index_rwlock_);
+  lock_timer.Stop();
+  PerfTimer timer(&PerfContext::index_lookup_nanos);
+  return find_locked(snapshot, key, value, inlined);
+}
+
+absl::optional<std::string> MyBitcask::next_key(const Snapshot* snapshot,
+                                                absl::string_view key,
+                                                bool inclusive) {
+  std::string current(key.data(), key.size());
+  absl::ReaderMutexLock guard(&index_rwlock_);
+  while (true) {
+    auto in_index = inclusive ? index_.lower_bound(current)
+                              : index_.upper_bound(current);
+    // Keys written since the snapshot may only be in the history
+    auto in_history = inclusive ? history_.lower_bound(current)
+                                : history_.upper_bound(current);
+    const std::string* next = nullptr;
+    if (in_index != index_.end()) {
+      next = &in_index->first;
+    }
+    if (in_history != history_.end() &&
+        (next == nullptr || in_history->first < *next)) {
+      next = &in_history->first;
+    }
+    if (next == nullptr) {
+      return absl::nullopt;
+    }
+    bool inlined = false;
+    if (find_locked(snapshot, *next, nullptr, &inlined).has_value()) {
+      return *next;
+    }
+    current = *next;
+    inclusive = false;
+  }
+}
+
+absl::optional<Position> MyBitcask::find_locked(const Snapshot* snapshot,
+                                                absl::string_view key,
+                                                std::string* value,
+                                                bool* inlined) {
+  if (snapshot != nullptr) {
+    auto versions = history_.find(key);
+    if (versions != history_.end()) {
+      for (auto& version : versions->second) {
+        if (version.until <= snapshot->sequence_) {
+          continue;
+        }
+        // The first version replaced after the snapshot was taken
+        if (!version.pos.has_value() ||
+            log::Expired(version.pos->expire_at)) {
+          return absl::nullopt;
+        }
+        *inlined = false;
+        return version.pos;
+      }
+    }
+  }
+  auto const search = index_.find(key);
+  if (search == index_.cend() ||
+      log::Expired(search->second.pos.expire_at)) {
+    return absl::nullopt;
+  }
+  auto& inlined_value = search->second.value;
+  *inlined = inlined_value != nullptr;
+  if (*inlined && value != nullptr) {
+    value->assign(reinterpret_cast<const char*>(&inlined_value[1]),
+                  inlined_value[0]);
+  }
+  return search->second.pos;
+}
+
+std::uint64_t MyBitcask::put_index(const std::string& key,
+                                   const Position& pos,
+                                   absl::Span<const std::uint8_t> value) {
+  PerfTimer lock_timer(&PerfContext::index_lock_wait_nanos);
+  absl::WriterMutexLock guard(&index_rwlock_);
+  lock_timer.Stop();
+  PerfTimer timer(&PerfContext::index_update_nanos);
+  auto it = index_.find(key);
+  record_write(key, it != index_.end() ? &it->second : nullptr);
+  if (it == index_.end()) {
+    it = index_.emplace(key, IndexEntry{pos, nullptr}).first;
+    inline_value(&it->second, value);
+    return 0;
+  }
+  auto garbage_bytes = log::EntryLen(key.size(), it->second.pos.value_len);
+  it->second.pos = pos;
+  inline_value(&it->second, value);
+  return garbage_bytes;
 }
 
-void MyBitcask::setup_worker(bool out_log) {
-  if (out_log) {
+std::uint64_t MyBitcask::put_index_sorted(
+    std::vector<std::pair<std::string, Position>>* entries) {
+  absl::WriterMutexLock guard(&index_rwlock_);
+  std::uint64_t garbage_bytes = 0;
+  // Each key is inserted right before the entry after the previous one,
+  // which takes amortized constant time while no other key is in between
+  auto hint = index_.end();
+  for (auto& entry : *entries) {
+    const auto& pos = entry.second;
+    auto it = index_.insert(
+        hint, std::make_pair(std::move(entry.first), IndexEntry{pos, nullptr}));
+    if (it->second.pos == pos) {
+      record_write(it->first, nullptr);
+    } else {
+      record_write(it->first, &it->second);
+      garbage_bytes +=
+          log::EntryLen(it->first.size(), it->second.pos.value_len);
+      it->second.pos = pos;
+      drop_inline_value(&it->second);
+    }
+    hint = std::next(it);
+  }
+  return garbage_bytes;
+}
+
+void MyBitcask::inline_value(IndexEntry* entry,
+                             absl::Span<const std::uint8_t> value) {
+  drop_inline_value(entry);
+  if (value.empty() || value.size() > inline_value_max_len_ ||
+      inline_bytes_ + value.size() + 1 > inline_values_budget_) {
+    return;
+  }
+  entry->value.reset(new std::uint8_t[value.size() + 1]);
+  entry->value[0] = static_cast<std::uint8_t>(value.size());
+  std::memcpy(&entry->value[1], value.data(), value.size());
+  inline_bytes_ += value.size() + 1;
+}
+
+void MyBitcask::drop_inline_value(IndexEntry* entry) {
+  if (entry->value != nullptr) {
+    inline_bytes_ -= entry->value[0] + 1;
+    entry->value.reset();
+  }
+}
+
+absl::Status MyBitcask::load_inline_values() {
+  if (inline_value_max_len_ == 0) {
+    return absl::OkStatus();
+  }
+  // Values are read in log order, so the log files are read sequentially
+  std::vector<std::pair<const std::string*, IndexEntry*>> small;
+  for (auto& kv : index_) {
+    if (kv.second.pos.value_len <= inline_value_max_len_) {
+      small.emplace_back(&kv.first, &kv.second);
+    }
+  }
+  std::sort(small.begin(), small.end(),
+            [](const std::pair<const std::string*, IndexEntry*>& a,
+               const std::pair<const std::string*, IndexEntry*>& b) {
+              return std::make_pair(a.second->pos.file_id,
+                                    a.second->pos.value_pos) <
+                     std::make_pair(b.second->pos.file_id,
+                                    b.second->pos.value_pos);
+            });
+  std::vector<std::uint8_t> value;
+  absl::WriterMutexLock guard(&index_rwlock_);
+  for (auto& key_entry : small) {
+    if (inline_bytes_ + key_entry.second->pos.value_len + 1 >
+        inline_values_budget_) {
+      break;
+    }
+    auto found = log_reader_.ReadValue(
+        key_entry.second->pos,
+        static_cast<std::uint32_t>(key_entry.first->size()),
+        [&](std::uint64_t value_len) {
+          value.resize(static_cast<std::size_t>(value_len));
+          return value.data();
+        });
+    if (!found.ok()) {
+      return found.status();
+    }
+    if (*found) {
+      inline_value(key_entry.second, absl::MakeSpan(value));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status MyBitcask::Merge() noexcept {
+  auto status = flush_hints();
+  if (!status.ok()) {
+    return status;
+  }
+  return merge_worker_->RunOnce();
+}
+
+absl::StatusOr<CompactionStats> MyBitcask::CompactFiles(
+    const std::vector<store::file_id_t>& file_ids,
+    const CompactOptions& options) noexcept {
+  // Closed log files without a hint file get one first
+  auto status = flush_hints();
+  if (!status.ok()) {
+    return status;
+  }
+  std::vector<store::file_id_t> sorted(file_ids);
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+  std::unique_ptr<RateLimiter> rate_limiter;
+  if (options.rate_limit_bytes_per_second > 0) {
+    rate_limiter = std::unique_ptr<RateLimiter>(
+        new RateLimiter(options.rate_limit_bytes_per_second));
+  }
+  auto stats = merge_worker_->Compact(
+      absl::MakeSpan(sorted), options.merge_threshold, rate_limiter.get());
+  train_dictionary();
+  return stats;
+}
+
+absl::StatusOr<CompactionStats> MyBitcask::CompactAll(
+    const CompactOptions& options) noexcept {
+  auto status = flush_hints();
+  if (!status.ok()) {
+    return status;
+  }
+  for (int attempt = 1;; attempt++) {
+    store::DBFiles dbfiles(store_->Path(), store_->env());
+    std::vector<store::file_id_t> file_ids(dbfiles.hint_files().begin(),
+                                           dbfiles.hint_files().end());
+    auto stats = CompactFiles(file_ids, options);
+    if (stats.status().code() != absl::StatusCode::kInvalidArgument ||
+        attempt == kCompactAllAttempts) {
+      return stats;
+    }
+    // Retried only if a background merge removed some of the files in the
+    // meantime
+    store::DBFiles after(store_->Path(), store_->env());
+    if (std::includes(after.hint_files().begin(), after.hint_files().end(),
+                      file_ids.begin(), file_ids.end())) {
+      return stats;
+    }
+  }
+}
+
+std::future<absl::StatusOr<CompactionStats>> MyBitcask::CompactFilesAsync(
+    const std::vector<store::file_id_t>& file_ids,
+    const CompactOptions& options) noexcept {
+  return compact_async(
+      [this, file_ids, options]() { return CompactFiles(file_ids, options); });
+}
+
+std::future<absl::StatusOr<CompactionStats>> MyBitcask::CompactAllAsync(
+    const CompactOptions& options) noexcept {
+  return compact_async([this, options]() { return CompactAll(options); });
+}
+
+namespace {
+// Fulfills the promise with a Cancelled error if the compaction never ran
+struct CompactionTask {
+  std::promise<absl::StatusOr<CompactionStats>> promise;
+  bool done = false;
+
+  ~CompactionTask() {
+    if (!done) {
+      promise.set_value(absl::CancelledError("database closed"));
+    }
+  }
+};
+}  // namespace
+
+std::future<absl::StatusOr<CompactionStats>> MyBitcask::compact_async(
+    std::function<absl::StatusOr<CompactionStats>()> compact) {
+  std::shared_ptr<CompactionTask> task(new CompactionTask());
+  auto future = task->promise.get_future();
+  scheduler_->Schedule(JobPriority::kLow, [task, compact]() {
+    task->promise.set_value(compact());
+    task->done = true;
+  });
+  return future;
+}
+
+absl::Status MyBitcask::IngestFiles(
+    const std::vector<ghc::filesystem::path>& paths) noexcept {
+  if (paths.empty()) {
+    return absl::OkStatus();
+  }
+  // Every file is read before any is moved, so that nothing is ingested if
+  // one is bad. Entries are numbered by their file from 1.
+  auto env = store_->env();
+  std::vector<std::pair<std::string, Position>> entries;
+  std::uint64_t user_bytes = 0;
+  std::uint64_t log_bytes = 0;
+  bool expiring_keys = false;
+  for (std::size_t i = 0; i < paths.size(); i++) {
+    auto file_len = env->GetFileSize(paths[i]);
+    if (!file_len.ok()) {
+      return file_len.status();
+    }
+    log_bytes += *file_len;
+    auto version = log::ReadFormatVersion(paths[i], env);
+    if (!version.ok()) {
+      return version.status();
+    }
+    if (!version->has_value() || **version != log::kFormatVersion) {
+      return absl::InvalidArgumentError(kErrNotIngestible);
+    }
+    auto file_id = static_cast<store::file_id_t>(i + 1);
+    bool tombstones = false;
+    auto folded =
+        store::hint::KeyIter(LogFileBuilder::HintFilePath(paths[i]), env)
+            .Fold<store::Void, std::string>(
+                store::Void(),
+                [&](store::Void&& acc, log::Key<std::string>&& key) {
+                  if (!key.value_pos.has_value()) {
+                    tombstones = true;
+                    return std::move(acc);
+                  }
+                  const auto& value_pos = *key.value_pos;
+                  user_bytes += key.key_data.size() + value_pos.value_len;
+                  expiring_keys = expiring_keys || value_pos.expire_at != 0;
+                  entries.emplace_back(
+                      std::move(key.key_data),
+                      Position{file_id, value_pos.compression,
+                               value_pos.value_pos, value_pos.value_len,
+                               value_pos.expire_at});
+                  return std::move(acc);
+                });
+    if (!folded.ok()) {
+      return folded.status();
+    }
+    if (tombstones) {
+      return absl::InvalidArgumentError(kErrNotIngestible);
+    }
+  }
+
+  // The index is updated with the keys sorted, and only with the last
+  // entry of each key. The earlier ones are garbage from the start.
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const std::pair<std::string, Position>& a,
+                      const std::pair<std::string, Position>& b) {
+                     return a.first < b.first;
+                   });
+  std::uint64_t garbage_bytes = 0;
+  std::size_t distinct = 0;
+  for (std::size_t i = 0; i < entries.size(); i++) {
+    const auto& entry = entries[i];
+    if (i + 1 < entries.size() && entries[i + 1].first == entry.first) {
+      garbage_bytes +=
+          log::EntryLen(entry.first.size(), entry.second.value_len);
+      continue;
+    }
+    if (distinct != i) {
+      entries[distinct] = std::move(entries[i]);
+    }
+    distinct++;
+  }
+  entries.resize(distinct);
+
+  auto status = store_->AddFiles(
+      static_cast<store::file_id_t>(paths.size()),
+      [&](store::file_id_t first_file_id) {
+        // A hint file without its log file is ignored, so log files are
+        // moved first. If a move fails, the files moved are moved back.
+        std::vector<std::pair<ghc::filesystem::path, ghc::filesystem::path>>
+            moves;
+        for (std::size_t i = 0; i < paths.size(); i++) {
+          auto file_id = first_file_id + static_cast<store::file_id_t>(i);
+          moves.emplace_back(paths[i],
+                             store_->Path() / store::LogFilename(file_id));
+          moves.emplace_back(LogFileBuilder::HintFilePath(paths[i]),
+                             store_->Path() / store::HintFilename(file_id));
+        }
+        for (std::size_t i = 0; i < moves.size(); i++) {
+          auto status = env->RenameFile(moves[i].first, moves[i].second);
+          if (!status.ok()) {
+            while (i-- > 0) {
+              auto _ = env->RenameFile(moves[i].second, moves[i].first);
+            }
+            return status;
+          }
+        }
+        for (auto& entry : entries) {
+          entry.second.file_id += first_file_id - 1;
+        }
+        garbage_bytes += put_index_sorted(&entries);
+        return absl::OkStatus();
+      });
+  if (!status.ok()) {
+    return status;
+  }
+  if (expiring_keys) {
+    expiring_keys_.store(true);
+  }
+  RecordTick(statistics_.get(), Ticker::kUserBytesWritten, user_bytes);
+  RecordTick(statistics_.get(), Ticker::kBytesWritten, log_bytes);
+  add_garbage(garbage_bytes);
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::unique_ptr<BulkLoader>>
+MyBitcask::NewBulkLoader() noexcept {
+  std::unique_ptr<BulkLoader> loader(
+      new BulkLoader(this, store_->env(), store_->Path(),
+                     static_cast<std::uint32_t>(
+                         store_->dead_bytes_threshold())));
+  auto status = loader->init();
+  if (!status.ok()) {
+    return status;
+  }
+  return loader;
+}
+
+void MyBitcask::PauseBackgroundWork() noexcept { scheduler_->Pause(); }
+
+void MyBitcask::ResumeBackgroundWork() noexcept { scheduler_->Resume(); }
+
+std::shared_ptr<const Statistics> MyBitcask::GetStatistics() noexcept {
+  if (statistics_ == nullptr) {
+    return nullptr;
+  }
+  update_gauges();
+  return statistics_;
+}
+
+void MyBitcask::update_gauges() {
+  {
+    absl::ReaderMutexLock guard(&index_rwlock_);
+    // The memory is estimated from the size of the index slots, the keys
+    // and the inlined values
+    std::uint64_t key_bytes = 0;
+    std::uint64_t live_bytes = 0;
+    for (const auto& entry : index_) {
+      key_bytes += entry.first.size();
+      live_bytes +=
+          log::EntryLen(entry.first.size(), entry.second.pos.value_len);
+    }
+    statistics_->Set(Gauge::kIndexKeys, index_.size());
+    statistics_->Set(
+        Gauge::kIndexMemoryBytes,
+        index_.size() * sizeof(std::pair<const std::string, IndexEntry>) +
+            key_bytes + inline_bytes_);
+    statistics_->Set(Gauge::kInlineValueBytes, inline_bytes_);
+    statistics_->Set(Gauge::kLiveDataBytes, live_bytes);
+  }
+  store::DBFiles dbfiles(store_->Path(), store_->env());
+  std::uint64_t log_bytes = 0;
+  std::uint64_t hint_bytes = 0;
+  for (auto file_id : dbfiles.log_files()) {
+    auto size = store_->env()->GetFileSize(dbfiles.path() /
+                                           store::LogFilename(file_id));
+    log_bytes += size.ok() ? *size : 0;
+  }
+  for (auto file_id : dbfiles.hint_files()) {
+    auto size = store_->env()->GetFileSize(dbfiles.path() /
+                                           store::HintFilename(file_id));
+    hint_bytes += size.ok() ? *size : 0;
+  }
+  statistics_->Set(Gauge::kLogFileBytes, log_bytes);
+  statistics_->Set(Gauge::kHintFileBytes, hint_bytes);
+}
+
+void MyBitcask::dump_statistics() {
+  update_gauges();
+  logger_->info(
+      "Space: live data {} bytes, log files {} bytes, hint files {} bytes, "
+      "space amplification {:.2f}. Writes: user {} bytes, log {} bytes of "
+      "which merges {} bytes, hint {} bytes, write amplification {:.2f}",
+      statistics_->Get(Gauge::kLiveDataBytes),
+      statistics_->Get(Gauge::kLogFileBytes),
+      statistics_->Get(Gauge::kHintFileBytes),
+      statistics_->SpaceAmplification(),
+      statistics_->Get(Ticker::kUserBytesWritten),
+      statistics_->Get(Ticker::kBytesWritten),
+      statistics_->Get(Ticker::kCompactionBytesWritten),
+      statistics_->Get(Ticker::kHintBytesWritten),
+      statistics_->WriteAmplification());
+}
+
+absl::Status MyBitcask::flush_hints() noexcept {
+  auto status = hint_builder_->Flush();
+  if (!status.ok()) {
+    logger_->warn("Failed to write hint files of closed log files: {}",
+                  status.ToString());
+  }
+  // Generates the hint files the builder failed to write, and those of log
+  // files closed before the database was opened
+  return generate_hint_worker_->RunOnce();
+}
+
+void MyBitcask::train_dictionary() {
+  if (dictionary_sampler_ == nullptr) {
+    return;
+  }
+  auto dictionary = dictionary_sampler_->Train();
+  if (dictionary == nullptr) {
+    return;
+  }
+  auto status = log_writer_.ChangeDictionary(dictionary);
+  if (!status.ok()) {
+    logger_->warn("Failed to change the compression dictionary: {}",
+                  status.ToString());
+    return;
+  }
+  logger_->info("Compressing against a new dictionary of {} bytes",
+                dictionary->data().size());
+}
+
+void MyBitcask::sweep_expired() {
+  // Cleared first, so keys inserted with a ttl during the sweep set it again
+  if (!expiring_keys_.exchange(false)) {
+    return;
+  }
+  bool expiring = false;
+  std::uint64_t garbage_bytes = 0;
+  std::string next;
+  while (true) {
+    auto now = log::NowMillis();
+    // The lock is released between batches, so reads and writes wait for
+    // at most expiry_sweep_batch_ keys
+    absl::WriterMutexLock guard(&index_rwlock_);
+    auto it = index_.lower_bound(next);
+    for (std::size_t n = 0; it != index_.end() && n < expiry_sweep_batch_;
+         n++) {
+      if (it->second.pos.expire_at == 0) {
+        ++it;
+      } else if (it->second.pos.expire_at <= now) {
+        garbage_bytes +=
+            log::EntryLen(it->first.size(), it->second.pos.value_len);
+        drop_inline_value(&it->second);
+        it = index_.erase(it);
+      } else {
+        expiring = true;
+        ++it;
+      }
+    }
+    if (it == index_.end()) {
+      break;
+    }
+    next = it->first;
+  }
+  if (expiring) {
+    expiring_keys_.store(true);
+  }
+  add_garbage(garbage_bytes);
+}
+
+void MyBitcask::add_garbage(std::uint64_t garbage_bytes) {
+  if (garbage_bytes == 0) {
+    return;
+  }
+  auto before = garbage_bytes_.fetch_add(garbage_bytes);
+  auto after = before + garbage_bytes;
+  if (merge_trigger_bytes_ == 0 ||
+      before / merge_trigger_bytes_ != after / merge_trigger_bytes_) {
+    scheduler_->Trigger(merge_job_);
+  }
+}
+
+void MyBitcask::merge_job() {
+  // Written now rather than by the concurrent hint job, so that no closed log
+  // file is left out for having no hint file yet
+  auto status = flush_hints();
+  auto run = merge_worker_->Run();
+  auto garbage = garbage_bytes_.load();
+  while (!garbage_bytes_.compare_exchange_weak(
+      garbage, garbage - std::min(garbage, run.dead_bytes))) {
+  }
+  train_dictionary();
+  if (status.ok() && run.status.ok() && !run.waiting_for_hint) {
+    merge_retries_ = 0;
+  } else if (merge_retries_ < kMergeRetries) {
+    merge_retries_++;
+    scheduler_->Trigger(merge_job_);
+  }
+}
+
+void MyBitcask::setup_worker(const Options& options) {
+  if (options.out_log) {
     logger_ = spdlog::rotating_logger_mt(
         "worker", (store_->Path() / kSpdlogFilename).string(),
         kSpdlogMaxFileSize, kSpdlogMaxFiles);
@@ -95,77 +1228,402 @@ void MyBitcask::setup_worker(bool out_log) {
   }
 
   generate_hint_worker_ = std::unique_ptr<worker::Worker>(
-      new worker::GenerateHint(&log_reader_, store_->Path(), logger_.get()));
-  generate_hint_worker_->Start(kWorkerIntervalSeconds);
-  merge_worker_ =
-      std::unique_ptr<worker::Worker>(new worker::Merge<std::string>(
-          &log_reader_, store_->Path(), 0.2f, logger_.get(),
-          [&](const log::Key<std::string>& key) {
+      new worker::GenerateHint(&log_reader_, store_->Path(), logger_.get(),
+                               statistics_.get()));
+  merge_worker_ = std::unique_ptr<worker::Merge<std::string>>(
+      new worker::Merge<std::string>(
+          &log_reader_, store_->Path(), options.merge_threshold,
+          options.merge_threads, logger_.get(), statistics_.get(),
+          [&](store::file_id_t file_id, const log::Key<std::string>& key) {
             // key_valid_fn
-            return key_valid(key);
+            return key_valid(file_id, key);
+          },
+          [&](store::file_id_t file_id, log::Key<std::string>&& key) {
+            return re_insert(file_id, std::move(key));
           },
-          [&](log::Key<std::string>&& key) {
-            return re_insert(std::move(key));
+          [&](store::file_id_t file_id) {
+            return remove_merged_file(file_id);
           }));
-  merge_worker_->Start(kWorkerIntervalSeconds);
+
+  if (options.compression_dictionary_len > 0) {
+    dictionary_sampler_ = std::unique_ptr<compression::DictionarySampler>(
+        new compression::DictionarySampler(
+            options.compression_dictionary_len));
+  }
+
+  expiry_sweep_batch_ = std::max<std::size_t>(1, options.expiry_sweep_batch);
+  merge_operator_ = options.merge_operator;
+  merge_trigger_bytes_ = options.merge_trigger_bytes;
+  if (merge_trigger_bytes_ == 0) {
+    merge_trigger_bytes_ = static_cast<std::uint64_t>(
+        options.dead_bytes_threshold *
+        std::max(0.0f, std::min(1.0f, 1.0f - options.merge_threshold)));
+  }
+  read_pool_ = std::unique_ptr<ThreadPool>(
+      new ThreadPool(std::max<std::size_t>(1, options.io_threads)));
+  write_pool_ = std::unique_ptr<ThreadPool>(new ThreadPool(1));
+  scheduler_ = std::unique_ptr<Scheduler>(
+      new Scheduler(options.background_threads));
+  // Hint files speed up both recovery and merge, and are cheap to write
+  hint_job_ = scheduler_->AddJob(JobPriority::kHigh,
+                                 [this]() { auto _ = flush_hints(); });
+  merge_job_ = scheduler_->AddJob(
+      JobPriority::kLow, [this]() { merge_job(); }, kMergeInterval);
+  if (options.expiry_sweep_interval_ms > 0) {
+    sweep_job_ = scheduler_->AddJob(
+        JobPriority::kLow, [this]() { sweep_expired(); },
+        absl::Milliseconds(options.expiry_sweep_interval_ms));
+  }
+  if (statistics_ != nullptr && options.stats_dump_interval_ms > 0) {
+    stats_dump_job_ = scheduler_->AddJob(
+        JobPriority::kLow, [this]() { dump_statistics(); },
+        absl::Milliseconds(options.stats_dump_interval_ms));
+  }
+  hint_builder_->SetFileClosedCallback(
+      [this]() { scheduler_->Trigger(hint_job_); });
+  scheduler_->Trigger(hint_job_);
 }
 
-bool MyBitcask::key_valid(const log::Key<std::string>& key) {
-  absl::ReaderMutexLock guard(&index_rwlock_);
+bool MyBitcask::key_valid(store::file_id_t file_id,
+                          const log::Key<std::string>& key) {
   auto pos = get_position(absl::string_view(key.key_data));
-  if (pos.has_value() && key.value_pos.has_value()) {
-    return pos.value().value_pos == key.value_pos.value().value_pos;
-  } else if (!pos.has_value() && !key.value_pos.has_value()) {
-    return true;
+  if (!key.value_pos.has_value()) {
+    return !pos.has_value();
   }
-  return false;
+  bool indexed = pos.has_value() && pos->file_id == file_id &&
+                 pos->value_pos == key.value_pos->value_pos;
+  if (log::Expired(key.value_pos->expire_at)) {
+    // An expired entry deletes its key like a tombstone, even once swept
+    return indexed || !pos.has_value();
+  }
+  return indexed;
 }
 
-absl::Status MyBitcask::re_insert(log::Key<std::string>&& key) {
-  std::string v;
-  auto found = Get(absl::string_view(key.key_data), &v);
-  if (!found.ok()) {
-    return found.status();
+absl::StatusOr<bool> MyBitcask::re_insert(store::file_id_t file_id,
+                                          log::Key<std::string>&& key) {
+  if (!key.value_pos.has_value()) {
+    // Keep the tombstone only while the key is still deleted
+    return log_writer_.AppendTombstoneIf(
+        MakeU8Span(key.key_data),
+        [&]() { return !get_position(key.key_data).has_value(); },
+        [](Position) {});
   }
-  if (*found) {
-    return Insert(key.key_data, v);
-  } else {
-    return Delete(key.key_data);
+
+  Position old_pos{file_id, key.value_pos->compression,
+                   key.value_pos->value_pos, key.value_pos->value_len,
+                   key.value_pos->expire_at};
+  if (log::Expired(old_pos.expire_at)) {
+    // The value is dropped, a tombstone keeps the older entries of the key
+    // from being recovered while it is not set again
+    return log_writer_.AppendTombstoneIf(
+        MakeU8Span(key.key_data),
+        [&]() {
+          auto pos = get_position(key.key_data);
+          return !pos.has_value() || *pos == old_pos;
+        },
+        [&](Position) {
+          absl::WriterMutexLock guard(&index_rwlock_);
+          auto it = index_.find(key.key_data);
+          if (it != index_.end() && it->second.pos == old_pos) {
+            drop_inline_value(&it->second);
+            index_.erase(it);
+          }
+        });
+  }
+  // The index entry is swapped only if it still points at the old position.
+  // The check and the append happen atomically, so a concurrent Insert or
+  // Delete of the same key is never overwritten by the moved value.
+  auto still_live = [&]() {
+    auto pos = get_position(key.key_data);
+    return pos.has_value() && *pos == old_pos;
+  };
+  auto update_index = [&](Position pos) {
+    // The value is the same, so it stays inlined
+    absl::WriterMutexLock guard(&index_rwlock_);
+    auto it = index_.find(key.key_data);
+    if (it != index_.end()) {
+      it->second.pos = pos;
+    } else {
+      index_.emplace(key.key_data, IndexEntry{pos, nullptr});
+    }
+  };
+
+  if (old_pos.compression == compression::kLzDictCompression ||
+      (dictionary_sampler_ != nullptr &&
+       old_pos.value_len <= compression::kMaxDictionaryValueLen)) {
+    // Small values are sampled for the next dictionary and compressed
+    // against the current one. Values compressed against the dictionary of
+    // their old file must be, since the latest file has another one.
+    std::string value;
+    auto read = log_reader_.ReadValue(
+        old_pos, static_cast<std::uint32_t>(key.key_data.size()),
+        [&](std::uint64_t value_len) {
+          value.resize(value_len);
+          return reinterpret_cast<std::uint8_t*>(&value[0]);
+        });
+    if (!read.ok() || !*read) {
+      return read;
+    }
+    if (dictionary_sampler_ != nullptr) {
+      dictionary_sampler_->Add(MakeU8Span(value));
+    }
+    return log_writer_.AppendIf(MakeU8Span(key.key_data), MakeU8Span(value),
+                                still_live, update_index, old_pos.expire_at);
   }
+  // The value is copied piece by piece from the old position, so moving a
+  // large value does not need memory for all of it. Compressed values are
+  // copied as they are stored.
+  bool found = true;
+  auto produce = [&](const store::PieceWriter& write) -> absl::Status {
+    auto read = log_reader_.ReadStoredStream(
+        old_pos, static_cast<std::uint32_t>(key.key_data.size()), write);
+    if (!read.ok()) {
+      return read.status();
+    }
+    found = *read;
+    if (!found) {
+      return absl::NotFoundError(log::kErrBadEntry);
+    }
+    return absl::OkStatus();
+  };
+  auto moved =
+      log_writer_.AppendStreamIf(MakeU8Span(key.key_data), old_pos.value_len,
+                                 produce, still_live, update_index,
+                                 old_pos.compression, old_pos.expire_at);
+  if (!found) {
+    return false;
+  }
+  return moved;
 }
 
 absl::StatusOr<std::unique_ptr<MyBitcask>> Open(
-    const ghc::filesystem::path& data_dir, std::uint32_t dead_bytes_threshold,
-    bool checksum, bool out_log) {
-  store::DBFiles dbfiles(data_dir);
+    const ghc::filesystem::path& data_dir, const Options& options) {
+  auto env = options.env;
+  store::DBFiles dbfiles(data_dir, env);
+  auto latest_file_id = dbfiles.latest_file_id();
+  auto recovery_report = RecoverTornTail(dbfiles, options.recovery_mode, env);
+  if (!recovery_report.ok()) {
+    return recovery_report.status();
+  }
+  auto latest_version = log::ReadFormatVersion(
+      dbfiles.path() / store::LogFilename(latest_file_id), env);
+  if (!latest_version.ok()) {
+    return latest_version.status();
+  }
+  // Entries of different formats are never mixed in a log file, so new
+  // entries go to a new log file if the latest one has another format. The
+  // last block of a block framed file is not recovered, so it is never
+  // appended to once closed.
+  auto version =
+      options.block_format ? log::kBlockFormatVersion : log::kFormatVersion;
+  bool same_format =
+      !latest_version->has_value() || **latest_version == version;
+  auto append_file_id = latest_file_id;
+  if (latest_version->has_value() &&
+      (!same_format || version == log::kBlockFormatVersion)) {
+    append_file_id++;
+  }
+  // A latest log file loaded by a BulkLoader already has its hint file,
+  // which would miss the entries appended to it
+  auto hint_files = dbfiles.hint_files();
+  if (!hint_files.empty() && hint_files.back() == latest_file_id) {
+    append_file_id = latest_file_id + 1;
+  }
+  // New log files keep the dictionary of the latest one
+  std::shared_ptr<const compression::Dictionary> dictionary;
+  if (options.compression_dictionary_len > 0 && same_format) {
+    auto data = log::ReadDictionary(
+        dbfiles.path() / store::LogFilename(latest_file_id), env);
+    if (!data.ok()) {
+      return data.status();
+    }
+    if (!data->empty()) {
+      dictionary = std::make_shared<compression::Dictionary>(
+          std::move(data).value());
+    }
+  }
+  std::shared_ptr<Statistics> statistics;
+  if (options.enable_statistics) {
+    statistics = std::make_shared<Statistics>();
+  }
   std::unique_ptr<store::Store> store(new store::Store(
-      dbfiles.path(), dbfiles.latest_file_id(), dead_bytes_threshold));
-  log::Reader log_reader(store.get(), checksum);
+      dbfiles.path(), append_file_id, options.dead_bytes_threshold,
+      dictionary != nullptr ? log::FileHeader(dictionary->data(), version)
+                            : log::FileHeader({}, version),
+      options.block_format, statistics.get(), env));
+  log::Reader log_reader(store.get(), options.checksum, options.compressor);
+  std::unique_ptr<store::hint::Builder> hint_builder(
+      new store::hint::Builder(dbfiles.path(), statistics.get(), env));
 
+  // Expired entries delete their keys like tombstones
+  auto now = log::NowMillis();
+  bool expiring_keys = false;
   auto index =
       dbfiles.key_iter(&log_reader)
-          .Fold<absl::btree_map<std::string, Position>, std::string>(
-              absl::btree_map<std::string, Position>(),
-              [](absl::btree_map<std::string, Position>&& acc,
-                 store::file_id_t file_id, log::Key<std::string>&& key) {
-                if (key.value_pos.has_value()) {
-                  acc.insert_or_assign(std::move(key.key_data),
-                              Position{file_id, key.value_pos->value_pos,
-                                       key.value_pos->value_len});
+          .Fold<absl::btree_map<std::string, IndexEntry>, std::string>(
+              absl::btree_map<std::string, IndexEntry>(),
+              [&](absl::btree_map<std::string, IndexEntry>&& acc,
+                  store::file_id_t file_id, log::Key<std::string>&& key) {
+                if (file_id == latest_file_id) {
+                  // New entries are appended to the latest log file, so its
+                  // hint file must also contain the entries already in it.
+                  hint_builder->Add(file_id, MakeU8Span(key.key_data),
+                                    key.value_pos);
+                }
+                auto expire_at =
+                    key.value_pos.has_value() ? key.value_pos->expire_at : 0;
+                if (key.value_pos.has_value() &&
+                    (expire_at == 0 || expire_at > now)) {
+                  expiring_keys = expiring_keys || expire_at != 0;
+                  acc.insert_or_assign(
+                      std::move(key.key_data),
+                      IndexEntry{Position{file_id, key.value_pos->compression,
+                                          key.value_pos->value_pos,
+                                          key.value_pos->value_len,
+                                          expire_at},
+                                 nullptr});
                 } else {
                   acc.erase(key.key_data);
                 }
-                return acc;
+                return std::move(acc);
               });
   if (!index.ok()) {
     return index.status();
   }
-  log::Writer log_writer(store.get());
-  auto mybitcask = std::unique_ptr<MyBitcask>(
-      new MyBitcask(std::move(store), std::move(log_reader),
-                    std::move(log_writer), std::move(index).value()));
-  mybitcask->setup_worker(out_log);
+  log::Writer log_writer(store.get(), hint_builder.get());
+  log_writer.SetCompression(options.compressor,
+                            options.compression_min_value_len);
+  log_writer.SetDictionary(dictionary);
+  auto mybitcask = std::unique_ptr<MyBitcask>(new MyBitcask(
+      std::move(store), std::move(hint_builder), std::move(log_reader),
+      std::move(log_writer), std::move(index).value()));
+  mybitcask->recovery_report_ = *recovery_report;
+  mybitcask->statistics_ = std::move(statistics);
+  mybitcask->expiring_keys_.store(expiring_keys);
+  mybitcask->inline_value_max_len_ =
+      std::min(options.inline_value_max_len, kMaxInlineValueLen);
+  mybitcask->inline_values_budget_ = options.inline_values_budget;
+  auto status = mybitcask->load_inline_values();
+  if (!status.ok()) {
+    return status;
+  }
+  mybitcask->setup_worker(options);
+  if (recovery_report->dropped_bytes > 0) {
+    mybitcask->logger_->warn(
+        "Truncated the torn tail of log file {}: dropped {} bytes from "
+        "offset {}",
+        recovery_report->file_id, recovery_report->dropped_bytes,
+        recovery_report->truncated_len);
+  }
   return mybitcask;
 }
 
+absl::StatusOr<std::unique_ptr<MyBitcask>> Open(
+    const ghc::filesystem::path& data_dir, std::uint32_t dead_bytes_threshold,
+    bool checksum, bool out_log) {
+  Options options;
+  options.dead_bytes_threshold = dead_bytes_threshold;
+  options.checksum = checksum;
+  options.out_log = out_log;
+  return Open(data_dir, options);
+}
+
+absl::StatusOr<std::unique_ptr<BulkLoader>> NewBulkLoader(
+    const ghc::filesystem::path& data_dir, const Options& options) {
+  // The latest log file is not the latest anymore once the files are
+  // loaded, so it must end with a complete entry
+  store::DBFiles dbfiles(data_dir, options.env);
+  auto recovery_report =
+      RecoverTornTail(dbfiles, options.recovery_mode, options.env);
+  if (!recovery_report.ok()) {
+    return recovery_report.status();
+  }
+  std::unique_ptr<BulkLoader> loader(new BulkLoader(
+      nullptr, options.env, dbfiles.path(), options.dead_bytes_threshold));
+  auto status = loader->init();
+  if (!status.ok()) {
+    return status;
+  }
+  return loader;
+}
+
+absl::Status GenerateHintFiles(const ghc::filesystem::path& data_dir,
+                               std::size_t threads, bool overwrite,
+                               Env* env) {
+  store::DBFiles dbfiles(data_dir, env);
+  std::vector<store::file_id_t> log_files(dbfiles.active_log_files().begin(),
+                                          dbfiles.active_log_files().end());
+  if (overwrite) {
+    log_files.insert(log_files.end(), dbfiles.older_log_files().begin(),
+                     dbfiles.older_log_files().end());
+  }
+  log_files.erase(std::remove(log_files.begin(), log_files.end(),
+                              dbfiles.latest_file_id()),
+                  log_files.end());
+  if (log_files.empty()) {
+    return absl::OkStatus();
+  }
+
+  store::Store store(dbfiles.path(), dbfiles.latest_file_id(), 0, {}, false,
+                     nullptr, env);
+  log::Reader log_reader(&store, false);
+  store::hint::Generator generator(&log_reader, dbfiles.path());
+
+  std::vector<absl::Status> results(log_files.size());
+  absl::BlockingCounter pending(static_cast<int>(log_files.size()));
+  {
+    ThreadPool pool(threads);
+    for (std::size_t i = 0; i < log_files.size(); i++) {
+      pool.Schedule([&, i]() {
+        results[i] = generator.Generate(log_files[i]);
+        pending.DecrementCount();
+      });
+    }
+    pending.Wait();
+  }
+  for (auto& status : results) {
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+Iterator::Iterator(MyBitcask* db, std::shared_ptr<const Snapshot> snapshot)
+    : db_(db), snapshot_(std::move(snapshot)), valid_(false) {}
+
+void Iterator::SeekToFirst() noexcept {
+  key_.clear();
+  seek(true);
+}
+
+void Iterator::Seek(absl::string_view target) noexcept {
+  key_.assign(target.data(), target.size());
+  seek(true);
+}
+
+void Iterator::Next() noexcept { seek(false); }
+
+void Iterator::seek(bool inclusive) {
+  valid_ = false;
+  while (true) {
+    auto next = db_->next_key(snapshot_.get(), key_, inclusive);
+    if (!next.has_value()) {
+      return;
+    }
+    key_ = std::move(next).value();
+    auto found = db_->get(snapshot_.get(), key_, &value_, 2);
+    if (!found.ok()) {
+      status_ = found.status();
+      return;
+    }
+    if (*found) {
+      valid_ = true;
+      return;
+    }
+    // The key expired in the meantime
+    inclusive = false;
+  }
+}
+
 }  // namespace mybitcask
@@ -1,7 +1,16 @@
 #include "mybitcask/mybitcask.h"
+#include "store_dbfiles.h"
+#include "store_filename.h"
 #include "test_util.h"
 
 #include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <thread>
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
 #include "gtest/gtest.h"
 
 namespace mybitcask {
@@ -62,4 +71,1169 @@ TEST(MyBitcaskTest, TestUpdate) {
   ASSERT_EQ(v, "2");
 }
 
+TEST(MyBitcaskTest, TestHintOfReopenedLogFile) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 1024;
+  {
+    auto mybitcask = Open(tmpdir->path(), options);
+    ASSERT_TRUE(mybitcask.ok());
+    ASSERT_TRUE((*mybitcask)->Insert("before_reopen", "1").ok());
+  }
+  {
+    // Appending to the reopened log file until it is closed writes its hint
+    // file, which must contain the entries written before reopening too.
+    auto mybitcask = Open(tmpdir->path(), options);
+    ASSERT_TRUE(mybitcask.ok());
+    for (int i = 0; i < 100; i++) {
+      ASSERT_TRUE(
+          (*mybitcask)->Insert("key" + std::to_string(i), "value").ok());
+    }
+  }
+  ASSERT_TRUE(ghc::filesystem::exists(tmpdir->path() / "1.hint"));
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  std::string value;
+  auto found = (*mybitcask)->Get("before_reopen", &value);
+  ASSERT_TRUE(found.ok());
+  ASSERT_TRUE(*found);
+  EXPECT_EQ(value, "1");
+}
+
+TEST(MyBitcaskTest, TestGenerateHintFiles) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 1024;
+  std::map<std::string, std::string> expected;
+  {
+    auto mybitcask = Open(tmpdir->path(), options);
+    ASSERT_TRUE(mybitcask.ok());
+    // Keep background merges from removing log files
+    (*mybitcask)->PauseBackgroundWork();
+    for (int i = 0; i < 200; i++) {
+      auto key = "key" + std::to_string(i % 50);
+      auto value = test::RandomString(1, 40);
+      ASSERT_TRUE((*mybitcask)->Insert(key, value).ok());
+      expected[key] = value;
+    }
+  }
+  std::size_t log_files = 0;
+  for (auto const& entry :
+       ghc::filesystem::directory_iterator(tmpdir->path())) {
+    if (entry.path().extension() == ".hint") {
+      ghc::filesystem::remove(entry.path());
+    } else if (entry.path().extension() == ".log") {
+      log_files++;
+    }
+  }
+  ASSERT_GT(log_files, 2);
+
+  ASSERT_TRUE(GenerateHintFiles(tmpdir->path(), 4).ok());
+  for (std::size_t file_id = 1; file_id < log_files; file_id++) {
+    EXPECT_TRUE(ghc::filesystem::exists(
+        tmpdir->path() / (std::to_string(file_id) + ".hint")));
+  }
+  EXPECT_FALSE(ghc::filesystem::exists(
+      tmpdir->path() / (std::to_string(log_files) + ".hint")));
+
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  for (auto& kv : expected) {
+    std::string value;
+    auto found = (*mybitcask)->Get(kv.first, &value);
+    ASSERT_TRUE(found.ok());
+    ASSERT_TRUE(*found);
+    EXPECT_EQ(value, kv.second);
+  }
+}
+
+TEST(MyBitcaskTest, TestParallelMerge) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 1024;
+  options.merge_threads = 4;
+  std::map<std::string, std::string> expected;
+  {
+    auto mybitcask_status = Open(tmpdir->path(), options);
+    ASSERT_TRUE(mybitcask_status.ok());
+    std::unique_ptr<MyBitcask> mybitcask = std::move(mybitcask_status).value();
+    // Only the explicit merge below may merge log files
+    mybitcask->PauseBackgroundWork();
+    for (int round = 0; round < 5; round++) {
+      for (int i = 0; i < 100; i++) {
+        auto key = "key" + std::to_string(i);
+        auto value = test::RandomString(10, 40);
+        ASSERT_TRUE(mybitcask->Insert(key, value).ok());
+        expected[key] = value;
+      }
+    }
+    for (int i = 0; i < 100; i += 3) {
+      auto key = "key" + std::to_string(i);
+      ASSERT_TRUE(mybitcask->Delete(key).ok());
+      expected.erase(key);
+    }
+    auto files_before = std::distance(
+        ghc::filesystem::directory_iterator(tmpdir->path()),
+        ghc::filesystem::directory_iterator());
+
+    // Keep writing while merging, the merged values must never overwrite
+    // newer ones.
+    std::thread writer([&]() {
+      for (int i = 1; i < 100; i += 3) {
+        auto key = "key" + std::to_string(i);
+        auto value = test::RandomString(10, 40);
+        ASSERT_TRUE(mybitcask->Insert(key, value).ok());
+        expected[key] = value;
+      }
+    });
+    ASSERT_TRUE(mybitcask->Merge().ok());
+    writer.join();
+
+    auto files_after = std::distance(
+        ghc::filesystem::directory_iterator(tmpdir->path()),
+        ghc::filesystem::directory_iterator());
+    EXPECT_LT(files_after, files_before);
+
+    for (int i = 0; i < 100; i++) {
+      auto key = "key" + std::to_string(i);
+      std::string value;
+      auto found = mybitcask->Get(key, &value);
+      ASSERT_TRUE(found.ok());
+      auto it = expected.find(key);
+      ASSERT_EQ(*found, it != expected.end()) << key;
+      if (*found) {
+        EXPECT_EQ(value, it->second);
+      }
+    }
+  }
+
+  // reopen
+  auto mybitcask_status = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask_status.ok());
+  std::unique_ptr<MyBitcask> mybitcask = std::move(mybitcask_status).value();
+  for (int i = 0; i < 100; i++) {
+    auto key = "key" + std::to_string(i);
+    std::string value;
+    auto found = mybitcask->Get(key, &value);
+    ASSERT_TRUE(found.ok());
+    auto it = expected.find(key);
+    ASSERT_EQ(*found, it != expected.end()) << key;
+    if (*found) {
+      EXPECT_EQ(value, it->second);
+    }
+  }
+}
+
+bool WaitForFile(const ghc::filesystem::path& path, absl::Duration timeout) {
+  auto deadline = absl::Now() + timeout;
+  while (!ghc::filesystem::exists(path)) {
+    if (absl::Now() > deadline) {
+      return false;
+    }
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  return true;
+}
+
+TEST(MyBitcaskTest, TestRolloverTriggersHint) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 1024;
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+
+  (*mybitcask)->PauseBackgroundWork();
+  while (!ghc::filesystem::exists(tmpdir->path() / "2.log")) {
+    ASSERT_TRUE((*mybitcask)
+                    ->Insert("key" + test::RandomString(1, 10),
+                             test::RandomString(10, 40))
+                    .ok());
+  }
+  absl::SleepFor(absl::Milliseconds(50));
+  EXPECT_FALSE(ghc::filesystem::exists(tmpdir->path() / "1.hint"));
+
+  // The hint file is written right after background work is resumed, not on
+  // the next periodic run
+  auto resumed = absl::Now();
+  (*mybitcask)->ResumeBackgroundWork();
+  ASSERT_TRUE(WaitForFile(tmpdir->path() / "1.hint", absl::Seconds(5)));
+  EXPECT_LT(absl::Now() - resumed, absl::Seconds(1));
+}
+
+TEST(MyBitcaskTest, TestGarbageTriggersMerge) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 1024;
+  options.merge_threshold = 0.5f;
+  options.enable_statistics = true;
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+
+  // Overwrite the same keys until the first log file is all garbage. The
+  // merge triggered meanwhile starts once all of it is written.
+  (*mybitcask)->PauseBackgroundWork();
+  std::map<std::string, std::string> expected;
+  for (int i = 0; i < 200; i++) {
+    auto key = "key" + std::to_string(i % 10);
+    auto value = test::RandomString(10, 40);
+    ASSERT_TRUE((*mybitcask)->Insert(key, value).ok());
+    expected[key] = value;
+  }
+  (*mybitcask)->ResumeBackgroundWork();
+  // Merged long before the periodic merge. The first file is merged first
+  // and removed before it is counted.
+  auto statistics = (*mybitcask)->GetStatistics();
+  auto deadline = absl::Now() + absl::Seconds(20);
+  while (statistics->Get(Ticker::kFilesCompacted) == 0 &&
+         absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+  ASSERT_GT(statistics->Get(Ticker::kFilesCompacted), 0);
+  EXPECT_FALSE(ghc::filesystem::exists(tmpdir->path() / "1.log"));
+  for (auto& kv : expected) {
+    std::string value;
+    auto found = (*mybitcask)->Get(kv.first, &value);
+    ASSERT_TRUE(found.ok());
+    ASSERT_TRUE(*found);
+    EXPECT_EQ(value, kv.second);
+  }
+}
+
+TEST(MyBitcaskTest, TestCompactAll) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 1024;
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  (*mybitcask)->PauseBackgroundWork();
+
+  std::map<std::string, std::string> expected;
+  for (int i = 0; i < 300; i++) {
+    auto key = "key" + std::to_string(i % 30);
+    auto value = test::RandomString(10, 40);
+    ASSERT_TRUE((*mybitcask)->Insert(key, value).ok());
+    expected[key] = value;
+  }
+  for (int i = 0; i < 30; i += 2) {
+    auto key = "key" + std::to_string(i);
+    ASSERT_TRUE((*mybitcask)->Delete(key).ok());
+    expected.erase(key);
+  }
+  ASSERT_TRUE(ghc::filesystem::exists(tmpdir->path() / "1.log"));
+
+  CompactOptions compact_options;
+  compact_options.rate_limit_bytes_per_second = 1024 * 1024;
+  auto stats = (*mybitcask)->CompactAll(compact_options);
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_GT(stats->files_compacted, 2);
+  EXPECT_GT(stats->bytes_read, stats->bytes_written);
+  EXPECT_GT(stats->bytes_written, 0);
+  EXPECT_GT(stats->bytes_reclaimed, 0);
+  EXPECT_FALSE(ghc::filesystem::exists(tmpdir->path() / "1.log"));
+
+  for (int i = 0; i < 30; i++) {
+    auto key = "key" + std::to_string(i);
+    std::string value;
+    auto found = (*mybitcask)->Get(key, &value);
+    ASSERT_TRUE(found.ok());
+    auto it = expected.find(key);
+    ASSERT_EQ(*found, it != expected.end()) << key;
+    if (*found) {
+      EXPECT_EQ(value, it->second);
+    }
+  }
+}
+
+TEST(MyBitcaskTest, TestCompactFiles) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 1024;
+  // Leave merging to the calls below
+  options.merge_threshold = -1;
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  // Log file 1 keeps live data, the following files are all garbage
+  ASSERT_TRUE((*mybitcask)->Insert("live", "value").ok());
+  for (int i = 0; !ghc::filesystem::exists(tmpdir->path() / "6.log"); i++) {
+    ASSERT_TRUE((*mybitcask)
+                    ->Insert("key" + std::to_string(i % 10),
+                             test::RandomString(10, 40))
+                    .ok());
+  }
+
+  CompactOptions compact_options;
+  // The latest log file and missing files can not be compacted
+  auto stats = (*mybitcask)->CompactFiles({100}, compact_options);
+  EXPECT_EQ(stats.status().code(), absl::StatusCode::kInvalidArgument);
+
+  // A file with live data above the threshold is left alone
+  compact_options.merge_threshold = 0.0f;
+  stats = (*mybitcask)->CompactFiles({1, 2, 3}, compact_options);
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_EQ(stats->files_compacted, 2);
+  EXPECT_EQ(stats->bytes_written, 0);
+  EXPECT_TRUE(ghc::filesystem::exists(tmpdir->path() / "1.log"));
+  EXPECT_FALSE(ghc::filesystem::exists(tmpdir->path() / "2.log"));
+
+  compact_options.merge_threshold = 1.0f;
+  auto future = (*mybitcask)->CompactFilesAsync({1}, compact_options);
+  stats = future.get();
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_EQ(stats->files_compacted, 1);
+  EXPECT_GT(stats->bytes_written, 0);
+  EXPECT_FALSE(ghc::filesystem::exists(tmpdir->path() / "1.log"));
+  std::string value;
+  auto found = (*mybitcask)->Get("live", &value);
+  ASSERT_TRUE(found.ok());
+  ASSERT_TRUE(*found);
+  EXPECT_EQ(value, "value");
+}
+
+// Value source of `len` bytes of a repeating pattern
+TEST(MyBitcaskTest, TestExpiringKeys) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 1024;
+  options.merge_threshold = -1;
+  options.expiry_sweep_interval_ms = 10;
+  options.expiry_sweep_batch = 2;
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+
+  auto fill_until = [&](const std::string& filename) {
+    for (int i = 0; !ghc::filesystem::exists(tmpdir->path() / filename);
+         i++) {
+      ASSERT_TRUE(
+          (*mybitcask)->Insert("filler" + std::to_string(i % 10), "x").ok());
+    }
+  };
+  auto found = [&](const std::string& key) {
+    auto found = (*mybitcask)->Get(key, nullptr);
+    EXPECT_TRUE(found.ok()) << found.status();
+    return found.ok() && *found;
+  };
+
+  EXPECT_EQ((*mybitcask)->Insert("key", "value", absl::ZeroDuration()).code(),
+            absl::StatusCode::kInvalidArgument);
+  // The value which "session" overwrites is in an older log file
+  ASSERT_TRUE((*mybitcask)->Insert("session", "old").ok());
+  fill_until("2.log");
+  auto ttl = absl::Milliseconds(200);
+  ASSERT_TRUE((*mybitcask)->Insert("session", "new", ttl).ok());
+  ASSERT_TRUE((*mybitcask)->Insert("swept", "value", ttl).ok());
+  ASSERT_TRUE((*mybitcask)->Insert("long", "value", absl::Hours(1)).ok());
+  ASSERT_TRUE(
+      (*mybitcask)->Insert("forever", "value", absl::InfiniteDuration()).ok());
+  EXPECT_TRUE(found("session"));
+  EXPECT_TRUE(found("swept"));
+  fill_until("4.log");
+
+  absl::SleepFor(ttl * 2);
+  EXPECT_FALSE(found("session"));
+  EXPECT_FALSE(found("swept"));
+  EXPECT_TRUE(found("long"));
+  EXPECT_TRUE(found("forever"));
+
+  // Merges drop the expired values, keeping the old value of "session"
+  // deleted
+  CompactOptions compact_options;
+  auto stats = (*mybitcask)->CompactFiles({2, 3}, compact_options);
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_EQ(stats->files_compacted, 2);
+  EXPECT_FALSE(found("session"));
+  EXPECT_TRUE(found("long"));
+
+  // Expired keys are not recovered, the others keep their expiry time
+  mybitcask->reset();
+  mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  EXPECT_FALSE(found("session"));
+  EXPECT_FALSE(found("swept"));
+  EXPECT_TRUE(found("long"));
+  EXPECT_TRUE(found("forever"));
+  ASSERT_TRUE((*mybitcask)->Insert("session", "again").ok());
+  EXPECT_TRUE(found("session"));
+}
+
+TEST(MyBitcaskTest, TestSnapshots) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 1024;
+  options.merge_threshold = -1;
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  auto db = mybitcask->get();
+
+  for (auto key : {"a", "b", "c"}) {
+    ASSERT_TRUE(db->Insert(key, "1").ok());
+  }
+  auto snapshot = db->GetSnapshot();
+  ReadOptions at_snapshot;
+  at_snapshot.snapshot = snapshot.get();
+  ASSERT_TRUE(db->Insert("a", "2").ok());
+  ASSERT_TRUE(db->Delete("b").ok());
+  ASSERT_TRUE(db->Insert("c", "2").ok());
+  ASSERT_TRUE(db->Insert("c", "3").ok());
+  ASSERT_TRUE(db->Insert("d", "2").ok());
+  // The log files written so far are merged away, but kept for the snapshot
+  for (int i = 0; !ghc::filesystem::exists(tmpdir->path() / "3.log"); i++) {
+    ASSERT_TRUE(db->Insert("filler" + std::to_string(i % 10), "x").ok());
+  }
+  auto stats = db->CompactFiles({1, 2}, CompactOptions());
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_EQ(stats->files_compacted, 2);
+  EXPECT_TRUE(ghc::filesystem::exists(tmpdir->path() / "1.log"));
+  // Nothing is reclaimed before they are removed
+  EXPECT_EQ(stats->bytes_reclaimed,
+            -static_cast<std::int64_t>(stats->bytes_written));
+  // and they are never merged again
+  stats = db->CompactFiles({1, 2}, CompactOptions());
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_EQ(stats->files_compacted, 0);
+
+  std::vector<std::string> values;
+  auto results = db->MultiGet(at_snapshot, {"a", "b", "c", "d"}, &values);
+  ASSERT_EQ(results.size(), 4);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(results[i].ok()) << results[i].status();
+    EXPECT_TRUE(*results[i]);
+    EXPECT_EQ(values[i], "1");
+  }
+  ASSERT_TRUE(results[3].ok());
+  EXPECT_FALSE(*results[3]);
+
+  results = db->MultiGet(ReadOptions(), {"a", "b", "c", "d"}, &values);
+  EXPECT_TRUE(*results[0] && values[0] == "2");
+  EXPECT_FALSE(*results[1]);
+  EXPECT_TRUE(*results[2] && values[2] == "3");
+  EXPECT_TRUE(*results[3] && values[3] == "2");
+
+  auto scan = [&](const ReadOptions& options) {
+    std::vector<std::pair<std::string, std::string>> pairs;
+    auto it = db->NewIterator(options);
+    for (it->Seek("a"); it->Valid() && it->key() < "e"; it->Next()) {
+      pairs.emplace_back(it->key(), it->value());
+    }
+    EXPECT_TRUE(it->status().ok()) << it->status();
+    return pairs;
+  };
+  using Pairs = std::vector<std::pair<std::string, std::string>>;
+  EXPECT_EQ(scan(at_snapshot), (Pairs{{"a", "1"}, {"b", "1"}, {"c", "1"}}));
+  EXPECT_EQ(scan(ReadOptions()), (Pairs{{"a", "2"}, {"c", "3"}, {"d", "2"}}));
+
+  // The merged files are removed with the last snapshot
+  auto another = db->GetSnapshot();
+  snapshot.reset();
+  EXPECT_TRUE(ghc::filesystem::exists(tmpdir->path() / "1.log"));
+  another.reset();
+  EXPECT_FALSE(ghc::filesystem::exists(tmpdir->path() / "1.log"));
+  std::string value;
+  auto found = db->Get("a", &value);
+  ASSERT_TRUE(found.ok() && *found);
+  EXPECT_EQ(value, "2");
+}
+
+// Overwrite the log files in `dir` with zeros, keeping their length
+void ZeroLogFiles(const ghc::filesystem::path& dir) {
+  for (auto& entry : ghc::filesystem::directory_iterator(dir)) {
+    if (entry.path().extension() != ".log") {
+      continue;
+    }
+    std::fstream file(entry.path().string(),
+                      std::ios::binary | std::ios::in | std::ios::out);
+    std::string zeros(ghc::filesystem::file_size(entry.path()), '\0');
+    file.write(zeros.data(), zeros.size());
+  }
+}
+
+TEST(MyBitcaskTest, TestAsync) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  auto mybitcask = Open(tmpdir->path(), Options());
+  ASSERT_TRUE(mybitcask.ok());
+  auto db = mybitcask->get();
+
+  // Writes complete in the order they were issued
+  const int n = 2000;
+  absl::Mutex mu;
+  std::vector<int> completed;
+  for (int i = 0; i < n; i++) {
+    db->InsertAsync("key" + std::to_string(i % 100), std::to_string(i),
+                    [&mu, &completed, i](absl::Status status) {
+                      EXPECT_TRUE(status.ok()) << status;
+                      absl::MutexLock lock(&mu);
+                      completed.push_back(i);
+                    });
+  }
+  WriteBatch batch;
+  batch.Insert("batch", "1");
+  batch.Delete("key0");
+  batch.Insert("batch", "2");
+  EXPECT_EQ(batch.size(), 3);
+  auto written = db->WriteAsync(std::move(batch));
+  ASSERT_TRUE(written.get().ok());
+  {
+    absl::MutexLock lock(&mu);
+    ASSERT_EQ(completed.size(), n);
+    EXPECT_TRUE(std::is_sorted(completed.begin(), completed.end()));
+  }
+
+  std::vector<std::future<absl::StatusOr<absl::optional<std::string>>>> gets;
+  for (int i = 0; i < 100; i++) {
+    gets.push_back(db->GetAsync(ReadOptions(), "key" + std::to_string(i)));
+  }
+  auto value = gets[0].get();
+  ASSERT_TRUE(value.ok());
+  EXPECT_FALSE(value->has_value());
+  for (int i = 1; i < 100; i++) {
+    value = gets[i].get();
+    ASSERT_TRUE(value.ok() && value->has_value());
+    EXPECT_EQ(**value, std::to_string(n - 100 + i));
+  }
+
+  absl::Notification done;
+  db->GetAsync(ReadOptions(), "batch",
+               [&done](absl::StatusOr<bool> found, std::string value) {
+                 EXPECT_TRUE(found.ok() && *found);
+                 EXPECT_EQ(value, "2");
+                 done.Notify();
+               });
+  done.WaitForNotification();
+
+  // Queued operations complete before the database is closed
+  for (int i = 0; i < 100; i++) {
+    db->InsertAsync("closing" + std::to_string(i), "value",
+                    [](absl::Status status) { EXPECT_TRUE(status.ok()); });
+  }
+  mybitcask->reset();
+  mybitcask = Open(tmpdir->path(), Options());
+  ASSERT_TRUE(mybitcask.ok());
+  std::string closing;
+  auto found = (*mybitcask)->Get("closing99", &closing);
+  ASSERT_TRUE(found.ok() && *found);
+}
+
+TEST(MyBitcaskTest, TestCompareAndSwap) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.inline_value_max_len = 8;
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  auto db = mybitcask->get();
+
+  auto swapped = db->CompareAndSwap("a", std::string("1"), std::string("2"));
+  ASSERT_TRUE(swapped.ok());
+  EXPECT_FALSE(*swapped);
+  swapped = db->CompareAndSwap("a", absl::nullopt, std::string("1"));
+  ASSERT_TRUE(swapped.ok() && *swapped);
+  swapped = db->CompareAndSwap("a", absl::nullopt, std::string("2"));
+  ASSERT_TRUE(swapped.ok());
+  EXPECT_FALSE(*swapped);
+  // Values too long to be inlined are read from the log
+  std::string long_value(100, 'x');
+  swapped = db->CompareAndSwap("a", std::string("1"), long_value);
+  ASSERT_TRUE(swapped.ok() && *swapped);
+  swapped = db->CompareAndSwap("a", long_value, absl::nullopt);
+  ASSERT_TRUE(swapped.ok() && *swapped);
+  std::string value;
+  auto found = db->Get("a", &value);
+  ASSERT_TRUE(found.ok());
+  EXPECT_FALSE(*found);
+
+  // Concurrent increments are never lost
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([db]() {
+      for (int i = 0; i < 100; i++) {
+        while (true) {
+          std::string current;
+          auto found = db->Get("counter", &current);
+          ASSERT_TRUE(found.ok());
+          auto next = std::to_string(*found ? std::stoi(current) + 1 : 1);
+          auto swapped = db->CompareAndSwap(
+              "counter",
+              *found ? absl::make_optional(current) : absl::nullopt, next);
+          ASSERT_TRUE(swapped.ok());
+          if (*swapped) {
+            break;
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  found = db->Get("counter", &value);
+  ASSERT_TRUE(found.ok() && *found);
+  EXPECT_EQ(value, "400");
+}
+
+TEST(MyBitcaskTest, TestMergeValue) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  auto mybitcask = Open(tmpdir->path(), Options());
+  ASSERT_TRUE(mybitcask.ok());
+  EXPECT_TRUE(absl::IsFailedPrecondition(
+      (*mybitcask)->MergeValue("counter", "1")));
+  mybitcask->reset();
+
+  Options options;
+  options.merge_operator = Int64AddOperator();
+  mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  auto db = mybitcask->get();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([db]() {
+      for (int i = 0; i < 100; i++) {
+        ASSERT_TRUE(db->MergeValue("counter", "3").ok());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_TRUE(db->MergeValue("counter", "-200").ok());
+  EXPECT_TRUE(absl::IsInvalidArgument(db->MergeValue("counter", "x")));
+  ASSERT_TRUE(db->Insert("text", "x").ok());
+  EXPECT_TRUE(absl::IsInvalidArgument(db->MergeValue("text", "1")));
+  mybitcask->reset();
+
+  options.merge_operator = StringAppendOperator(',');
+  mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  db = mybitcask->get();
+  std::string value;
+  auto found = db->Get("counter", &value);
+  ASSERT_TRUE(found.ok() && *found);
+  EXPECT_EQ(value, "1000");
+  for (auto item : {"a", "b", "c"}) {
+    ASSERT_TRUE(db->MergeValue("list", item).ok());
+  }
+  found = db->Get("list", &value);
+  ASSERT_TRUE(found.ok() && *found);
+  EXPECT_EQ(value, "a,b,c");
+}
+
+TEST(MyBitcaskTest, TestStatistics) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  auto mybitcask = Open(tmpdir->path(), Options());
+  ASSERT_TRUE(mybitcask.ok());
+  EXPECT_EQ((*mybitcask)->GetStatistics(), nullptr);
+  mybitcask->reset();
+
+  Options options;
+  options.enable_statistics = true;
+  options.dead_bytes_threshold = 1024;
+  options.inline_value_max_len = 16;
+  mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  auto db = mybitcask->get();
+  db->PauseBackgroundWork();
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(db->Insert("key" + std::to_string(i % 10),
+                           std::string(i % 2 == 0 ? 8 : 40, 'v'))
+                    .ok());
+  }
+  ASSERT_TRUE(db->Delete("key0").ok());
+  std::string value;
+  for (int i = 0; i < 10; i++) {
+    ASSERT_TRUE(db->Get("key" + std::to_string(i), &value).ok());
+  }
+  ASSERT_TRUE(db->Get("missing", &value).ok());
+
+  auto statistics = db->GetStatistics();
+  ASSERT_NE(statistics, nullptr);
+  EXPECT_EQ(statistics->Get(Ticker::kGetHits), 9);
+  EXPECT_EQ(statistics->Get(Ticker::kGetMisses), 2);
+  EXPECT_EQ(statistics->Get(Ticker::kInlineValueHits), 4);
+  EXPECT_EQ(statistics->Get(Ticker::kInlineValueMisses), 5);
+  EXPECT_GT(statistics->Get(Ticker::kBytesWritten), 100 * 8);
+  EXPECT_GE(statistics->Get(Ticker::kBytesRead), 5 * 40);
+  EXPECT_GT(statistics->Get(Ticker::kRollovers), 0);
+  EXPECT_EQ(statistics->Get(Histogram::kGetMicros).count, 11);
+  EXPECT_EQ(statistics->Get(Histogram::kInsertMicros).count, 100);
+  EXPECT_EQ(statistics->Get(Histogram::kDeleteMicros).count, 1);
+  EXPECT_EQ(statistics->Get(Gauge::kIndexKeys), 9);
+  EXPECT_EQ(statistics->Get(Gauge::kInlineValueBytes), 4 * (8 + 1));
+  EXPECT_GT(statistics->Get(Gauge::kIndexMemoryBytes),
+            statistics->Get(Gauge::kInlineValueBytes));
+  // 100 values and a tombstone of 4 byte keys
+  EXPECT_EQ(statistics->Get(Ticker::kUserBytesWritten),
+            50 * (4 + 8) + 50 * (4 + 40) + 4);
+  EXPECT_EQ(statistics->Get(Gauge::kLiveDataBytes),
+            log::EntryLen(4, 8) * 4 + log::EntryLen(4, 40) * 5);
+  EXPECT_GE(statistics->Get(Gauge::kLogFileBytes),
+            statistics->Get(Ticker::kBytesWritten));
+  EXPECT_GT(statistics->SpaceAmplification(), 1);
+  EXPECT_GT(statistics->WriteAmplification(), 1);
+  auto space_amplification = statistics->SpaceAmplification();
+
+  auto stats = db->CompactAll(CompactOptions());
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_GT(statistics->Get(Ticker::kHintFilesWritten), 0);
+  EXPECT_GT(statistics->Get(Histogram::kHintGenerationMicros).count, 0);
+  EXPECT_EQ(statistics->Get(Ticker::kFilesCompacted),
+            stats->files_compacted);
+  EXPECT_EQ(statistics->Get(Ticker::kCompactionBytesWritten),
+            stats->bytes_written);
+  EXPECT_GT(statistics->Get(Ticker::kHintBytesWritten), 0);
+  // The compacted files are gone along with their hint files
+  db->GetStatistics();
+  EXPECT_LT(statistics->SpaceAmplification(), space_amplification);
+}
+
+TEST(MyBitcaskTest, TestInlineValues) {
+  Options options;
+  options.checksum = true;
+  options.inline_value_max_len = 16;
+  // Three values of 10 bytes
+  options.inline_values_budget = 3 * 11;
+  auto expect_values = [](MyBitcask* mybitcask,
+                          const std::vector<std::string>& keys,
+                          bool readable) {
+    for (auto& key : keys) {
+      std::string value;
+      auto found = mybitcask->Get(key, &value);
+      EXPECT_EQ(found.ok() && *found && value == "value-" + key, readable)
+          << key;
+    }
+  };
+
+  // Inlined by Insert
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  for (auto key : {"key0", "key1", "key2", "key3"}) {
+    ASSERT_TRUE((*mybitcask)->Insert(key, "value-" + std::string(key)).ok());
+  }
+  // Deleting a key frees its budget
+  ASSERT_TRUE((*mybitcask)->Delete("key0").ok());
+  ASSERT_TRUE((*mybitcask)->Insert("key4", "value-key4").ok());
+  ASSERT_TRUE((*mybitcask)
+                  ->Insert("large", "value-large" + std::string(16, 'x'))
+                  .ok());
+  ZeroLogFiles(tmpdir->path());
+  expect_values(mybitcask->get(), {"key1", "key2", "key4"}, true);
+  expect_values(mybitcask->get(), {"key3", "large"}, false);
+  std::string streamed;
+  auto found = (*mybitcask)->GetStream(
+      "key1", [&](absl::Span<const std::uint8_t> piece) {
+        streamed.append(piece.begin(), piece.end());
+        return absl::OkStatus();
+      });
+  ASSERT_TRUE(found.ok() && *found);
+  EXPECT_EQ(streamed, "value-key1");
+  mybitcask->reset();
+
+  // Inlined by Open, in log order
+  tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  mybitcask = Open(tmpdir->path(), Options());
+  ASSERT_TRUE(mybitcask.ok());
+  for (auto key : {"key3", "key2", "key1", "key0"}) {
+    ASSERT_TRUE((*mybitcask)->Insert(key, "value-" + std::string(key)).ok());
+  }
+  mybitcask->reset();
+  mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  ZeroLogFiles(tmpdir->path());
+  expect_values(mybitcask->get(), {"key3", "key2", "key1"}, true);
+  expect_values(mybitcask->get(), {"key0"}, false);
+}
+
+ValueSource PatternSource(std::uint64_t len) {
+  std::shared_ptr<std::uint64_t> offset(new std::uint64_t(0));
+  return [len, offset](absl::Span<std::uint8_t> dst) {
+    std::size_t n = 0;
+    for (; n < dst.size() && *offset < len; n++, (*offset)++) {
+      dst[n] = static_cast<std::uint8_t>(*offset % 251);
+    }
+    return absl::StatusOr<std::size_t>(n);
+  };
+}
+
+// Check that `key` holds the value of PatternSource(len)
+void ExpectPatternValue(MyBitcask* mybitcask, const std::string& key,
+                        std::uint64_t len) {
+  std::uint64_t offset = 0;
+  bool matches = true;
+  auto found = mybitcask->GetStream(
+      key, [&](absl::Span<const std::uint8_t> piece) {
+        EXPECT_LE(piece.size(), log::kStreamChunkSize);
+        for (auto b : piece) {
+          matches = matches && b == static_cast<std::uint8_t>(offset % 251);
+          offset++;
+        }
+        return absl::OkStatus();
+      });
+  ASSERT_TRUE(found.ok()) << found.status();
+  ASSERT_TRUE(*found);
+  EXPECT_EQ(offset, len);
+  EXPECT_TRUE(matches);
+}
+
+TEST(MyBitcaskTest, TestStreamLargeValue) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 1024 * 1024;
+  options.checksum = true;
+  options.merge_threshold = -1;
+  const std::uint64_t kValueLen = 5 * 1024 * 1024 + 7;
+  {
+    auto mybitcask = Open(tmpdir->path(), options);
+    ASSERT_TRUE(mybitcask.ok());
+    ASSERT_TRUE((*mybitcask)->Insert("small", "value").ok());
+    ASSERT_TRUE(
+        (*mybitcask)->InsertStream("large", kValueLen, PatternSource(kValueLen))
+            .ok());
+    // A source which ends early writes nothing
+    auto status = (*mybitcask)->InsertStream("short", kValueLen,
+                                             PatternSource(kValueLen - 1));
+    EXPECT_FALSE(status.ok());
+    EXPECT_FALSE(*(*mybitcask)->Get("short", nullptr));
+    ExpectPatternValue(mybitcask->get(), "large", kValueLen);
+    ASSERT_TRUE((*mybitcask)->Insert("next", "value").ok());
+
+    // Compaction moves the large value to the latest log file
+    auto stats = (*mybitcask)->CompactAll(CompactOptions());
+    ASSERT_TRUE(stats.ok()) << stats.status();
+    EXPECT_GT(stats->bytes_written, kValueLen);
+    ExpectPatternValue(mybitcask->get(), "large", kValueLen);
+  }
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  ExpectPatternValue(mybitcask->get(), "large", kValueLen);
+  std::string value;
+  ASSERT_TRUE(*(*mybitcask)->Get("small", &value));
+  EXPECT_EQ(value, "value");
+  ASSERT_TRUE(*(*mybitcask)->Get("large", &value));
+  EXPECT_EQ(value.size(), kValueLen);
+}
+
+TEST(MyBitcaskTest, TestCompressedValues) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 64 * 1024;
+  options.checksum = true;
+  options.compressor = compression::LzCompressor();
+  options.compression_min_value_len = 32;
+
+  std::map<std::string, std::string> expected;
+  std::uint64_t raw_bytes = 0;
+  {
+    auto mybitcask = Open(tmpdir->path(), options);
+    ASSERT_TRUE(mybitcask.ok());
+    (*mybitcask)->PauseBackgroundWork();
+    for (int i = 0; i < 200; i++) {
+      auto key = "key" + std::to_string(i % 50);
+      auto value = i % 3 == 0 ? test::RandomString(10, 40)
+                              : std::string(1000 + i, 'a' + i % 26);
+      ASSERT_TRUE((*mybitcask)->Insert(key, value).ok());
+      expected[key] = value;
+      raw_bytes += value.size();
+    }
+    // Compaction copies compressed values without decompressing them
+    auto stats = (*mybitcask)->CompactAll(CompactOptions());
+    ASSERT_TRUE(stats.ok()) << stats.status();
+    for (auto& entry : expected) {
+      std::string value;
+      auto found = (*mybitcask)->Get(entry.first, &value);
+      ASSERT_TRUE(found.ok()) << found.status();
+      ASSERT_TRUE(*found);
+      EXPECT_EQ(value, entry.second);
+    }
+  }
+  std::uint64_t disk_bytes = 0;
+  for (auto& file : ghc::filesystem::directory_iterator(tmpdir->path())) {
+    if (file.path().extension() == ".log") {
+      disk_bytes += ghc::filesystem::file_size(file.path());
+    }
+  }
+  EXPECT_LT(disk_bytes, raw_bytes / 4);
+
+  // The built-in compressor is always available to readers
+  auto mybitcask = Open(tmpdir->path(), Options());
+  ASSERT_TRUE(mybitcask.ok());
+  for (auto& entry : expected) {
+    std::string value;
+    auto found = (*mybitcask)->Get(entry.first, &value);
+    ASSERT_TRUE(found.ok()) << found.status();
+    ASSERT_TRUE(*found);
+    EXPECT_EQ(value, entry.second);
+    std::string streamed;
+    found = (*mybitcask)->GetStream(
+        entry.first, [&](absl::Span<const std::uint8_t> piece) {
+          streamed.append(reinterpret_cast<const char*>(piece.data()),
+                          piece.size());
+          return absl::OkStatus();
+        });
+    ASSERT_TRUE(found.ok()) << found.status();
+    EXPECT_EQ(streamed, entry.second);
+  }
+}
+
+TEST(MyBitcaskTest, TestDictionaryCompression) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.dead_bytes_threshold = 16 * 1024;
+  options.checksum = true;
+  options.compression_min_value_len = 32;
+  options.compression_dictionary_len = 2048;
+  auto record = [](int i) {
+    return "{\"order_id\": " + std::to_string(i) + ", \"customer\": \"" +
+           test::RandomString(6) +
+           "\", \"status\": \"shipped\", \"currency\": \"EUR\", "
+           "\"items\": [{\"sku\": \"" +
+           test::RandomString(8) +
+           "\", \"quantity\": 1, \"warehouse\": \"north-east-2\"}]}";
+  };
+
+  std::map<std::string, std::string> expected;
+  {
+    auto mybitcask = Open(tmpdir->path(), options);
+    ASSERT_TRUE(mybitcask.ok());
+    (*mybitcask)->PauseBackgroundWork();
+    for (int i = 0; i < 400; i++) {
+      auto key = "key" + std::to_string(i % 100);
+      auto value = record(i);
+      ASSERT_TRUE((*mybitcask)->Insert(key, value).ok());
+      expected[key] = value;
+    }
+    // The first compaction trains the dictionary, the second one moves
+    // values to files compressed against it
+    for (int i = 0; i < 2; i++) {
+      auto stats = (*mybitcask)->CompactAll(CompactOptions());
+      ASSERT_TRUE(stats.ok()) << stats.status();
+    }
+    for (int i = 0; i < 50; i++) {
+      auto key = "key" + std::to_string(i);
+      expected[key] = record(1000 + i);
+      ASSERT_TRUE((*mybitcask)->Insert(key, expected[key]).ok());
+    }
+    for (auto& entry : expected) {
+      std::string value;
+      auto found = (*mybitcask)->Get(entry.first, &value);
+      ASSERT_TRUE(found.ok()) << found.status();
+      ASSERT_TRUE(*found);
+      EXPECT_EQ(value, entry.second);
+    }
+  }
+  store::DBFiles dbfiles(tmpdir->path());
+  auto dictionary = log::ReadDictionary(
+      tmpdir->path() / store::LogFilename(dbfiles.latest_file_id()));
+  ASSERT_TRUE(dictionary.ok()) << dictionary.status();
+  EXPECT_FALSE(dictionary->empty());
+  EXPECT_LE(dictionary->size(), options.compression_dictionary_len);
+
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  expected["new"] = record(5000);
+  ASSERT_TRUE((*mybitcask)->Insert("new", expected["new"]).ok());
+  for (auto& entry : expected) {
+    std::string value;
+    auto found = (*mybitcask)->Get(entry.first, &value);
+    ASSERT_TRUE(found.ok()) << found.status();
+    ASSERT_TRUE(*found);
+    EXPECT_EQ(value, entry.second);
+  }
+}
+
+TEST(MyBitcaskTest, TestOpenLegacyLogFile) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  {
+    // A log file written before log files had a header
+    store::Store store(tmpdir->path(), 1, 1024);
+    std::uint8_t entry[log::log_internal::kHeaderLen + 5]{};
+    log::log_internal::RawHeader header(entry);
+    header.set_key_len(3);
+    header.set_value_len(2);
+    std::memcpy(&entry[log::log_internal::kHeaderLen], "oldvv", 5);
+    header.set_crc32(
+        header.calc_actual_crc(&entry[log::log_internal::kHeaderLen]));
+    ASSERT_TRUE(store.Append(absl::MakeSpan(entry)).ok());
+  }
+  Options options;
+  options.checksum = true;
+  for (int i = 0; i < 2; i++) {
+    auto mybitcask = Open(tmpdir->path(), options);
+    ASSERT_TRUE(mybitcask.ok());
+    std::string value;
+    auto found = (*mybitcask)->Get("old", &value);
+    ASSERT_TRUE(found.ok()) << found.status();
+    ASSERT_TRUE(*found);
+    EXPECT_EQ(value, "vv");
+    ASSERT_TRUE((*mybitcask)->Insert("new" + std::to_string(i), "value").ok());
+    // New entries never go to the legacy log file
+    EXPECT_TRUE(ghc::filesystem::exists(tmpdir->path() / "2.log"));
+    for (int j = 0; j <= i; j++) {
+      found = (*mybitcask)->Get("new" + std::to_string(j), &value);
+      ASSERT_TRUE(found.ok()) << found.status();
+      ASSERT_TRUE(*found);
+    }
+  }
+}
+
+TEST(MyBitcaskTest, TestBlockFormat) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.checksum = true;
+  options.block_format = true;
+  std::map<std::string, std::string> expected;
+  for (int i = 0; i < 3; i++) {
+    auto mybitcask = Open(tmpdir->path(), options);
+    ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+    for (auto& entry : expected) {
+      std::string value;
+      auto found = (*mybitcask)->Get(entry.first, &value);
+      ASSERT_TRUE(found.ok()) << found.status();
+      ASSERT_TRUE(*found);
+      EXPECT_EQ(value, entry.second);
+    }
+    for (int j = 0; j < 100; j++) {
+      auto key = test::RandomString(1, 32);
+      auto value = test::RandomString(1, j % 10 == 0 ? 50000 : 2000);
+      ASSERT_TRUE((*mybitcask)->Insert(key, value).ok());
+      expected[key] = value;
+    }
+  }
+  // Every Open appended to a new block framed log file
+  for (store::file_id_t file_id = 1; file_id <= 3; file_id++) {
+    auto version =
+        log::ReadFormatVersion(tmpdir->path() / store::LogFilename(file_id));
+    ASSERT_TRUE(version.ok());
+    ASSERT_TRUE(version->has_value());
+    EXPECT_EQ(**version, log::kBlockFormatVersion);
+  }
+
+  // A corrupt block loses the entries starting in it instead of failing Open
+  {
+    std::fstream file(tmpdir->path() / store::LogFilename(2),
+                      std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(store::kBlockSize + 100);
+    file.put('\x5A');
+  }
+  options.block_format = false;
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+  std::size_t found_count = 0;
+  for (auto& entry : expected) {
+    std::string value;
+    auto found = (*mybitcask)->Get(entry.first, &value);
+    if (found.ok() && *found) {
+      EXPECT_EQ(value, entry.second);
+      found_count++;
+    }
+  }
+  EXPECT_GE(found_count, expected.size() - 30);
+}
+
+// Crashes are simulated by cutting the latest log file at random offsets,
+// maybe followed by garbage, as a writer killed in the middle of an append
+// leaves it. Every entry appended completely before the cut must be
+// recovered, and none after.
+TEST(MyBitcaskTest, TestRecoverTornTail) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  auto db_path = tmpdir->path() / "db";
+  auto crash_path = tmpdir->path() / "crash";
+  std::vector<std::pair<std::string, std::string>> entries;
+  // Length of the latest log file after each entry
+  std::vector<std::uint64_t> ends;
+  ghc::filesystem::path latest_log;
+  ghc::filesystem::create_directories(db_path);
+  {
+    auto mybitcask = Open(db_path, Options());
+    ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+    latest_log = db_path / store::LogFilename(
+                               store::DBFiles(db_path).latest_file_id());
+    for (int i = 0; i < 300; i++) {
+      entries.emplace_back(
+          "key" + std::to_string(i),
+          test::RandomString(1, i % 30 == 0 ? 100000 : 1000));
+      ASSERT_TRUE(
+          (*mybitcask)->Insert(entries.back().first, entries.back().second)
+              .ok());
+      auto size = io::GetFileSize(latest_log);
+      ASSERT_TRUE(size.ok());
+      ends.push_back(*size);
+    }
+  }
+
+  std::mt19937 engine(7);
+  std::uniform_int_distribution<std::uint64_t> dist(0, ends.back());
+  for (int trial = 0; trial < 10; trial++) {
+    auto cut = dist(engine);
+    ghc::filesystem::remove_all(crash_path);
+    ghc::filesystem::copy(db_path, crash_path,
+                          ghc::filesystem::copy_options::recursive);
+    auto crash_log = crash_path / latest_log.filename();
+    ghc::filesystem::resize_file(crash_log, cut);
+    if (trial % 2 == 1) {
+      std::ofstream file(crash_log, std::ios::binary | std::ios::app);
+      file << test::RandomString(1, 64);
+    }
+    auto recovered = static_cast<std::size_t>(
+        std::upper_bound(ends.begin(), ends.end(), cut) - ends.begin());
+
+    Options options;
+    options.recovery_mode = RecoveryMode::kAbsoluteConsistency;
+    auto mybitcask = Open(crash_path, options);
+    bool consistent = mybitcask.ok();
+    if (!consistent) {
+      ASSERT_TRUE(absl::IsDataLoss(mybitcask.status())) << mybitcask.status();
+    }
+    mybitcask = absl::InternalError("closed");
+    auto crash_len = io::GetFileSize(crash_log);
+    ASSERT_TRUE(crash_len.ok());
+
+    options.recovery_mode = RecoveryMode::kTruncateTornTail;
+    mybitcask = Open(crash_path, options);
+    ASSERT_TRUE(mybitcask.ok()) << "cut at " << cut << ": "
+                                << mybitcask.status();
+    auto& report = (*mybitcask)->recovery_report();
+    EXPECT_EQ(report.dropped_bytes, *crash_len - report.truncated_len);
+    EXPECT_EQ(report.dropped_bytes == 0, consistent);
+    if (recovered > 0) {
+      EXPECT_LE(report.truncated_len, ends[recovered - 1]);
+    }
+    for (std::size_t i = 0; i < entries.size(); i++) {
+      std::string value;
+      auto found = (*mybitcask)->Get(entries[i].first, &value);
+      ASSERT_TRUE(found.ok()) << found.status();
+      ASSERT_EQ(*found, i < recovered) << "cut at " << cut << ", entry " << i;
+      if (*found) {
+        EXPECT_EQ(value, entries[i].second);
+      }
+    }
+    // New entries follow the recovered ones
+    ASSERT_TRUE((*mybitcask)->Insert("new", "value").ok());
+    mybitcask->reset();
+    mybitcask = Open(crash_path, options);
+    ASSERT_TRUE(mybitcask.ok()) << mybitcask.status();
+    EXPECT_EQ((*mybitcask)->recovery_report().dropped_bytes, 0);
+    std::string value;
+    auto found = (*mybitcask)->Get("new", &value);
+    ASSERT_TRUE(found.ok() && *found);
+  }
+}
+
 }  // namespace mybitcask
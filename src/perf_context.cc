@@ -0,0 +1,74 @@
+#include "mybitcask/internal/perf_context.h"
+
+#include <cstdio>
+
+namespace mybitcask {
+
+namespace perf_internal {
+
+thread_local PerfLevel perf_level = PerfLevel::kDisable;
+thread_local PerfContext perf_context;
+
+}  // namespace perf_internal
+
+namespace {
+
+struct PerfMetric {
+  const char* name;
+  std::uint64_t PerfContext::*metric;
+};
+
+const PerfMetric kPerfMetrics[] = {
+    {"get_count", &PerfContext::get_count},
+    {"get_nanos", &PerfContext::get_nanos},
+    {"insert_count", &PerfContext::insert_count},
+    {"insert_nanos", &PerfContext::insert_nanos},
+    {"index_lock_wait_nanos", &PerfContext::index_lock_wait_nanos},
+    {"index_lookup_nanos", &PerfContext::index_lookup_nanos},
+    {"index_update_nanos", &PerfContext::index_update_nanos},
+    {"log_read_count", &PerfContext::log_read_count},
+    {"log_read_nanos", &PerfContext::log_read_nanos},
+    {"decompress_nanos", &PerfContext::decompress_nanos},
+    {"read_checksum_nanos", &PerfContext::read_checksum_nanos},
+    {"reader_lock_wait_nanos", &PerfContext::reader_lock_wait_nanos},
+    {"reader_open_count", &PerfContext::reader_open_count},
+    {"read_at_count", &PerfContext::read_at_count},
+    {"read_at_bytes", &PerfContext::read_at_bytes},
+    {"read_at_nanos", &PerfContext::read_at_nanos},
+    {"log_append_count", &PerfContext::log_append_count},
+    {"log_append_nanos", &PerfContext::log_append_nanos},
+    {"encode_nanos", &PerfContext::encode_nanos},
+    {"write_checksum_nanos", &PerfContext::write_checksum_nanos},
+    {"store_lock_wait_nanos", &PerfContext::store_lock_wait_nanos},
+    {"store_write_count", &PerfContext::store_write_count},
+    {"store_write_bytes", &PerfContext::store_write_bytes},
+    {"store_write_nanos", &PerfContext::store_write_nanos},
+    {"rollover_count", &PerfContext::rollover_count},
+    {"rollover_nanos", &PerfContext::rollover_nanos},
+    {"sync_count", &PerfContext::sync_count},
+    {"sync_nanos", &PerfContext::sync_nanos},
+};
+
+}  // namespace
+
+void PerfContext::Reset() {
+  for (const auto& m : kPerfMetrics) {
+    this->*m.metric = 0;
+  }
+}
+
+std::string PerfContext::ToString(bool exclude_zero) const {
+  std::string out;
+  char pair[64];
+  for (const auto& m : kPerfMetrics) {
+    if (exclude_zero && this->*m.metric == 0) {
+      continue;
+    }
+    std::snprintf(pair, sizeof(pair), "%s%s = %llu", out.empty() ? "" : ", ",
+                  m.name, static_cast<unsigned long long>(this->*m.metric));
+    out += pair;
+  }
+  return out;
+}
+
+}  // namespace mybitcask
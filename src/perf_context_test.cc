@@ -0,0 +1,96 @@
+#include "mybitcask/internal/perf_context.h"
+
+#include "gtest/gtest.h"
+#include "mybitcask/mybitcask.h"
+#include "test_util.h"
+
+#include <string>
+#include <thread>
+
+namespace mybitcask {
+
+TEST(PerfContextTest, Levels) {
+  EXPECT_EQ(GetPerfLevel(), PerfLevel::kDisable);
+  GetPerfContext()->Reset();
+  PerfCount(&PerfContext::get_count);
+  {
+    PerfTimer timer(&PerfContext::get_nanos);
+  }
+  EXPECT_EQ(GetPerfContext()->get_count, 0);
+  EXPECT_EQ(GetPerfContext()->ToString(true), "");
+
+  SetPerfLevel(PerfLevel::kEnableCount);
+  PerfCount(&PerfContext::get_count, 2);
+  {
+    PerfTimer timer(&PerfContext::get_nanos);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(GetPerfContext()->get_count, 2);
+  EXPECT_EQ(GetPerfContext()->get_nanos, 0);
+
+  SetPerfLevel(PerfLevel::kEnableTime);
+  {
+    PerfTimer timer(&PerfContext::get_nanos);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    timer.Stop();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  EXPECT_GE(GetPerfContext()->get_nanos, 1000000);
+  EXPECT_LT(GetPerfContext()->get_nanos, 50000000);
+  EXPECT_EQ(GetPerfContext()->ToString(true).find("get_count = 2, get_nanos"),
+            0);
+
+  // Other threads have perf contexts of their own, disabled by default
+  std::thread([]() {
+    EXPECT_EQ(GetPerfLevel(), PerfLevel::kDisable);
+    EXPECT_EQ(GetPerfContext()->get_count, 0);
+    PerfCount(&PerfContext::get_count);
+  }).join();
+  EXPECT_EQ(GetPerfContext()->get_count, 2);
+
+  GetPerfContext()->Reset();
+  EXPECT_EQ(GetPerfContext()->get_nanos, 0);
+  SetPerfLevel(PerfLevel::kDisable);
+}
+
+TEST(PerfContextTest, Breakdown) {
+  auto tmpdir = test::MakeTempDir("mybitcask_");
+  ASSERT_TRUE(tmpdir.ok());
+  Options options;
+  options.checksum = true;
+  auto mybitcask = Open(tmpdir->path(), options);
+  ASSERT_TRUE(mybitcask.ok());
+  auto db = mybitcask->get();
+
+  SetPerfLevel(PerfLevel::kEnableTime);
+  GetPerfContext()->Reset();
+  ASSERT_TRUE(db->Insert("key", std::string(100, 'v')).ok());
+  auto perf = *GetPerfContext();
+  EXPECT_EQ(perf.insert_count, 1);
+  EXPECT_EQ(perf.log_append_count, 1);
+  EXPECT_EQ(perf.sync_count, 1);
+  EXPECT_GT(perf.store_write_count, 0);
+  EXPECT_GT(perf.store_write_bytes, 100);
+  EXPECT_GT(perf.insert_nanos, 0);
+  EXPECT_GE(perf.insert_nanos, perf.log_append_nanos);
+  EXPECT_GE(perf.log_append_nanos,
+            perf.store_write_nanos + perf.sync_nanos + perf.encode_nanos);
+  EXPECT_EQ(perf.get_count, 0);
+
+  GetPerfContext()->Reset();
+  std::string value;
+  auto found = db->Get("key", &value);
+  ASSERT_TRUE(found.ok() && *found);
+  perf = *GetPerfContext();
+  EXPECT_EQ(perf.get_count, 1);
+  EXPECT_EQ(perf.log_read_count, 1);
+  EXPECT_GT(perf.read_at_count, 0);
+  EXPECT_GE(perf.read_at_bytes, 100);
+  EXPECT_GT(perf.read_checksum_nanos, 0);
+  EXPECT_GE(perf.get_nanos, perf.log_read_nanos + perf.index_lookup_nanos);
+  EXPECT_GE(perf.log_read_nanos, perf.read_at_nanos);
+  EXPECT_EQ(perf.insert_count, 0);
+  SetPerfLevel(PerfLevel::kDisable);
+}
+
+}  // namespace mybitcask
@@ -0,0 +1,27 @@
+#include "rate_limiter.h"
+
+#include "absl/time/clock.h"
+
+#include <algorithm>
+
+namespace mybitcask {
+
+RateLimiter::RateLimiter(std::uint64_t bytes_per_second)
+    : mu_(),
+      bytes_per_second_(static_cast<double>(std::max<std::uint64_t>(
+          bytes_per_second, 1))),
+      next_free_(absl::InfinitePast()) {}
+
+void RateLimiter::Request(std::uint64_t bytes) {
+  absl::Time start;
+  {
+    absl::MutexLock guard(&mu_);
+    start = std::max(absl::Now(), next_free_);
+    next_free_ = start + absl::Seconds(static_cast<double>(bytes) /
+                                       bytes_per_second_);
+  }
+  // Wait for the bytes requested before to pass
+  absl::SleepFor(start - absl::Now());
+}
+
+}  // namespace mybitcask
@@ -0,0 +1,34 @@
+#ifndef MYBITCASK_SRC_RATE_LIMITER_H_
+#define MYBITCASK_SRC_RATE_LIMITER_H_
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+#include <cstdint>
+
+namespace mybitcask {
+
+// RateLimiter limits the rate of bytes passing through it. The limit is
+// shared by all threads calling Request.
+class RateLimiter {
+ public:
+  explicit RateLimiter(std::uint64_t bytes_per_second);
+
+  RateLimiter(const RateLimiter&) = delete;
+  RateLimiter& operator=(const RateLimiter&) = delete;
+
+  // Block until `bytes` bytes are allowed to pass.
+  //
+  // Safe for concurrent use by multiple threads.
+  void Request(std::uint64_t bytes);
+
+ private:
+  absl::Mutex mu_;
+  const double bytes_per_second_;
+  // When the bytes requested so far have all passed
+  absl::Time next_free_;
+};
+
+}  // namespace mybitcask
+
+#endif  // MYBITCASK_SRC_RATE_LIMITER_H_
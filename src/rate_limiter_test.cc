@@ -0,0 +1,30 @@
+#include "rate_limiter.h"
+
+#include "absl/time/clock.h"
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+namespace mybitcask {
+
+TEST(RateLimiterTest, Request) {
+  RateLimiter limiter(1024 * 1024);
+  auto start = absl::Now();
+  // The first request passes right away
+  limiter.Request(100 * 1024);
+  EXPECT_LT(absl::Now() - start, absl::Milliseconds(50));
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&]() { limiter.Request(100 * 1024); });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  // 400KiB had to wait for the 400KiB before them at 1MiB/s
+  EXPECT_GE(absl::Now() - start, absl::Milliseconds(350));
+  EXPECT_LT(absl::Now() - start, absl::Seconds(2));
+}
+
+}  // namespace mybitcask
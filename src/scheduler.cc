@@ -0,0 +1,162 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+namespace mybitcask {
+
+Scheduler::Scheduler(std::size_t num_threads)
+    : mu_(),
+      jobs_(),
+      tasks_(),
+      paused_(false),
+      stopped_(false),
+      running_(0),
+      jobs_version_(0),
+      threads_() {
+  num_threads = std::max<std::size_t>(num_threads, 1);
+  threads_.reserve(num_threads);
+  for (std::size_t i = 0; i < num_threads; i++) {
+    threads_.emplace_back([this]() { work_loop(); });
+  }
+}
+
+Scheduler::~Scheduler() { Shutdown(); }
+
+Scheduler::JobId Scheduler::AddJob(JobPriority priority,
+                                   std::function<void()> job,
+                                   absl::Duration period) {
+  absl::MutexLock guard(&mu_);
+  jobs_.push_back(
+      Job{priority, std::move(job), period, absl::Now() + period, false, false});
+  jobs_version_++;
+  return jobs_.size() - 1;
+}
+
+void Scheduler::Trigger(JobId id) {
+  absl::MutexLock guard(&mu_);
+  jobs_[id].pending = true;
+}
+
+void Scheduler::Schedule(JobPriority priority, std::function<void()> task) {
+  absl::MutexLock guard(&mu_);
+  tasks_.push_back(Task{priority, std::move(task)});
+}
+
+void Scheduler::Pause() {
+  absl::MutexLock guard(&mu_);
+  paused_ = true;
+  auto idle = [this]() { return running_ == 0; };
+  mu_.Await(absl::Condition(&idle));
+}
+
+void Scheduler::Resume() {
+  absl::MutexLock guard(&mu_);
+  paused_ = false;
+  // Waiting threads recompute their deadlines, periodic jobs were skipped
+  // while paused
+  jobs_version_++;
+}
+
+void Scheduler::Shutdown() {
+  std::vector<std::thread> threads;
+  std::deque<Task> tasks;
+  {
+    absl::MutexLock guard(&mu_);
+    stopped_ = true;
+    threads.swap(threads_);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  {
+    absl::MutexLock guard(&mu_);
+    tasks.swap(tasks_);
+  }
+  // Destroyed without holding mu_, a task may schedule others when destroyed
+  tasks.clear();
+}
+
+bool Scheduler::has_ready_job() const {
+  if (stopped_) {
+    return true;
+  }
+  if (paused_) {
+    return false;
+  }
+  if (!tasks_.empty()) {
+    return true;
+  }
+  for (auto& job : jobs_) {
+    if (job.pending && !job.running) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Scheduler::work_loop() {
+  absl::MutexLock guard(&mu_);
+  while (!stopped_) {
+    auto now = absl::Now();
+    auto deadline = absl::InfiniteFuture();
+    std::size_t next = jobs_.size();
+    for (std::size_t i = 0; !paused_ && i < jobs_.size(); i++) {
+      auto& job = jobs_[i];
+      if (job.running) {
+        continue;
+      }
+      if (!job.pending) {
+        if (job.next_run > now) {
+          deadline = std::min(deadline, job.next_run);
+          continue;
+        }
+        job.pending = true;
+      }
+      if (next == jobs_.size() || job.priority > jobs_[next].priority) {
+        next = i;
+      }
+    }
+    // A task runs first unless a job of higher priority is eligible
+    auto task = tasks_.end();
+    for (auto it = tasks_.begin(); !paused_ && it != tasks_.end(); ++it) {
+      if (task == tasks_.end() || it->priority > task->priority) {
+        task = it;
+      }
+    }
+    if (task != tasks_.end() &&
+        (next == jobs_.size() || task->priority >= jobs_[next].priority)) {
+      auto fn = std::move(task->fn);
+      tasks_.erase(task);
+      running_++;
+      mu_.Unlock();
+      fn();
+      // Destroy the task without holding mu_
+      fn = nullptr;
+      mu_.Lock();
+      running_--;
+      continue;
+    }
+    if (next == jobs_.size()) {
+      auto version = jobs_version_;
+      auto wake = [this, version]() {
+        return version != jobs_version_ || has_ready_job();
+      };
+      mu_.AwaitWithDeadline(absl::Condition(&wake), deadline);
+      continue;
+    }
+
+    jobs_[next].pending = false;
+    jobs_[next].running = true;
+    running_++;
+    // jobs_ may grow while the job runs
+    auto fn = jobs_[next].fn;
+    mu_.Unlock();
+    fn();
+    mu_.Lock();
+    jobs_[next].running = false;
+    jobs_[next].next_run = absl::Now() + jobs_[next].period;
+    running_--;
+  }
+}
+
+}  // namespace mybitcask
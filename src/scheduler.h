@@ -0,0 +1,96 @@
+#ifndef MYBITCASK_SRC_SCHEDULER_H_
+#define MYBITCASK_SRC_SCHEDULER_H_
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace mybitcask {
+
+// Eligible jobs of higher priority start first
+enum class JobPriority { kLow = 0, kHigh = 1 };
+
+// Scheduler runs background jobs on a fixed number of threads. A job becomes
+// eligible when it is triggered, or when its period elapses, and starts as
+// soon as a thread is free. A job never runs concurrently with itself;
+// triggering a running job makes it run again once it finishes.
+class Scheduler {
+ public:
+  using JobId = std::size_t;
+
+  explicit Scheduler(std::size_t num_threads);
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  // Shutdown
+  ~Scheduler();
+
+  // Register `job`. Besides being triggered, the job becomes eligible
+  // `period` after its previous run ended (or after it was added).
+  //
+  // Safe for concurrent use by multiple threads.
+  JobId AddJob(JobPriority priority, std::function<void()> job,
+               absl::Duration period = absl::InfiniteDuration());
+
+  // Make job `id` eligible.
+  //
+  // Safe for concurrent use by multiple threads.
+  void Trigger(JobId id);
+
+  // Run `task` once. Tasks of the same priority start in the order they are
+  // scheduled.
+  //
+  // Safe for concurrent use by multiple threads.
+  void Schedule(JobPriority priority, std::function<void()> task);
+
+  // Stop starting jobs and wait for the running jobs to finish. Jobs that
+  // become eligible while paused start once Resume is called.
+  void Pause();
+  void Resume();
+
+  // Wait for the running jobs to finish and join all threads. Eligible jobs
+  // and tasks which have not started are not run, the tasks are destroyed.
+  // Calling Shutdown more than once has no effect.
+  void Shutdown();
+
+ private:
+  struct Job {
+    JobPriority priority;
+    std::function<void()> fn;
+    absl::Duration period;
+    absl::Time next_run;
+    bool pending;
+    bool running;
+  };
+
+  struct Task {
+    JobPriority priority;
+    std::function<void()> fn;
+  };
+
+  // REQUIRES: mu_ held
+  bool has_ready_job() const;
+  void work_loop();
+
+  absl::Mutex mu_;
+  std::vector<Job> jobs_;
+  std::deque<Task> tasks_;
+  bool paused_;
+  bool stopped_;
+  std::size_t running_;
+  // Incremented whenever a job is added or the scheduler resumes, so that
+  // waiting threads recompute their deadlines
+  std::uint64_t jobs_version_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace mybitcask
+
+#endif  // MYBITCASK_SRC_SCHEDULER_H_
@@ -0,0 +1,140 @@
+#include "scheduler.h"
+
+#include "absl/synchronization/notification.h"
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <string>
+
+namespace mybitcask {
+
+TEST(SchedulerTest, TriggerStartsJobPromptly) {
+  Scheduler scheduler(2);
+  absl::Notification done;
+  absl::Time started;
+  auto id = scheduler.AddJob(JobPriority::kLow, [&]() {
+    started = absl::Now();
+    done.Notify();
+  });
+  auto triggered = absl::Now();
+  scheduler.Trigger(id);
+  ASSERT_TRUE(done.WaitForNotificationWithTimeout(absl::Seconds(5)));
+  EXPECT_LT(started - triggered, absl::Milliseconds(100));
+}
+
+TEST(SchedulerTest, HigherPriorityFirst) {
+  Scheduler scheduler(1);
+  std::string order;
+  absl::Notification done;
+  auto low = scheduler.AddJob(JobPriority::kLow, [&]() {
+    order += "l";
+    done.Notify();
+  });
+  auto high = scheduler.AddJob(JobPriority::kHigh, [&]() { order += "h"; });
+  scheduler.Pause();
+  scheduler.Trigger(low);
+  scheduler.Trigger(high);
+  scheduler.Resume();
+  ASSERT_TRUE(done.WaitForNotificationWithTimeout(absl::Seconds(5)));
+  EXPECT_EQ(order, "hl");
+}
+
+TEST(SchedulerTest, PauseWaitsForRunningJobs) {
+  Scheduler scheduler(2);
+  std::atomic<int> runs(0);
+  absl::Notification started;
+  auto id = scheduler.AddJob(JobPriority::kLow, [&]() {
+    if (!started.HasBeenNotified()) {
+      started.Notify();
+    }
+    absl::SleepFor(absl::Milliseconds(50));
+    runs++;
+  });
+  scheduler.Trigger(id);
+  started.WaitForNotification();
+  scheduler.Pause();
+  EXPECT_EQ(runs.load(), 1);
+
+  scheduler.Trigger(id);
+  absl::SleepFor(absl::Milliseconds(100));
+  EXPECT_EQ(runs.load(), 1);
+  scheduler.Resume();
+  auto deadline = absl::Now() + absl::Seconds(5);
+  while (runs.load() < 2 && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_EQ(runs.load(), 2);
+}
+
+TEST(SchedulerTest, JobNeverRunsConcurrentlyWithItself) {
+  Scheduler scheduler(4);
+  std::atomic<int> running(0);
+  std::atomic<int> max_running(0);
+  std::atomic<int> runs(0);
+  Scheduler::JobId id = scheduler.AddJob(JobPriority::kLow, [&]() {
+    int now = ++running;
+    if (now > max_running) {
+      max_running = now;
+    }
+    absl::SleepFor(absl::Milliseconds(10));
+    running--;
+    runs++;
+  });
+  for (int i = 0; i < 20; i++) {
+    scheduler.Trigger(id);
+    absl::SleepFor(absl::Milliseconds(2));
+  }
+  absl::SleepFor(absl::Milliseconds(100));
+  EXPECT_EQ(max_running.load(), 1);
+  // Triggers of a running job are coalesced
+  EXPECT_GE(runs.load(), 2);
+  EXPECT_LT(runs.load(), 20);
+}
+
+TEST(SchedulerTest, PeriodicJob) {
+  std::atomic<int> runs(0);
+  Scheduler scheduler(1);
+  // Runs again without being triggered
+  scheduler.AddJob(JobPriority::kLow, [&]() { runs++; },
+                   absl::Milliseconds(20));
+  auto deadline = absl::Now() + absl::Seconds(5);
+  while (runs.load() < 2 && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_GE(runs.load(), 2);
+}
+
+TEST(SchedulerTest, PeriodicJobAfterResume) {
+  std::atomic<int> runs(0);
+  Scheduler scheduler(2);
+  scheduler.Pause();
+  scheduler.AddJob(JobPriority::kLow, [&]() { runs++; },
+                   absl::Milliseconds(20));
+  absl::SleepFor(absl::Milliseconds(50));
+  EXPECT_EQ(runs.load(), 0);
+  scheduler.Resume();
+  auto deadline = absl::Now() + absl::Seconds(5);
+  while (runs.load() < 2 && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_GE(runs.load(), 2);
+}
+
+TEST(SchedulerTest, ShutdownJoinsRunningJobs) {
+  std::atomic<bool> finished(false);
+  absl::Notification started;
+  Scheduler scheduler(1);
+  auto id = scheduler.AddJob(JobPriority::kLow, [&]() {
+    started.Notify();
+    absl::SleepFor(absl::Milliseconds(50));
+    finished = true;
+  });
+  scheduler.Trigger(id);
+  started.WaitForNotification();
+  scheduler.Shutdown();
+  EXPECT_TRUE(finished.load());
+  // Does nothing once shut down
+  scheduler.Shutdown();
+}
+
+}  // namespace mybitcask
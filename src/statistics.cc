@@ -0,0 +1,334 @@
+#include "mybitcask/internal/statistics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+namespace mybitcask {
+
+namespace {
+
+const std::size_t kNumTickers = static_cast<std::size_t>(Ticker::kNumTickers);
+const std::size_t kNumHistograms =
+    static_cast<std::size_t>(Histogram::kNumHistograms);
+const std::size_t kNumGauges = static_cast<std::size_t>(Gauge::kNumGauges);
+
+// Number of shards, a power of two. Threads are spread over the shards
+// round-robin, so they rarely share one.
+const std::size_t kNumShards = 16;
+
+// Values below kSubBuckets have a bucket each, the larger ones are bucketed
+// by their highest set bit and the kSubBucketBits bits after it, so buckets
+// are at most 25% wide.
+const std::size_t kSubBucketBits = 2;
+const std::size_t kSubBuckets = 1 << kSubBucketBits;
+const std::size_t kNumBuckets =
+    kSubBuckets + (64 - kSubBucketBits) * kSubBuckets;
+
+std::size_t BucketIndex(std::uint64_t value) {
+  if (value < kSubBuckets) {
+    return static_cast<std::size_t>(value);
+  }
+  std::size_t msb = 63;
+  while ((value >> msb) == 0) {
+    msb--;
+  }
+  auto sub = static_cast<std::size_t>(value >> (msb - kSubBucketBits)) &
+             (kSubBuckets - 1);
+  return kSubBuckets + (msb - kSubBucketBits) * kSubBuckets + sub;
+}
+
+// Smallest value of bucket `index`
+double BucketStart(std::size_t index) {
+  if (index < kSubBuckets) {
+    return static_cast<double>(index);
+  }
+  auto msb = (index - kSubBuckets) / kSubBuckets + kSubBucketBits;
+  auto sub = (index - kSubBuckets) % kSubBuckets;
+  return static_cast<double>((kSubBuckets + sub)) *
+         static_cast<double>(std::uint64_t(1) << (msb - kSubBucketBits));
+}
+
+std::size_t ShardIndex() {
+  static std::atomic<std::size_t> next_shard(0);
+  thread_local std::size_t shard = next_shard.fetch_add(1) % kNumShards;
+  return shard;
+}
+
+void AtomicMin(std::atomic<std::uint64_t>* min, std::uint64_t value) {
+  auto current = min->load(std::memory_order_relaxed);
+  while (value < current &&
+         !min->compare_exchange_weak(current, value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+void AtomicMax(std::atomic<std::uint64_t>* max, std::uint64_t value) {
+  auto current = max->load(std::memory_order_relaxed);
+  while (value > current &&
+         !max->compare_exchange_weak(current, value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+struct HistogramShard {
+  std::atomic<std::uint64_t> count;
+  std::atomic<std::uint64_t> sum;
+  std::atomic<std::uint64_t> min;
+  std::atomic<std::uint64_t> max;
+  std::array<std::atomic<std::uint64_t>, kNumBuckets> buckets;
+};
+
+}  // namespace
+
+struct Statistics::Shard {
+  // Keeps the tickers, the hottest part of a shard, off the cache line the
+  // end of the previous shard is in
+  char padding[64];
+  std::array<std::atomic<std::uint64_t>, kNumTickers> tickers;
+  std::array<HistogramShard, kNumHistograms> histograms;
+};
+
+Statistics::Statistics() : shards_(new Shard[kNumShards]) {
+  for (auto& gauge : gauges_) {
+    gauge.store(0);
+  }
+  Reset();
+}
+
+Statistics::~Statistics() = default;
+
+void Statistics::Add(Ticker ticker, std::uint64_t count) noexcept {
+  shards_[ShardIndex()]
+      .tickers[static_cast<std::size_t>(ticker)]
+      .fetch_add(count, std::memory_order_relaxed);
+}
+
+void Statistics::Record(Histogram histogram, std::uint64_t value) noexcept {
+  auto& shard = shards_[ShardIndex()]
+                    .histograms[static_cast<std::size_t>(histogram)];
+  shard.count.fetch_add(1, std::memory_order_relaxed);
+  shard.sum.fetch_add(value, std::memory_order_relaxed);
+  AtomicMin(&shard.min, value);
+  AtomicMax(&shard.max, value);
+  shard.buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Statistics::Set(Gauge gauge, std::uint64_t value) noexcept {
+  gauges_[static_cast<std::size_t>(gauge)].store(value,
+                                                 std::memory_order_relaxed);
+}
+
+std::uint64_t Statistics::Get(Ticker ticker) const noexcept {
+  std::uint64_t count = 0;
+  for (std::size_t i = 0; i < kNumShards; i++) {
+    count += shards_[i].tickers[static_cast<std::size_t>(ticker)].load(
+        std::memory_order_relaxed);
+  }
+  return count;
+}
+
+HistogramData Statistics::Get(Histogram histogram) const noexcept {
+  HistogramData data;
+  std::array<std::uint64_t, kNumBuckets> buckets{};
+  data.min = std::numeric_limits<std::uint64_t>::max();
+  for (std::size_t i = 0; i < kNumShards; i++) {
+    auto& shard =
+        shards_[i].histograms[static_cast<std::size_t>(histogram)];
+    data.count += shard.count.load(std::memory_order_relaxed);
+    data.sum += shard.sum.load(std::memory_order_relaxed);
+    data.min = std::min(data.min, shard.min.load(std::memory_order_relaxed));
+    data.max = std::max(data.max, shard.max.load(std::memory_order_relaxed));
+    for (std::size_t b = 0; b < kNumBuckets; b++) {
+      buckets[b] += shard.buckets[b].load(std::memory_order_relaxed);
+    }
+  }
+  std::uint64_t total = 0;
+  for (auto n : buckets) {
+    total += n;
+  }
+  if (total == 0) {
+    data.min = 0;
+    return data;
+  }
+  data.average = static_cast<double>(data.sum) / static_cast<double>(total);
+  auto percentile = [&](double p) {
+    auto rank = p * static_cast<double>(total);
+    double seen = 0;
+    for (std::size_t b = 0; b < kNumBuckets; b++) {
+      if (buckets[b] == 0) {
+        continue;
+      }
+      if (seen + static_cast<double>(buckets[b]) >= rank) {
+        auto start = BucketStart(b);
+        auto end = b + 1 < kNumBuckets ? BucketStart(b + 1) : start;
+        auto value = start + (end - start) * (rank - seen) /
+                                 static_cast<double>(buckets[b]);
+        return std::max(static_cast<double>(data.min),
+                        std::min(static_cast<double>(data.max), value));
+      }
+      seen += static_cast<double>(buckets[b]);
+    }
+    return static_cast<double>(data.max);
+  };
+  data.p50 = percentile(0.5);
+  data.p99 = percentile(0.99);
+  data.p999 = percentile(0.999);
+  return data;
+}
+
+std::uint64_t Statistics::Get(Gauge gauge) const noexcept {
+  return gauges_[static_cast<std::size_t>(gauge)].load(
+      std::memory_order_relaxed);
+}
+
+void Statistics::Reset() noexcept {
+  for (std::size_t i = 0; i < kNumShards; i++) {
+    for (auto& ticker : shards_[i].tickers) {
+      ticker.store(0, std::memory_order_relaxed);
+    }
+    for (auto& histogram : shards_[i].histograms) {
+      histogram.count.store(0, std::memory_order_relaxed);
+      histogram.sum.store(0, std::memory_order_relaxed);
+      histogram.min.store(std::numeric_limits<std::uint64_t>::max(),
+                          std::memory_order_relaxed);
+      histogram.max.store(0, std::memory_order_relaxed);
+      for (auto& bucket : histogram.buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+double Statistics::SpaceAmplification() const noexcept {
+  auto live = Get(Gauge::kLiveDataBytes);
+  if (live == 0) {
+    return 0;
+  }
+  return static_cast<double>(Get(Gauge::kLogFileBytes) +
+                             Get(Gauge::kHintFileBytes)) /
+         static_cast<double>(live);
+}
+
+double Statistics::WriteAmplification() const noexcept {
+  auto user = Get(Ticker::kUserBytesWritten);
+  if (user == 0) {
+    return 0;
+  }
+  // Bytes written by merges are appended to the log like any other entry
+  return static_cast<double>(Get(Ticker::kBytesWritten) +
+                             Get(Ticker::kHintBytesWritten)) /
+         static_cast<double>(user);
+}
+
+std::string Statistics::ToString() const {
+  std::string out;
+  char line[256];
+  for (std::size_t i = 0; i < kNumTickers; i++) {
+    auto ticker = static_cast<Ticker>(i);
+    std::snprintf(line, sizeof(line), "%s: %llu\n", TickerName(ticker),
+                  static_cast<unsigned long long>(Get(ticker)));
+    out += line;
+  }
+  for (std::size_t i = 0; i < kNumHistograms; i++) {
+    auto histogram = static_cast<Histogram>(i);
+    auto data = Get(histogram);
+    std::snprintf(line, sizeof(line),
+                  "%s: count %llu, average %.2f, p50 %.2f, p99 %.2f, "
+                  "p999 %.2f, max %llu\n",
+                  HistogramName(histogram),
+                  static_cast<unsigned long long>(data.count), data.average,
+                  data.p50, data.p99, data.p999,
+                  static_cast<unsigned long long>(data.max));
+    out += line;
+  }
+  for (std::size_t i = 0; i < kNumGauges; i++) {
+    auto gauge = static_cast<Gauge>(i);
+    std::snprintf(line, sizeof(line), "%s: %llu\n", GaugeName(gauge),
+                  static_cast<unsigned long long>(Get(gauge)));
+    out += line;
+  }
+  std::snprintf(line, sizeof(line),
+                "space.amplification: %.2f\nwrite.amplification: %.2f\n",
+                SpaceAmplification(), WriteAmplification());
+  out += line;
+  return out;
+}
+
+const char* TickerName(Ticker ticker) {
+  switch (ticker) {
+    case Ticker::kGetHits:
+      return "get.hits";
+    case Ticker::kGetMisses:
+      return "get.misses";
+    case Ticker::kInlineValueHits:
+      return "inline_value.hits";
+    case Ticker::kInlineValueMisses:
+      return "inline_value.misses";
+    case Ticker::kBytesWritten:
+      return "bytes.written";
+    case Ticker::kBytesRead:
+      return "bytes.read";
+    case Ticker::kSyncs:
+      return "syncs";
+    case Ticker::kRollovers:
+      return "rollovers";
+    case Ticker::kFilesCompacted:
+      return "compaction.files";
+    case Ticker::kCompactionBytesRead:
+      return "compaction.bytes.read";
+    case Ticker::kCompactionBytesWritten:
+      return "compaction.bytes.written";
+    case Ticker::kCompactionBytesReclaimed:
+      return "compaction.bytes.reclaimed";
+    case Ticker::kHintFilesWritten:
+      return "hint.files.written";
+    case Ticker::kHintBytesWritten:
+      return "hint.bytes.written";
+    case Ticker::kUserBytesWritten:
+      return "user.bytes.written";
+    case Ticker::kNumTickers:
+      break;
+  }
+  return "unknown";
+}
+
+const char* HistogramName(Histogram histogram) {
+  switch (histogram) {
+    case Histogram::kGetMicros:
+      return "get.micros";
+    case Histogram::kInsertMicros:
+      return "insert.micros";
+    case Histogram::kDeleteMicros:
+      return "delete.micros";
+    case Histogram::kSyncMicros:
+      return "sync.micros";
+    case Histogram::kHintGenerationMicros:
+      return "hint.generation.micros";
+    case Histogram::kNumHistograms:
+      break;
+  }
+  return "unknown";
+}
+
+const char* GaugeName(Gauge gauge) {
+  switch (gauge) {
+    case Gauge::kIndexKeys:
+      return "index.keys";
+    case Gauge::kIndexMemoryBytes:
+      return "index.memory.bytes";
+    case Gauge::kInlineValueBytes:
+      return "inline_value.bytes";
+    case Gauge::kLiveDataBytes:
+      return "live_data.bytes";
+    case Gauge::kLogFileBytes:
+      return "log_files.bytes";
+    case Gauge::kHintFileBytes:
+      return "hint_files.bytes";
+    case Gauge::kNumGauges:
+      break;
+  }
+  return "unknown";
+}
+
+}  // namespace mybitcask
@@ -0,0 +1,96 @@
+#include "mybitcask/internal/statistics.h"
+
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+namespace mybitcask {
+
+TEST(StatisticsTest, Tickers) {
+  Statistics statistics;
+  EXPECT_EQ(statistics.Get(Ticker::kGetHits), 0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&statistics]() {
+      for (int i = 0; i < 1000; i++) {
+        statistics.Add(Ticker::kGetHits);
+        statistics.Add(Ticker::kBytesWritten, 10);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(statistics.Get(Ticker::kGetHits), 4000);
+  EXPECT_EQ(statistics.Get(Ticker::kBytesWritten), 40000);
+  EXPECT_EQ(statistics.Get(Ticker::kGetMisses), 0);
+
+  RecordTick(&statistics, Ticker::kGetMisses, 2);
+  RecordTick(nullptr, Ticker::kGetMisses);
+  EXPECT_EQ(statistics.Get(Ticker::kGetMisses), 2);
+
+  statistics.Reset();
+  EXPECT_EQ(statistics.Get(Ticker::kGetHits), 0);
+  EXPECT_EQ(statistics.Get(Ticker::kBytesWritten), 0);
+}
+
+TEST(StatisticsTest, Histogram) {
+  Statistics statistics;
+  auto empty = statistics.Get(Histogram::kGetMicros);
+  EXPECT_EQ(empty.count, 0);
+  EXPECT_EQ(empty.min, 0);
+  EXPECT_EQ(empty.p99, 0);
+
+  for (std::uint64_t v = 1; v <= 1000; v++) {
+    statistics.Record(Histogram::kGetMicros, v);
+  }
+  auto data = statistics.Get(Histogram::kGetMicros);
+  EXPECT_EQ(data.count, 1000);
+  EXPECT_EQ(data.sum, 500500);
+  EXPECT_EQ(data.min, 1);
+  EXPECT_EQ(data.max, 1000);
+  EXPECT_DOUBLE_EQ(data.average, 500.5);
+  // Buckets are at most 25% wide
+  EXPECT_NEAR(data.p50, 500, 500 * 0.25);
+  EXPECT_NEAR(data.p99, 990, 990 * 0.25);
+  EXPECT_LE(data.p999, 1000);
+  EXPECT_LE(data.p50, data.p99);
+  EXPECT_LE(data.p99, data.p999);
+
+  statistics.Record(Histogram::kGetMicros, UINT64_MAX / 2);
+  EXPECT_EQ(statistics.Get(Histogram::kGetMicros).max, UINT64_MAX / 2);
+  EXPECT_EQ(statistics.Get(Histogram::kSyncMicros).count, 0);
+}
+
+TEST(StatisticsTest, GaugesAndToString) {
+  Statistics statistics;
+  statistics.Set(Gauge::kIndexKeys, 5);
+  statistics.Set(Gauge::kIndexKeys, 3);
+  EXPECT_EQ(statistics.Get(Gauge::kIndexKeys), 3);
+  {
+    StopWatch watch(&statistics, Histogram::kInsertMicros);
+  }
+  EXPECT_EQ(statistics.Get(Histogram::kInsertMicros).count, 1);
+
+  EXPECT_EQ(statistics.SpaceAmplification(), 0);
+  EXPECT_EQ(statistics.WriteAmplification(), 0);
+  statistics.Set(Gauge::kLiveDataBytes, 100);
+  statistics.Set(Gauge::kLogFileBytes, 250);
+  statistics.Set(Gauge::kHintFileBytes, 50);
+  EXPECT_DOUBLE_EQ(statistics.SpaceAmplification(), 3);
+  statistics.Add(Ticker::kUserBytesWritten, 100);
+  statistics.Add(Ticker::kBytesWritten, 120);
+  statistics.Add(Ticker::kHintBytesWritten, 30);
+  EXPECT_DOUBLE_EQ(statistics.WriteAmplification(), 1.5);
+
+  auto s = statistics.ToString();
+  EXPECT_NE(s.find("get.hits: 0\n"), std::string::npos);
+  EXPECT_NE(s.find("insert.micros: count 1"), std::string::npos);
+  EXPECT_NE(s.find("index.keys: 3\n"), std::string::npos);
+  EXPECT_NE(s.find("space.amplification: 3.00\n"), std::string::npos);
+  EXPECT_NE(s.find("write.amplification: 1.50\n"), std::string::npos);
+}
+
+}  // namespace mybitcask
@@ -1,14 +1,152 @@
 #include "mybitcask/internal/store.h"
+#include "mybitcask/internal/perf_context.h"
 #include "store_filename.h"
 
+#include "absl/base/internal/endian.h"
+#include "crc32c/crc32c.h"
+
 #include <algorithm>
+#include <cstring>
 
 namespace mybitcask {
 namespace store {
 
-Position::Position(file_id_t file_id, std::uint32_t offset_in_file)
+Position::Position(file_id_t file_id, std::uint64_t offset_in_file)
     : file_id(file_id), offset_in_file(offset_in_file) {}
 
+const std::string kErrEntryLength = "entry length mismatch";
+
+std::uint64_t BlockContentOffset(std::uint64_t file_offset) {
+  return file_offset / kBlockSize * kBlockContentLen +
+         std::min<std::uint64_t>(file_offset % kBlockSize, kBlockContentLen);
+}
+
+std::uint64_t BlockFileOffset(std::uint64_t content_offset) {
+  return content_offset / kBlockContentLen * kBlockSize +
+         content_offset % kBlockContentLen;
+}
+
+BlockReader::BlockReader(std::unique_ptr<io::SequentialReader>&& file)
+    : file_(std::move(file)),
+      file_offset_(0),
+      chunk_(kScanBlocks * kBlockSize),
+      chunk_offset_(0),
+      chunk_len_(0),
+      intact_(kScanBlocks),
+      pos_(0),
+      corrupt_blocks_(0) {}
+
+absl::StatusOr<std::size_t> BlockReader::Read(
+    absl::Span<std::uint8_t> dst) noexcept {
+  std::size_t read_len = 0;
+  while (read_len < dst.size()) {
+    auto status = load();
+    if (!status.ok()) {
+      return status;
+    }
+    auto in_chunk = static_cast<std::size_t>(pos_ - chunk_offset_);
+    if (in_chunk >= chunk_len_) {
+      // end of file
+      break;
+    }
+    auto block = in_chunk / kBlockSize;
+    auto block_len = std::min<std::size_t>(chunk_len_ - block * kBlockSize,
+                                           kBlockContentLen);
+    if (chunk_len_ - block * kBlockSize >= kBlockSize && !intact_[block]) {
+      if (read_len > 0) {
+        break;
+      }
+      return absl::DataLossError(kErrCorruptBlock);
+    }
+    auto in_block = in_chunk % kBlockSize;
+    if (in_block >= block_len) {
+      // end of the content of the last block
+      break;
+    }
+    auto n = std::min(block_len - in_block, dst.size() - read_len);
+    std::memcpy(dst.data() + read_len, chunk_.data() + in_chunk, n);
+    read_len += n;
+    pos_ = BlockFileOffset(BlockContentOffset(pos_) + n);
+  }
+  return read_len;
+}
+
+absl::Status BlockReader::Skip(std::uint64_t n) noexcept {
+  pos_ = BlockFileOffset(BlockContentOffset(pos_) + n);
+  return absl::OkStatus();
+}
+
+absl::StatusOr<absl::optional<std::uint64_t>> BlockReader::Resync() noexcept {
+  corrupt_blocks_++;
+  while (true) {
+    pos_ = (pos_ / kBlockSize + 1) * kBlockSize;
+    auto status = load();
+    if (!status.ok()) {
+      return status;
+    }
+    auto in_chunk = static_cast<std::size_t>(pos_ - chunk_offset_);
+    if (chunk_len_ - std::min(in_chunk, chunk_len_) < kBlockSize) {
+      // the last block, or none
+      pos_ = chunk_offset_ + chunk_len_;
+      return absl::nullopt;
+    }
+    auto block = in_chunk / kBlockSize;
+    if (!intact_[block]) {
+      corrupt_blocks_++;
+      continue;
+    }
+    auto first_entry = absl::little_endian::Load32(
+        chunk_.data() + in_chunk + kBlockContentLen);
+    if (first_entry == kNoEntry) {
+      // the block only holds the rest of an entry started before
+      continue;
+    }
+    if (first_entry >= kBlockContentLen) {
+      corrupt_blocks_++;
+      continue;
+    }
+    pos_ += first_entry;
+    return BlockContentOffset(pos_);
+  }
+}
+
+absl::Status BlockReader::load() noexcept {
+  if (pos_ < chunk_offset_ + chunk_len_) {
+    return absl::OkStatus();
+  }
+  auto offset = pos_ / kBlockSize * kBlockSize;
+  if (offset < file_offset_) {
+    // past the end of the last block read
+    return absl::OkStatus();
+  }
+  auto status = file_->Skip(offset - file_offset_);
+  if (!status.ok()) {
+    return status;
+  }
+  file_offset_ = chunk_offset_ = offset;
+  chunk_len_ = 0;
+  while (chunk_len_ < chunk_.size()) {
+    auto read_len = file_->Read(
+        absl::MakeSpan(chunk_.data() + chunk_len_, chunk_.size() - chunk_len_));
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    if (*read_len == 0) {
+      break;
+    }
+    chunk_len_ += *read_len;
+    file_offset_ += *read_len;
+  }
+  for (std::size_t block = 0; (block + 1) * kBlockSize <= chunk_len_;
+       block++) {
+    auto data = chunk_.data() + block * kBlockSize;
+    intact_[block] =
+        crc32c::Crc32c(data, kBlockSize - 4) ==
+        absl::little_endian::Load32(data + kBlockSize - 4);
+  }
+  return absl::OkStatus();
+}
+
 absl::StatusOr<std::size_t> Store::ReadAt(
     const Position& pos, absl::Span<std::uint8_t> dst) noexcept {
   auto r = reader(pos.file_id);
@@ -18,60 +156,293 @@ absl::StatusOr<std::size_t> Store::ReadAt(
   if (*r == nullptr) {
     return absl::OutOfRangeError("Invalid file id");
   }
-  return (*r)->ReadAt(pos.offset_in_file, dst);
+  PerfTimer timer(&PerfContext::read_at_nanos);
+  PerfCount(&PerfContext::read_at_count);
+  auto read_len = (*r)->ReadAt(pos.offset_in_file, dst);
+  if (read_len.ok()) {
+    PerfCount(&PerfContext::read_at_bytes, *read_len);
+    RecordTick(statistics_, Ticker::kBytesRead, *read_len);
+  }
+  return read_len;
+}
+
+absl::StatusOr<std::size_t> Store::ReadContentAt(
+    const Position& pos, absl::Span<std::uint8_t> dst) noexcept {
+  auto r = reader(pos.file_id);
+  if (!r.ok()) {
+    return absl::Status(r.status());
+  }
+  if (*r == nullptr) {
+    return absl::OutOfRangeError("Invalid file id");
+  }
+  // One read per block the content spans
+  PerfTimer timer(&PerfContext::read_at_nanos);
+  std::size_t read_len = 0;
+  auto offset = BlockFileOffset(BlockContentOffset(pos.offset_in_file));
+  while (read_len < dst.size()) {
+    auto n = std::min<std::size_t>(dst.size() - read_len,
+                                   kBlockContentLen - offset % kBlockSize);
+    auto piece_len = (*r)->ReadAt(offset, dst.subspan(read_len, n));
+    PerfCount(&PerfContext::read_at_count);
+    if (!piece_len.ok()) {
+      return piece_len.status();
+    }
+    PerfCount(&PerfContext::read_at_bytes, *piece_len);
+    read_len += *piece_len;
+    if (*piece_len < n) {
+      break;
+    }
+    offset = BlockFileOffset(BlockContentOffset(offset) + n);
+  }
+  RecordTick(statistics_, Ticker::kBytesRead, read_len);
+  return read_len;
 }
 
 absl::Status Store::Append(
     absl::Span<const uint8_t> src,
     const std::function<void(Position)>& success_callback) noexcept {
+  return AppendStream(
+             src.size(),
+             [&](const PieceWriter& write) { return write(src); }, nullptr,
+             success_callback)
+      .status();
+}
+
+absl::StatusOr<bool> Store::AppendIf(
+    absl::Span<const std::uint8_t> src,
+    const std::function<bool()>& precondition,
+    const std::function<void(Position)>& success_callback) noexcept {
+  return AppendStream(
+      src.size(), [&](const PieceWriter& write) { return write(src); },
+      &precondition, success_callback);
+}
+
+absl::StatusOr<bool> Store::AppendStream(
+    std::uint64_t len,
+    const std::function<absl::Status(const PieceWriter&)>& fill,
+    const std::function<bool()>* precondition,
+    const std::function<void(Position)>& success_callback) noexcept {
+  PerfTimer lock_timer(&PerfContext::store_lock_wait_nanos);
   absl::WriterMutexLock guard(&latest_file_lock_);
+  lock_timer.Stop();
+  if (precondition != nullptr && !(*precondition)()) {
+    return false;
+  }
+  auto status = append_locked(len, fill, success_callback);
+  if (!status.ok()) {
+    return status;
+  }
+  return true;
+}
+
+absl::Status Store::append_locked(
+    std::uint64_t len,
+    const std::function<absl::Status(const PieceWriter&)>& fill,
+    const std::function<void(Position)>& success_callback) {
   if (nullptr == latest_writer_) {
-    auto writer =
-        io::OpenSequentialFileWriter(path_ / LogFilename(latest_file_id_));
-    if (!writer.ok()) {
-      return absl::Status(writer.status());
+    auto status = open_latest_locked(latest_file_id_.load());
+    if (!status.ok()) {
+      return status;
     }
-    latest_writer_ = std::move(writer).value();
   }
   auto file_size = latest_writer_->Size();
 
-  if (file_size + src.size() > dead_bytes_threshold_) {
+  if (file_size > latest_header_len_ &&
+      file_size + len > dead_bytes_threshold_) {
     // The current file has exceeded the threshold. Create a new data file.
-    auto latest_filename = path_ / LogFilename(++latest_file_id_);
-    auto writer =
-        io::OpenSequentialFileWriter(ghc::filesystem::path(latest_filename));
-    if (!writer.ok()) {
-      return absl::Status(writer.status());
+    // The current file is closed before the new one is published, so a
+    // reader of a file which is not the latest sees all of its entries.
+    PerfTimer timer(&PerfContext::rollover_nanos);
+    PerfCount(&PerfContext::rollover_count);
+    auto latest_file_id = latest_file_id_.load() + 1;
+    latest_writer_.reset();
+    auto status = open_latest_locked(latest_file_id);
+    if (!status.ok()) {
+      return status;
+    }
+    latest_file_id_.store(latest_file_id);
+    RecordTick(statistics_, Ticker::kRollovers);
+  }
+
+  auto offset = latest_writer_->Size();
+  auto block_crc = block_crc_;
+  auto block_first_entry = block_first_entry_;
+  if (block_framed_ && block_first_entry_ == kNoEntry) {
+    block_first_entry_ = static_cast<std::uint32_t>(offset % kBlockSize);
+  }
+  std::uint64_t written = 0;
+  auto status = fill(
+      [&](absl::Span<const std::uint8_t> piece) -> absl::Status {
+        if (written + piece.size() > len) {
+          return absl::InternalError(kErrEntryLength);
+        }
+        PerfTimer timer(&PerfContext::store_write_nanos);
+        PerfCount(&PerfContext::store_write_count);
+        PerfCount(&PerfContext::store_write_bytes, piece.size());
+        auto status = write_locked(piece);
+        if (!status.ok()) {
+          return status;
+        }
+        written += piece.size();
+        return absl::OkStatus();
+      });
+  if (status.ok() && written != len) {
+    status = absl::InternalError(kErrEntryLength);
+  }
+  if (!status.ok()) {
+    auto _ = latest_writer_->Truncate(offset);
+    block_crc_ = block_crc;
+    block_first_entry_ = block_first_entry;
+    return status;
+  }
+  RecordTick(statistics_, Ticker::kBytesWritten,
+             latest_writer_->Size() - offset);
+  success_callback(Position(latest_file_id_.load(), offset));
+  return absl::OkStatus();
+}
+
+absl::Status Store::write_locked(absl::Span<const std::uint8_t> data) {
+  if (!block_framed_) {
+    return latest_writer_->Append(data).status();
+  }
+  while (!data.empty()) {
+    auto in_block = latest_writer_->Size() % kBlockSize;
+    auto piece = data.subspan(
+        0, std::min<std::size_t>(data.size(), kBlockContentLen - in_block));
+    auto appended = latest_writer_->Append(piece);
+    if (!appended.ok()) {
+      return appended.status();
+    }
+    block_crc_ = crc32c::Extend(block_crc_, piece.data(), piece.size());
+    data.remove_prefix(piece.size());
+    if (in_block + piece.size() < kBlockContentLen) {
+      break;
     }
-    latest_writer_ = std::move(writer).value();
-    auto reader = io::OpenRandomAccessFileReader(std::move(latest_filename));
-    if (!reader.ok()) {
-      return absl::Status(reader.status());
+    // The content of the block is complete
+    std::uint8_t trailer[kBlockTrailerLen]{};
+    absl::little_endian::Store32(trailer, block_first_entry_);
+    absl::little_endian::Store32(
+        trailer + 4, crc32c::Extend(block_crc_, trailer, 4));
+    appended = latest_writer_->Append(absl::MakeSpan(trailer));
+    if (!appended.ok()) {
+      return appended.status();
     }
-    latest_reader_ = std::move(reader).value();
+    block_crc_ = 0;
+    block_first_entry_ = kNoEntry;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Store::open_latest_locked(file_id_t file_id) {
+  auto writer = env_->NewSequentialWriter(path_ / LogFilename(file_id));
+  if (!writer.ok()) {
+    return absl::Status(writer.status());
   }
-  auto offset = latest_writer_->Append(src);
-  if (offset.ok()) {
-    success_callback(Position(latest_file_id_, *offset));
+  latest_writer_ = std::move(writer).value();
+  latest_header_len_ = 0;
+  block_crc_ = 0;
+  block_first_entry_ = kNoEntry;
+  if (latest_writer_->Size() == 0 && !file_header_.empty()) {
+    auto status = write_locked(absl::MakeSpan(file_header_));
+    if (!status.ok()) {
+      latest_writer_.reset();
+      return status;
+    }
+    latest_header_len_ = latest_writer_->Size();
   }
-  return offset.status();
+  return absl::OkStatus();
+}
+
+absl::Status Store::SetFileHeader(
+    std::vector<std::uint8_t> file_header,
+    const std::function<void()>& callback) noexcept {
+  absl::WriterMutexLock guard(&latest_file_lock_);
+  file_header_ = std::move(file_header);
+  auto latest_file_id = latest_file_id_.load();
+  if (nullptr == latest_writer_) {
+    auto status = open_latest_locked(latest_file_id);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  auto file_size = latest_writer_->Size();
+  if (latest_header_len_ > 0 && file_size == latest_header_len_) {
+    // Only the old header was written, replace it
+    auto status = latest_writer_->Truncate(0);
+    block_crc_ = 0;
+    block_first_entry_ = kNoEntry;
+    if (status.ok()) {
+      status = write_locked(absl::MakeSpan(file_header_));
+    }
+    if (!status.ok()) {
+      return status;
+    }
+    latest_header_len_ = latest_writer_->Size();
+  } else if (file_size > 0) {
+    latest_writer_.reset();
+    auto status = open_latest_locked(latest_file_id + 1);
+    if (!status.ok()) {
+      return status;
+    }
+    latest_file_id_.store(latest_file_id + 1);
+  }
+  callback();
+  return latest_writer_->Sync();
+}
+
+absl::Status Store::AddFiles(
+    file_id_t count,
+    const std::function<absl::Status(file_id_t)>& add) noexcept {
+  absl::WriterMutexLock guard(&latest_file_lock_);
+  if (latest_writer_ != nullptr) {
+    auto status = latest_writer_->Sync();
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  // The ids are published before the files are in place, but nothing reads
+  // them until `add` points the index at them. If `add` fails, the next
+  // append opens the file after them.
+  auto first_file_id = latest_file_id_.load() + 1;
+  latest_writer_.reset();
+  latest_file_id_.store(first_file_id + count);
+  auto status = add(first_file_id);
+  if (!status.ok()) {
+    return status;
+  }
+  return open_latest_locked(first_file_id + count);
 }
 
 absl::Status Store::Sync() noexcept {
+  PerfTimer lock_timer(&PerfContext::store_lock_wait_nanos);
   absl::ReaderMutexLock latest_file_lock(&latest_file_lock_);
+  lock_timer.Stop();
   if (latest_writer_ != nullptr) {
+    PerfTimer timer(&PerfContext::sync_nanos);
+    PerfCount(&PerfContext::sync_count);
+    StopWatch watch(statistics_, Histogram::kSyncMicros);
+    RecordTick(statistics_, Ticker::kSyncs);
     return latest_writer_->Sync();
   }
   return absl::OkStatus();
 }
 
 Store::Store(const ghc::filesystem::path path, file_id_t latest_file_id,
-             std::uint32_t dead_bytes_threshold)
+             std::uint32_t dead_bytes_threshold,
+             std::vector<std::uint8_t> file_header, bool block_framed,
+             Statistics* statistics, Env* env)
     : latest_file_id_(latest_file_id),
+      latest_writer_(nullptr),
+      latest_header_len_(0),
       latest_file_lock_(),
+      file_header_(std::move(file_header)),
+      block_framed_(block_framed),
+      block_crc_(0),
+      block_first_entry_(kNoEntry),
       path_(path),
       dead_bytes_threshold_(dead_bytes_threshold),
-      latest_writer_(nullptr),
+      statistics_(statistics),
+      env_(env),
       readers_(),
       readers_lock_() {}
 
@@ -80,50 +451,41 @@ Store::~Store() { auto _ = Sync(); }
 const ghc::filesystem::path& Store::Path() { return path_; }
 
 absl::StatusOr<io::RandomAccessReader*> Store::reader(file_id_t file_id) {
-  latest_file_lock_.ReaderLock();
-  if (file_id == latest_file_id_) {
-    latest_file_lock_.ReaderUnlock();
-    absl::WriterMutexLock writerGuard(&latest_file_lock_);
-    if (nullptr == latest_reader_) {
-      auto reader =
-          io::OpenRandomAccessFileReader(path_ / LogFilename(latest_file_id_));
-      if (!reader.ok()) {
-        return absl::Status(reader.status());
-      }
-      latest_reader_ = std::move(reader).value();
-    }
-    return latest_reader_.get();
-  }
-  latest_file_lock_.ReaderUnlock();
   {
-    absl::ReaderMutexLock readerGuard(&latest_file_lock_);
-    readers_lock_.ReaderLock();
+    PerfTimer lock_timer(&PerfContext::reader_lock_wait_nanos);
+    absl::ReaderMutexLock guard(&readers_lock_);
+    lock_timer.Stop();
     auto it = readers_.find(file_id);
-    if (it == readers_.end()) {
-      readers_lock_.ReaderUnlock();
-      if (file_id > latest_file_id_) {
-        return nullptr;
-      }
-      readers_lock_.Lock();
-      it = readers_.find(file_id);
-      if (it == readers_.end()) {
-        // Read only files can be accessed through MmapRandomAccessFileReader
-        // file reader.
-        auto r =
-            io::OpenMmapRandomAccessFileReader(path_ / LogFilename(file_id));
-        if (!r.ok()) {
-          readers_lock_.Unlock();
-          return absl::Status(r.status());
-        }
-        it = readers_.emplace(std::move(file_id), std::move(r).value()).first;
-      }
-      readers_lock_.Unlock();
+    if (it != readers_.end()) {
+      return (*it).second.get();
+    }
+  }
+  auto latest_file_id = latest_file_id_.load();
+  if (file_id > latest_file_id) {
+    return nullptr;
+  }
+  PerfTimer lock_timer(&PerfContext::reader_lock_wait_nanos);
+  absl::MutexLock guard(&readers_lock_);
+  lock_timer.Stop();
+  auto it = readers_.find(file_id);
+  if (it == readers_.end()) {
+    PerfCount(&PerfContext::reader_open_count);
+    absl::StatusOr<std::unique_ptr<io::RandomAccessReader>> r;
+    if (file_id == latest_file_id) {
+      // The latest file keeps growing, so it can not be mapped. Its reader
+      // is kept after the file is closed, since it may be in use.
+      r = env_->NewRandomAccessReader(path_ / LogFilename(file_id));
     } else {
-      readers_lock_.ReaderUnlock();
+      // Read only files can be accessed through MmapRandomAccessFileReader
+      // file reader.
+      r = env_->NewMmapReader(path_ / LogFilename(file_id));
     }
-
-    return (*it).second.get();
+    if (!r.ok()) {
+      return absl::Status(r.status());
+    }
+    it = readers_.emplace(file_id, std::move(r).value()).first;
   }
+  return (*it).second.get();
 }
 
 }  // namespace store
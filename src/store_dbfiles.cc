@@ -1,22 +1,28 @@
 #include "store_dbfiles.h"
 
+#include <algorithm>
+#include <iterator>
+
 namespace mybitcask {
 namespace store {
 
-DBFiles::DBFiles(const ghc::filesystem::path& path)
-    : path_(path), hint_files_() {
-  std::vector<file_id_t> log_files;
-  for (auto const& dir_entry : ghc::filesystem::directory_iterator(path)) {
+DBFiles::DBFiles(const ghc::filesystem::path& path, Env* env)
+    : path_(path), env_(env), log_files_(), hint_files_() {
+  std::vector<file_id_t> hint_files;
+  auto children = env->GetChildren(path);
+  if (!children.ok()) {
+    children = std::vector<std::string>();
+  }
+  for (auto const& filename : *children) {
     file_id_t file_id;
     FileType file_type;
-    auto filename = dir_entry.path().filename().string();
     if (ParseFilename(filename, &file_id, &file_type)) {
       switch (file_type) {
         case FileType::kLogFile:
-          log_files.push_back(file_id);
+          log_files_.push_back(file_id);
           break;
         case FileType::kHintFile:
-          hint_files_.push_back(file_id);
+          hint_files.push_back(file_id);
           break;
         default:
           break;
@@ -24,37 +30,41 @@ DBFiles::DBFiles(const ghc::filesystem::path& path)
     }
   }
 
-  std::sort(log_files.begin(), log_files.end());
-  std::sort(hint_files_.begin(), hint_files_.end());
+  std::sort(log_files_.begin(), log_files_.end());
+  std::sort(hint_files.begin(), hint_files.end());
 
-  active_log_files_ = std::vector<file_id_t>(
-      log_files.begin() + hint_files_.size(), log_files.end());
-  older_log_files_ = std::vector<file_id_t>(
-      log_files.begin(), log_files.begin() + hint_files_.size());
+  // A hint file may be generated for any log file, not only for a prefix of
+  // them (e.g. when hint files are generated in parallel).
+  std::set_intersection(log_files_.begin(), log_files_.end(),
+                        hint_files.begin(), hint_files.end(),
+                        std::back_inserter(hint_files_));
+  older_log_files_ = hint_files_;
+  std::set_difference(log_files_.begin(), log_files_.end(),
+                      hint_files_.begin(), hint_files_.end(),
+                      std::back_inserter(active_log_files_));
 }
 
 file_id_t DBFiles::latest_file_id() const {
-  if (!active_log_files().empty()) {
-    return active_log_files().back();
-  } else if (!older_log_files().empty()) {
-    return older_log_files().back();
+  if (!log_files_.empty()) {
+    return log_files_.back();
   } else {
     return 1;
   }
 }
 
 KeyIter DBFiles::key_iter(const log::Reader* log_reader) const {
-  return KeyIter(log_reader, &path_, &hint_files_, &active_log_files_);
+  return KeyIter(log_reader, &path_, &log_files_, &hint_files_, env_);
 }
 
 KeyIter::KeyIter(const log::Reader* log_reader,
                  const ghc::filesystem::path* path,
-                 const std::vector<file_id_t>* hint_files,
-                 const std::vector<file_id_t>* active_log_files)
+                 const std::vector<file_id_t>* log_files,
+                 const std::vector<file_id_t>* hint_files, Env* env)
     : log_reader_(log_reader),
       path_(path),
+      log_files_(log_files),
       hint_files_(hint_files),
-      active_log_files_(active_log_files) {}
+      env_(env) {}
 
 }  // namespace store
 }  // namespace mybitcask
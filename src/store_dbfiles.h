@@ -12,19 +12,28 @@ class KeyIter;
 
 class DBFiles {
  public:
-  DBFiles(const ghc::filesystem::path& path);
+  // List the files in `path` through `env`. A directory which can not be
+  // listed holds no files.
+  DBFiles(const ghc::filesystem::path& path, Env* env = Env::Default());
 
   const ghc::filesystem::path& path() const { return path_; }
 
+  // All log files
+  absl::Span<const file_id_t> log_files() const {
+    return absl::MakeSpan(log_files_);
+  }
+  // Log files without a hint file
   absl::Span<const file_id_t> active_log_files() const {
     return absl::MakeSpan(active_log_files_);
   }
+  // Log files with a hint file
   absl::Span<const file_id_t> older_log_files() const {
     return absl::MakeSpan(older_log_files_);
   }
 
   file_id_t latest_file_id() const;
 
+  // Hint files whose log file exists
   absl::Span<const file_id_t> hint_files() const {
     return absl::MakeSpan(hint_files_);
   }
@@ -33,58 +42,57 @@ class DBFiles {
 
  private:
   ghc::filesystem::path path_;
+  Env* env_;
+  std::vector<file_id_t> log_files_;
   std::vector<file_id_t> active_log_files_;
   std::vector<file_id_t> older_log_files_;
   std::vector<file_id_t> hint_files_;
 };
 
-struct Void {};
-
 class KeyIter {
  public:
   KeyIter(const log::Reader* log_reader, const ghc::filesystem::path* path,
-          const std::vector<file_id_t>* hint_files,
-          const std::vector<file_id_t>* active_log_files);
+          const std::vector<file_id_t>* log_files,
+          const std::vector<file_id_t>* hint_files, Env* env);
 
+  // Folds the keys of all log files in file id order. The keys of a log file
+  // are read from its hint file if there is one, else from the log file.
   template <typename T, typename Container>
   absl::StatusOr<T> Fold(
       T init,
       const std::function<T(T&&, file_id_t file_id, log::Key<Container>&&)>& f)
       const noexcept {
     auto&& acc = std::move(init);
-    for (auto& hint_file_id : *hint_files_) {
-      auto status =
-          hint::KeyIter(path_, hint_file_id)
-              .Fold<Void, Container>(
-                  Void(), [&](Void&&, log::Key<Container>&& key) {
-                    acc = f(std::move(acc), hint_file_id, std::move(key));
-                    return Void();
-                  });
-      if (!status.ok()) {
-        return status.status();
+    auto hint_it = hint_files_->begin();
+    for (auto& file_id : *log_files_) {
+      while (hint_it != hint_files_->end() && *hint_it < file_id) {
+        ++hint_it;
+      }
+      auto fold_fn = [&](Void&&, log::Key<Container>&& key) {
+        acc = f(std::move(acc), file_id, std::move(key));
+        return Void();
+      };
+      absl::StatusOr<Void> status;
+      if (hint_it != hint_files_->end() && *hint_it == file_id) {
+        status = hint::KeyIter(path_, file_id, env_)
+                     .Fold<Void, Container>(Void(), fold_fn);
+      } else {
+        status = log_reader_->key_iter(file_id).Fold<Void, Container>(
+            Void(), fold_fn);
       }
-    }
-
-    for (auto& log_file_id : *active_log_files_) {
-      auto status =
-          log_reader_->key_iter(log_file_id)
-              .Fold<Void, Container>(
-                  Void(), [&](Void&&, log::Key<Container>&& key) {
-                    acc = f(std::move(acc), log_file_id, std::move(key));
-                    return Void();
-                  });
       if (!status.ok()) {
         return status.status();
       }
     }
-    return acc;
+    return std::move(acc);
   }
 
  private:
   const log::Reader* log_reader_;
   const ghc::filesystem::path* path_;
+  const std::vector<file_id_t>* log_files_;
   const std::vector<file_id_t>* hint_files_;
-  const std::vector<file_id_t>* active_log_files_;
+  Env* env_;
 };
 
 }  // namespace store
@@ -1,12 +1,17 @@
 #include "store_filename.h"
 
+#include <atomic>
 #include <cassert>
 
 namespace mybitcask {
 namespace store {
 const char* const LOG_FILE_SUFFIX = "log";
 const char* const HINT_FILE_SUFFIX = "hint";
+const char* const TEMP_FILE_SUFFIX = ".tmp";
 const char* const FILENAME_FORMAT = "%u.%s";
+// Suffixes longer than the buffer they are scanned into, e.g. those of
+// temporary files, are cut off, and then match no known suffix
+const char* const FILENAME_SCAN_FORMAT = "%u.%9s";
 
 static std::string MakeFilename(std::uint32_t file_id, const char* suffix) {
   char buf[100];
@@ -25,11 +30,16 @@ std::string HintFilename(std::uint32_t file_id) {
   return MakeFilename(file_id, HINT_FILE_SUFFIX);
 }
 
+std::string TempFilename(const std::string& filename) {
+  static std::atomic<std::uint64_t> next_temp_id(0);
+  return filename + "." + std::to_string(next_temp_id++) + TEMP_FILE_SUFFIX;
+}
+
 bool ParseFilename(absl::string_view filename, std::uint32_t* file_id,
                    FileType* type) {
   char suffix[10]{};
   suffix[9] = '\0';
-  if (std::sscanf(filename.data(), FILENAME_FORMAT, file_id, suffix) < 2) {
+  if (std::sscanf(filename.data(), FILENAME_SCAN_FORMAT, file_id, suffix) < 2) {
     return false;
   }
 
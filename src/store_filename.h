@@ -16,6 +16,11 @@ std::string LogFilename(std::uint32_t file_id);
 // Return the name of the hint file with the specified file_id
 std::string HintFilename(std::uint32_t file_id);
 
+// Return a unique name for a temporary file which is renamed to `filename`
+// once it is completely written. Temporary files are never parsed as
+// mybitcask files.
+std::string TempFilename(const std::string& filename);
+
 // If filename is a mybitcask file, store the type of the file in *type.
 // The file_id encoded in the filename is stored in *file_id.  If the
 // filename was successfully parsed, returns true.  Else return false.
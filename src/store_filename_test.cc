@@ -44,7 +44,8 @@ TEST(FilenameTest, Parse) {
   }
   std::vector<std::string> errors = {"",     "foo",     "foo-dx-100.log",
                                      ".log", ".hint",   "100",
-                                     "100.", "100.abc", "42949672951.hint"};
+                                     "100.", "100.abc", "42949672951.hint",
+                                     TempFilename(HintFilename(100))};
   for (const auto& filename : errors) {
     EXPECT_FALSE(ParseFilename(filename, &file_id, &type));
   }
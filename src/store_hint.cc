@@ -1,13 +1,17 @@
 #include "store_hint.h"
 #include "absl/base/internal/endian.h"
+#include "bloom.h"
+#include "coding.h"
 #include "store_filename.h"
 
+#include <algorithm>
+
 namespace mybitcask {
 namespace store {
 
 namespace hint {
 
-// If the value of the `value_len` field in the `Entry` structure is
+// If the value of the `value_len` field of a kLegacyVersion entry is
 // kTombstone(0xFFFF) then this record is a tombstone record
 const std::uint16_t kTombstone = 0xFFFF;
 
@@ -35,62 +39,398 @@ std::uint16_t RawHeader::raw_value_len() const {
   return absl::little_endian::Load16(&data_[kKeyLenLen]);
 }
 
+void EncodeEntry(std::vector<std::uint8_t>* dst,
+                 absl::Span<const std::uint8_t> key,
+                 const absl::optional<log::ValuePos>& value_pos) {
+  using log::log_internal::kCompressionMask;
+  using log::log_internal::kCompressionShift;
+  bool expires = value_pos.has_value() && value_pos->expire_at != 0;
+  dst->push_back(value_pos.has_value()
+                     ? static_cast<std::uint8_t>(
+                           (value_pos->compression << kCompressionShift &
+                            kCompressionMask) |
+                           (expires ? kExpireFlag : 0))
+                     : kTombstoneFlag);
+  coding::PutVarint64(dst, key.size());
+  coding::PutVarint64(dst, value_pos.has_value() ? value_pos->value_len : 0);
+  coding::PutVarint64(dst, value_pos.has_value() ? value_pos->value_pos : 0);
+  if (expires) {
+    coding::PutVarint64(dst, value_pos->expire_at);
+  }
+  dst->insert(dst->end(), key.begin(), key.end());
+}
+
+std::size_t EntryLen(std::size_t key_len,
+                     const absl::optional<log::ValuePos>& value_pos) {
+  std::size_t header_len = 1 + coding::VarintLength(key_len);
+  if (value_pos.has_value()) {
+    header_len += coding::VarintLength(value_pos->value_len) +
+                  coding::VarintLength(value_pos->value_pos);
+    if (value_pos->expire_at != 0) {
+      header_len += coding::VarintLength(value_pos->expire_at);
+    }
+  } else {
+    header_len += 2;
+  }
+  return header_len + key_len;
+}
+
+absl::Status PeekEntry(io::Scanner* scanner, std::uint32_t version,
+                       EntryHeader* header) noexcept {
+  if (version == kLegacyVersion) {
+    auto read_len = scanner->Peek(kHeaderLen);
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    if (*read_len < kHeaderLen) {
+      return absl::InternalError(kErrRead);
+    }
+    std::uint8_t header_data[kHeaderLen]{};
+    std::memcpy(header_data, scanner->data(), kHeaderLen);
+    RawHeader raw_header(header_data);
+    header->tombstone = raw_header.is_tombstone();
+    header->compression = compression::kNoCompression;
+    header->key_len = raw_header.key_len();
+    header->value_len = raw_header.value_len();
+    header->value_pos = raw_header.value_pos();
+    header->expire_at = 0;
+    header->header_len = kHeaderLen;
+  } else {
+    auto read_len = scanner->Peek(kMaxHeaderLen);
+    if (!read_len.ok()) {
+      return read_len.status();
+    }
+    if (*read_len == 0) {
+      return absl::InternalError(kErrRead);
+    }
+    auto p = scanner->data();
+    auto limit = p + std::min<std::size_t>(*read_len, kMaxHeaderLen);
+    header->tombstone = (*p & kTombstoneFlag) != 0;
+    header->compression = (*(p++) & log::log_internal::kCompressionMask) >>
+                          log::log_internal::kCompressionShift;
+    p = coding::DecodeVarint64(p, limit, &header->key_len);
+    if (p != nullptr) {
+      p = coding::DecodeVarint64(p, limit, &header->value_len);
+    }
+    if (p != nullptr) {
+      p = coding::DecodeVarint64(p, limit, &header->value_pos);
+    }
+    header->expire_at = 0;
+    if (p != nullptr && (scanner->data()[0] & kExpireFlag) != 0) {
+      p = coding::DecodeVarint64(p, limit, &header->expire_at);
+    }
+    if (p == nullptr || header->key_len > log::kMaxKeyLen) {
+      return absl::InternalError(kErrRead);
+    }
+    header->header_len = static_cast<std::size_t>(p - scanner->data());
+  }
+  std::size_t entry_len = header->header_len + header->key_len;
+  auto read_len = scanner->Peek(entry_len);
+  if (!read_len.ok()) {
+    return read_len.status();
+  }
+  if (*read_len < entry_len) {
+    return absl::InternalError(kErrRead);
+  }
+  return absl::OkStatus();
+}
+
+std::uint32_t KeyHash(absl::Span<const std::uint8_t> key) {
+  return bloom::Hash(key);
+}
+
+absl::StatusOr<Footer> ReadFooter(const ghc::filesystem::path& hint_file_path,
+                                  Env* env) noexcept {
+  if (!env->FileExists(hint_file_path)) {
+    return absl::NotFoundError(kErrRead);
+  }
+  auto file_size = env->GetFileSize(hint_file_path);
+  if (!file_size.ok()) {
+    return file_size.status();
+  }
+  Footer footer{kLegacyVersion, *file_size, absl::nullopt};
+  if (*file_size < kFooterTrailerLen) {
+    return footer;
+  }
+  auto reader = env->NewRandomAccessReader(hint_file_path);
+  if (!reader.ok()) {
+    return absl::InternalError(kErrRead);
+  }
+  std::uint8_t trailer[kFooterTrailerLen]{};
+  auto read_len = (*reader)->ReadAt(*file_size - kFooterTrailerLen,
+                                    absl::MakeSpan(trailer));
+  if (!read_len.ok() || *read_len != kFooterTrailerLen) {
+    return absl::InternalError(kErrRead);
+  }
+  auto magic = absl::little_endian::Load64(&trailer[kFilterLenLen]);
+  if (magic == kFooterMagic) {
+    footer.version = kFormatVersion;
+  } else if (magic != kLegacyFooterMagic) {
+    return footer;
+  }
+  std::uint32_t filter_len = absl::little_endian::Load32(trailer);
+  if (filter_len > *file_size - kFooterTrailerLen) {
+    return absl::InternalError(kErrRead);
+  }
+  footer.entries_len = *file_size - kFooterTrailerLen - filter_len;
+  std::vector<std::uint8_t> filter(filter_len);
+  read_len = (*reader)->ReadAt(footer.entries_len, absl::MakeSpan(filter));
+  if (!read_len.ok() || *read_len != filter_len) {
+    return absl::InternalError(kErrRead);
+  }
+  footer.filter = std::move(filter);
+  return footer;
+}
+
+FileWriter::FileWriter(const ghc::filesystem::path& path, file_id_t file_id,
+                       Env* env)
+    : FileWriter(path / HintFilename(file_id), env) {}
+
+FileWriter::FileWriter(const ghc::filesystem::path& hint_file_path, Env* env)
+    : env_(env),
+      hint_file_path_(hint_file_path),
+      tmp_file_path_(hint_file_path.parent_path() /
+                     TempFilename(hint_file_path.filename().string())),
+      writer_(nullptr),
+      buf_(),
+      key_hashes_(),
+      finished_(false) {
+  buf_.reserve(kWriteBufferSize);
+}
+
+FileWriter::~FileWriter() {
+  if (!finished_) {
+    writer_.reset();
+    auto _ = env_->RemoveFile(tmp_file_path_);
+  }
+}
+
+absl::Status FileWriter::Add(
+    absl::Span<const std::uint8_t> key,
+    const absl::optional<log::ValuePos>& value_pos) noexcept {
+  EncodeEntry(&buf_, key, value_pos);
+  key_hashes_.push_back(KeyHash(key));
+  if (buf_.size() >= kWriteBufferSize) {
+    return flush_buffer();
+  }
+  return absl::OkStatus();
+}
+
+absl::Status FileWriter::AddEncoded(
+    absl::Span<const std::uint8_t> entries,
+    absl::Span<const std::uint32_t> key_hashes) noexcept {
+  key_hashes_.insert(key_hashes_.end(), key_hashes.begin(), key_hashes.end());
+  auto status = flush_buffer();
+  if (!status.ok()) {
+    return status;
+  }
+  if (entries.empty()) {
+    return absl::OkStatus();
+  }
+  // Already encoded entries bypass the buffer
+  auto offset = writer_->Append(entries);
+  if (!offset.ok()) {
+    return absl::InternalError(kErrWrite);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status FileWriter::Finish() noexcept {
+  // Duplicate keys only need to be added to the filter once
+  std::sort(key_hashes_.begin(), key_hashes_.end());
+  key_hashes_.erase(std::unique(key_hashes_.begin(), key_hashes_.end()),
+                    key_hashes_.end());
+  auto filter_begin = buf_.size();
+  bloom::CreateFilter(absl::MakeSpan(key_hashes_), kBloomBitsPerKey, &buf_);
+  auto filter_len = static_cast<std::uint32_t>(buf_.size() - filter_begin);
+  std::uint8_t trailer[kFooterTrailerLen]{};
+  absl::little_endian::Store32(trailer, filter_len);
+  absl::little_endian::Store64(&trailer[kFilterLenLen], kFooterMagic);
+  buf_.insert(buf_.end(), trailer, trailer + kFooterTrailerLen);
+
+  auto status = flush_buffer();
+  if (!status.ok()) {
+    return status;
+  }
+  status = writer_->Sync();
+  if (!status.ok()) {
+    return status;
+  }
+  writer_.reset();
+  status = env_->RenameFile(tmp_file_path_, hint_file_path_);
+  if (!status.ok()) {
+    return status;
+  }
+  finished_ = true;
+  return absl::OkStatus();
+}
+
+absl::Status FileWriter::flush_buffer() noexcept {
+  if (writer_ == nullptr) {
+    // Truncate a temporary file left over by a crash
+    auto _ = env_->RemoveFile(tmp_file_path_);
+    auto writer = env_->NewSequentialWriter(tmp_file_path_);
+    if (!writer.ok()) {
+      return absl::InternalError(kErrWrite);
+    }
+    writer_ = std::move(writer).value();
+  }
+  if (buf_.empty()) {
+    return absl::OkStatus();
+  }
+  auto offset = writer_->Append(absl::MakeSpan(buf_));
+  if (!offset.ok()) {
+    return absl::InternalError(kErrWrite);
+  }
+  buf_.clear();
+  return absl::OkStatus();
+}
+
+Builder::Builder(const ghc::filesystem::path& path, Statistics* statistics,
+                 Env* env)
+    : path_(path),
+      statistics_(statistics),
+      env_(env),
+      on_file_closed_(nullptr),
+      file_id_(0),
+      entries_(),
+      key_hashes_(),
+      closed_(),
+      closed_lock_(),
+      flush_lock_() {}
+
+void Builder::Add(file_id_t file_id, absl::Span<const std::uint8_t> key,
+                  const absl::optional<log::ValuePos>& value_pos) {
+  if (file_id != file_id_) {
+    if (!entries_.empty()) {
+      {
+        absl::MutexLock guard(&closed_lock_);
+        closed_.push_back(
+            ClosedFile{file_id_, std::move(entries_), std::move(key_hashes_)});
+      }
+      if (on_file_closed_) {
+        on_file_closed_();
+      }
+    }
+    file_id_ = file_id;
+    entries_ = std::vector<std::uint8_t>();
+    key_hashes_ = std::vector<std::uint32_t>();
+  }
+  EncodeEntry(&entries_, key, value_pos);
+  key_hashes_.push_back(KeyHash(key));
+}
+
+void Builder::SetFileClosedCallback(std::function<void()> on_file_closed) {
+  on_file_closed_ = std::move(on_file_closed);
+}
+
+absl::Status Builder::Flush() noexcept {
+  absl::MutexLock flush_guard(&flush_lock_);
+  std::vector<ClosedFile> closed;
+  {
+    absl::MutexLock guard(&closed_lock_);
+    if (closed_.empty()) {
+      return absl::OkStatus();
+    }
+    closed.swap(closed_);
+  }
+  for (auto& file : closed) {
+    StopWatch watch(statistics_, Histogram::kHintGenerationMicros);
+    FileWriter writer(path_, file.file_id, env_);
+    auto status = writer.AddEncoded(absl::MakeSpan(file.entries),
+                                    absl::MakeSpan(file.key_hashes));
+    if (!status.ok()) {
+      return status;
+    }
+    status = writer.Finish();
+    if (!status.ok()) {
+      return status;
+    }
+    RecordTick(statistics_, Ticker::kHintFilesWritten);
+    if (statistics_ != nullptr) {
+      auto size = env_->GetFileSize(path_ / HintFilename(file.file_id));
+      RecordTick(statistics_, Ticker::kHintBytesWritten,
+                 size.ok() ? *size : 0);
+    }
+  }
+  return absl::OkStatus();
+}
+
 Generator::Generator(log::Reader* log_reader, const ghc::filesystem::path& path)
     : log_reader_(log_reader), path_(path) {}
 
 absl::Status Generator::Generate(std::uint32_t file_id) noexcept {
   auto log_file_path = path_ / LogFilename(file_id);
 
-  if (!ghc::filesystem::exists(log_file_path)) {
+  if (!log_reader_->env()->FileExists(log_file_path)) {
     return absl::NotFoundError(kErrLogFileNotExist);
   }
 
-  std::ofstream hint_file(path_ / HintFilename(file_id),
-                          std::ios::binary | std::ios::trunc | std::ios::out);
-  if (!hint_file) {
-    return absl::InternalError(kErrRead);
+  FileWriter writer(path_, file_id, log_reader_->env());
+  absl::Status write_status;
+  auto scanned =
+      log_reader_->key_iter(file_id).Fold<store::Void, std::string>(
+          store::Void(), [&](store::Void&&, log::Key<std::string>&& key) {
+            if (write_status.ok()) {
+              write_status = writer.Add(
+                  {reinterpret_cast<const std::uint8_t*>(key.key_data.data()),
+                   key.key_data.size()},
+                  key.value_pos);
+            }
+            return store::Void();
+          });
+  if (!scanned.ok()) {
+    return scanned.status();
   }
-
-  using key_t = log::Key<std::vector<std::uint8_t>>;
-  auto keys =
-      log_reader_->key_iter(file_id)
-          .Fold<std::vector<key_t>, std::vector<std::uint8_t>>(
-              std::vector<key_t>(), [&](std::vector<key_t>&& acc, key_t&& key) {
-                acc.push_back(std::move(key));
-                return acc;
-              });
-  if (!keys.ok()) {
-    return keys.status();
+  if (!write_status.ok()) {
+    return write_status;
   }
-  for (auto& key : *keys) {
-    std::uint8_t header_data[kHeaderLen]{};
-    RawHeader header(header_data);
-    header.set_key_len(static_cast<std::uint8_t>(key.key_data.size()));
-    if (key.value_pos.has_value()) {
-      header.set_value_len(key.value_pos->value_len);
-      header.set_value_pos(key.value_pos->value_pos);
-    } else {
-      header.set_tombstone();
-    }
+  return writer.Finish();
+}
 
-    // write header
-    hint_file.write(reinterpret_cast<char*>(header_data), kHeaderLen);
+KeyIter::KeyIter(const ghc::filesystem::path* path, file_id_t hint_file_id,
+                 Env* env)
+    : KeyIter(*path / HintFilename(hint_file_id), env) {}
 
-    if (hint_file.fail()) {
-      return absl::InternalError(kErrWrite);
+KeyIter::KeyIter(const ghc::filesystem::path& hint_file_path, Env* env)
+    : hint_file_path_(hint_file_path), env_(env) {}
+
+absl::StatusOr<Presence> Presence::Load(
+    const ghc::filesystem::path& path, absl::Span<const file_id_t> log_files,
+    absl::Span<const file_id_t> hint_files, Env* env) noexcept {
+  Presence presence;
+  auto hint_it = hint_files.begin();
+  for (auto file_id : log_files) {
+    while (hint_it != hint_files.end() && *hint_it < file_id) {
+      ++hint_it;
     }
-    hint_file.write(reinterpret_cast<char*>(key.key_data.data()),
-                    key.key_data.size());
-    if (hint_file.fail()) {
-      return absl::InternalError(kErrWrite);
+    File file{file_id, absl::nullopt};
+    if (hint_it != hint_files.end() && *hint_it == file_id) {
+      auto footer = ReadFooter(path / HintFilename(file_id), env);
+      if (!footer.ok()) {
+        return footer.status();
+      }
+      file.filter = std::move(footer->filter);
     }
+    presence.files_.push_back(std::move(file));
   }
-  hint_file.flush();
-  return absl::OkStatus();
+  return presence;
 }
 
-KeyIter::KeyIter(const ghc::filesystem::path* path, file_id_t hint_file_id)
-    : path_(path), hint_file_id_(hint_file_id) {}
+bool Presence::MayContainBefore(file_id_t file_id,
+                                absl::Span<const std::uint8_t> key) const {
+  auto key_hash = KeyHash(key);
+  for (auto& file : files_) {
+    if (file.file_id >= file_id) {
+      break;
+    }
+    if (!file.filter.has_value() ||
+        bloom::KeyMayMatch(key_hash, absl::MakeSpan(*file.filter))) {
+      return true;
+    }
+  }
+  return false;
+}
 
 }  // namespace hint
 }  // namespace store
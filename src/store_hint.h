@@ -1,33 +1,85 @@
 #ifndef MYBITCASK_SRC_STORE_HINT_H_
 #define MYBITCASK_SRC_STORE_HINT_H_
 
+#include "mybitcask/internal/env.h"
+#include "mybitcask/internal/io.h"
 #include "mybitcask/internal/log.h"
+#include "mybitcask/internal/statistics.h"
 #include "mybitcask/internal/store.h"
 #include "mybitcask/mybitcask.h"
+#include "rate_limiter.h"
 #include "store_filename.h"
 
 #include <cstdint>
-#include <fstream>
+#include <cstring>
 #include <functional>
+#include <memory>
 #include <vector>
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "ghc/filesystem.hpp"
 
 namespace mybitcask {
 namespace store {
+
+// Empty accumulator for folds which are only run for their side effects
+struct Void {};
+
 namespace hint {
 
 const std::string kErrRead = "failed to read hint entry";
 const std::string kErrWrite = "failed to write hint entry";
 const std::string kErrLogFileNotExist = "log file not exist";
 
+// Buffer size of FileWriter
+const std::size_t kWriteBufferSize = 64 * 1024;
+
+// Format versions of hint files. Hint files without a footer, or whose
+// footer has kLegacyFooterMagic, are kLegacyVersion.
+const std::uint32_t kLegacyVersion = 1;
+const std::uint32_t kFormatVersion = 2;
+
+// Format of a hint entry of kFormatVersion:
+// +-------+---------+-----------+-----------+-------------+-- - - --+
+// | flags | key_len | value_len | value_pos | [expire_at] |   key   |
+// +-------+---------+-----------+-----------+-------------+-- - - --+
+//  (8bits) (varint)  (varint)    (varint)    (varint)
+//
+// If bit kTombstoneFlag of flags is set the entry is a tombstone. Bits 1-3 of
+// flags hold the compression type of the value, as in log entries. expire_at
+// is only present if bit kExpireFlag of flags is set.
+const std::uint8_t kTombstoneFlag = 0x01;
+const std::uint8_t kExpireFlag = 0x10;
+// flags and four varint64s
+const std::size_t kMaxHeaderLen = 1 + 4 * 10;
+
+// Header of a kLegacyVersion hint entry
 const std::uint32_t kKeyLenLen = 1;
 const std::uint32_t kValLenLen = 2;
 const std::uint32_t kValPosLen = 4;
 const std::uint32_t kHeaderLen = kKeyLenLen + kValLenLen + kValPosLen;
 
+// A hint file ends with a footer holding a bloom filter of the keys of its
+// log file:
+// +---------+--------------+-------------------+-------------+
+// | entries | bloom filter | filter_len(32bit) | magic(64bit) |
+// +---------+--------------+-------------------+-------------+
+// Hint files without a footer are still readable, their log file may
+// contain any key.
+const std::uint64_t kFooterMagic = 0x32746e686b62796dULL;  // "mybkhnt2"
+const std::uint64_t kLegacyFooterMagic =
+    0x746e69686b62796dULL;  // "mybkhint"
+const std::uint32_t kFilterLenLen = 4;
+const std::uint32_t kMagicLen = 8;
+const std::uint32_t kFooterTrailerLen = kFilterLenLen + kMagicLen;
+
+// Bits per key of the bloom filter, about 1% false positive rate
+const std::size_t kBloomBitsPerKey = 10;
+
+// RawHeader represents the header of a kLegacyVersion hint entry
 class RawHeader final {
  public:
   RawHeader(std::uint8_t* const data);
@@ -47,10 +99,163 @@ class RawHeader final {
   std::uint8_t* const data_;
 };
 
+// EntryHeader is the decoded header of a hint entry
+struct EntryHeader {
+  bool tombstone;
+  std::uint8_t compression;
+  std::uint64_t key_len;
+  std::uint64_t value_len;
+  std::uint64_t value_pos;
+  // Expiry time of the entry, 0 if it never expires
+  std::uint64_t expire_at;
+  // Encoded length of the header
+  std::size_t header_len;
+};
+
+// Decode the header of the entry at the beginning of the bytes buffered by
+// `scanner`, which reads a hint file of format `version`, and buffer the key
+// after it.
+absl::Status PeekEntry(io::Scanner* scanner, std::uint32_t version,
+                       EntryHeader* header) noexcept;
+
+// Return the encoded length of a hint entry.
+std::size_t EntryLen(std::size_t key_len,
+                     const absl::optional<log::ValuePos>& value_pos);
+
+// Encode a hint entry for `key` and append it to `dst`. `value_pos` if empty
+// means tombstone entry.
+void EncodeEntry(std::vector<std::uint8_t>* dst,
+                 absl::Span<const std::uint8_t> key,
+                 const absl::optional<log::ValuePos>& value_pos);
+
+struct Footer {
+  // Format version of the entries
+  std::uint32_t version;
+  // Length of the entries, at the beginning of the hint file
+  std::uint64_t entries_len;
+  // Empty if the hint file has no footer
+  absl::optional<std::vector<std::uint8_t>> filter;
+};
+
+// Read the footer of hint file `hint_file_path`.
+absl::StatusOr<Footer> ReadFooter(const ghc::filesystem::path& hint_file_path,
+                                  Env* env = Env::Default()) noexcept;
+
+// Return the hash of `key` added to the bloom filter of the hint file
+std::uint32_t KeyHash(absl::Span<const std::uint8_t> key);
+
+// FileWriter writes the hint file of a log file through a buffer of
+// kWriteBufferSize bytes. Entries are written to a temporary file which is
+// renamed to the hint file by Finish, so readers never observe a partially
+// written hint file.
+class FileWriter {
+ public:
+  FileWriter(const ghc::filesystem::path& path, file_id_t file_id,
+             Env* env = Env::Default());
+  // Same, for the hint file at `hint_file_path`, of a log file outside of
+  // any database
+  FileWriter(const ghc::filesystem::path& hint_file_path, Env* env);
+
+  FileWriter(const FileWriter&) = delete;
+  FileWriter& operator=(const FileWriter&) = delete;
+
+  // Removes the temporary file if Finish was not called successfully.
+  ~FileWriter();
+
+  // Add a hint entry. `value_pos` if empty means tombstone entry.
+  absl::Status Add(absl::Span<const std::uint8_t> key,
+                   const absl::optional<log::ValuePos>& value_pos) noexcept;
+
+  // Add entries already encoded by EncodeEntry, `key_hashes` are the
+  // KeyHash of their keys.
+  absl::Status AddEncoded(absl::Span<const std::uint8_t> entries,
+                          absl::Span<const std::uint32_t> key_hashes) noexcept;
+
+  // Write out the buffered entries and the footer, and atomically replace the
+  // hint file.
+  absl::Status Finish() noexcept;
+
+ private:
+  absl::Status flush_buffer() noexcept;
+
+  Env* env_;
+  ghc::filesystem::path hint_file_path_;
+  ghc::filesystem::path tmp_file_path_;
+  std::unique_ptr<io::SequentialWriter> writer_;
+  std::vector<std::uint8_t> buf_;
+  // Hashes of the keys added, the bloom filter is built from them by Finish
+  std::vector<std::uint32_t> key_hashes_;
+  bool finished_;
+};
+
+// Builder builds the hint file of the log file being written from the
+// entries appended to it, so that log file never has to be scanned again.
+// The hint file is written by Flush once the log file is closed, and counted
+// in `statistics` unless it is nullptr.
+class Builder {
+ public:
+  explicit Builder(const ghc::filesystem::path& path,
+                   Statistics* statistics = nullptr,
+                   Env* env = Env::Default());
+
+  Builder(const Builder&) = delete;
+  Builder& operator=(const Builder&) = delete;
+
+  // Record an entry appended to log file `file_id`. Entries must be added in
+  // the order they are appended to the log. Adding an entry of a newer log
+  // file closes the log file being built; its hint file is written by the
+  // next Flush.
+  //
+  // REQUIRES: External synchronization, calls must be serialized with
+  // appends to the log (e.g. made from the store append callback).
+  void Add(file_id_t file_id, absl::Span<const std::uint8_t> key,
+           const absl::optional<log::ValuePos>& value_pos);
+
+  // Set a function called from Add whenever a log file is closed, e.g. to
+  // schedule a Flush.
+  //
+  // REQUIRES: No concurrent call of Add
+  void SetFileClosedCallback(std::function<void()> on_file_closed);
+
+  // Write the hint files of all closed log files.
+  //
+  // Safe for concurrent use by multiple threads.
+  absl::Status Flush() noexcept;
+
+ private:
+  struct ClosedFile {
+    file_id_t file_id;
+    std::vector<std::uint8_t> entries;
+    std::vector<std::uint32_t> key_hashes;
+  };
+
+  ghc::filesystem::path path_;
+  Statistics* statistics_;
+  Env* env_;
+  std::function<void()> on_file_closed_;
+
+  // Log file being built and its hint entries
+  file_id_t file_id_;
+  std::vector<std::uint8_t> entries_;
+  std::vector<std::uint32_t> key_hashes_;
+
+  // Closed log files whose hint files are not written yet
+  std::vector<ClosedFile> closed_;
+  absl::Mutex closed_lock_;
+
+  // Keeps hint files written in log file order
+  absl::Mutex flush_lock_;
+};
+
 class Generator {
  public:
   Generator(log::Reader* log_reader, const ghc::filesystem::path& path);
 
+  // Generate the hint file of log file `file_id` in a single pass over the
+  // log file. Memory usage does not depend on the size of the log file.
+  //
+  // Safe for concurrent use by multiple threads, as long as each thread
+  // generates a different hint file.
   absl::Status Generate(std::uint32_t file_id) noexcept;
 
  private:
@@ -60,38 +265,43 @@ class Generator {
 
 class KeyIter {
  public:
-  KeyIter(const ghc::filesystem::path* path, file_id_t hint_file_id);
+  KeyIter(const ghc::filesystem::path* path, file_id_t hint_file_id,
+          Env* env = Env::Default());
+  // Same, for the hint file at `hint_file_path`
+  KeyIter(const ghc::filesystem::path& hint_file_path, Env* env);
 
   template <typename T, typename Container>
   absl::StatusOr<T> Fold(
       T init, const std::function<T(T&&, log::Key<Container>&&)>& f) noexcept {
-    std::ifstream hint_file(*path_ / HintFilename(hint_file_id_),
-                            std::ios::binary | std::ios::in);
-    if (!hint_file) {
+    auto footer = ReadFooter(hint_file_path_, env_);
+    if (!footer.ok()) {
+      return footer.status();
+    }
+    auto reader = env_->NewSequentialReader(hint_file_path_);
+    if (!reader.ok()) {
       return absl::InternalError(kErrRead);
     }
+    io::Scanner scanner(std::move(reader).value());
     auto&& acc = std::move(init);
-    while (true) {
-      std::uint8_t header_data[kHeaderLen]{};
-      hint_file.read(reinterpret_cast<char*>(header_data), kHeaderLen);
-      if (hint_file.eof()) {
-        return acc;
-      }
-      if (hint_file.fail()) {
-        return absl::InternalError(kErrRead);
+    EntryHeader header{};
+    while (scanner.offset() < footer->entries_len) {
+      auto status = PeekEntry(&scanner, footer->version, &header);
+      if (!status.ok()) {
+        return status;
       }
-      RawHeader header(header_data);
       log::Key<Container> key{};
-      key.value_pos = header.is_tombstone()
+      key.value_pos = header.tombstone
                           ? absl::nullopt
                           : absl::make_optional(log::ValuePos{
-                                header.value_len(), header.value_pos()});
-      log::key_container_internal::Resize(key.key_data, header.key_len());
-      hint_file.read(
-          log::key_container_internal::GetData<Container, char>(key.key_data),
-          header.key_len());
-      if (hint_file.fail()) {
-        return absl::InternalError(kErrRead);
+                                header.value_len, header.value_pos,
+                                header.compression, header.expire_at});
+      log::key_container_internal::Resize(key.key_data, header.key_len);
+      std::memcpy(log::key_container_internal::GetData<Container, std::uint8_t>(
+                      key.key_data),
+                  scanner.data() + header.header_len, header.key_len);
+      status = scanner.Skip(header.header_len + header.key_len);
+      if (!status.ok()) {
+        return status;
       }
       acc = f(std::move(acc), std::move(key));
     }
@@ -99,72 +309,153 @@ class KeyIter {
   }
 
  private:
-  const ghc::filesystem::path* path_;
-  file_id_t hint_file_id_;
+  ghc::filesystem::path hint_file_path_;
+  Env* env_;
+};
+
+// Presence tells which keys the log files of a database may contain, from
+// the bloom filters in their hint files.
+class Presence {
+ public:
+  Presence() = default;
+
+  // Load the filters of `log_files` from the hint files in `path`. Log files
+  // without a hint file, or whose hint file has no footer, may contain any
+  // key.
+  static absl::StatusOr<Presence> Load(
+      const ghc::filesystem::path& path, absl::Span<const file_id_t> log_files,
+      absl::Span<const file_id_t> hint_files,
+      Env* env = Env::Default()) noexcept;
+
+  // Return false if no log file older than `file_id` contains `key`.
+  //
+  // Safe for concurrent use by multiple threads.
+  bool MayContainBefore(file_id_t file_id,
+                        absl::Span<const std::uint8_t> key) const;
+
+ private:
+  struct File {
+    file_id_t file_id;
+    absl::optional<std::vector<std::uint8_t>> filter;
+  };
+  // Sorted by file id
+  std::vector<File> files_;
 };
 
 struct DataDistribution {
-  std::uint32_t valid_data_len;
-  std::uint32_t total_data_len;
+  std::uint64_t valid_data_len;
+  std::uint64_t total_data_len;
 };
 
 template <typename Container>
 class Merger {
  public:
+  // `key_valid_fn` returns whether a key read from the hint file of the given
+  // log file is still live. A tombstone is dropped without asking
+  // `key_valid_fn` if, according to `presence`, no older log file contains
+  // its key, since there is nothing left for it to delete. So is an expired
+  // entry, which deletes its key like a tombstone.
+  // `re_insert_fn` moves a live key of the given log file to the latest log
+  // file, returning false if the key turned out not to be live anymore.
   Merger(log::Reader* log_reader, const ghc::filesystem::path& path,
-         std::function<bool(const log::Key<Container>&)>&& key_valid_fn,
-         std::function<absl::Status(log::Key<Container>&&)>&& re_insert_fn)
+         std::function<bool(file_id_t, const log::Key<Container>&)>&&
+             key_valid_fn,
+         std::function<absl::StatusOr<bool>(file_id_t, log::Key<Container>&&)>&&
+             re_insert_fn)
       : log_reader_(log_reader),
         path_(path),
         key_valid_fn_(std::move(key_valid_fn)),
         re_insert_fn_(std::move(re_insert_fn)){};
 
+  // Safe for concurrent use by multiple threads.
   absl::StatusOr<struct DataDistribution> DataDistribution(
-      std::uint32_t file_id) noexcept {
-    auto keyiter = KeyIter(&path_, file_id);
+      file_id_t file_id, const Presence& presence) noexcept {
+    auto keyiter = KeyIter(&path_, file_id, log_reader_->env());
     return keyiter.template Fold<struct DataDistribution, Container>(
         {0, 0}, [&](struct DataDistribution&& acc, log::Key<Container>&& key) {
-          std::uint32_t data_len = key.key_data.size();
+          std::uint64_t data_len = key.key_data.size();
           if (key.value_pos.has_value()) {
             data_len += key.value_pos.value().value_len;
           }
-          if (key_valid_fn_(key)) {
-            acc.valid_data_len += data_len;
+          if (is_live(file_id, key, presence)) {
+            // Only the key of an expired entry is kept
+            acc.valid_data_len += expired(key) ? key.key_data.size()
+                                               : data_len;
           }
           acc.total_data_len += data_len;
           return acc;
         });
   }
 
-  absl::Status Merge(std::uint32_t file_id) noexcept {
-    auto keyiter = KeyIter(&path_, file_id);
+  // Moves the live keys of log file `file_id` to the latest log file. Moved
+  // entries pass through `rate_limiter` unless it is nullptr. The returned
+  // stats count the bytes read and written.
+  //
+  // Safe for concurrent use by multiple threads, as long as each thread
+  // merges a different file.
+  absl::StatusOr<CompactionStats> Merge(file_id_t file_id,
+                                        const Presence& presence,
+                                        RateLimiter* rate_limiter) noexcept {
+    CompactionStats stats;
+    auto keyiter = KeyIter(&path_, file_id, log_reader_->env());
     auto valid_keys =
         keyiter.template Fold<std::vector<log::Key<Container>>, Container>(
             std::vector<log::Key<Container>>(),
             [&](std::vector<log::Key<Container>>&& acc,
                 log::Key<Container>&& key) {
-              if (key_valid_fn_(key)) {
+              stats.bytes_read += EntryLen(key.key_data.size(), key.value_pos);
+              if (is_live(file_id, key, presence)) {
                 acc.push_back(std::move(key));
               }
-              return acc;
+              return std::move(acc);
             });
     if (!valid_keys.ok()) {
       return valid_keys.status();
     }
-    for (auto key : *valid_keys) {
-      auto status = re_insert_fn_(std::move(key));
-      if (!status.ok()) {
-        return status;
+    for (auto& key : *valid_keys) {
+      // An expired entry is moved as a tombstone
+      bool is_value = key.value_pos.has_value() && !expired(key);
+      std::uint64_t entry_len = log::EntryLen(
+          key.key_data.size(), is_value ? key.value_pos->value_len : 0);
+      if (rate_limiter != nullptr) {
+        rate_limiter->Request(entry_len);
+      }
+      auto moved = re_insert_fn_(file_id, std::move(key));
+      if (!moved.ok()) {
+        return moved.status();
+      }
+      if (is_value) {
+        stats.bytes_read += entry_len;
+      }
+      if (*moved) {
+        stats.bytes_written += entry_len;
       }
     }
-    return absl::OkStatus();
+    return stats;
   }
 
  private:
+  static bool expired(const log::Key<Container>& key) {
+    return key.value_pos.has_value() && log::Expired(key.value_pos->expire_at);
+  }
+
+  bool is_live(file_id_t file_id, const log::Key<Container>& key,
+               const Presence& presence) {
+    if ((!key.value_pos.has_value() || expired(key)) &&
+        !presence.MayContainBefore(
+            file_id,
+            {reinterpret_cast<const std::uint8_t*>(key.key_data.data()),
+             key.key_data.size()})) {
+      return false;
+    }
+    return key_valid_fn_(file_id, key);
+  }
+
   log::Reader* log_reader_;
   ghc::filesystem::path path_;
-  std::function<bool(const log::Key<Container>&)> key_valid_fn_;
-  std::function<absl::Status(log::Key<Container>&&)> re_insert_fn_;
+  std::function<bool(file_id_t, const log::Key<Container>&)> key_valid_fn_;
+  std::function<absl::StatusOr<bool>(file_id_t, log::Key<Container>&&)>
+      re_insert_fn_;
 };
 
 }  // namespace hint
@@ -14,7 +14,8 @@ TEST(HintTest, GenerateAndFold) {
   auto tmpdir = test::MakeTempDir("mybitcask_store_hint_");
   ASSERT_TRUE(tmpdir.ok());
   store::Store store(tmpdir->path(),
-                     store::DBFiles(tmpdir->path()).latest_file_id(), 2048);
+                     store::DBFiles(tmpdir->path()).latest_file_id(), 2048,
+                     log::FileHeader());
   log::Writer log_writer(&store);
   log::Reader log_reader(&store, false);
 
@@ -56,6 +57,98 @@ TEST(HintTest, GenerateAndFold) {
     EXPECT_EQ(!entries[i].value.has_value(), fold_keys[i].is_tombstone);
   }
 }
+TEST(HintTest, BuilderWritesHintOnRollover) {
+  auto tmpdir = test::MakeTempDir("mybitcask_store_hint_");
+  ASSERT_TRUE(tmpdir.ok());
+  Store store(tmpdir->path(), DBFiles(tmpdir->path()).latest_file_id(), 512,
+              log::FileHeader());
+  Builder builder(tmpdir->path());
+  log::Writer log_writer(&store, &builder);
+
+  std::vector<file_id_t> entry_file_ids;
+  auto entries = test::RandomEntries(100);
+  for (auto& entry : entries) {
+    ASSERT_TRUE(test::AppendTestEntry(&log_writer, entry, [&](mybitcask::Position pos) {
+                  entry_file_ids.push_back(pos.file_id);
+                }).ok());
+  }
+
+  ASSERT_TRUE(builder.Flush().ok());
+  // Every log file except the one still being written has a hint file
+  DBFiles dbfiles(tmpdir->path());
+  ASSERT_EQ(dbfiles.active_log_files().size(), 1);
+  ASSERT_EQ(dbfiles.hint_files().size(), dbfiles.older_log_files().size());
+  struct Void {};
+  std::size_t i = 0;
+  for (auto file_id : dbfiles.hint_files()) {
+    auto status =
+        KeyIter(&tmpdir->path(), file_id)
+            .Fold<Void, std::string>(
+                Void(), [&](Void&&, log::Key<std::string>&& key) {
+                  EXPECT_EQ(entry_file_ids[i], file_id);
+                  EXPECT_EQ(entries[i].key, key.key_data);
+                  EXPECT_EQ(!entries[i].value.has_value(),
+                            !key.value_pos.has_value());
+                  i++;
+                  return Void();
+                });
+    ASSERT_TRUE(status.ok());
+  }
+  ASSERT_GT(i, 0);
+  for (; i < entries.size(); i++) {
+    EXPECT_EQ(entry_file_ids[i], dbfiles.active_log_files().back());
+  }
+}
+
+absl::Span<const std::uint8_t> AsBytes(const std::string& s) {
+  return {reinterpret_cast<const std::uint8_t*>(s.data()), s.size()};
+}
+
+TEST(HintTest, TombstoneWithoutOlderRecordIsDropped) {
+  auto tmpdir = test::MakeTempDir("mybitcask_store_hint_");
+  ASSERT_TRUE(tmpdir.ok());
+  Store store(tmpdir->path(), DBFiles(tmpdir->path()).latest_file_id(), 64,
+              log::FileHeader());
+  Builder builder(tmpdir->path());
+  log::Writer log_writer(&store, &builder);
+  auto noop = [](mybitcask::Position) {};
+
+  // log file 1: a value of "a", log file 2: tombstones of "a" and "b"
+  std::string value(50, 'v');
+  ASSERT_TRUE(log_writer.Append(AsBytes("a"), AsBytes(value), noop).ok());
+  ASSERT_TRUE(log_writer.AppendTombstone(AsBytes("a"), noop).ok());
+  ASSERT_TRUE(log_writer.AppendTombstone(AsBytes("b"), noop).ok());
+  ASSERT_TRUE(log_writer.Append(AsBytes("c"), AsBytes(value), noop).ok());
+  ASSERT_TRUE(builder.Flush().ok());
+
+  DBFiles dbfiles(tmpdir->path());
+  ASSERT_EQ(dbfiles.hint_files().size(), 2);
+  auto footer = ReadFooter(tmpdir->path() / HintFilename(2));
+  ASSERT_TRUE(footer.ok());
+  ASSERT_TRUE(footer->filter.has_value());
+
+  auto presence = Presence::Load(tmpdir->path(), dbfiles.log_files(),
+                                 dbfiles.hint_files());
+  ASSERT_TRUE(presence.ok());
+  EXPECT_TRUE(presence->MayContainBefore(2, AsBytes("a")));
+  EXPECT_FALSE(presence->MayContainBefore(2, AsBytes("b")));
+  EXPECT_FALSE(presence->MayContainBefore(1, AsBytes("a")));
+  // The latest log file has no hint file, it may contain any key
+  EXPECT_TRUE(presence->MayContainBefore(4, AsBytes("z")));
+
+  log::Reader log_reader(&store, false);
+  std::vector<std::string> re_inserted;
+  Merger<std::string> merger(
+      &log_reader, tmpdir->path(),
+      [](file_id_t, const log::Key<std::string>&) { return true; },
+      [&](file_id_t, log::Key<std::string>&& key) {
+        re_inserted.push_back(std::move(key.key_data));
+        return absl::StatusOr<bool>(true);
+      });
+  ASSERT_TRUE(merger.Merge(2, *presence, nullptr).ok());
+  EXPECT_EQ(re_inserted, std::vector<std::string>{"a"});
+}
+
 }  // namespace hint
 }  // namespace store
 
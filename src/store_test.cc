@@ -4,6 +4,9 @@
 #include "gtest/gtest.h"
 #include "test_util.h"
 
+#include <algorithm>
+#include <fstream>
+
 namespace mybitcask {
 namespace store {
 TEST(Store, StoreReaderWriter) {
@@ -46,5 +49,94 @@ TEST(Store, StoreReaderWriter) {
     ASSERT_STREQ(reinterpret_cast<char*>(buf), "3333");
   }
 }
+
+void CorruptByte(const ghc::filesystem::path& path, std::uint64_t offset) {
+  std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+  file.seekg(static_cast<std::streamoff>(offset));
+  char byte = 0;
+  file.read(&byte, 1);
+  byte ^= 0x5A;
+  file.seekp(static_cast<std::streamoff>(offset));
+  file.write(&byte, 1);
+}
+
+TEST(Store, BlockFraming) {
+  auto tmpdir = test::MakeTempDir("mybitcask_store_");
+  ASSERT_TRUE(tmpdir.ok());
+  Store store(tmpdir->path(), 1, 128 * 1024 * 1024, {}, true);
+  std::string content;
+  std::vector<std::uint64_t> starts;
+  for (int i = 0; i < 100; i++) {
+    auto piece = test::RandomString(1, i % 10 == 0 ? 50000 : 3000);
+    ASSERT_TRUE(store
+                    .Append(test::StrSpan(piece),
+                            [&](Position pos) {
+                              starts.push_back(pos.offset_in_file);
+                            })
+                    .ok());
+    EXPECT_EQ(BlockContentOffset(starts.back()), content.size());
+    content += piece;
+  }
+  ASSERT_TRUE(store.Sync().ok());
+  auto file_size = io::GetFileSize(tmpdir->path() / "1.log");
+  ASSERT_TRUE(file_size.ok());
+  EXPECT_EQ(*file_size, BlockFileOffset(content.size()));
+
+  // Content spanning blocks is read without the trailers
+  std::string read(content.size() - 100, '\0');
+  auto read_len = store.ReadContentAt(
+      Position(1, BlockFileOffset(100)),
+      {reinterpret_cast<std::uint8_t*>(&read[0]), read.size()});
+  ASSERT_TRUE(read_len.ok()) << read_len.status();
+  ASSERT_EQ(*read_len, read.size());
+  EXPECT_EQ(read, content.substr(100));
+
+  auto scan = [&]() {
+    auto file = io::OpenSequentialFileReader(tmpdir->path() / "1.log");
+    EXPECT_TRUE(file.ok());
+    return std::unique_ptr<BlockReader>(
+        new BlockReader(std::move(file).value()));
+  };
+  {
+    auto reader = scan();
+    std::string scanned(content.size() + 1, '\0');
+    read_len = reader->Read(
+        {reinterpret_cast<std::uint8_t*>(&scanned[0]), scanned.size()});
+    ASSERT_TRUE(read_len.ok()) << read_len.status();
+    ASSERT_EQ(*read_len, content.size());
+    scanned.resize(*read_len);
+    EXPECT_EQ(scanned, content);
+  }
+
+  // A corrupt block stops the scan until Resync moves past it, to the first
+  // piece starting in an intact block
+  const std::uint64_t corrupt_block = 3;
+  CorruptByte(tmpdir->path() / "1.log", corrupt_block * kBlockSize + 10);
+  auto reader = scan();
+  std::string scanned(content.size(), '\0');
+  read_len = reader->Read(
+      {reinterpret_cast<std::uint8_t*>(&scanned[0]), scanned.size()});
+  ASSERT_TRUE(read_len.ok()) << read_len.status();
+  EXPECT_EQ(*read_len, corrupt_block * kBlockContentLen);
+  read_len = reader->Read(
+      {reinterpret_cast<std::uint8_t*>(&scanned[0]), scanned.size()});
+  ASSERT_TRUE(absl::IsDataLoss(read_len.status())) << read_len.status();
+
+  auto next = reader->Resync();
+  ASSERT_TRUE(next.ok()) << next.status();
+  ASSERT_TRUE(next->has_value());
+  EXPECT_EQ(reader->corrupt_blocks(), 1);
+  auto it = std::find_if(starts.begin(), starts.end(), [&](std::uint64_t s) {
+    return s >= (corrupt_block + 1) * kBlockSize;
+  });
+  ASSERT_NE(it, starts.end());
+  EXPECT_EQ(**next, BlockContentOffset(*it));
+  read_len = reader->Read(
+      {reinterpret_cast<std::uint8_t*>(&scanned[0]), scanned.size()});
+  ASSERT_TRUE(read_len.ok()) << read_len.status();
+  scanned.resize(*read_len);
+  EXPECT_EQ(scanned, content.substr(**next));
+}
+
 }  // namespace store
 }  // namespace mybitcask
@@ -0,0 +1,49 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace mybitcask {
+
+ThreadPool::ThreadPool(std::size_t num_threads)
+    : mu_(), tasks_(), stopped_(false), threads_() {
+  num_threads = std::max<std::size_t>(num_threads, 1);
+  threads_.reserve(num_threads);
+  for (std::size_t i = 0; i < num_threads; i++) {
+    threads_.emplace_back([this]() { work_loop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    absl::MutexLock guard(&mu_);
+    stopped_ = true;
+  }
+  for (auto& t : threads_) {
+    t.join();
+  }
+}
+
+void ThreadPool::Schedule(std::function<void()> task) {
+  absl::MutexLock guard(&mu_);
+  tasks_.push_back(std::move(task));
+}
+
+void ThreadPool::work_loop() {
+  auto has_work = [this]() { return stopped_ || !tasks_.empty(); };
+  while (true) {
+    std::function<void()> task;
+    {
+      absl::MutexLock guard(&mu_);
+      mu_.Await(absl::Condition(&has_work));
+      if (tasks_.empty()) {
+        // stopped and drained
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+}  // namespace mybitcask
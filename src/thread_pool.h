@@ -0,0 +1,44 @@
+#ifndef MYBITCASK_SRC_THREAD_POOL_H_
+#define MYBITCASK_SRC_THREAD_POOL_H_
+
+#include "absl/synchronization/mutex.h"
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace mybitcask {
+
+// ThreadPool runs scheduled tasks on a fixed number of threads.
+// All threads are joined when the ThreadPool is destroyed, after the tasks
+// that are already scheduled have finished.
+class ThreadPool {
+ public:
+  explicit ThreadPool(std::size_t num_threads);
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool();
+
+  // Schedule `task` to run on one of the threads of this pool.
+  //
+  // Safe for concurrent use by multiple threads.
+  void Schedule(std::function<void()> task);
+
+  std::size_t num_threads() const { return threads_.size(); }
+
+ private:
+  void work_loop();
+
+  absl::Mutex mu_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopped_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace mybitcask
+
+#endif  // MYBITCASK_SRC_THREAD_POOL_H_
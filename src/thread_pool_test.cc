@@ -0,0 +1,38 @@
+#include "thread_pool.h"
+
+#include "absl/synchronization/blocking_counter.h"
+#include "gtest/gtest.h"
+
+#include <atomic>
+
+namespace mybitcask {
+
+TEST(ThreadPoolTest, Schedule) {
+  std::atomic<int> c(0);
+  {
+    ThreadPool pool(4);
+    ASSERT_EQ(pool.num_threads(), 4);
+    absl::BlockingCounter pending(100);
+    for (int i = 0; i < 100; i++) {
+      pool.Schedule([&]() {
+        c++;
+        pending.DecrementCount();
+      });
+    }
+    pending.Wait();
+    ASSERT_EQ(c.load(), 100);
+  }
+}
+
+TEST(ThreadPoolTest, DrainOnDestroy) {
+  std::atomic<int> c(0);
+  {
+    ThreadPool pool(2);
+    for (int i = 0; i < 50; i++) {
+      pool.Schedule([&]() { c++; });
+    }
+  }
+  ASSERT_EQ(c.load(), 50);
+}
+
+}  // namespace mybitcask
@@ -1,43 +1,49 @@
 #include "worker_generate_hint.h"
 #include "store_dbfiles.h"
-#include "timer.h"
+#include "store_filename.h"
 
 namespace mybitcask {
 namespace worker {
 
 GenerateHint::GenerateHint(log::Reader* log_reader,
                            const ghc::filesystem::path& db_path,
-                           spdlog::logger* logger)
+                           spdlog::logger* logger, Statistics* statistics)
     : db_path_(db_path),
-      stop_fn_(absl::nullopt),
+      env_(log_reader->env()),
       hint_generator_(store::hint::Generator(log_reader, db_path)),
-      logger_(logger) {}
+      logger_(logger),
+      statistics_(statistics),
+      run_lock_() {}
 
-GenerateHint::~GenerateHint() {
-  if (stop_fn_.has_value()) {
-    stop_fn_.value()();
+absl::Status GenerateHint::RunOnce() noexcept {
+  absl::MutexLock guard(&run_lock_);
+  store::DBFiles dbfiles(db_path_, env_);
+  for (auto log_file_id : dbfiles.active_log_files()) {
+    if (log_file_id == dbfiles.latest_file_id()) {
+      // still being written
+      continue;
+    }
+    absl::Status status;
+    {
+      StopWatch watch(statistics_, Histogram::kHintGenerationMicros);
+      status = hint_generator_.Generate(log_file_id);
+    }
+    if (!status.ok()) {
+      logger_->warn("Hint file generation failed. Log file id: {}, status: {}",
+                    log_file_id, status.ToString());
+      return status;
+    }
+    RecordTick(statistics_, Ticker::kHintFilesWritten);
+    if (statistics_ != nullptr) {
+      auto size =
+          env_->GetFileSize(db_path_ / store::HintFilename(log_file_id));
+      RecordTick(statistics_, Ticker::kHintBytesWritten,
+                 size.ok() ? *size : 0);
+    }
+    logger_->info("Hint file generated successfully. Log file id: {}",
+                  log_file_id);
   }
-}
-
-void GenerateHint::Start(std::size_t interval_seconds) {
-  stop_fn_ = absl::make_optional(timer::SetInterval(
-      [&]() {
-        store::DBFiles dbfiles(db_path_);
-        auto active_log_files = dbfiles.active_log_files();
-        for (auto log_file_id :
-             active_log_files.subspan(0, active_log_files.size() - 1)) {
-          auto status = hint_generator_.Generate(log_file_id);
-          if (!status.ok()) {
-            logger_->warn(
-                "Hint file generation failed. Log file id: {}, status: {}",
-                log_file_id, status.ToString());
-            break;
-          }
-          logger_->info("Hint file generated successfully. Log file id: {}",
-                       log_file_id);
-        }
-      },
-      std::chrono::seconds(interval_seconds)));
+  return absl::OkStatus();
 }
 
 }  // namespace worker
@@ -1,8 +1,9 @@
 #ifndef MYBITCASK_SRC_WORKER_GENERATE_HINT_H_
 #define MYBITCASK_SRC_WORKER_GENERATE_HINT_H_
 
-#include "absl/types/optional.h"
+#include "absl/synchronization/mutex.h"
 #include "mybitcask/internal/log.h"
+#include "mybitcask/internal/statistics.h"
 #include "mybitcask/internal/worker.h"
 #include "store_hint.h"
 #include "spdlog/spdlog.h"
@@ -12,17 +13,21 @@ namespace worker {
 
 class GenerateHint final : public Worker {
  public:
-  GenerateHint(log::Reader* log_reader, const ghc::filesystem::path& db_path, spdlog::logger* logger);
+  // Hint files generated are counted in `statistics` unless it is nullptr.
+  GenerateHint(log::Reader* log_reader, const ghc::filesystem::path& db_path,
+               spdlog::logger* logger, Statistics* statistics = nullptr);
 
-  void Start(std::size_t interval_seconds);
-
-  ~GenerateHint();
+  // Generate hint files for all closed log files which do not have one yet.
+  absl::Status RunOnce() noexcept override;
 
  private:
   ghc::filesystem::path db_path_;
-  absl::optional<std::function<void()>> stop_fn_;
+  Env* env_;
   store::hint::Generator hint_generator_;
   spdlog::logger* logger_;
+  Statistics* statistics_;
+  // Serializes RunOnce between the scheduler and manual calls
+  absl::Mutex run_lock_;
 };
 
 }  // namespace worker
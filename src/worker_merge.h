@@ -1,81 +1,244 @@
 #ifndef MYBITCASK_SRC_WORKER_MERGE_H_
 #define MYBITCASK_SRC_WORKER_MERGE_H_
 
-#include <chrono>
-#include "absl/types/optional.h"
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/mutex.h"
 #include "ghc/filesystem.hpp"
 #include "mybitcask/internal/log.h"
+#include "mybitcask/internal/statistics.h"
 #include "mybitcask/internal/worker.h"
+#include "mybitcask/mybitcask.h"
+#include "rate_limiter.h"
 #include "spdlog/spdlog.h"
 #include "store_dbfiles.h"
 #include "store_filename.h"
 #include "store_hint.h"
-#include "timer.h"
+#include "thread_pool.h"
 
 namespace mybitcask {
 namespace worker {
 
+// Outcome of Merge::Run
+struct MergeRun {
+  absl::Status status;
+  // Bytes of dead log entries in the files merged, also when merging
+  // another file failed
+  std::uint64_t dead_bytes = 0;
+  // Whether a closed log file was left out since it has no hint file yet
+  bool waiting_for_hint = false;
+};
+
 template <typename Container>
 class Merge final : public Worker {
  public:
+  // Files are merged concurrently by `merge_threads` threads. Each thread
+  // works on a different file, so the input file sets never overlap.
+  // `remove_file_fn` removes a merged log file and its hint file, possibly
+  // later on, and returns whether it removed them at once; merged files are
+  // never merged again meanwhile. Merged files
+  // are counted in `statistics` unless it is nullptr.
   Merge(log::Reader* log_reader, const ghc::filesystem::path& db_path,
-        float merge_threshold, spdlog::logger* logger,
-        std::function<bool(const log::Key<Container>&)>&& key_valid_fn,
-        std::function<absl::Status(log::Key<Container>&&)>&& re_insert_fn)
+        float merge_threshold, std::size_t merge_threads,
+        spdlog::logger* logger, Statistics* statistics,
+        std::function<bool(store::file_id_t, const log::Key<Container>&)>&&
+            key_valid_fn,
+        std::function<absl::StatusOr<bool>(store::file_id_t,
+                                           log::Key<Container>&&)>&&
+            re_insert_fn,
+        std::function<bool(store::file_id_t)>&& remove_file_fn)
       : db_path_(db_path),
-        stop_fn_(absl::nullopt),
+        env_(log_reader->env()),
         merge_threshold_(merge_threshold),
-        logger_(logger), merger_(store::hint::Merger<Container>(
-            log_reader, db_path, std::move(key_valid_fn),
-            std::move(re_insert_fn))){};
+        merger_(store::hint::Merger<Container>(log_reader, db_path,
+                                               std::move(key_valid_fn),
+                                               std::move(re_insert_fn))),
+        remove_file_fn_(std::move(remove_file_fn)),
+        logger_(logger),
+        statistics_(statistics),
+        pool_(merge_threads),
+        run_lock_(){};
 
-  void Start(std::size_t interval_seconds) {
-    stop_fn_ = absl::make_optional(timer::SetInterval(
-        [&]() {
-          store::DBFiles dbfiles(db_path_);
-          auto hint_files = dbfiles.hint_files();
+  // Merge every file whose live data ratio is at or below the merge
+  // threshold. Returns the first error encountered, files which do not fail
+  // are still merged.
+  absl::Status RunOnce() noexcept override { return Run().status; }
 
-          for (auto file_id : hint_files.subspan(0, hint_files.size() - 1)) {
-            auto data_distribution = merger_.DataDistribution(file_id);
-            if (!data_distribution.ok()) {
-              logger_->warn(
-                  "Failed to merge file. Unable to get datadistribution, "
-                  "file "
-                  "id: "
-                  "{}, status: {}",
-                  file_id, data_distribution.status().ToString());
-              break;
-            }
-            if (static_cast<float>((*data_distribution).valid_data_len) /
-                    static_cast<float>((*data_distribution).total_data_len) <=
-                merge_threshold_) {
-              auto status = merger_.Merge(file_id);
-              if (!status.ok()) {
-                logger_->warn("Merge file failed. file id: {}, status: {}",
-                             file_id, status.ToString());
-                break;
-              }
-              logger_->info("Merge file successfully. file id: {}", file_id);
-              ghc::filesystem::remove(db_path_ / store::HintFilename(file_id));
-              ghc::filesystem::remove(db_path_ / store::LogFilename(file_id));
-            }
-          }
-        },
-        std::chrono::seconds(interval_seconds)));
+  // Same as RunOnce, but also tells how much garbage was merged and whether
+  // a file had to be left out.
+  MergeRun Run() noexcept {
+    absl::MutexLock guard(&run_lock_);
+    MergeRun run;
+    store::DBFiles dbfiles(db_path_, env_);
+    for (auto file_id : dbfiles.active_log_files()) {
+      if (file_id != dbfiles.latest_file_id()) {
+        run.waiting_for_hint = true;
+      }
+    }
+    auto hint_files = dbfiles.hint_files();
+    if (hint_files.empty()) {
+      return run;
+    }
+    run.status =
+        compact_locked(dbfiles, hint_files.subspan(0, hint_files.size() - 1),
+                       merge_threshold_, nullptr, &run.dead_bytes)
+            .status();
+    return run;
   }
 
-  ~Merge() {
-    if (stop_fn_.has_value()) {
-      stop_fn_.value()();
+  // Merge each of `file_ids` whose live data ratio is at or below
+  // `merge_threshold`, passing the moved entries through `rate_limiter`
+  // unless it is nullptr. Every file must have a hint file. Returns the
+  // first error encountered, files which do not fail are still merged.
+  absl::StatusOr<CompactionStats> Compact(
+      absl::Span<const store::file_id_t> file_ids, float merge_threshold,
+      RateLimiter* rate_limiter) noexcept {
+    absl::MutexLock guard(&run_lock_);
+    store::DBFiles dbfiles(db_path_, env_);
+    auto hint_files = dbfiles.hint_files();
+    for (auto file_id : file_ids) {
+      if (!std::binary_search(hint_files.begin(), hint_files.end(), file_id)) {
+        return absl::InvalidArgumentError(
+            "log file " + std::to_string(file_id) + " can not be compacted");
+      }
     }
+    return compact_locked(dbfiles, file_ids, merge_threshold, rate_limiter,
+                          nullptr);
   }
 
  private:
+  // Bytes of dead log entries in the files merged are added to `*dead_bytes`
+  // unless it is nullptr.
+  //
+  // REQUIRES: run_lock_ held
+  absl::StatusOr<CompactionStats> compact_locked(
+      const store::DBFiles& dbfiles,
+      absl::Span<const store::file_id_t> candidates, float merge_threshold,
+      RateLimiter* rate_limiter, std::uint64_t* dead_bytes) noexcept {
+    // Files merged before but not removed yet are left alone
+    std::set<store::file_id_t> merged;
+    for (auto file_id : dbfiles.log_files()) {
+      if (merged_.count(file_id) > 0) {
+        merged.insert(file_id);
+      }
+    }
+    merged_.swap(merged);
+    std::vector<store::file_id_t> unmerged;
+    for (auto file_id : candidates) {
+      if (merged_.count(file_id) == 0) {
+        unmerged.push_back(file_id);
+      }
+    }
+    candidates = absl::MakeSpan(unmerged);
+    if (candidates.empty()) {
+      return CompactionStats();
+    }
+    // New log files are always newer than the candidates, so the log files
+    // listed now include every file older than a candidate.
+    auto presence = store::hint::Presence::Load(
+        db_path_, dbfiles.log_files(), dbfiles.hint_files(), env_);
+    if (!presence.ok()) {
+      return presence.status();
+    }
+
+    std::vector<absl::StatusOr<CompactionStats>> results(candidates.size());
+    std::vector<std::uint64_t> dead(candidates.size(), 0);
+    absl::BlockingCounter pending(static_cast<int>(candidates.size()));
+    for (std::size_t i = 0; i < candidates.size(); i++) {
+      pool_.Schedule([&, i]() {
+        results[i] = merge_file(candidates[i], *presence, merge_threshold,
+                                rate_limiter, &dead[i]);
+        pending.DecrementCount();
+      });
+    }
+    pending.Wait();
+
+    CompactionStats total;
+    for (std::size_t i = 0; i < candidates.size(); i++) {
+      if (results[i].ok() && results[i]->files_compacted > 0) {
+        merged_.insert(candidates[i]);
+        if (dead_bytes != nullptr) {
+          *dead_bytes += dead[i];
+        }
+      }
+    }
+    for (auto& result : results) {
+      if (!result.ok()) {
+        return result.status();
+      }
+      total.files_compacted += result->files_compacted;
+      total.bytes_read += result->bytes_read;
+      total.bytes_written += result->bytes_written;
+      total.bytes_reclaimed += result->bytes_reclaimed;
+    }
+    return total;
+  }
+
+  // Sets `*dead_bytes` to the bytes of dead log entries in the file.
+  absl::StatusOr<CompactionStats> merge_file(
+      store::file_id_t file_id, const store::hint::Presence& presence,
+      float merge_threshold, RateLimiter* rate_limiter,
+      std::uint64_t* dead_bytes) noexcept {
+    auto data_distribution = merger_.DataDistribution(file_id, presence);
+    if (!data_distribution.ok()) {
+      logger_->warn(
+          "Failed to merge file. Unable to get datadistribution, file id: {}, "
+          "status: {}",
+          file_id, data_distribution.status().ToString());
+      return data_distribution.status();
+    }
+    *dead_bytes =
+        data_distribution->total_data_len - data_distribution->valid_data_len;
+    if (!(static_cast<float>((*data_distribution).valid_data_len) /
+              static_cast<float>((*data_distribution).total_data_len) <=
+          merge_threshold)) {
+      return CompactionStats();
+    }
+    auto stats = merger_.Merge(file_id, presence, rate_limiter);
+    if (!stats.ok()) {
+      logger_->warn("Merge file failed. file id: {}, status: {}", file_id,
+                    stats.status().ToString());
+      return stats.status();
+    }
+    logger_->info("Merge file successfully. file id: {}", file_id);
+    std::uint64_t removed_bytes = 0;
+    for (const auto& file : {db_path_ / store::HintFilename(file_id),
+                             db_path_ / store::LogFilename(file_id)}) {
+      auto size = env_->GetFileSize(file);
+      removed_bytes += size.ok() ? *size : 0;
+    }
+    // Files kept for snapshots are not reclaimed yet
+    if (!remove_file_fn_(file_id)) {
+      removed_bytes = 0;
+    }
+    stats->files_compacted = 1;
+    stats->bytes_reclaimed = static_cast<std::int64_t>(removed_bytes) -
+                             static_cast<std::int64_t>(stats->bytes_written);
+    RecordTick(statistics_, Ticker::kFilesCompacted);
+    RecordTick(statistics_, Ticker::kCompactionBytesRead, stats->bytes_read);
+    RecordTick(statistics_, Ticker::kCompactionBytesWritten,
+               stats->bytes_written);
+    RecordTick(statistics_, Ticker::kCompactionBytesReclaimed,
+               static_cast<std::uint64_t>(
+                   std::max<std::int64_t>(0, stats->bytes_reclaimed)));
+    return stats;
+  }
+
   ghc::filesystem::path db_path_;
-  absl::optional<std::function<void()>> stop_fn_;
+  Env* env_;
   float merge_threshold_;
   store::hint::Merger<Container> merger_;
+  std::function<bool(store::file_id_t)> remove_file_fn_;
   spdlog::logger* logger_;
+  Statistics* statistics_;
+  ThreadPool pool_;
+  // Serializes merges between the scheduler and manual calls
+  absl::Mutex run_lock_;
+  // Files merged whose removal was deferred, guarded by run_lock_
+  std::set<store::file_id_t> merged_;
 };
 
 }  // namespace worker